@@ -0,0 +1,265 @@
+//! Compression and decompression throughput of blusc next to c-blosc2 (through
+//! `blosc2-src`), over every codec × filter × typesize × clevel × dataset of
+//! `common::matrix`. Criterion reports throughput in uncompressed bytes per second; the
+//! compression ratios of both libraries are printed before each group.
+//!
+//! The full matrix takes a long time; pass a filter to run part of it:
+//!
+//! ```sh
+//! cargo bench --bench codecs -- 'zstd/shuffle/ts4'
+//! cargo bench --bench codecs -- '/sensor'
+//! cargo bench --bench codecs -- 'batch/'
+//! cargo bench --bench codecs -- 'convenience/'
+//! ```
+mod common;
+
+use blosc2_src::{
+    blosc2_compress_ctx as bound_blosc2_compress_ctx, blosc2_context as bound_blosc2_context,
+    blosc2_create_cctx as bound_blosc2_create_cctx, blosc2_create_dctx as bound_blosc2_create_dctx,
+    blosc2_decompress_ctx as bound_blosc2_decompress_ctx, blosc2_free_ctx as bound_blosc2_free_ctx,
+    blosc2_init as bound_blosc2_init, BLOSC2_CPARAMS_DEFAULTS as BOUND_BLOSC2_CPARAMS_DEFAULTS,
+    BLOSC2_DPARAMS_DEFAULTS as BOUND_BLOSC2_DPARAMS_DEFAULTS,
+    BLOSC2_MAX_OVERHEAD as BOUND_BLOSC2_MAX_OVERHEAD,
+};
+use blusc::api::{
+    blosc2_compress_batch as blusc_blosc2_compress_batch,
+    blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_decompress_batch as blusc_blosc2_decompress_batch,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+};
+use blusc::convenience::{
+    blosc2_compress as blusc_convenience_compress,
+    blosc2_compress_into as blusc_convenience_compress_into,
+    blosc2_decompress as blusc_convenience_decompress,
+    blosc2_decompress_into as blusc_convenience_decompress_into,
+};
+use common::{
+    blusc_chunk, blusc_contexts, dataset, matrix, Config, CODECS, DATASETS, FILTERS, TYPESIZES,
+};
+use criterion::{Criterion, Throughput};
+use std::collections::HashMap;
+use std::hint::black_box;
+use std::time::Duration;
+
+/// c-blosc2 compression and decompression contexts, freed on drop.
+struct BoundContexts {
+    cctx: *mut bound_blosc2_context,
+    dctx: *mut bound_blosc2_context,
+}
+
+impl BoundContexts {
+    fn new(config: &Config) -> Self {
+        unsafe {
+            let mut cparams = BOUND_BLOSC2_CPARAMS_DEFAULTS;
+            cparams.compcode = config.codec.1;
+            cparams.clevel = config.clevel;
+            cparams.typesize = config.typesize as i32;
+            cparams.filters[5] = config.filter.1;
+            cparams.nthreads = 1;
+            let mut dparams = BOUND_BLOSC2_DPARAMS_DEFAULTS;
+            dparams.nthreads = 1;
+            BoundContexts {
+                cctx: bound_blosc2_create_cctx(cparams),
+                dctx: bound_blosc2_create_dctx(dparams),
+            }
+        }
+    }
+
+    fn compress(&self, src: &[u8], dest: &mut [u8]) -> i32 {
+        unsafe {
+            bound_blosc2_compress_ctx(
+                self.cctx,
+                src.as_ptr().cast(),
+                src.len() as i32,
+                dest.as_mut_ptr().cast(),
+                dest.len() as i32,
+            )
+        }
+    }
+
+    fn decompress(&self, src: &[u8], dest: &mut [u8]) -> i32 {
+        unsafe {
+            bound_blosc2_decompress_ctx(
+                self.dctx,
+                src.as_ptr().cast(),
+                src.len() as i32,
+                dest.as_mut_ptr().cast(),
+                dest.len() as i32,
+            )
+        }
+    }
+}
+
+impl Drop for BoundContexts {
+    fn drop(&mut self) {
+        unsafe {
+            bound_blosc2_free_ctx(self.cctx);
+            bound_blosc2_free_ctx(self.dctx);
+        }
+    }
+}
+
+fn bench_matrix(c: &mut Criterion) {
+    // Datasets only depend on the typesize through their item layout
+    let mut datasets = HashMap::new();
+    for dataset_name in DATASETS {
+        for typesize in TYPESIZES {
+            datasets.insert((dataset_name, typesize), dataset(dataset_name, typesize));
+        }
+    }
+
+    for config in matrix() {
+        let src = &datasets[&(config.dataset, config.typesize)];
+        let (cctx, dctx) = blusc_contexts(&config);
+        let chunk = blusc_chunk(&cctx, &dctx, src);
+
+        let bound = BoundContexts::new(&config);
+        let mut bound_chunk = vec![0u8; src.len() + BOUND_BLOSC2_MAX_OVERHEAD as usize];
+        let cbytes = bound.compress(src, &mut bound_chunk);
+        assert!(
+            cbytes > 0,
+            "c-blosc2 compression failed for {}",
+            config.id()
+        );
+        bound_chunk.truncate(cbytes as usize);
+
+        println!(
+            "ratio {}: blusc {:.3} c-blosc2 {:.3}",
+            config.id(),
+            src.len() as f64 / chunk.len() as f64,
+            src.len() as f64 / bound_chunk.len() as f64,
+        );
+
+        let mut group = c.benchmark_group(config.id());
+        group.throughput(Throughput::Bytes(src.len() as u64));
+        let mut dest = vec![0u8; src.len() + BOUND_BLOSC2_MAX_OVERHEAD as usize];
+        group.bench_function("compress/blusc", |b| {
+            b.iter(|| blusc_blosc2_compress_ctx(&cctx, black_box(src), &mut dest))
+        });
+        group.bench_function("compress/c-blosc2", |b| {
+            b.iter(|| bound.compress(black_box(src), &mut dest))
+        });
+        dest.truncate(src.len());
+        group.bench_function("decompress/blusc", |b| {
+            b.iter(|| blusc_blosc2_decompress_ctx(&dctx, black_box(&chunk), &mut dest))
+        });
+        group.bench_function("decompress/c-blosc2", |b| {
+            b.iter(|| bound.decompress(black_box(&bound_chunk), &mut dest))
+        });
+        group.finish();
+    }
+}
+
+/// Chunk sizes of a Zarr-like batch, cycled through.
+const BATCH_CHUNK_LENS: [usize; 4] = [16 << 10, 24 << 10, 40 << 10, 64 << 10];
+
+/// Many small chunks, as Zarr stores hand them over: blusc with one `*_ctx` call per
+/// chunk and with one batch call, next to a c-blosc2 loop.
+fn bench_batch(c: &mut Criterion) {
+    let config = Config {
+        codec: CODECS[4],
+        filter: FILTERS[1],
+        typesize: 4,
+        clevel: 5,
+        dataset: "sensor",
+    };
+    let data = dataset(config.dataset, config.typesize);
+    let mut srcs: Vec<&[u8]> = Vec::new();
+    let mut nbytes = 0;
+    for len in BATCH_CHUNK_LENS.iter().cycle() {
+        if nbytes + len > data.len() {
+            break;
+        }
+        srcs.push(&data[nbytes..nbytes + len]);
+        nbytes += len;
+    }
+
+    let (cctx, dctx) = blusc_contexts(&config);
+    let bound = BoundContexts::new(&config);
+    let chunks: Vec<Vec<u8>> = srcs
+        .iter()
+        .map(|src| blusc_chunk(&cctx, &dctx, src))
+        .collect();
+    let chunks: Vec<&[u8]> = chunks.iter().map(Vec::as_slice).collect();
+    let mut dests: Vec<Vec<u8>> = srcs
+        .iter()
+        .map(|src| vec![0u8; src.len() + BOUND_BLOSC2_MAX_OVERHEAD as usize])
+        .collect();
+
+    let mut group = c.benchmark_group(format!("batch/{}", config.id()));
+    group.throughput(Throughput::Bytes(nbytes as u64));
+    group.bench_function("compress/blusc", |b| {
+        b.iter(|| {
+            for (src, dest) in srcs.iter().zip(dests.iter_mut()) {
+                blusc_blosc2_compress_ctx(&cctx, black_box(src), dest);
+            }
+        })
+    });
+    group.bench_function("compress/blusc-batch", |b| {
+        b.iter(|| {
+            let mut dests: Vec<&mut [u8]> = dests.iter_mut().map(Vec::as_mut_slice).collect();
+            blusc_blosc2_compress_batch(&cctx, black_box(&srcs), &mut dests)
+        })
+    });
+    group.bench_function("compress/c-blosc2", |b| {
+        b.iter(|| {
+            for (src, dest) in srcs.iter().zip(dests.iter_mut()) {
+                bound.compress(black_box(src), dest);
+            }
+        })
+    });
+    group.bench_function("decompress/blusc", |b| {
+        b.iter(|| {
+            for (chunk, dest) in chunks.iter().zip(dests.iter_mut()) {
+                blusc_blosc2_decompress_ctx(&dctx, black_box(chunk), dest);
+            }
+        })
+    });
+    group.bench_function("decompress/blusc-batch", |b| {
+        b.iter(|| {
+            let mut dests: Vec<&mut [u8]> = dests.iter_mut().map(Vec::as_mut_slice).collect();
+            blusc_blosc2_decompress_batch(&dctx, black_box(&chunks), &mut dests)
+        })
+    });
+    group.finish();
+}
+
+/// The convenience functions on a chunk of a dataset: a new `Vec` per call, and one
+/// `Vec` reused through `*_into`.
+fn bench_convenience(c: &mut Criterion) {
+    let data = dataset("sensor", 8);
+    let src = data.as_slice();
+    let chunk = blusc_convenience_compress(src).unwrap();
+
+    let mut group = c.benchmark_group("convenience/sensor");
+    group.throughput(Throughput::Bytes(src.len() as u64));
+    group.bench_function("compress/new-vec", |b| {
+        b.iter(|| blusc_convenience_compress(black_box(src)))
+    });
+    let mut dest = Vec::new();
+    group.bench_function("compress/into", |b| {
+        b.iter(|| blusc_convenience_compress_into(black_box(src), &mut dest))
+    });
+    group.bench_function("decompress/new-vec", |b| {
+        b.iter(|| blusc_convenience_decompress(black_box(&chunk)))
+    });
+    group.bench_function("decompress/into", |b| {
+        b.iter(|| blusc_convenience_decompress_into(black_box(&chunk), &mut dest))
+    });
+    group.finish();
+}
+
+fn main() {
+    unsafe {
+        bound_blosc2_init();
+    }
+    let mut criterion = Criterion::default()
+        .sample_size(10)
+        .warm_up_time(Duration::from_millis(300))
+        .measurement_time(Duration::from_secs(1))
+        .configure_from_args();
+    bench_batch(&mut criterion);
+    bench_convenience(&mut criterion);
+    bench_matrix(&mut criterion);
+    criterion.final_summary();
+}
@@ -0,0 +1,204 @@
+//! The benchmark matrix and datasets shared by `codecs.rs` (criterion, side by side with
+//! c-blosc2) and `wasm.rs` (a plain runner for targets the C library does not build for).
+#![allow(dead_code)]
+
+use blusc::api::{
+    blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_create_cctx as blusc_blosc2_create_cctx, blosc2_create_dctx as blusc_blosc2_create_dctx,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    BLOSC2_CPARAMS_DEFAULTS as BLUSC_BLOSC2_CPARAMS_DEFAULTS,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::{
+    Blosc2Context, BLOSC2_MAX_OVERHEAD, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_LZ4, BLOSC_LZ4HC,
+    BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_ZLIB, BLOSC_ZSTD,
+};
+
+/// Bytes per benchmarked chunk. Large enough to span many blocks at every clevel.
+pub const CHUNK_LEN: usize = 2 << 20;
+
+/// The codecs c-blosc2 ships (it dropped Snappy, so blusc's is not compared).
+pub const CODECS: [(&str, u8); 5] = [
+    ("blosclz", BLOSC_BLOSCLZ),
+    ("lz4", BLOSC_LZ4),
+    ("lz4hc", BLOSC_LZ4HC),
+    ("zlib", BLOSC_ZLIB),
+    ("zstd", BLOSC_ZSTD),
+];
+
+pub const FILTERS: [(&str, u8); 3] = [
+    ("noshuffle", BLOSC_NOSHUFFLE),
+    ("shuffle", BLOSC_SHUFFLE),
+    ("bitshuffle", BLOSC_BITSHUFFLE),
+];
+
+pub const TYPESIZES: [usize; 5] = [1, 2, 4, 8, 16];
+
+pub const CLEVELS: [u8; 3] = [1, 5, 9];
+
+pub const DATASETS: [&str; 5] = ["random", "sparse", "ramp", "sensor", "logs"];
+
+/// One point of the matrix.
+#[derive(Debug, Clone, Copy)]
+pub struct Config {
+    pub codec: (&'static str, u8),
+    pub filter: (&'static str, u8),
+    pub typesize: usize,
+    pub clevel: u8,
+    pub dataset: &'static str,
+}
+
+impl Config {
+    /// `codec/filter/tsN/clN/dataset`, the id benchmarks are reported and filtered by.
+    pub fn id(&self) -> String {
+        format!(
+            "{}/{}/ts{}/cl{}/{}",
+            self.codec.0, self.filter.0, self.typesize, self.clevel, self.dataset
+        )
+    }
+}
+
+/// Every codec × filter × typesize × clevel × dataset.
+pub fn matrix() -> Vec<Config> {
+    let mut configs = Vec::new();
+    for codec in CODECS {
+        for filter in FILTERS {
+            for typesize in TYPESIZES {
+                for clevel in CLEVELS {
+                    for dataset in DATASETS {
+                        configs.push(Config {
+                            codec,
+                            filter,
+                            typesize,
+                            clevel,
+                            dataset,
+                        });
+                    }
+                }
+            }
+        }
+    }
+    configs
+}
+
+/// xorshift64*, so datasets are the same on every run and target.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_f491_4f6c_dd1d)
+    }
+
+    /// Uniform in [-1, 1).
+    fn unit(&mut self) -> f32 {
+        (self.next() >> 40) as f32 / (1u64 << 23) as f32 - 1.0
+    }
+}
+
+/// `CHUNK_LEN` bytes of `name`, laid out in items of `typesize` where that matters.
+///
+/// - `random`: uniform bytes, the incompressible worst case.
+/// - `sparse`: zeros with a random item every ~100, like masks and sparse arrays.
+/// - `ramp`: an incrementing little-endian counter per item, the case shuffle is for.
+/// - `sensor`: a noisy random walk of f32 readings, like a measured time series.
+/// - `logs`: text lines with timestamps, levels and a few recurring messages.
+pub fn dataset(name: &str, typesize: usize) -> Vec<u8> {
+    let mut rng = Rng(0x9e37_79b9_7f4a_7c15);
+    let mut data = Vec::with_capacity(CHUNK_LEN + 256);
+    match name {
+        "random" => {
+            while data.len() < CHUNK_LEN {
+                data.extend_from_slice(&rng.next().to_le_bytes());
+            }
+        }
+        "sparse" => {
+            data.resize(CHUNK_LEN, 0);
+            for item in data.chunks_exact_mut(typesize) {
+                if rng.next() % 100 == 0 {
+                    let value = rng.next().to_le_bytes();
+                    for (k, b) in item.iter_mut().enumerate() {
+                        *b = value[k % 8];
+                    }
+                }
+            }
+        }
+        "ramp" => {
+            let mut i = 0u128;
+            while data.len() < CHUNK_LEN {
+                data.extend_from_slice(&i.to_le_bytes()[..typesize]);
+                i += 1;
+            }
+        }
+        "sensor" => {
+            let mut value = 20.0f32;
+            while data.len() < CHUNK_LEN {
+                value += rng.unit() * 0.05;
+                // Readings come with a few significant digits
+                let reading = (value * 1000.0).round() / 1000.0;
+                data.extend_from_slice(&reading.to_le_bytes());
+            }
+        }
+        "logs" => {
+            const LEVELS: [&str; 4] = ["INFO", "INFO", "WARN", "DEBUG"];
+            const MESSAGES: [&str; 5] = [
+                "request served",
+                "cache miss for key",
+                "connection reset by peer",
+                "flushed pages to disk",
+                "slow query detected",
+            ];
+            let mut t = 1_700_000_000_000u64;
+            while data.len() < CHUNK_LEN {
+                t += rng.next() % 50;
+                let r = rng.next() as usize;
+                let line = format!(
+                    "{}.{:03} [{}] worker-{} {} id={}\n",
+                    t / 1000,
+                    t % 1000,
+                    LEVELS[r % 4],
+                    r % 16,
+                    MESSAGES[(r >> 8) % 5],
+                    (r >> 16) % 100_000
+                );
+                data.extend_from_slice(line.as_bytes());
+            }
+        }
+        _ => panic!("unknown dataset {name}"),
+    }
+    data.truncate(CHUNK_LEN);
+    data
+}
+
+/// Single-threaded contexts for `config`, as both libraries are measured with.
+pub fn blusc_contexts(config: &Config) -> (Blosc2Context, Blosc2Context) {
+    let mut cparams = BLUSC_BLOSC2_CPARAMS_DEFAULTS;
+    cparams.compcode = config.codec.1;
+    cparams.clevel = config.clevel;
+    cparams.typesize = config.typesize as i32;
+    cparams.filters[5] = config.filter.1;
+    cparams.nthreads = 1;
+    let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+    dparams.nthreads = 1;
+    (
+        blusc_blosc2_create_cctx(cparams),
+        blusc_blosc2_create_dctx(dparams),
+    )
+}
+
+/// Compresses `src` with blusc and checks the round trip, returning the chunk.
+pub fn blusc_chunk(cctx: &Blosc2Context, dctx: &Blosc2Context, src: &[u8]) -> Vec<u8> {
+    let mut chunk = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    let cbytes = blusc_blosc2_compress_ctx(cctx, src, &mut chunk);
+    assert!(cbytes > 0, "blusc compression failed");
+    chunk.truncate(cbytes as usize);
+    let mut dest = vec![0u8; src.len()];
+    assert_eq!(
+        blusc_blosc2_decompress_ctx(dctx, &chunk, &mut dest),
+        src.len() as i32
+    );
+    assert!(dest == src, "blusc round trip differs");
+    chunk
+}
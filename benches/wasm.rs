@@ -0,0 +1,82 @@
+//! A dependency-free runner over the matrix of `common::matrix`, for targets where
+//! neither c-blosc2 nor criterion build, WASM in particular:
+//!
+//! ```sh
+//! CARGO_TARGET_WASM32_WASIP1_RUNNER=wasmtime cargo bench --bench wasm --target wasm32-wasip1
+//! cargo bench --bench wasm -- zstd/shuffle
+//! ```
+//!
+//! Arguments that are not flags keep only the configurations whose id contains one of
+//! them. Each line reports the best of `ROUNDS` timings, in GB/s of uncompressed data.
+mod common;
+
+use blusc::api::{
+    blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+};
+use blusc::BLOSC2_MAX_OVERHEAD;
+use common::{blusc_chunk, blusc_contexts, dataset, matrix};
+use std::hint::black_box;
+use std::time::{Duration, Instant};
+
+const ROUNDS: usize = 5;
+
+/// The fastest of `ROUNDS` runs of `f`, each repeated until it takes 50 ms.
+fn best_time(mut f: impl FnMut()) -> Duration {
+    let mut best = Duration::MAX;
+    for _ in 0..ROUNDS {
+        let start = Instant::now();
+        let mut iters = 0u32;
+        while iters == 0 || start.elapsed() < Duration::from_millis(50) {
+            f();
+            iters += 1;
+        }
+        best = best.min(start.elapsed() / iters);
+    }
+    best
+}
+
+fn gbps(nbytes: usize, time: Duration) -> f64 {
+    nbytes as f64 / time.as_secs_f64() / 1e9
+}
+
+fn main() {
+    let filters: Vec<String> = std::env::args()
+        .skip(1)
+        .filter(|arg| !arg.starts_with("--"))
+        .collect();
+
+    println!(
+        "{:<40} {:>8} {:>12} {:>12}",
+        "config", "ratio", "comp GB/s", "decomp GB/s"
+    );
+    for config in matrix() {
+        let id = config.id();
+        if !filters.is_empty() && !filters.iter().any(|f| id.contains(f.as_str())) {
+            continue;
+        }
+        let src = dataset(config.dataset, config.typesize);
+        let (cctx, dctx) = blusc_contexts(&config);
+        let chunk = blusc_chunk(&cctx, &dctx, &src);
+
+        let mut dest = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+        let compress = best_time(|| {
+            black_box(blusc_blosc2_compress_ctx(&cctx, black_box(&src), &mut dest));
+        });
+        dest.truncate(src.len());
+        let decompress = best_time(|| {
+            black_box(blusc_blosc2_decompress_ctx(
+                &dctx,
+                black_box(&chunk),
+                &mut dest,
+            ));
+        });
+        println!(
+            "{:<40} {:>8.3} {:>12.3} {:>12.3}",
+            id,
+            src.len() as f64 / chunk.len() as f64,
+            gbps(src.len(), compress),
+            gbps(src.len(), decompress),
+        );
+    }
+}
@@ -1,16 +1,25 @@
 use crate::internal;
 use crate::internal::constants::*;
+use std::cell::RefCell;
 use std::os::raw::c_void;
 
 /// Holds compression and decompression parameters for a Blosc2 operation.
 ///
-/// Created via [`blosc2_create_cctx`] or [`blosc2_create_dctx`].
+/// Created via [`blosc2_create_cctx`] or [`blosc2_create_dctx`]. The context also holds
+/// state of its own, so it cannot be built with a struct literal outside this crate.
 #[repr(C)]
+#[non_exhaustive]
 pub struct Blosc2Context {
     /// Compression parameters.
     pub cparams: Blosc2Cparams,
     /// Decompression parameters.
     pub dparams: Blosc2Dparams,
+    /// Working buffers reused by every `*_ctx` call on this context.
+    pub(crate) scratch: RefCell<internal::ScratchArena>,
+    /// State of the [`BLOSC_BTUNE`](crate::tune::BLOSC_BTUNE) tuner, once it has run.
+    pub(crate) tuner: RefCell<Option<crate::tune::Btune>>,
+    /// Set by [`blosc2_set_incompressible_hint`].
+    pub(crate) incompressible_hint: bool,
 }
 
 /// Parameters controlling Blosc2 compression behavior.
@@ -24,15 +33,20 @@ pub struct Blosc2Cparams {
     pub compcode_meta: u8,
     /// Compression level, 0 (no compression) through 9 (maximum).
     pub clevel: u8,
-    /// Whether to use a dictionary for compression.
+    /// Whether to use a dictionary for compression. Nonzero trains a zstd dictionary on
+    /// each chunk and stores it in the chunk, which helps chunks with many small blocks;
+    /// codecs other than [`BLOSC_ZSTD`] fail with [`BLOSC2_ERROR_CODEC_DICT`].
     pub use_dict: i32,
     /// Size in bytes of the atomic data type (e.g. 4 for `f32`).
     pub typesize: i32,
-    /// Number of threads for compression (currently only 1 is supported).
+    /// Number of threads for compression. Values above 1 compress blocks in parallel
+    /// when the `parallel` cargo feature is enabled, and are ignored otherwise.
     pub nthreads: i16,
     /// Internal block size in bytes. 0 means automatic selection.
     pub blocksize: i32,
-    /// Block split mode (e.g. [`BLOSC_FORWARD_COMPAT_SPLIT`], [`BLOSC_ALWAYS_SPLIT`]).
+    /// Block split mode: whether blocks are compressed as one stream per byte of the items
+    /// ([`BLOSC_ALWAYS_SPLIT`], [`BLOSC_NEVER_SPLIT`], [`BLOSC_AUTO_SPLIT`], or the rules of
+    /// [`BLOSC_FORWARD_COMPAT_SPLIT`]).
     pub splitmode: i32,
     /// Pointer to an associated super-chunk, if any.
     pub schunk: *mut c_void,
@@ -46,9 +60,12 @@ pub struct Blosc2Cparams {
     pub preparams: *mut c_void,
     /// Reserved: tuner parameters pointer.
     pub tuner_params: *mut c_void,
-    /// Tuner identifier.
+    /// Tuner identifier: [`BLOSC_STUNE`] (the static rules) or
+    /// [`BLOSC_BTUNE`](crate::tune::BLOSC_BTUNE), which picks the codec, filter and clevel
+    /// from measurements (see [`crate::tune`]).
     pub tuner_id: i32,
-    /// Whether to instrument the codec (for development/debugging).
+    /// Whether to write instrumented chunks, which hold a [`crate::instr::Blosc2Instr`]
+    /// record per stream instead of the data (for development/debugging).
     pub instr_codec: bool,
     /// Reserved: codec-specific parameters pointer.
     pub codec_params: *mut c_void,
@@ -61,7 +78,8 @@ pub struct Blosc2Cparams {
 /// Use [`BLOSC2_DPARAMS_DEFAULTS`] as a starting point and override individual fields.
 #[repr(C)]
 pub struct Blosc2Dparams {
-    /// Number of threads for decompression (currently only 1 is supported).
+    /// Number of threads for decompression. Values above 1 decode blocks in parallel
+    /// when the `parallel` cargo feature is enabled, and are ignored otherwise.
     pub nthreads: i16,
     /// Pointer to an associated super-chunk, if any.
     pub schunk: *mut c_void,
@@ -298,43 +316,112 @@ pub fn blosc2_create_cctx(cparams: Blosc2Cparams) -> Blosc2Context {
     Blosc2Context {
         cparams,
         dparams: BLOSC2_DPARAMS_DEFAULTS,
+        scratch: RefCell::default(),
+        tuner: RefCell::default(),
+        incompressible_hint: false,
     }
 }
 
 /// Compresses `src` into `dest` using the codec and filters specified in `context`.
 ///
+/// With the `parallel` feature enabled, blocks are compressed on
+/// `context.cparams.nthreads` threads. The output is identical to a single-threaded run.
+///
 /// Returns the number of compressed bytes written, or 0 on error.
 pub fn blosc2_compress_ctx(context: &Blosc2Context, src: &[u8], dest: &mut [u8]) -> i32 {
-    let clevel = context.cparams.clevel as i32;
-    let typesize = context.cparams.typesize as usize;
-    let compressor = context.cparams.compcode;
-
-    let mut doshuffle = BLOSC_NOSHUFFLE as i32;
-    for &f in context.cparams.filters.iter() {
-        if f == BLOSC_SHUFFLE {
-            doshuffle = BLOSC_SHUFFLE as i32;
-        }
-        if f == BLOSC_BITSHUFFLE {
-            doshuffle = BLOSC_BITSHUFFLE as i32;
-        }
+    match internal::compress_ctx(context, src, dest) {
+        Ok(size) => size as i32,
+        Err(_) => 0,
     }
+}
 
-    // Filters are already u8 array
-    let filters = context.cparams.filters;
-    let filters_meta = context.cparams.filters_meta;
+/// `cparams.blocksize` that sizes blocks from the detected L1 and L2 caches and from
+/// `nthreads`, instead of the fixed table (0). C has no such value: its blocksizes are
+/// never negative.
+pub const BLOSC2_BLOCKSIZE_CACHE: i32 = -1;
 
-    match internal::compress_extended(
-        clevel,
-        doshuffle,
-        typesize,
-        src,
-        dest,
-        compressor,
-        &filters,
-        &filters_meta,
-    ) {
+/// Tells `context` that its data is mostly incompressible, such as encrypted or already
+/// compressed blobs. C has no such setting.
+///
+/// Every chunk is then sampled before compression: a few blocks are filtered and their
+/// byte entropy and repeats estimated. If one of them looks random, the chunk is stored
+/// memcpyed straight away, for any codec. The sample may be wrong: random bytes repeated
+/// every few KiB look random to it, and such a chunk is then memcpyed although the codec
+/// would have compressed it. Without the hint, only a chunk after one the codec gave up on
+/// is sampled, and a random-looking block is compressed to confirm before the chunk is
+/// memcpyed. [`BLOSC_ZLIB`] and [`BLOSC_ZSTD`] are then left to try. Chunks that the
+/// sample does not rule out compress as usual.
+pub fn blosc2_set_incompressible_hint(context: &mut Blosc2Context, hint: bool) {
+    context.incompressible_hint = hint;
+}
+
+/// Compresses each of `srcs` into the matching buffer of `dests`, as many
+/// [`blosc2_compress_ctx`] calls would, but with `context.cparams` interpreted once.
+///
+/// With the `parallel` feature enabled and `context.cparams.nthreads > 1`, whole chunks
+/// are compressed on that many threads, largest first. Each chunk is identical to what
+/// [`blosc2_compress_ctx`] writes.
+///
+/// Returns one result per item of `srcs`: the compressed size, or 0 on error (also for
+/// items without a matching `dests` buffer).
+pub fn blosc2_compress_batch(
+    context: &Blosc2Context,
+    srcs: &[&[u8]],
+    dests: &mut [&mut [u8]],
+) -> Vec<i32> {
+    internal::compress_batch(context, srcs, dests)
+        .into_iter()
+        .map(|result| result.map_or(0, |size| size as i32))
+        .collect()
+}
+
+/// Writes a chunk of `nbytes` zero bytes to `dest`: a header alone, 32 bytes whatever
+/// `nbytes` is (C `blosc2_chunk_zeros`). Decoding it is a plain fill, and
+/// `blosc1_getitem` answers from the header.
+///
+/// `nbytes` must be a multiple of `cparams.typesize`. The header records the block size
+/// that [`blosc2_compress_ctx`] would use with `cparams`.
+///
+/// Returns the chunk size, or a negative `BLOSC2_ERROR_*` code (`BLOSC2_ERROR_DATA` if
+/// `dest` is too small).
+pub fn blosc2_chunk_zeros(cparams: &Blosc2Cparams, nbytes: usize, dest: &mut [u8]) -> i32 {
+    chunk_special(cparams, BLOSC2_SPECIAL_ZERO, nbytes, &[], dest)
+}
+
+/// Like [`blosc2_chunk_zeros`], but every item is a NaN (C `blosc2_chunk_nans`). Only
+/// typesizes 4 (`f32`) and 8 (`f64`) are supported.
+pub fn blosc2_chunk_nans(cparams: &Blosc2Cparams, nbytes: usize, dest: &mut [u8]) -> i32 {
+    chunk_special(cparams, BLOSC2_SPECIAL_NAN, nbytes, &[], dest)
+}
+
+/// Like [`blosc2_chunk_zeros`], but every item is `repeatval`, which must be
+/// `cparams.typesize` bytes long and is stored after the header (C
+/// `blosc2_chunk_repeatval`).
+pub fn blosc2_chunk_repeatval(
+    cparams: &Blosc2Cparams,
+    nbytes: usize,
+    dest: &mut [u8],
+    repeatval: &[u8],
+) -> i32 {
+    chunk_special(cparams, BLOSC2_SPECIAL_VALUE, nbytes, repeatval, dest)
+}
+
+/// Like [`blosc2_chunk_zeros`], but for a chunk whose contents do not matter (C
+/// `blosc2_chunk_uninit`): decoding it leaves the destination untouched.
+pub fn blosc2_chunk_uninit(cparams: &Blosc2Cparams, nbytes: usize, dest: &mut [u8]) -> i32 {
+    chunk_special(cparams, BLOSC2_SPECIAL_UNINIT, nbytes, &[], dest)
+}
+
+fn chunk_special(
+    cparams: &Blosc2Cparams,
+    special: u8,
+    nbytes: usize,
+    value: &[u8],
+    dest: &mut [u8],
+) -> i32 {
+    match internal::chunk_special(cparams, special, nbytes, value, dest) {
         Ok(size) => size as i32,
-        Err(_) => 0,
+        Err(code) => code,
     }
 }
 
@@ -358,15 +445,106 @@ pub fn blosc2_create_dctx(dparams: Blosc2Dparams) -> Blosc2Context {
     Blosc2Context {
         cparams: BLOSC2_CPARAMS_DEFAULTS,
         dparams,
+        scratch: RefCell::default(),
+        tuner: RefCell::default(),
+        incompressible_hint: false,
     }
 }
 
 /// Decompresses a Blosc2 compressed buffer using the given context.
 ///
+/// With the `parallel` feature enabled, blocks are decoded on
+/// `context.dparams.nthreads` threads.
+///
 /// Returns the number of decompressed bytes, or -1 on error.
-pub fn blosc2_decompress_ctx(_context: &Blosc2Context, src: &[u8], dest: &mut [u8]) -> i32 {
-    match internal::decompress(src, dest) {
+pub fn blosc2_decompress_ctx(context: &Blosc2Context, src: &[u8], dest: &mut [u8]) -> i32 {
+    match internal::decompress_ctx(context, src, dest) {
+        Ok(size) => size as i32,
+        Err(_) => -1,
+    }
+}
+
+/// Decompresses each of `srcs` into the matching buffer of `dests`, as many
+/// [`blosc2_decompress_ctx`] calls would.
+///
+/// With the `parallel` feature enabled and `context.dparams.nthreads > 1`, whole
+/// chunks are decoded on that many threads, largest first.
+///
+/// Returns one result per item of `srcs`: the decompressed size, or -1 on error (also
+/// for items without a matching `dests` buffer).
+pub fn blosc2_decompress_batch(
+    context: &Blosc2Context,
+    srcs: &[&[u8]],
+    dests: &mut [&mut [u8]],
+) -> Vec<i32> {
+    internal::decompress_batch(context, srcs, dests)
+        .into_iter()
+        .map(|result| result.map_or(-1, |size| size as i32))
+        .collect()
+}
+
+/// Extracts a slice of items from a Blosc2 compressed buffer using the given context.
+///
+/// Like [`blosc1_getitem`], but block buffers are kept in `context` and reused by
+/// later calls, which matters when many small slices are read from the same chunk.
+///
+/// Returns the number of bytes written, or -1 on error.
+pub fn blosc2_getitem_ctx(
+    context: &Blosc2Context,
+    src: &[u8],
+    start: i32,
+    nitems: i32,
+    dest: &mut [u8],
+) -> i32 {
+    if start < 0 || nitems < 0 {
+        return -1;
+    }
+    match internal::getitem_ctx(context, src, start as usize, nitems as usize, dest) {
         Ok(size) => size as i32,
         Err(_) => -1,
     }
 }
+
+/// Extracts a strided N-d selection from a chunk holding a C-order array of `shape`
+/// items, in the spirit of C `b2nd_get_slice_cbuffer`.
+///
+/// Along dimension `d` the selection takes indices `start[d]`, `start[d] + step[d]`, ...
+/// below `stop[d]`; `shape`, `start`, `stop` and `step` have one entry per dimension, at
+/// most [`BLOSC2_MAX_DIM`]. The selected items are written to `dest` as a C-order array
+/// of the selected shape. Every block holding a selected item is decoded once, whatever
+/// the number of rows that cross it, and blocks holding none are skipped.
+///
+/// Returns the number of bytes written, or a negative `BLOSC2_ERROR_*` code:
+/// `BLOSC2_ERROR_INVALID_PARAM` if the selection is not inside `shape` or `shape` does
+/// not match the chunk's size, and `BLOSC2_ERROR_WRITE_BUFFER` if `dest` is too small.
+pub fn blosc2_getslice_ctx(
+    context: &Blosc2Context,
+    src: &[u8],
+    shape: &[i64],
+    start: &[i64],
+    stop: &[i64],
+    step: &[i64],
+    dest: &mut [u8],
+) -> i32 {
+    let ndim = shape.len();
+    if start.len() != ndim || stop.len() != ndim || step.len() != ndim {
+        return BLOSC2_ERROR_INVALID_PARAM;
+    }
+    let mut dims = Vec::with_capacity(ndim);
+    for d in 0..ndim {
+        let values = [shape[d], start[d], stop[d], step[d]].map(usize::try_from);
+        let [Ok(len), Ok(start), Ok(stop), Ok(step)] = values else {
+            return BLOSC2_ERROR_INVALID_PARAM;
+        };
+        dims.push(internal::DimSelection {
+            len,
+            start,
+            stop,
+            step,
+        });
+    }
+    match internal::getslice(src, &dims, dest, &mut context.scratch.borrow_mut()) {
+        Ok(size) => size as i32,
+        Err(code) => code,
+    }
+}
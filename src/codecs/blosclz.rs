@@ -76,20 +76,7 @@ pub fn decompress(input: &[u8], output: &mut [u8]) -> usize {
             ctrl = input[ip] as u32;
             ip += 1;
 
-            if distance == 1 {
-                let val = output[ref_pos];
-                for i in 0..len as usize {
-                    output[op + i] = val;
-                }
-            } else {
-                if distance as usize >= len as usize {
-                    output.copy_within(ref_pos..ref_pos + len as usize, op);
-                } else {
-                    for i in 0..len as usize {
-                        output[op + i] = output[ref_pos + i];
-                    }
-                }
-            }
+            copy_match(output, op, ref_pos, len as usize);
             op += len as usize;
         } else {
             ctrl += 1;
@@ -115,6 +102,56 @@ pub fn decompress(input: &[u8], output: &mut [u8]) -> usize {
     op
 }
 
+/// Copies the `len` bytes of a match starting `op - ref_pos` bytes back to `output[op..]`,
+/// where source and destination may overlap (C `copy_match` / `safe_copy`). The caller has
+/// checked that `op + len <= output.len()`.
+#[inline]
+fn copy_match(output: &mut [u8], op: usize, ref_pos: usize, len: usize) {
+    let distance = op - ref_pos;
+    if distance == 1 {
+        // A run of one byte
+        let val = output[ref_pos];
+        output[op..op + len].fill(val);
+    } else if distance >= len {
+        output.copy_within(ref_pos..ref_pos + len, op);
+    } else if distance >= 8 && op + (len + 7) / 8 * 8 <= output.len() {
+        // Wild copy: 8 bytes at a time, each piece at least 8 bytes behind its source.
+        // It may write up to 7 bytes past the match, which the next literal or match then
+        // overwrites; only done when those bytes are still inside `output`.
+        let mut i = 0;
+        while i < len {
+            output.copy_within(ref_pos + i..ref_pos + i + 8, op + i);
+            i += 8;
+        }
+    } else {
+        // The match repeats its first `distance` bytes. Copy the longest prefix already
+        // written, which doubles the pattern on every pass.
+        let mut done = 0;
+        while done < len {
+            let n = std::cmp::min(op + done - ref_pos, len - done);
+            output.copy_within(ref_pos..ref_pos + n, op + done);
+            done += n;
+        }
+    }
+}
+
+/// Number of equal leading bytes of two words whose XOR is `diff` (non-zero), both read
+/// little-endian.
+#[inline]
+fn equal_prefix(diff: u128) -> usize {
+    (diff.trailing_zeros() / 8) as usize
+}
+
+#[inline]
+fn read_u64(input: &[u8], pos: usize) -> u64 {
+    u64::from_le_bytes(input[pos..pos + 8].try_into().unwrap())
+}
+
+#[inline]
+fn read_u128(input: &[u8], pos: usize) -> u128 {
+    u128::from_le_bytes(input[pos..pos + 16].try_into().unwrap())
+}
+
 #[inline]
 fn hash_function(seq: u32, hashlog: usize) -> usize {
     if hashlog == 0 {
@@ -126,6 +163,8 @@ fn hash_function(seq: u32, hashlog: usize) -> usize {
 /// Equivalent to C get_match: returns index one past last matching byte.
 /// Compares bytes starting from ip and ref_pos, up to ip_bound.
 /// Returns the position after the last matching byte (mimics C post-increment behavior).
+///
+/// `ref_pos` is always behind `ip`, so every read below `ip_bound` is in bounds for both.
 #[inline]
 fn get_match(input: &[u8], mut ip: usize, ip_bound: usize, mut ref_pos: usize) -> usize {
     // Mimics C get_match (non-STRICT_ALIGN path):
@@ -138,35 +177,28 @@ fn get_match(input: &[u8], mut ip: usize, ip_bound: usize, mut ref_pos: usize) -
     //   }
     //   while ((ip < ip_bound) && (*ref++ == *ip++)) {}
     //   return ip;
-    while ip + 8 <= ip_bound {
-        if ref_pos + 8 <= input.len() {
-            let ip_bytes = u64::from_le_bytes(input[ip..ip + 8].try_into().unwrap());
-            let ref_bytes = u64::from_le_bytes(input[ref_pos..ref_pos + 8].try_into().unwrap());
-            if ip_bytes != ref_bytes {
-                // Byte-by-byte with no ip_bound check (matches C behavior)
-                while ref_pos < input.len() && input[ref_pos] == input[ip] {
-                    ref_pos += 1;
-                    ip += 1;
-                }
-                // C post-increment: ip advances one more on mismatch (always, no bounds check)
-                ip += 1;
-                return ip;
-            } else {
-                ip += 8;
-                ref_pos += 8;
-            }
-        } else {
-            break;
+    // The first mismatching byte is found from the XOR of the two words. 16-byte steps
+    // are two 8-byte steps at once: same result, half the iterations.
+    debug_assert!(ref_pos < ip);
+    while ip + 16 <= ip_bound {
+        let diff = read_u128(input, ip) ^ read_u128(input, ref_pos);
+        if diff != 0 {
+            // C post-increment: ip advances one more on mismatch
+            return ip + equal_prefix(diff) + 1;
         }
+        ip += 16;
+        ref_pos += 16;
     }
-    // Scalar remainder: while ((ip < ip_bound) && (*ref++ == *ip++)) {}
-    loop {
-        if ip >= ip_bound {
-            break;
-        }
-        if ref_pos >= input.len() {
-            break;
+    if ip + 8 <= ip_bound {
+        let diff = read_u64(input, ip) ^ read_u64(input, ref_pos);
+        if diff != 0 {
+            return ip + equal_prefix(diff as u128) + 1;
         }
+        ip += 8;
+        ref_pos += 8;
+    }
+    // Scalar remainder: while ((ip < ip_bound) && (*ref++ == *ip++)) {}
+    while ip < ip_bound {
         let matches = input[ref_pos] == input[ip];
         // C post-increment: both advance regardless of match result
         ref_pos += 1;
@@ -193,29 +225,28 @@ fn get_match(input: &[u8], mut ip: usize, ip_bound: usize, mut ref_pos: usize) -
 #[inline]
 fn get_run(input: &[u8], mut ip: usize, ip_bound: usize, mut ref_pos: usize) -> usize {
     let x = input[ip - 1]; // The repeated byte value
-    let xval = x as u64;
-    let broadcast = xval * 0x0101010101010101u64;
-    // 8-byte fast path
-    while ip + 8 <= ip_bound {
-        if ref_pos + 8 <= input.len() {
-            let ref_bytes = u64::from_ne_bytes(input[ref_pos..ref_pos + 8].try_into().unwrap());
-            if broadcast != ref_bytes {
-                // C: while (*ref++ == x) ip++;
-                while ref_pos < input.len() && input[ref_pos] == x {
-                    ref_pos += 1;
-                    ip += 1;
-                }
-                return ip;
-            } else {
-                ip += 8;
-                ref_pos += 8;
-            }
-        } else {
-            break;
+    let broadcast = u128::from_ne_bytes([x; 16]);
+    debug_assert!(ref_pos < ip);
+    // Word-at-a-time fast path, as in `get_match`
+    while ip + 16 <= ip_bound {
+        let diff = read_u128(input, ref_pos) ^ broadcast;
+        if diff != 0 {
+            // C: while (*ref++ == x) ip++;
+            return ip + equal_prefix(diff);
+        }
+        ip += 16;
+        ref_pos += 16;
+    }
+    if ip + 8 <= ip_bound {
+        let diff = read_u64(input, ref_pos) ^ broadcast as u64;
+        if diff != 0 {
+            return ip + equal_prefix(diff as u128);
         }
+        ip += 8;
+        ref_pos += 8;
     }
     // Scalar remainder: while ((ip < ip_bound) && (*ref++ == x)) ip++;
-    while ip < ip_bound && ref_pos < input.len() && input[ref_pos] == x {
+    while ip < ip_bound && input[ref_pos] == x {
         ref_pos += 1;
         ip += 1;
     }
@@ -232,7 +263,7 @@ fn get_cratio(
     maxlen: usize,
     minlen: usize,
     ipshift: usize,
-    htab: &mut [usize],
+    htab: &mut [u32],
     hashlog: usize,
 ) -> f64 {
     let hashlen = 1usize << hashlog;
@@ -245,9 +276,7 @@ fn get_cratio(
     let ip_limit_probe = base + limit - 12;
 
     // Initialize hash table to 0 (distances of 0)
-    for i in 0..hashlen {
-        htab[i] = 0;
-    }
+    htab[..hashlen].fill(0);
 
     let mut ip = base;
     let mut oc: i32 = 0;
@@ -259,10 +288,10 @@ fn get_cratio(
 
         let seq = u32::from_le_bytes(input[ip..ip + 4].try_into().unwrap());
         let hval = hash_function(seq, hashlog);
-        let ref_pos = base + htab[hval]; // relative to base
+        let ref_pos = base + htab[hval] as usize; // relative to base
         let distance = anchor - ref_pos; // could underflow if ref_pos > anchor, but htab starts at 0
 
-        htab[hval] = anchor - base;
+        htab[hval] = (anchor - base) as u32;
 
         if distance == 0 || distance >= MAX_FARDISTANCE {
             // LITERAL2
@@ -340,7 +369,7 @@ fn get_cratio(
         if ip + 4 <= input.len() {
             let seq = u32::from_le_bytes(input[ip..ip + 4].try_into().unwrap());
             let hval = hash_function(seq, hashlog);
-            htab[hval] = ip - base;
+            htab[hval] = (ip - base) as u32;
         }
         ip += 1;
         ip += 1;
@@ -361,7 +390,46 @@ fn get_cratio(
 /// Returns the number of compressed bytes written to `output`, or 0 if the data
 /// is incompressible at the given level.
 pub fn compress(clevel: i32, input: &[u8], output: &mut [u8]) -> usize {
-    if input.is_empty() {
+    let mut htab = Vec::new();
+    compress_with_htab(clevel, input, output, &mut htab)
+}
+
+/// Like [`compress`], but uses `htab` as the match hash table instead of allocating one.
+///
+/// `htab` is grown to the size needed for `clevel` if it is shorter; its previous
+/// contents are irrelevant since the table is cleared before use. Reusing one table
+/// across streams avoids a 64 KiB allocation per call. Positions are `u32`, like C's
+/// `uint32_t htab[]`, so inputs of 4 GiB or more are not compressed.
+pub fn compress_with_htab(
+    clevel: i32,
+    input: &[u8],
+    output: &mut [u8],
+    htab: &mut Vec<u32>,
+) -> usize {
+    compress_impl(clevel, input, output, htab, true)
+}
+
+/// Like [`compress_with_htab`], but skips the entropy probe, for callers that already
+/// know `input` compresses well (see `internal::estimate`). When the probe would have
+/// passed, the output is the same; the probe can cost as much as the compression
+/// itself at clevel >= 7.
+pub fn compress_without_probe(
+    clevel: i32,
+    input: &[u8],
+    output: &mut [u8],
+    htab: &mut Vec<u32>,
+) -> usize {
+    compress_impl(clevel, input, output, htab, false)
+}
+
+fn compress_impl(
+    clevel: i32,
+    input: &[u8],
+    output: &mut [u8],
+    htab: &mut Vec<u32>,
+    probe: bool,
+) -> usize {
+    if input.is_empty() || input.len() > u32::MAX as usize {
         return 0;
     }
     let length = input.len();
@@ -381,24 +449,29 @@ pub fn compress(clevel: i32, input: &[u8], output: &mut [u8]) -> usize {
         _ => HASH_LOG,
     };
     let hash_size = 1usize << hashlog;
-    let mut htab = vec![0usize; hash_size];
+    if htab.len() < hash_size {
+        htab.resize(hash_size, 0);
+    }
+    let htab = &mut htab[..hash_size];
 
     // Entropy probing: estimate compression ratio and bail early if too low.
     // The probe length depends on clevel.
-    let maxlen = if clevel < 2 {
-        length / 8
-    } else if clevel < 4 {
-        length / 4
-    } else if clevel < 7 {
-        length / 2
-    } else {
-        length
-    };
-    let shift = length - maxlen;
-    let cratio = get_cratio(input, shift, maxlen, minlen, ipshift, &mut htab, hashlog);
-    let cratio_thresholds: [f64; 10] = [0.0, 2.0, 1.5, 1.2, 1.2, 1.2, 1.2, 1.15, 1.1, 1.0];
-    if cratio < cratio_thresholds[clevel as usize] {
-        return 0;
+    if probe {
+        let maxlen = if clevel < 2 {
+            length / 8
+        } else if clevel < 4 {
+            length / 4
+        } else if clevel < 7 {
+            length / 2
+        } else {
+            length
+        };
+        let shift = length - maxlen;
+        let cratio = get_cratio(input, shift, maxlen, minlen, ipshift, htab, hashlog);
+        let cratio_thresholds: [f64; 10] = [0.0, 2.0, 1.5, 1.2, 1.2, 1.2, 1.2, 1.15, 1.1, 1.0];
+        if cratio < cratio_thresholds[clevel as usize] {
+            return 0;
+        }
     }
 
     let mut ip: usize = 0;
@@ -407,9 +480,7 @@ pub fn compress(clevel: i32, input: &[u8], output: &mut [u8]) -> usize {
     let mut op: usize = 0;
 
     // Re-initialize hash table (C does this after entropy probing)
-    for i in 0..hash_size {
-        htab[i] = 0;
-    }
+    htab.fill(0);
 
     // Start with literal copy
     let mut copy: usize = 4;
@@ -435,13 +506,13 @@ pub fn compress(clevel: i32, input: &[u8], output: &mut [u8]) -> usize {
         // Find potential match
         let seq = u32::from_le_bytes(input[ip..ip + 4].try_into().unwrap());
         let hval = hash_function(seq, hashlog);
-        let ref_pos = htab[hval]; // absolute position in input
+        let ref_pos = htab[hval] as usize; // absolute position in input
 
         // Calculate distance
         let distance = anchor.wrapping_sub(ref_pos);
 
         // Update hash table
-        htab[hval] = anchor;
+        htab[hval] = anchor as u32;
 
         if distance == 0 || distance >= MAX_FARDISTANCE {
             // LITERAL
@@ -614,13 +685,13 @@ pub fn compress(clevel: i32, input: &[u8], output: &mut [u8]) -> usize {
         if ip + 4 <= input.len() {
             let seq = u32::from_le_bytes(input[ip..ip + 4].try_into().unwrap());
             let hval = hash_function(seq, hashlog);
-            htab[hval] = ip;
+            htab[hval] = ip as u32;
             ip += 1;
             if clevel == 9 {
                 // In some situations, including a second hash proves useful
                 let seq_shifted = seq >> 8;
                 let hval_shifted = hash_function(seq_shifted, hashlog);
-                htab[hval_shifted] = ip;
+                htab[hval_shifted] = ip as u32;
             }
             ip += 1;
         } else {
@@ -0,0 +1,403 @@
+//! High-compression LZ4 encoder (LZ4HC).
+//!
+//! Port of the hash-chain strategy of `lz4hc.c` (`LZ4HC_compress_hashChain`), which
+//! c-blosc2 uses for `BLOSC_LZ4HC`: every position is inserted into a hash table plus a
+//! 64 KiB chain of backward deltas, and each match search walks that chain for up to
+//! `1 << (level - 1)` candidates (the `clTable` of `lz4hc.c`). Instead of LZ4HC's
+//! overlapping-match heuristics this encoder does one-step lazy matching: a match is
+//! only taken if the next position does not start a longer one.
+//!
+//! The output is the plain LZ4 block format, so any LZ4 block decoder
+//! (`lz4_flex::block::decompress_into` here, `LZ4_decompress_safe` in C) reads it. The
+//! bytes are not identical to C's LZ4HC output.
+
+const MINMATCH: usize = 4;
+/// The last 5 bytes of a block are always literals.
+const LASTLITERALS: usize = 5;
+/// A match must start at least 12 bytes before the end of the block.
+const MFLIMIT: usize = 12;
+const MAX_DISTANCE: usize = 65535;
+const HASH_LOG: usize = 15;
+const CHAIN_SIZE: usize = 1 << 16;
+const CHAIN_MASK: usize = CHAIN_SIZE - 1;
+const ML_MASK: usize = 15;
+const RUN_MASK: usize = 15;
+
+/// Match-finder tables, reusable across calls to avoid allocating 256 KiB per stream.
+#[derive(Default)]
+pub struct MatchTables {
+    /// Last position (plus one, 0 = empty) with each 4-byte hash.
+    hash: Vec<u32>,
+    /// Distance from a position to the previous one with the same hash, indexed by
+    /// position modulo 64 KiB.
+    chain: Vec<u16>,
+}
+
+/// Number of chain candidates examined per search, as `lz4hc.c`'s `clTable` for
+/// levels 1-9 (`nbSearches`).
+fn max_attempts(clevel: i32) -> usize {
+    match clevel {
+        i32::MIN..=2 => 2,
+        3..=8 => 1 << (clevel - 1),
+        _ => 256,
+    }
+}
+
+#[inline]
+fn read_u32(input: &[u8], pos: usize) -> u32 {
+    u32::from_le_bytes(input[pos..pos + 4].try_into().unwrap())
+}
+
+#[inline]
+fn hash(sequence: u32) -> usize {
+    (sequence.wrapping_mul(2654435761) >> (32 - HASH_LOG)) as usize
+}
+
+/// Length of the common run of `input[a..]` and `input[b..]`, stopping at `limit`
+/// (`a` > `b`), like `LZ4_count`.
+#[inline]
+fn count(input: &[u8], mut a: usize, mut b: usize, limit: usize) -> usize {
+    let start = a;
+    while a + 8 <= limit {
+        let x = u64::from_le_bytes(input[a..a + 8].try_into().unwrap())
+            ^ u64::from_le_bytes(input[b..b + 8].try_into().unwrap());
+        if x != 0 {
+            return a - start + (x.trailing_zeros() / 8) as usize;
+        }
+        a += 8;
+        b += 8;
+    }
+    while a < limit && input[a] == input[b] {
+        a += 1;
+        b += 1;
+    }
+    a - start
+}
+
+struct MatchFinder<'a> {
+    input: &'a [u8],
+    hash: &'a mut [u32],
+    chain: &'a mut [u16],
+    next_to_update: usize,
+    attempts: usize,
+    match_limit: usize,
+}
+
+impl MatchFinder<'_> {
+    /// Inserts all positions before `ip` into the tables (`LZ4HC_Insert`).
+    fn insert(&mut self, ip: usize) {
+        while self.next_to_update < ip {
+            let pos = self.next_to_update;
+            let h = hash(read_u32(self.input, pos));
+            let head = self.hash[h] as usize;
+            let delta = if head == 0 {
+                MAX_DISTANCE
+            } else {
+                std::cmp::min(pos + 1 - head, MAX_DISTANCE)
+            };
+            self.chain[pos & CHAIN_MASK] = delta as u16;
+            self.hash[h] = (pos + 1) as u32;
+            self.next_to_update += 1;
+        }
+    }
+
+    /// Returns the longest match for `ip` as `(length, position)`, with length 0 if
+    /// there is none (`LZ4HC_InsertAndFindBestMatch`).
+    fn find(&mut self, ip: usize) -> (usize, usize) {
+        self.insert(ip);
+        let input = self.input;
+        let head = self.hash[hash(read_u32(input, ip))] as usize;
+        let (mut best_len, mut best_pos) = (0, 0);
+        if head == 0 {
+            return (0, 0);
+        }
+        let mut candidate = head - 1;
+        let sequence = read_u32(input, ip);
+        for _ in 0..self.attempts {
+            if ip - candidate > MAX_DISTANCE {
+                break;
+            }
+            // Cheap rejection: a longer match must also agree at the current best length
+            if input[candidate + best_len] == input[ip + best_len]
+                && read_u32(input, candidate) == sequence
+            {
+                let len =
+                    MINMATCH + count(input, ip + MINMATCH, candidate + MINMATCH, self.match_limit);
+                if len > best_len {
+                    best_len = len;
+                    best_pos = candidate;
+                    if ip + len == self.match_limit {
+                        break;
+                    }
+                }
+            }
+            let delta = self.chain[candidate & CHAIN_MASK] as usize;
+            if delta > candidate {
+                break;
+            }
+            candidate -= delta;
+        }
+        (best_len, best_pos)
+    }
+}
+
+/// Writes an LZ4 length that did not fit in its 4-bit token field (`len` already
+/// minus the 15 stored in the token).
+#[inline]
+fn write_length(output: &mut [u8], op: &mut usize, mut len: usize) {
+    while len >= 255 {
+        output[*op] = 255;
+        *op += 1;
+        len -= 255;
+    }
+    output[*op] = len as u8;
+    *op += 1;
+}
+
+/// Emits one sequence: the literals, then a match of `match_len` bytes at `offset`
+/// back (`match_len` 0 for the final literal-only sequence). Returns `false` if it
+/// does not fit in `output`.
+fn write_sequence(
+    output: &mut [u8],
+    op: &mut usize,
+    literals: &[u8],
+    match_len: usize,
+    offset: usize,
+) -> bool {
+    let lit_len = literals.len();
+    let mut needed = 1 + lit_len + lit_len / 255 + 1;
+    if match_len > 0 {
+        needed += 2 + (match_len - MINMATCH) / 255 + 1;
+    }
+    if *op + needed > output.len() {
+        return false;
+    }
+
+    let token_pos = *op;
+    *op += 1;
+    let mut token = if lit_len >= RUN_MASK {
+        write_length(output, op, lit_len - RUN_MASK);
+        (RUN_MASK as u8) << 4
+    } else {
+        (lit_len as u8) << 4
+    };
+    output[*op..*op + lit_len].copy_from_slice(literals);
+    *op += lit_len;
+
+    if match_len > 0 {
+        output[*op..*op + 2].copy_from_slice(&(offset as u16).to_le_bytes());
+        *op += 2;
+        let len = match_len - MINMATCH;
+        if len >= ML_MASK {
+            token |= ML_MASK as u8;
+            write_length(output, op, len - ML_MASK);
+        } else {
+            token |= len as u8;
+        }
+    }
+    output[token_pos] = token;
+    true
+}
+
+/// Compresses `input` into `output` as one LZ4 block, searching harder for matches
+/// as `clevel` (1–9) grows.
+///
+/// Returns the number of compressed bytes written to `output`, or 0 if `input` is
+/// empty or the block does not fit in `output`.
+pub fn compress(clevel: i32, input: &[u8], output: &mut [u8]) -> usize {
+    compress_with_tables(clevel, input, output, &mut MatchTables::default())
+}
+
+/// Like [`compress`], but uses `tables` for the match finder instead of allocating them.
+/// Only the hash table is cleared per call; chain entries are always written before
+/// they are read.
+pub fn compress_with_tables(
+    clevel: i32,
+    input: &[u8],
+    output: &mut [u8],
+    tables: &mut MatchTables,
+) -> usize {
+    let length = input.len();
+    if length == 0 {
+        return 0;
+    }
+    let mut op = 0;
+    let mut anchor = 0;
+
+    // Blocks shorter than MFLIMIT + 1 are all literals
+    if length > MFLIMIT {
+        tables.hash.clear();
+        tables.hash.resize(1 << HASH_LOG, 0);
+        tables.chain.resize(CHAIN_SIZE, 0);
+        let mf_limit = length - MFLIMIT;
+        let mut finder = MatchFinder {
+            input,
+            hash: &mut tables.hash,
+            chain: &mut tables.chain,
+            next_to_update: 0,
+            attempts: max_attempts(clevel),
+            match_limit: length - LASTLITERALS,
+        };
+
+        let mut ip = 0;
+        while ip < mf_limit {
+            let (mut match_len, mut match_pos) = finder.find(ip);
+            if match_len < MINMATCH {
+                ip += 1;
+                continue;
+            }
+            // Lazy evaluation: prefer a longer match starting one byte later
+            while ip + 1 < mf_limit {
+                let (next_len, next_pos) = finder.find(ip + 1);
+                if next_len <= match_len {
+                    break;
+                }
+                ip += 1;
+                match_len = next_len;
+                match_pos = next_pos;
+            }
+
+            if !write_sequence(
+                output,
+                &mut op,
+                &input[anchor..ip],
+                match_len,
+                ip - match_pos,
+            ) {
+                return 0;
+            }
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+
+    if !write_sequence(output, &mut op, &input[anchor..], 0, 0) {
+        return 0;
+    }
+    op
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Reference LZ4 block decoder, straight from the format description.
+    fn lz4_decode(input: &[u8], expected_len: usize) -> Vec<u8> {
+        let mut out = Vec::with_capacity(expected_len);
+        let mut ip = 0;
+        loop {
+            let token = input[ip];
+            ip += 1;
+            let mut lit_len = (token >> 4) as usize;
+            if lit_len == 15 {
+                loop {
+                    let b = input[ip];
+                    ip += 1;
+                    lit_len += b as usize;
+                    if b != 255 {
+                        break;
+                    }
+                }
+            }
+            out.extend_from_slice(&input[ip..ip + lit_len]);
+            ip += lit_len;
+            if ip == input.len() {
+                break;
+            }
+            let offset = u16::from_le_bytes([input[ip], input[ip + 1]]) as usize;
+            ip += 2;
+            let mut match_len = (token & 15) as usize;
+            if match_len == 15 {
+                loop {
+                    let b = input[ip];
+                    ip += 1;
+                    match_len += b as usize;
+                    if b != 255 {
+                        break;
+                    }
+                }
+            }
+            match_len += MINMATCH;
+            assert!(offset > 0 && offset <= out.len());
+            let start = out.len() - offset;
+            for k in 0..match_len {
+                out.push(out[start + k]);
+            }
+        }
+        out
+    }
+
+    fn samples() -> Vec<Vec<u8>> {
+        let mut state: u32 = 12345;
+        let mut noise = || {
+            state = state.wrapping_mul(1_103_515_245).wrapping_add(12_345);
+            (state >> 16) as u8
+        };
+        let text: Vec<u8> = b"the quick brown fox jumps over the lazy dog; "
+            .iter()
+            .cycle()
+            .take(100_000)
+            .copied()
+            .collect();
+        let ints: Vec<u8> = (0..50_000u32)
+            .flat_map(|i| (i.wrapping_mul(7) / 3).to_le_bytes())
+            .collect();
+        let random: Vec<u8> = (0..70_000).map(|_| noise()).collect();
+        let mixed: Vec<u8> = (0..200_000)
+            .map(|i| {
+                if i % 1000 < 900 {
+                    (i / 1000) as u8
+                } else {
+                    noise()
+                }
+            })
+            .collect();
+        vec![
+            vec![7],
+            b"abcdabcdabcd".to_vec(),
+            b"abcdabcdabcdabcdabcd".to_vec(),
+            vec![0; 65_536 * 3],
+            text,
+            ints,
+            random,
+            mixed,
+        ]
+    }
+
+    #[test]
+    fn roundtrip_all_levels() {
+        let mut tables = MatchTables::default();
+        for data in samples() {
+            for clevel in 1..=9 {
+                let mut out = vec![0u8; data.len() + data.len() / 255 + 16];
+                let n = compress_with_tables(clevel, &data, &mut out, &mut tables);
+                assert!(n > 0, "len={}, clevel={}", data.len(), clevel);
+                assert_eq!(lz4_decode(&out[..n], data.len()), data, "clevel={}", clevel);
+                // Fresh tables give the same bytes as reused ones
+                let mut fresh = vec![0u8; out.len()];
+                assert_eq!(compress(clevel, &data, &mut fresh), n);
+                assert_eq!(&fresh[..n], &out[..n]);
+            }
+        }
+    }
+
+    #[test]
+    fn deeper_search_compresses_better() {
+        let data = samples().pop().unwrap();
+        let mut out = vec![0u8; data.len() * 2];
+        let sizes: Vec<usize> = [1, 5, 9]
+            .iter()
+            .map(|&clevel| compress(clevel, &data, &mut out))
+            .collect();
+        assert!(sizes[0] >= sizes[1] && sizes[1] >= sizes[2], "{:?}", sizes);
+        assert!(sizes[2] < data.len() / 4, "{:?}", sizes);
+    }
+
+    #[test]
+    fn output_too_small() {
+        let data = vec![3u8; 1000];
+        let mut out = vec![0u8; 4];
+        assert_eq!(compress(9, &data, &mut out), 0);
+        assert_eq!(compress(9, &[], &mut out), 0);
+    }
+}
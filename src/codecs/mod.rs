@@ -1 +1,3 @@
 pub mod blosclz;
+pub mod lz4hc;
+pub(crate) mod state;
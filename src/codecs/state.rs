@@ -0,0 +1,210 @@
+//! Codec encoder/decoder state kept across streams.
+//!
+//! C blosc2 keeps a zstd `CCtx`/`DCtx` per thread context (`thread_context.zstd_cctx`,
+//! `zstd_dctx`) and reuses it for every stream. This does the same for the codecs whose
+//! setup is not free: zstd contexts, zlib (de)compressors and snappy's hash table. Each
+//! one is created on first use and reset between streams. Reset contexts give the same
+//! bytes as freshly created ones. LZ4 (`lz4_flex::block`) has no state worth keeping;
+//! the BloscLZ and LZ4HC match tables live in the [`crate::internal::ScratchArena`].
+//!
+//! Chunks written with `use_dict` carry a zstd dictionary. The prepared forms (C
+//! `dict_cdict`/`dict_ddict`) are kept here too: the compression one for the chunk being
+//! compressed, and the decompression one until a chunk with a different dictionary
+//! comes along.
+
+use flate2::{Compress, Compression, Decompress, FlushCompress, FlushDecompress, Status};
+use std::sync::Arc;
+use zstd::stream::raw::{InBuffer, Operation, OutBuffer};
+use zstd::zstd_safe::{CCtx, CDict, DCtx, DDict};
+
+/// A prepared zstd compression dictionary, shared by the worker arenas of one chunk.
+pub(crate) type SharedCDict = Arc<CDict<'static>>;
+
+/// Prepares `dict` for compressing at `clevel` (C `ZSTD_createCDict`).
+pub(crate) fn new_cdict(dict: &[u8], clevel: i32) -> SharedCDict {
+    Arc::new(CDict::create(dict, clevel))
+}
+
+/// Lazily created codec contexts, owned by a [`crate::internal::ScratchArena`].
+#[derive(Default)]
+pub(crate) struct CodecState {
+    zstd_cctx: Option<(i32, zstd::stream::raw::Encoder<'static>)>,
+    zstd_dctx: Option<DCtx<'static>>,
+    /// Dictionary of the chunk being compressed, if any.
+    zstd_cdict: Option<SharedCDict>,
+    /// Context for [`CCtx::compress_using_cdict`], separate from the streaming one.
+    zstd_dict_cctx: Option<CCtx<'static>>,
+    /// Last dictionary seen while decompressing, with its prepared form.
+    zstd_ddict: Option<(Vec<u8>, DDict<'static>)>,
+    /// Whether the chunk being decompressed uses `zstd_ddict`.
+    zstd_ddict_active: bool,
+    zlib_compress: Option<(u32, Compress)>,
+    zlib_decompress: Option<Decompress>,
+    snappy_encoder: Option<snap::raw::Encoder>,
+    snappy_decoder: Option<snap::raw::Decoder>,
+}
+
+impl CodecState {
+    /// Compresses `src` as one zstd frame into `dest`, like a `zstd::stream::write::Encoder`
+    /// fed the whole stream and then finished. Returns the frame size, or 0 if it does not
+    /// fit in `dest`; `Err` only if a context cannot be created.
+    pub(crate) fn zstd_compress(
+        &mut self,
+        clevel: i32,
+        src: &[u8],
+        dest: &mut [u8],
+    ) -> Result<usize, i32> {
+        if let Some(cdict) = &self.zstd_cdict {
+            let cctx = self.zstd_dict_cctx.get_or_insert_with(CCtx::create);
+            return Ok(cctx.compress_using_cdict(dest, src, cdict).unwrap_or(0));
+        }
+        let encoder = match &mut self.zstd_cctx {
+            Some((level, encoder)) => {
+                // Drops anything left over from a stream that did not fit
+                encoder.reinit().map_err(|_| -1)?;
+                if *level != clevel {
+                    encoder
+                        .set_parameter(zstd::stream::raw::CParameter::CompressionLevel(clevel))
+                        .map_err(|_| -1)?;
+                    *level = clevel;
+                }
+                encoder
+            }
+            cctx => {
+                let encoder = zstd::stream::raw::Encoder::new(clevel).map_err(|_| -1)?;
+                &mut cctx.insert((clevel, encoder)).1
+            }
+        };
+
+        let dest_len = dest.len();
+        let mut input = InBuffer::around(src);
+        let mut output = OutBuffer::around(dest);
+        loop {
+            if encoder.run(&mut input, &mut output).is_err() {
+                return Ok(0);
+            }
+            if input.pos() == src.len() {
+                break;
+            }
+            if output.pos() == dest_len {
+                return Ok(0);
+            }
+        }
+        loop {
+            match encoder.finish(&mut output, true) {
+                Ok(0) => break,
+                Ok(_) if output.pos() < dest_len => {}
+                _ => return Ok(0),
+            }
+        }
+        Ok(output.pos())
+    }
+
+    /// Decompresses one zstd frame into `dest` and returns its size, with the dictionary
+    /// selected by [`CodecState::set_zstd_ddict`] if there is one.
+    pub(crate) fn zstd_decompress(&mut self, src: &[u8], dest: &mut [u8]) -> Result<usize, String> {
+        let dctx = self.zstd_dctx.get_or_insert_with(DCtx::create);
+        let result = match &self.zstd_ddict {
+            Some((_, ddict)) if self.zstd_ddict_active => {
+                dctx.decompress_using_ddict(dest, src, ddict)
+            }
+            _ => dctx.decompress(dest, src),
+        };
+        result.map_err(|code| format!("Zstd error: {}", zstd::zstd_safe::get_error_name(code)))
+    }
+
+    /// Makes [`CodecState::zstd_compress`] compress with `cdict` (`None` for no
+    /// dictionary) until the next call.
+    pub(crate) fn set_zstd_cdict(&mut self, cdict: Option<SharedCDict>) {
+        self.zstd_cdict = cdict;
+    }
+
+    /// Makes [`CodecState::zstd_decompress`] decompress with `dict` (`None` for no
+    /// dictionary) until the next call. The prepared dictionary is kept, so a run of
+    /// chunks with the same dictionary only prepares it once.
+    pub(crate) fn set_zstd_ddict(&mut self, dict: Option<&[u8]>) {
+        self.zstd_ddict_active = dict.is_some();
+        if let Some(dict) = dict {
+            if !matches!(&self.zstd_ddict, Some((bytes, _)) if bytes[..] == *dict) {
+                self.zstd_ddict = Some((dict.to_vec(), DDict::create(dict)));
+            }
+        }
+    }
+
+    /// Compresses `src` as one zlib stream into `dest`, like a `flate2::write::ZlibEncoder`
+    /// fed the whole stream and then finished. Returns the stream size, or 0 if it does
+    /// not fit in `dest`.
+    pub(crate) fn zlib_compress(&mut self, clevel: i32, src: &[u8], dest: &mut [u8]) -> usize {
+        let level = clevel as u32;
+        let compress = match &mut self.zlib_compress {
+            Some((l, compress)) if *l == level => {
+                compress.reset();
+                compress
+            }
+            state => {
+                &mut state
+                    .insert((level, Compress::new(Compression::new(level), true)))
+                    .1
+            }
+        };
+
+        let total_in = |c: &Compress| c.total_in() as usize;
+        let total_out = |c: &Compress| c.total_out() as usize;
+        while total_in(compress) < src.len() {
+            let progress = (total_in(compress), total_out(compress));
+            let result = compress.compress(
+                &src[progress.0..],
+                &mut dest[progress.1..],
+                FlushCompress::None,
+            );
+            if result.is_err() || (total_in(compress), total_out(compress)) == progress {
+                return 0;
+            }
+        }
+        loop {
+            let out = total_out(compress);
+            match compress.compress(&[], &mut dest[out..], FlushCompress::Finish) {
+                Ok(Status::StreamEnd) => return total_out(compress),
+                Ok(_) if total_out(compress) > out => {}
+                _ => return 0,
+            }
+        }
+    }
+
+    /// Decompresses one zlib stream into `dest` and returns its size.
+    pub(crate) fn zlib_decompress(&mut self, src: &[u8], dest: &mut [u8]) -> Result<usize, String> {
+        let decompress = match &mut self.zlib_decompress {
+            Some(decompress) => {
+                decompress.reset(true);
+                decompress
+            }
+            state => state.insert(Decompress::new(true)),
+        };
+        match decompress.decompress(src, dest, FlushDecompress::Finish) {
+            Ok(Status::StreamEnd) => Ok(decompress.total_out() as usize),
+            Ok(_) => Err("Zlib error: truncated stream or output too small".to_string()),
+            Err(e) => Err(format!("Zlib error: {}", e)),
+        }
+    }
+
+    /// Compresses `src` with snappy into `dest`. Returns the compressed size, or 0 if it
+    /// does not fit.
+    pub(crate) fn snappy_compress(&mut self, src: &[u8], dest: &mut [u8]) -> usize {
+        self.snappy_encoder
+            .get_or_insert_with(snap::raw::Encoder::new)
+            .compress(src, dest)
+            .unwrap_or(0)
+    }
+
+    /// Decompresses a snappy stream into `dest` and returns its size.
+    pub(crate) fn snappy_decompress(
+        &mut self,
+        src: &[u8],
+        dest: &mut [u8],
+    ) -> Result<usize, String> {
+        self.snappy_decoder
+            .get_or_insert_with(snap::raw::Decoder::new)
+            .decompress(src, dest)
+            .map_err(|e| format!("Snappy error: {}", e))
+    }
+}
@@ -1,6 +1,19 @@
 use crate::api::{blosc2_cbuffer_sizes, BLOSC2_CPARAMS_DEFAULTS};
 use crate::internal;
 use crate::internal::constants::*;
+use crate::internal::ScratchArena;
+use std::cell::RefCell;
+
+thread_local! {
+    /// The working buffers of the convenience functions on this thread, kept between
+    /// calls as a [`crate::api::Blosc2Context`] keeps its own.
+    static SCRATCH: RefCell<ScratchArena> = RefCell::new(ScratchArena::default());
+}
+
+/// Runs `f` with this thread's [`SCRATCH`].
+fn with_scratch<T>(f: impl FnOnce(&mut ScratchArena) -> T) -> T {
+    SCRATCH.with(|scratch| f(&mut scratch.borrow_mut()))
+}
 
 /// Error returned by the convenience compress/decompress functions.
 #[derive(Debug)]
@@ -22,6 +35,13 @@ impl std::fmt::Display for BloscError {
 
 impl std::error::Error for BloscError {}
 
+/// Size of a `dest` that the compressor never runs out of: C's `nbytes +
+/// BLOSC2_MAX_OVERHEAD`, the most [`blosc2_compress`] (or [`crate::blosc2_compress_ctx`]
+/// without `instr_codec`) writes for `nbytes` of input.
+pub fn compress_bound(nbytes: usize) -> usize {
+    nbytes + BLOSC2_MAX_OVERHEAD
+}
+
 /// Compresses `src` using Blosc1 format with default parameters.
 ///
 /// Uses BloscLZ codec, compression level 5, typesize 8, and byte shuffle.
@@ -29,18 +49,31 @@ impl std::error::Error for BloscError {}
 pub fn blosc1_compress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
     let clevel = BLOSC2_CPARAMS_DEFAULTS.clevel as i32;
     let typesize = BLOSC2_CPARAMS_DEFAULTS.typesize as usize;
-    let doshuffle = BLOSC_SHUFFLE as i32;
     let compressor = BLOSC_BLOSCLZ;
 
-    let max_out = src.len() + BLOSC_MIN_HEADER_LENGTH;
-    let mut dest = vec![0u8; max_out];
+    // As `internal::compress` sets them for `BLOSC_SHUFFLE`
+    let mut filters = [BLOSC_NOFILTER; 6];
+    if typesize > 1 {
+        filters[5] = BLOSC_SHUFFLE;
+    }
 
-    internal::compress(clevel, doshuffle, typesize, src, &mut dest, compressor)
-        .map(|n| {
-            dest.truncate(n);
-            dest
-        })
-        .map_err(|_| BloscError::Failed)
+    let mut dest = Vec::new();
+    with_scratch(|scratch| {
+        internal::compress_append(
+            clevel,
+            typesize,
+            src,
+            src.len() + BLOSC_MIN_HEADER_LENGTH,
+            &mut dest,
+            compressor,
+            false,
+            &filters,
+            &[0; 6],
+            scratch,
+        )
+    })
+    .map(|_| dest)
+    .map_err(|_| BloscError::Failed)
 }
 
 /// Decompresses a Blosc1 compressed buffer.
@@ -48,15 +81,8 @@ pub fn blosc1_compress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
 /// The uncompressed size is read from the header automatically.
 /// Returns the decompressed bytes on success.
 pub fn blosc1_decompress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
-    let (nbytes, _, _) = blosc2_cbuffer_sizes(src);
-    if nbytes == 0 && src.len() < BLOSC_MIN_HEADER_LENGTH {
-        return Err(BloscError::InvalidHeader);
-    }
-
-    let mut dest = vec![0u8; nbytes];
-    internal::decompress(src, &mut dest)
-        .map(|_| dest)
-        .map_err(|_| BloscError::Failed)
+    let mut dest = Vec::new();
+    blosc2_decompress_into(src, &mut dest).map(|_| dest)
 }
 
 /// Compresses `src` using Blosc2 format with default parameters.
@@ -64,9 +90,21 @@ pub fn blosc1_decompress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
 /// Uses BloscLZ codec, compression level 5, typesize 8, and byte shuffle.
 /// Returns the compressed bytes on success.
 pub fn blosc2_compress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
+    let mut dest = Vec::new();
+    blosc2_compress_into(src, &mut dest).map(|_| dest)
+}
+
+/// Like [`blosc2_compress`], but writes the chunk into `dest`, replacing its contents,
+/// and returns its size.
+///
+/// The capacity of `dest` is reused: it grows to [`compress_bound`] if it is smaller,
+/// and none of it is zeroed first. The working buffers are kept per thread, so
+/// compressing many chunks into the same `Vec` on one thread allocates and clears
+/// nothing after the first one. The chunk is the same as
+/// [`blosc2_compress`]'s. On failure `dest` is left empty.
+pub fn blosc2_compress_into(src: &[u8], dest: &mut Vec<u8>) -> Result<usize, BloscError> {
     let clevel = BLOSC2_CPARAMS_DEFAULTS.clevel as i32;
     let typesize = BLOSC2_CPARAMS_DEFAULTS.typesize as usize;
-    let doshuffle = BLOSC_SHUFFLE as i32;
     let compressor = BLOSC_BLOSCLZ;
 
     let filters = BLOSC2_CPARAMS_DEFAULTS.filters;
@@ -77,22 +115,20 @@ pub fn blosc2_compress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
         actual_filters[5] = BLOSC_SHUFFLE;
     }
 
-    let max_out = src.len() + BLOSC2_MAX_OVERHEAD;
-    let mut dest = vec![0u8; max_out];
-
-    internal::compress_extended(
-        clevel,
-        doshuffle,
-        typesize,
-        src,
-        &mut dest,
-        compressor,
-        &actual_filters,
-        &filters_meta,
-    )
-    .map(|n| {
-        dest.truncate(n);
-        dest
+    dest.clear();
+    with_scratch(|scratch| {
+        internal::compress_append(
+            clevel,
+            typesize,
+            src,
+            compress_bound(src.len()),
+            dest,
+            compressor,
+            true,
+            &actual_filters,
+            &filters_meta,
+            scratch,
+        )
     })
     .map_err(|_| BloscError::Failed)
 }
@@ -102,13 +138,55 @@ pub fn blosc2_compress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
 /// The uncompressed size is read from the header automatically.
 /// Returns the decompressed bytes on success.
 pub fn blosc2_decompress(src: &[u8]) -> Result<Vec<u8>, BloscError> {
+    let mut dest = Vec::new();
+    blosc2_decompress_into(src, &mut dest).map(|_| dest)
+}
+
+/// Like [`blosc2_decompress`], but writes the data into `dest`, replacing its contents,
+/// and returns its size. Blosc1 chunks decompress too.
+///
+/// Blocks are decoded one at a time into a block-sized buffer, kept per thread, and
+/// appended to `dest`, whose capacity is reused; none of `dest` is zeroed ahead of the
+/// data. Chunks written
+/// with `instr_codec` hold no data, and fail with [`BloscError::InvalidHeader`]. On
+/// failure `dest` is left empty.
+pub fn blosc2_decompress_into(src: &[u8], dest: &mut Vec<u8>) -> Result<usize, BloscError> {
     let (nbytes, _, _) = blosc2_cbuffer_sizes(src);
+    dest.clear();
     if nbytes == 0 && src.len() < BLOSC_MIN_HEADER_LENGTH {
         return Err(BloscError::InvalidHeader);
     }
 
-    let mut dest = vec![0u8; nbytes];
-    internal::decompress(src, &mut dest)
-        .map(|_| dest)
-        .map_err(|_| BloscError::Failed)
+    with_scratch(|scratch| internal::decompress_append(src, dest, scratch)).map_err(|code| {
+        match code {
+            BLOSC2_ERROR_READ_BUFFER | BLOSC2_ERROR_INVALID_HEADER => BloscError::InvalidHeader,
+            _ => BloscError::Failed,
+        }
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// The calls after the first find the block buffer it grew, and neither move nor grow
+    /// it.
+    #[test]
+    fn scratch_kept_between_calls() {
+        let src: Vec<u8> = (0..500_000u32)
+            .flat_map(|i| (i / 3).to_le_bytes())
+            .collect();
+        let block = || with_scratch(|scratch| (scratch.block.as_ptr(), scratch.block.capacity()));
+        let (mut chunk, mut dest) = (Vec::new(), Vec::new());
+        blosc2_compress_into(&src, &mut chunk).unwrap();
+        blosc2_decompress_into(&chunk, &mut dest).unwrap();
+        let first = block();
+        assert!(first.1 > 0);
+        for _ in 0..3 {
+            blosc2_compress_into(&src, &mut chunk).unwrap();
+            blosc2_decompress_into(&chunk, &mut dest).unwrap();
+            assert_eq!(block(), first);
+        }
+        assert!(dest == src);
+    }
 }
@@ -0,0 +1,266 @@
+//! Vectorized 8x8 bit-matrix transposes for the bitshuffle filter
+//! (bitshuffle's `bitshuffle_core.c` SSE2/AVX2/NEON kernels).
+//!
+//! The scalar `bshuf_trans_bit_byte` transposes the bits of each group of 8 bytes as a
+//! `u64` ([`super::trans_bit_8x8`]) and scatters the 8 result bytes into 8 bit rows.
+//! Here the two halves are done separately. These kernels transpose every 64-bit word of
+//! a buffer in place, 2 (SSE2/NEON/simd128) or 4 (AVX2) words per instruction. The
+//! scatter/gather of bytes into bit rows is a typesize-8 byte (un)shuffle, which the
+//! vector shuffle kernels already handle.
+//!
+//! The transpose is its own inverse, so the same kernels serve bitshuffle and bitunshuffle.
+
+/// Defines `trans_bit_8x8` for the vector primitives in scope: `V`, `LANES`, `load`,
+/// `store` and `transpose`.
+macro_rules! trans_bit_8x8_kernel {
+    ($feature:literal) => {
+        /// Transposes the bits of every 8-byte word in `buf` in place, in groups of `LANES`
+        /// bytes. Returns how many leading bytes were processed.
+        #[target_feature(enable = $feature)]
+        pub unsafe fn trans_bit_8x8(buf: &mut [u8]) -> usize {
+            let len = buf.len() - buf.len() % LANES;
+            let p = buf.as_mut_ptr();
+            let mut i = 0;
+            while i < len {
+                store(p.add(i), transpose(load(p.add(i))));
+                i += LANES;
+            }
+            len
+        }
+    };
+}
+
+#[cfg(target_arch = "x86_64")]
+pub mod sse2 {
+    use std::arch::x86_64::*;
+
+    type V = __m128i;
+    pub const LANES: usize = 16;
+
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn load(p: *const u8) -> V {
+        _mm_loadu_si128(p as *const V)
+    }
+
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn store(p: *mut u8, v: V) {
+        _mm_storeu_si128(p as *mut V, v)
+    }
+
+    /// One delta-swap: exchanges the bits selected by `mask` with those `S` places up.
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn swap<const S: i32>(x: V, mask: i64) -> V {
+        let t = _mm_and_si128(
+            _mm_xor_si128(x, _mm_srli_epi64::<S>(x)),
+            _mm_set1_epi64x(mask),
+        );
+        _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64::<S>(t))
+    }
+
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn transpose(x: V) -> V {
+        let x = swap::<7>(x, 0x00AA00AA00AA00AA);
+        let x = swap::<14>(x, 0x0000CCCC0000CCCC);
+        swap::<28>(x, 0x00000000F0F0F0F0)
+    }
+
+    trans_bit_8x8_kernel!("sse2");
+}
+
+#[cfg(target_arch = "x86_64")]
+pub mod avx2 {
+    use std::arch::x86_64::*;
+
+    type V = __m256i;
+    pub const LANES: usize = 32;
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn load(p: *const u8) -> V {
+        _mm256_loadu_si256(p as *const V)
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn store(p: *mut u8, v: V) {
+        _mm256_storeu_si256(p as *mut V, v)
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn swap<const S: i32>(x: V, mask: i64) -> V {
+        let t = _mm256_and_si256(
+            _mm256_xor_si256(x, _mm256_srli_epi64::<S>(x)),
+            _mm256_set1_epi64x(mask),
+        );
+        _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64::<S>(t))
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn transpose(x: V) -> V {
+        let x = swap::<7>(x, 0x00AA00AA00AA00AA);
+        let x = swap::<14>(x, 0x0000CCCC0000CCCC);
+        swap::<28>(x, 0x00000000F0F0F0F0)
+    }
+
+    trans_bit_8x8_kernel!("avx2");
+}
+
+#[cfg(all(target_arch = "aarch64", target_feature = "neon"))]
+pub mod neon {
+    use std::arch::aarch64::*;
+
+    type V = uint64x2_t;
+    pub const LANES: usize = 16;
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn load(p: *const u8) -> V {
+        vreinterpretq_u64_u8(vld1q_u8(p))
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn store(p: *mut u8, v: V) {
+        vst1q_u8(p, vreinterpretq_u8_u64(v))
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn swap<const S: i32>(x: V, mask: u64) -> V {
+        let t = vandq_u64(veorq_u64(x, vshrq_n_u64::<S>(x)), vdupq_n_u64(mask));
+        veorq_u64(veorq_u64(x, t), vshlq_n_u64::<S>(t))
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn transpose(x: V) -> V {
+        let x = swap::<7>(x, 0x00AA00AA00AA00AA);
+        let x = swap::<14>(x, 0x0000CCCC0000CCCC);
+        swap::<28>(x, 0x00000000F0F0F0F0)
+    }
+
+    trans_bit_8x8_kernel!("neon");
+}
+
+#[cfg(all(target_arch = "wasm32", target_feature = "simd128"))]
+pub mod simd128 {
+    use std::arch::wasm32::*;
+
+    type V = v128;
+    pub const LANES: usize = 16;
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn load(p: *const u8) -> V {
+        v128_load(p as *const V)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn store(p: *mut u8, v: V) {
+        v128_store(p as *mut V, v)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn swap(x: V, s: u32, mask: u64) -> V {
+        let t = v128_and(v128_xor(x, u64x2_shr(x, s)), u64x2_splat(mask));
+        v128_xor(v128_xor(x, t), u64x2_shl(t, s))
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn transpose(x: V) -> V {
+        let x = swap(x, 7, 0x00AA00AA00AA00AA);
+        let x = swap(x, 14, 0x0000CCCC0000CCCC);
+        swap(x, 28, 0x00000000F0F0F0F0)
+    }
+
+    trans_bit_8x8_kernel!("simd128");
+}
+
+/// Transposes the bits of as many leading 8-byte words of `buf` as the best available
+/// kernel can handle, and returns how many bytes it did.
+pub fn trans_bit_8x8(buf: &mut [u8]) -> usize {
+    #[allow(unused_mut)]
+    let mut done = 0;
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        if is_x86_feature_detected!("avx2") {
+            done = avx2::trans_bit_8x8(buf);
+        }
+        done += sse2::trans_bit_8x8(&mut buf[done..]);
+    }
+    #[cfg(all(target_arch = "aarch64", target_feature = "neon"))]
+    unsafe {
+        done = neon::trans_bit_8x8(buf);
+    }
+    #[cfg(all(target_arch = "wasm32", target_feature = "simd128"))]
+    unsafe {
+        done = simd128::trans_bit_8x8(buf);
+    }
+    done
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn scalar(buf: &[u8]) -> Vec<u8> {
+        buf.chunks_exact(8)
+            .flat_map(|w| {
+                super::super::trans_bit_8x8(u64::from_le_bytes(w.try_into().unwrap())).to_le_bytes()
+            })
+            .collect()
+    }
+
+    macro_rules! check_kernel {
+        ($isa:ident) => {
+            for nwords in [0usize, 1, 2, 3, 4, 5, 17] {
+                let src: Vec<u8> = (0..nwords * 8).map(|i| (i * 151 + i / 3) as u8).collect();
+                let mut buf = src.clone();
+                let done = unsafe { $isa::trans_bit_8x8(&mut buf) };
+                assert_eq!(done, src.len() - src.len() % $isa::LANES);
+                assert_eq!(
+                    buf[..done],
+                    scalar(&src)[..done],
+                    "{} nwords={}",
+                    stringify!($isa),
+                    nwords
+                );
+            }
+        };
+    }
+
+    #[cfg(target_arch = "x86_64")]
+    #[test]
+    fn test_sse2_trans_bit_8x8() {
+        check_kernel!(sse2);
+    }
+
+    #[cfg(target_arch = "x86_64")]
+    #[test]
+    fn test_avx2_trans_bit_8x8() {
+        if is_x86_feature_detected!("avx2") {
+            check_kernel!(avx2);
+        }
+    }
+
+    #[cfg(all(target_arch = "aarch64", target_feature = "neon"))]
+    #[test]
+    fn test_neon_trans_bit_8x8() {
+        check_kernel!(neon);
+    }
+
+    #[cfg(all(target_arch = "wasm32", target_feature = "simd128"))]
+    #[test]
+    fn test_simd128_trans_bit_8x8() {
+        check_kernel!(simd128);
+    }
+}
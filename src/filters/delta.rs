@@ -0,0 +1,146 @@
+//! Delta filter (C `delta.c`).
+//!
+//! The first block of a chunk is the reference block: each of its words is XORed with
+//! the word before it, and the first word is kept. Every other block is XORed word by
+//! word with the reference block. C works in words of the typesize for 1, 2, 4 and 8
+//! bytes, in 8-byte words for other multiples of 8 and byte by byte otherwise. Bytes past
+//! the last whole word are left as they are.
+//!
+//! XOR works byte by byte, so a word XOR is the same as a byte XOR at a lag of the word
+//! size. That makes the encoder and the decoder of the non-reference blocks plain
+//! element-wise loops, which the compiler vectorizes. Decoding the reference block is a
+//! prefix scan; [`delta_decoder`] runs it on eight bytes at a time.
+
+/// Word size C codes deltas in for `typesize`.
+fn word_size(typesize: usize) -> usize {
+    match typesize {
+        1 | 2 | 4 | 8 => typesize,
+        t if t % 8 == 0 => 8,
+        _ => 1,
+    }
+}
+
+/// `dest[k] = a[k] ^ b[k]`.
+fn xor_into(dest: &mut [u8], a: &[u8], b: &[u8]) {
+    for ((d, &x), &y) in dest.iter_mut().zip(a).zip(b) {
+        *d = x ^ y;
+    }
+}
+
+/// Delta-codes the `nbytes` bytes of `src`, the block at byte `offset` of its chunk, into
+/// `dest`. `dref` is the reference block: the first block, and so `src` itself when
+/// `offset` is 0. Mirrors C `delta_encoder`.
+pub fn delta_encoder(
+    dref: &[u8],
+    offset: usize,
+    nbytes: usize,
+    typesize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+) {
+    let w = word_size(typesize);
+    let whole = nbytes - nbytes % w;
+    let dest = &mut dest[..nbytes];
+    if offset == 0 {
+        if whole >= w {
+            dest[..w].copy_from_slice(&dref[..w]);
+            xor_into(&mut dest[w..whole], &src[w..whole], &dref[..whole - w]);
+        }
+    } else {
+        xor_into(&mut dest[..whole], &src[..whole], &dref[..whole]);
+    }
+    dest[whole..].copy_from_slice(&src[whole..nbytes]);
+}
+
+/// Undoes [`delta_encoder`] in place on the first `nbytes` bytes of `buf`, the block at
+/// byte `offset` of its chunk. For any block but the first, `dref` is the decoded
+/// reference block; it is not used for the first block. Mirrors C `delta_decoder`.
+pub fn delta_decoder(dref: &[u8], offset: usize, nbytes: usize, typesize: usize, buf: &mut [u8]) {
+    let w = word_size(typesize);
+    let whole = nbytes - nbytes % w;
+    if offset == 0 {
+        prefix_xor(&mut buf[..whole], w);
+    } else {
+        for (x, &r) in buf[..whole].iter_mut().zip(&dref[..whole]) {
+            *x ^= r;
+        }
+    }
+}
+
+/// `buf[k] ^= buf[k - w]` for every `k >= w`, in order, for `w` in 1, 2, 4, 8.
+///
+/// Eight bytes are loaded as a little-endian u64: shifting by multiples of `w` bytes
+/// gives the scan inside the word, and the last `w` bytes of the previous word, repeated
+/// across the word, carry it over.
+fn prefix_xor(buf: &mut [u8], w: usize) {
+    let broadcast = match w {
+        1 => 0x0101_0101_0101_0101u64,
+        2 => 0x0001_0001_0001_0001,
+        4 => 0x0000_0001_0000_0001,
+        _ => 1,
+    };
+    let mut prev = 0u64;
+    let mut words = buf.chunks_exact_mut(8);
+    for word in &mut words {
+        let mut x = u64::from_le_bytes((&*word).try_into().unwrap());
+        let mut shift = 8 * w;
+        while shift < 64 {
+            x ^= x << shift;
+            shift *= 2;
+        }
+        x ^= (prev >> (64 - 8 * w)).wrapping_mul(broadcast);
+        word.copy_from_slice(&x.to_le_bytes());
+        prev = x;
+    }
+    let start = std::cmp::max(buf.len() - buf.len() % 8, w);
+    for k in start..buf.len() {
+        buf[k] ^= buf[k - w];
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// C `delta_encoder` / `delta_decoder`, one word at a time.
+    fn encode_ref(dref: &[u8], offset: usize, typesize: usize, src: &[u8]) -> Vec<u8> {
+        let w = word_size(typesize);
+        let mut dest = src.to_vec();
+        for i in 0..src.len() / w {
+            for k in 0..w {
+                let b = i * w + k;
+                dest[b] = if offset == 0 {
+                    if i == 0 {
+                        dref[b]
+                    } else {
+                        src[b] ^ dref[b - w]
+                    }
+                } else {
+                    src[b] ^ dref[b]
+                };
+            }
+        }
+        dest
+    }
+
+    #[test]
+    fn matches_word_at_a_time_reference() {
+        let block0: Vec<u8> = (0..1003u32).map(|i| (i * 7919 % 251) as u8).collect();
+        let block1: Vec<u8> = (0..1003u32).map(|i| (i * 104_729 % 253) as u8).collect();
+        for typesize in [1, 2, 3, 4, 8, 12, 16, 24] {
+            for len in [0, 1, 7, 8, 9, 64, 1000, 1003] {
+                let mut enc0 = vec![0u8; len];
+                delta_encoder(&block0, 0, len, typesize, &block0[..len], &mut enc0);
+                assert_eq!(enc0, encode_ref(&block0, 0, typesize, &block0[..len]));
+                delta_decoder(&[], 0, len, typesize, &mut enc0);
+                assert_eq!(enc0, &block0[..len], "typesize {typesize} len {len}");
+
+                let mut enc1 = vec![0u8; len];
+                delta_encoder(&block0, len, len, typesize, &block1[..len], &mut enc1);
+                assert_eq!(enc1, encode_ref(&block0, 1, typesize, &block1[..len]));
+                delta_decoder(&block0, len, len, typesize, &mut enc1);
+                assert_eq!(enc1, &block1[..len]);
+            }
+        }
+    }
+}
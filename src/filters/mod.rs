@@ -1,15 +1,70 @@
+mod bitshuffle_simd;
+mod delta;
+mod shuffle_simd;
+mod trunc_prec;
+
+pub use delta::{delta_decoder, delta_encoder};
+pub use trunc_prec::truncate_precision;
+
 /// Byte-wise shuffle: rearranges bytes so that the most-significant bytes of all
 /// elements are grouped together, then the next bytes, and so on.
 ///
 /// This improves compression ratios because bytes at the same significance level
 /// tend to be similar. `bytesoftype` is the element size (e.g. 4 for `f32`).
+///
+/// Typesizes 2, 4, 8 and 16 use SSE2/AVX2 (x86_64, detected at runtime), NEON
+/// (aarch64) or simd128 (wasm32 built with `+simd128`) kernels for the bulk of the
+/// block; the output is identical to [`shuffle_generic`].
 pub fn shuffle(bytesoftype: usize, blocksize: usize, src: &[u8], dest: &mut [u8]) {
+    let neblock_quot = blocksize / bytesoftype;
+    let vectorized = shuffle_simd::shuffle(bytesoftype, neblock_quot, src, dest);
+    shuffle_generic_inline(bytesoftype, vectorized, blocksize, src, dest);
+}
+
+/// Inverse of [`shuffle`]: restores the original element-interleaved byte order
+/// from a significance-grouped layout.
+pub fn unshuffle(bytesoftype: usize, blocksize: usize, src: &[u8], dest: &mut [u8]) {
+    let neblock_quot = blocksize / bytesoftype;
+    let vectorized = shuffle_simd::unshuffle(bytesoftype, neblock_quot, src, dest);
+    unshuffle_generic_inline(bytesoftype, vectorized, blocksize, src, dest);
+}
+
+/// Portable scalar [`shuffle`] (C `shuffle_generic`). Serves as the reference for
+/// the vectorized kernels.
+pub fn shuffle_generic(bytesoftype: usize, blocksize: usize, src: &[u8], dest: &mut [u8]) {
+    shuffle_generic_inline(bytesoftype, 0, blocksize, src, dest);
+}
+
+/// Portable scalar [`unshuffle`] (C `unshuffle_generic`).
+pub fn unshuffle_generic(bytesoftype: usize, blocksize: usize, src: &[u8], dest: &mut [u8]) {
+    unshuffle_generic_inline(bytesoftype, 0, blocksize, src, dest);
+}
+
+/// Shuffles elements `vectorized..` of the block, plus the trailing bytes that do not
+/// form a whole element (C `shuffle_generic_inline`, which takes the already
+/// vectorized part in bytes rather than elements).
+fn shuffle_generic_inline(
+    bytesoftype: usize,
+    vectorized: usize,
+    blocksize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+) {
     let neblock_quot = blocksize / bytesoftype;
     let neblock_rem = blocksize % bytesoftype;
 
-    for j in 0..bytesoftype {
-        for i in 0..neblock_quot {
-            dest[j * neblock_quot + i] = src[i * bytesoftype + j];
+    match bytesoftype {
+        1 => shuffle_n::<1>(vectorized, neblock_quot, src, dest),
+        2 => shuffle_n::<2>(vectorized, neblock_quot, src, dest),
+        4 => shuffle_n::<4>(vectorized, neblock_quot, src, dest),
+        8 => shuffle_n::<8>(vectorized, neblock_quot, src, dest),
+        16 => shuffle_n::<16>(vectorized, neblock_quot, src, dest),
+        _ => {
+            for j in 0..bytesoftype {
+                for i in vectorized..neblock_quot {
+                    dest[j * neblock_quot + i] = src[i * bytesoftype + j];
+                }
+            }
         }
     }
 
@@ -19,15 +74,29 @@ pub fn shuffle(bytesoftype: usize, blocksize: usize, src: &[u8], dest: &mut [u8]
     }
 }
 
-/// Inverse of [`shuffle`]: restores the original element-interleaved byte order
-/// from a significance-grouped layout.
-pub fn unshuffle(bytesoftype: usize, blocksize: usize, src: &[u8], dest: &mut [u8]) {
+/// Unshuffles elements `vectorized..` of the block (C `unshuffle_generic_inline`).
+fn unshuffle_generic_inline(
+    bytesoftype: usize,
+    vectorized: usize,
+    blocksize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+) {
     let neblock_quot = blocksize / bytesoftype;
     let neblock_rem = blocksize % bytesoftype;
 
-    for i in 0..neblock_quot {
-        for j in 0..bytesoftype {
-            dest[i * bytesoftype + j] = src[j * neblock_quot + i];
+    match bytesoftype {
+        1 => unshuffle_n::<1>(vectorized, neblock_quot, src, dest),
+        2 => unshuffle_n::<2>(vectorized, neblock_quot, src, dest),
+        4 => unshuffle_n::<4>(vectorized, neblock_quot, src, dest),
+        8 => unshuffle_n::<8>(vectorized, neblock_quot, src, dest),
+        16 => unshuffle_n::<16>(vectorized, neblock_quot, src, dest),
+        _ => {
+            for i in vectorized..neblock_quot {
+                for j in 0..bytesoftype {
+                    dest[i * bytesoftype + j] = src[j * neblock_quot + i];
+                }
+            }
         }
     }
 
@@ -37,6 +106,34 @@ pub fn unshuffle(bytesoftype: usize, blocksize: usize, src: &[u8], dest: &mut [u
     }
 }
 
+/// Shuffles elements `vectorized..neblock` for a typesize `N` known at compile time.
+///
+/// Iterating over `N`-byte chunks with a constant `N` lets the compiler unroll the
+/// per-byte loop and drop the bounds checks, which the runtime-typesize loop cannot.
+fn shuffle_n<const N: usize>(vectorized: usize, neblock: usize, src: &[u8], dest: &mut [u8]) {
+    let src = &src[vectorized * N..neblock * N];
+    let dest = &mut dest[..neblock * N];
+    for j in 0..N {
+        let row = &mut dest[j * neblock + vectorized..(j + 1) * neblock];
+        for (out, elem) in row.iter_mut().zip(src.chunks_exact(N)) {
+            *out = elem[j];
+        }
+    }
+}
+
+/// Unshuffles elements `vectorized..neblock` for a typesize `N` known at compile time.
+fn unshuffle_n<const N: usize>(vectorized: usize, neblock: usize, src: &[u8], dest: &mut [u8]) {
+    let src = &src[..neblock * N];
+    let dest = &mut dest[vectorized * N..neblock * N];
+    for (i, elem) in dest.chunks_exact_mut(N).enumerate() {
+        let i = vectorized + i;
+        let elem: &mut [u8; N] = elem.try_into().unwrap();
+        for j in 0..N {
+            elem[j] = src[j * neblock + i];
+        }
+    }
+}
+
 fn trans_bit_8x8(mut x: u64) -> u64 {
     let mut t;
     t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AA;
@@ -103,22 +200,98 @@ fn bshuf_trans_bitrow_eight(in_buf: &[u8], out_buf: &mut [u8], size: usize, elem
     }
 }
 
+/// Transposes the bits of every 8-byte word of `buf` in place, reading each word as a
+/// little-endian `u64` like the scalar transposes do.
+fn trans_bit_8x8_words(buf: &mut [u8]) {
+    let done = bitshuffle_simd::trans_bit_8x8(buf);
+    for word in buf[done..].chunks_exact_mut(8) {
+        let x = trans_bit_8x8(u64::from_le_bytes(word.try_into().unwrap()));
+        word.copy_from_slice(&x.to_le_bytes());
+    }
+}
+
+/// Vectorized `bshuf_trans_bit_byte_scal`: transposes the bits of each 8-byte word and
+/// then scatters the words' bytes into 8 bit rows, which is a typesize-8 [`shuffle`].
+/// `in_buf` is used as working space and is left bit-transposed.
+fn bshuf_trans_bit_byte(in_buf: &mut [u8], out_buf: &mut [u8], size: usize, elem_size: usize) {
+    let nbyte = elem_size * size;
+    trans_bit_8x8_words(&mut in_buf[..nbyte]);
+    shuffle(8, nbyte, &in_buf[..nbyte], out_buf);
+}
+
 /// Bit-wise shuffle: transposes individual bits across elements, grouping
 /// corresponding bits of all elements together.
 ///
 /// More aggressive than [`shuffle`] — works at the bit level rather than
 /// byte level, which can yield better compression for data with low bit-entropy.
 /// The element count is rounded down to a multiple of 8; leftover bytes are copied as-is.
+///
+/// The byte and bit transposes run on the vector kernels where available; the output is
+/// identical to [`bitshuffle_generic`].
 pub fn bitshuffle(
     bytesoftype: usize,
     blocksize: usize,
     src: &[u8],
     dest: &mut [u8],
+) -> Result<(), i32> {
+    let mut tmp = Vec::new();
+    bitshuffle_tmp(bytesoftype, blocksize, src, dest, &mut tmp)
+}
+
+/// Like [`bitshuffle`], but uses `tmp` as working space instead of allocating.
+///
+/// `tmp` is grown to `blocksize` bytes if it is shorter, so passing the same
+/// buffer for every block avoids any allocation after the first one
+/// (C `bitshuffle` likewise takes a caller-owned `_tmp` buffer).
+pub fn bitshuffle_tmp(
+    bytesoftype: usize,
+    blocksize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+    tmp: &mut Vec<u8>,
 ) -> Result<(), i32> {
     let size = blocksize / bytesoftype;
     // Round down to multiple of 8 (bitshuffle only supports multiples of 8)
     let aligned_size = size - (size % 8);
 
+    if aligned_size > 0 {
+        let aligned_bytes = aligned_size * bytesoftype;
+        if tmp.len() < aligned_bytes {
+            tmp.resize(aligned_bytes, 0);
+        }
+        let tmp_buf = &mut tmp[..aligned_bytes];
+
+        // `bshuf_trans_byte_elem` is a byte shuffle of the aligned part
+        shuffle(bytesoftype, aligned_bytes, &src[..aligned_bytes], dest);
+        bshuf_trans_bit_byte(
+            &mut dest[..aligned_bytes],
+            tmp_buf,
+            aligned_size,
+            bytesoftype,
+        );
+        bshuf_trans_bitrow_eight(tmp_buf, dest, aligned_size, bytesoftype);
+    }
+
+    // Copy leftover bytes that can't be bitshuffled
+    let offset = aligned_size * bytesoftype;
+    if offset < blocksize {
+        dest[offset..blocksize].copy_from_slice(&src[offset..blocksize]);
+    }
+
+    Ok(())
+}
+
+/// Portable scalar [`bitshuffle`] (C `bshuf_trans_bit_elem_scal`). Serves as the
+/// reference for the vectorized path.
+pub fn bitshuffle_generic(
+    bytesoftype: usize,
+    blocksize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+) -> Result<(), i32> {
+    let size = blocksize / bytesoftype;
+    let aligned_size = size - (size % 8);
+
     if aligned_size > 0 {
         let aligned_bytes = aligned_size * bytesoftype;
         let mut tmp_buf = vec![0u8; aligned_bytes];
@@ -133,7 +306,6 @@ pub fn bitshuffle(
         bshuf_trans_bitrow_eight(&tmp_buf, dest, aligned_size, bytesoftype);
     }
 
-    // Copy leftover bytes that can't be bitshuffled
     let offset = aligned_size * bytesoftype;
     if offset < blocksize {
         dest[offset..blocksize].copy_from_slice(&src[offset..blocksize]);
@@ -163,9 +335,6 @@ fn bshuf_untrans_bit_byte_scal(in_buf: &[u8], out_buf: &mut [u8], size: usize, e
     let nbyte_bitrow = nbyte / 8;
     let bit_row_skip = nbyte_bitrow;
 
-    let out_u64 =
-        unsafe { std::slice::from_raw_parts_mut(out_buf.as_mut_ptr() as *mut u64, nbyte / 8) };
-
     for ii in 0..nbyte_bitrow {
         let mut x: u64 = 0;
         for kk in 0..8 {
@@ -173,10 +342,18 @@ fn bshuf_untrans_bit_byte_scal(in_buf: &[u8], out_buf: &mut [u8], size: usize, e
             x |= (val as u64) << (kk * 8);
         }
         x = trans_bit_8x8(x);
-        out_u64[ii] = x;
+        out_buf[ii * 8..ii * 8 + 8].copy_from_slice(&x.to_le_bytes());
     }
 }
 
+/// Vectorized `bshuf_untrans_bit_byte_scal`: gathers one byte from each of the 8 bit
+/// rows into a word (a typesize-8 [`unshuffle`]) and transposes the bits of each word.
+fn bshuf_untrans_bit_byte(in_buf: &[u8], out_buf: &mut [u8], size: usize, elem_size: usize) {
+    let nbyte = elem_size * size;
+    unshuffle(8, nbyte, &in_buf[..nbyte], out_buf);
+    trans_bit_8x8_words(&mut out_buf[..nbyte]);
+}
+
 /// Inverse of [`bitshuffle`]: restores the original byte layout from a
 /// bit-transposed representation.
 pub fn bitunshuffle(
@@ -184,33 +361,77 @@ pub fn bitunshuffle(
     blocksize: usize,
     src: &[u8],
     dest: &mut [u8],
+) -> Result<(), i32> {
+    let mut tmp = Vec::new();
+    bitunshuffle_tmp(bytesoftype, blocksize, src, dest, &mut tmp)
+}
+
+/// Like [`bitunshuffle`], but uses `tmp` as working space instead of allocating.
+///
+/// `tmp` is grown to `2 * blocksize` bytes if it is shorter.
+pub fn bitunshuffle_tmp(
+    bytesoftype: usize,
+    blocksize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+    tmp: &mut Vec<u8>,
 ) -> Result<(), i32> {
     let size = blocksize / bytesoftype;
     // Round down to multiple of 8 (bitunshuffle only supports multiples of 8)
     let aligned_size = size - (size % 8);
 
+    if aligned_size > 0 {
+        let aligned_bytes = aligned_size * bytesoftype;
+        if tmp.len() < 2 * aligned_bytes {
+            tmp.resize(2 * aligned_bytes, 0);
+        }
+        let (tmp_buf, tmp_buf2) = tmp[..2 * aligned_bytes].split_at_mut(aligned_bytes);
+
+        // 1. Reverse Step 3: Untranspose bitrows
+        bshuf_untrans_bitrow_eight(&src[..aligned_bytes], tmp_buf, aligned_size, bytesoftype);
+
+        // 2. Reverse Step 2: Untranspose bits
+        bshuf_untrans_bit_byte(tmp_buf, tmp_buf2, aligned_size, bytesoftype);
+
+        // 3. Reverse Step 1: Untranspose bytes/elements, a byte unshuffle
+        unshuffle(bytesoftype, aligned_bytes, tmp_buf2, dest);
+    }
+
+    // Copy leftover bytes
+    let offset = aligned_size * bytesoftype;
+    if offset < blocksize {
+        dest[offset..blocksize].copy_from_slice(&src[offset..blocksize]);
+    }
+
+    Ok(())
+}
+
+/// Portable scalar [`bitunshuffle`] (C `bshuf_untrans_bit_elem_scal`).
+pub fn bitunshuffle_generic(
+    bytesoftype: usize,
+    blocksize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+) -> Result<(), i32> {
+    let size = blocksize / bytesoftype;
+    let aligned_size = size - (size % 8);
+
     if aligned_size > 0 {
         let aligned_bytes = aligned_size * bytesoftype;
         let mut tmp_buf = vec![0u8; aligned_bytes];
         let mut tmp_buf2 = vec![0u8; aligned_bytes];
 
-        // 1. Reverse Step 3: Untranspose bitrows
         bshuf_untrans_bitrow_eight(
             &src[..aligned_bytes],
             &mut tmp_buf,
             aligned_size,
             bytesoftype,
         );
-
-        // 2. Reverse Step 2: Untranspose bits
         bshuf_untrans_bit_byte_scal(&tmp_buf, &mut tmp_buf2, aligned_size, bytesoftype);
-
-        // 3. Reverse Step 1: Untranspose bytes/elements
         // Note: we swap size and bytesoftype to reverse the transpose
         bshuf_trans_byte_elem_scal(&tmp_buf2, dest, bytesoftype, aligned_size);
     }
 
-    // Copy leftover bytes
     let offset = aligned_size * bytesoftype;
     if offset < blocksize {
         dest[offset..blocksize].copy_from_slice(&src[offset..blocksize]);
@@ -223,6 +444,117 @@ pub fn bitunshuffle(
 mod tests {
     use super::*;
 
+    fn test_block(blocksize: usize) -> Vec<u8> {
+        (0..blocksize)
+            .map(|i| (i.wrapping_mul(7919) >> 3) as u8)
+            .collect()
+    }
+
+    #[test]
+    fn test_shuffle_matches_generic() {
+        for typesize in 1..=17 {
+            for nelems in [0, 1, 15, 16, 17, 31, 32, 33, 64, 100, 1000] {
+                for extra in [0, typesize / 2] {
+                    let blocksize = nelems * typesize + extra;
+                    let src = test_block(blocksize);
+                    let mut expected = vec![0u8; blocksize];
+                    let mut actual = vec![0u8; blocksize];
+
+                    shuffle_generic(typesize, blocksize, &src, &mut expected);
+                    shuffle(typesize, blocksize, &src, &mut actual);
+                    assert_eq!(
+                        expected, actual,
+                        "shuffle typesize={} blocksize={}",
+                        typesize, blocksize
+                    );
+
+                    let mut recovered = vec![0u8; blocksize];
+                    unshuffle(typesize, blocksize, &actual, &mut recovered);
+                    assert_eq!(
+                        src, recovered,
+                        "unshuffle typesize={} blocksize={}",
+                        typesize, blocksize
+                    );
+                }
+            }
+        }
+    }
+
+    /// The const-generic instantiations against the plain runtime-typesize loops,
+    /// including a vectorized prefix that they must leave untouched.
+    #[test]
+    fn test_shuffle_n_matches_runtime_loop() {
+        for typesize in [1usize, 2, 4, 8, 16] {
+            for neblock in [0usize, 1, 5, 33] {
+                for vectorized in [0, neblock / 2] {
+                    let blocksize = neblock * typesize;
+                    let src = test_block(blocksize);
+
+                    let mut expected = vec![0xAAu8; blocksize];
+                    for j in 0..typesize {
+                        for i in vectorized..neblock {
+                            expected[j * neblock + i] = src[i * typesize + j];
+                        }
+                    }
+                    let mut actual = vec![0xAAu8; blocksize];
+                    shuffle_generic_inline(typesize, vectorized, blocksize, &src, &mut actual);
+                    assert_eq!(
+                        expected, actual,
+                        "shuffle_n typesize={} neblock={}",
+                        typesize, neblock
+                    );
+
+                    let mut expected = vec![0xAAu8; blocksize];
+                    for i in vectorized..neblock {
+                        for j in 0..typesize {
+                            expected[i * typesize + j] = src[j * neblock + i];
+                        }
+                    }
+                    let mut actual = vec![0xAAu8; blocksize];
+                    unshuffle_generic_inline(typesize, vectorized, blocksize, &src, &mut actual);
+                    assert_eq!(
+                        expected, actual,
+                        "unshuffle_n typesize={} neblock={}",
+                        typesize, neblock
+                    );
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_bitshuffle_matches_generic() {
+        for typesize in 1..=17 {
+            for nelems in [0, 7, 8, 9, 64, 128, 131, 1000] {
+                for extra in [0, typesize / 2] {
+                    let blocksize = nelems * typesize + extra;
+                    let src = test_block(blocksize);
+                    let mut expected = vec![0u8; blocksize];
+                    let mut actual = vec![0u8; blocksize];
+
+                    bitshuffle_generic(typesize, blocksize, &src, &mut expected).unwrap();
+                    bitshuffle(typesize, blocksize, &src, &mut actual).unwrap();
+                    assert_eq!(
+                        expected, actual,
+                        "bitshuffle typesize={} blocksize={}",
+                        typesize, blocksize
+                    );
+
+                    let mut expected_back = vec![0u8; blocksize];
+                    let mut actual_back = vec![0u8; blocksize];
+                    bitunshuffle_generic(typesize, blocksize, &actual, &mut expected_back).unwrap();
+                    bitunshuffle(typesize, blocksize, &actual, &mut actual_back).unwrap();
+                    assert_eq!(src, expected_back);
+                    assert_eq!(
+                        src, actual_back,
+                        "bitunshuffle typesize={} blocksize={}",
+                        typesize, blocksize
+                    );
+                }
+            }
+        }
+    }
+
     #[test]
     fn test_bitshuffle_roundtrip() {
         let size = 128;
@@ -0,0 +1,471 @@
+//! Vectorized byte shuffle/unshuffle kernels for typesizes 2, 4, 8 and 16
+//! (C `shuffle-sse2.c`, `shuffle-avx2.c`, `shuffle-neon.c`, `shuffle-altivec.c`).
+//!
+//! All instruction sets share one algorithm. A group of `LANES` elements is loaded into
+//! `N = typesize` vectors and de-interleaved `log2(N)` times: each pass keeps the even
+//! bytes of every pair of vectors in the first half and the odd bytes in the second half.
+//! Afterwards vector `j` holds byte `j` of all `LANES` elements, which is exactly the
+//! shuffled layout. Unshuffle runs the inverse pass (interleave) the same number of times.
+//! Only the load/store and the even/odd/interleave primitives differ per instruction set.
+//!
+//! The kernels only cover whole groups of `LANES` elements; the caller finishes the
+//! remaining elements with the generic code.
+
+/// Defines `shuffle` and `unshuffle` kernels for the vector primitives in scope:
+/// `V`, `LANES`, `zero`, `load`, `store`, `even`, `odd`, `zip_lo` and `zip_hi`.
+macro_rules! shuffle_kernels {
+    ($feature:literal) => {
+        /// Shuffles elements `start..` of `src` in groups of `LANES`, returning the
+        /// index of the first element left for the caller.
+        ///
+        /// `neblock` is the number of elements in the block; `src` and `dest` must hold
+        /// at least `N * neblock` bytes.
+        #[target_feature(enable = $feature)]
+        pub unsafe fn shuffle<const N: usize>(
+            src: &[u8],
+            dest: &mut [u8],
+            neblock: usize,
+            start: usize,
+        ) -> usize {
+            debug_assert!(src.len() >= N * neblock && dest.len() >= N * neblock);
+            let passes = N.trailing_zeros();
+            let src = src.as_ptr();
+            let dest = dest.as_mut_ptr();
+            let mut i = start;
+            while i + LANES <= neblock {
+                let mut v = [zero(); N];
+                for k in 0..N {
+                    v[k] = load(src.add(i * N + k * LANES));
+                }
+                for _ in 0..passes {
+                    let mut t = [zero(); N];
+                    for k in 0..N / 2 {
+                        t[k] = even(v[2 * k], v[2 * k + 1]);
+                        t[N / 2 + k] = odd(v[2 * k], v[2 * k + 1]);
+                    }
+                    v = t;
+                }
+                for j in 0..N {
+                    store(dest.add(j * neblock + i), v[j]);
+                }
+                i += LANES;
+            }
+            i
+        }
+
+        /// Inverse of [`shuffle`], with the same contract.
+        #[target_feature(enable = $feature)]
+        pub unsafe fn unshuffle<const N: usize>(
+            src: &[u8],
+            dest: &mut [u8],
+            neblock: usize,
+            start: usize,
+        ) -> usize {
+            debug_assert!(src.len() >= N * neblock && dest.len() >= N * neblock);
+            let passes = N.trailing_zeros();
+            let src = src.as_ptr();
+            let dest = dest.as_mut_ptr();
+            let mut i = start;
+            while i + LANES <= neblock {
+                let mut v = [zero(); N];
+                for j in 0..N {
+                    v[j] = load(src.add(j * neblock + i));
+                }
+                for _ in 0..passes {
+                    let mut t = [zero(); N];
+                    for k in 0..N / 2 {
+                        t[2 * k] = zip_lo(v[k], v[N / 2 + k]);
+                        t[2 * k + 1] = zip_hi(v[k], v[N / 2 + k]);
+                    }
+                    v = t;
+                }
+                for k in 0..N {
+                    store(dest.add(i * N + k * LANES), v[k]);
+                }
+                i += LANES;
+            }
+            i
+        }
+    };
+}
+
+#[cfg(target_arch = "x86_64")]
+pub mod sse2 {
+    use std::arch::x86_64::*;
+
+    type V = __m128i;
+    pub const LANES: usize = 16;
+
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn zero() -> V {
+        _mm_setzero_si128()
+    }
+
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn load(p: *const u8) -> V {
+        _mm_loadu_si128(p as *const V)
+    }
+
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn store(p: *mut u8, v: V) {
+        _mm_storeu_si128(p as *mut V, v)
+    }
+
+    /// Even bytes of `a` followed by even bytes of `b`.
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn even(a: V, b: V) -> V {
+        let mask = _mm_set1_epi16(0x00FF);
+        _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask))
+    }
+
+    /// Odd bytes of `a` followed by odd bytes of `b`.
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn odd(a: V, b: V) -> V {
+        _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8))
+    }
+
+    /// Interleaves the low halves of `a` and `b`.
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn zip_lo(a: V, b: V) -> V {
+        _mm_unpacklo_epi8(a, b)
+    }
+
+    /// Interleaves the high halves of `a` and `b`.
+    #[inline]
+    #[target_feature(enable = "sse2")]
+    unsafe fn zip_hi(a: V, b: V) -> V {
+        _mm_unpackhi_epi8(a, b)
+    }
+
+    shuffle_kernels!("sse2");
+}
+
+#[cfg(target_arch = "x86_64")]
+pub mod avx2 {
+    use std::arch::x86_64::*;
+
+    type V = __m256i;
+    pub const LANES: usize = 32;
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn zero() -> V {
+        _mm256_setzero_si256()
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn load(p: *const u8) -> V {
+        _mm256_loadu_si256(p as *const V)
+    }
+
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn store(p: *mut u8, v: V) {
+        _mm256_storeu_si256(p as *mut V, v)
+    }
+
+    /// Even bytes of `a` followed by even bytes of `b`. `packus` works per 128-bit
+    /// lane, so the 64-bit quarters are put back in order afterwards.
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn even(a: V, b: V) -> V {
+        let mask = _mm256_set1_epi16(0x00FF);
+        let packed = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        _mm256_permute4x64_epi64(packed, 0xD8)
+    }
+
+    /// Odd bytes of `a` followed by odd bytes of `b`.
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn odd(a: V, b: V) -> V {
+        let packed = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+        _mm256_permute4x64_epi64(packed, 0xD8)
+    }
+
+    /// Interleaves the low halves of `a` and `b`. `unpack` works per 128-bit lane, so
+    /// the quarters are first arranged so that each lane sees the right inputs.
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn zip_lo(a: V, b: V) -> V {
+        _mm256_unpacklo_epi8(
+            _mm256_permute4x64_epi64(a, 0xD8),
+            _mm256_permute4x64_epi64(b, 0xD8),
+        )
+    }
+
+    /// Interleaves the high halves of `a` and `b`.
+    #[inline]
+    #[target_feature(enable = "avx2")]
+    unsafe fn zip_hi(a: V, b: V) -> V {
+        _mm256_unpackhi_epi8(
+            _mm256_permute4x64_epi64(a, 0xD8),
+            _mm256_permute4x64_epi64(b, 0xD8),
+        )
+    }
+
+    shuffle_kernels!("avx2");
+}
+
+#[cfg(all(target_arch = "aarch64", target_feature = "neon"))]
+pub mod neon {
+    use std::arch::aarch64::*;
+
+    type V = uint8x16_t;
+    pub const LANES: usize = 16;
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn zero() -> V {
+        vdupq_n_u8(0)
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn load(p: *const u8) -> V {
+        vld1q_u8(p)
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn store(p: *mut u8, v: V) {
+        vst1q_u8(p, v)
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn even(a: V, b: V) -> V {
+        vuzp1q_u8(a, b)
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn odd(a: V, b: V) -> V {
+        vuzp2q_u8(a, b)
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn zip_lo(a: V, b: V) -> V {
+        vzip1q_u8(a, b)
+    }
+
+    #[inline]
+    #[target_feature(enable = "neon")]
+    unsafe fn zip_hi(a: V, b: V) -> V {
+        vzip2q_u8(a, b)
+    }
+
+    shuffle_kernels!("neon");
+}
+
+#[cfg(all(target_arch = "wasm32", target_feature = "simd128"))]
+pub mod simd128 {
+    use std::arch::wasm32::*;
+
+    type V = v128;
+    pub const LANES: usize = 16;
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn zero() -> V {
+        u8x16_splat(0)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn load(p: *const u8) -> V {
+        v128_load(p as *const V)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn store(p: *mut u8, v: V) {
+        v128_store(p as *mut V, v)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn even(a: V, b: V) -> V {
+        u8x16_shuffle::<0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30>(a, b)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn odd(a: V, b: V) -> V {
+        u8x16_shuffle::<1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31>(a, b)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn zip_lo(a: V, b: V) -> V {
+        u8x16_shuffle::<0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23>(a, b)
+    }
+
+    #[inline]
+    #[target_feature(enable = "simd128")]
+    unsafe fn zip_hi(a: V, b: V) -> V {
+        u8x16_shuffle::<8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31>(a, b)
+    }
+
+    shuffle_kernels!("simd128");
+}
+
+/// Calls `$isa::$kernel::<N>` for the runtime `bytesoftype`, or returns `$start` unchanged
+/// for typesizes without a vector kernel.
+macro_rules! dispatch_typesize {
+    ($isa:ident::$kernel:ident, $bytesoftype:expr, $src:expr, $dest:expr, $neblock:expr, $start:expr) => {
+        match $bytesoftype {
+            2 => $isa::$kernel::<2>($src, $dest, $neblock, $start),
+            4 => $isa::$kernel::<4>($src, $dest, $neblock, $start),
+            8 => $isa::$kernel::<8>($src, $dest, $neblock, $start),
+            16 => $isa::$kernel::<16>($src, $dest, $neblock, $start),
+            _ => $start,
+        }
+    };
+}
+
+/// Shuffles as many leading elements as the best available kernel can handle and
+/// returns how many it did (C `shuffle` host-implementation dispatch).
+///
+/// `src` and `dest` must hold at least `bytesoftype * neblock` bytes.
+pub fn shuffle(bytesoftype: usize, neblock: usize, src: &[u8], dest: &mut [u8]) -> usize {
+    assert!(src.len() >= bytesoftype * neblock && dest.len() >= bytesoftype * neblock);
+    #[allow(unused_mut)]
+    let mut done = 0;
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        if is_x86_feature_detected!("avx2") {
+            done = dispatch_typesize!(avx2::shuffle, bytesoftype, src, dest, neblock, done);
+        }
+        // SSE2 is part of the x86_64 baseline.
+        done = dispatch_typesize!(sse2::shuffle, bytesoftype, src, dest, neblock, done);
+    }
+    #[cfg(all(target_arch = "aarch64", target_feature = "neon"))]
+    unsafe {
+        done = dispatch_typesize!(neon::shuffle, bytesoftype, src, dest, neblock, done);
+    }
+    #[cfg(all(target_arch = "wasm32", target_feature = "simd128"))]
+    unsafe {
+        done = dispatch_typesize!(simd128::shuffle, bytesoftype, src, dest, neblock, done);
+    }
+    done
+}
+
+/// Inverse of [`shuffle`], with the same contract.
+pub fn unshuffle(bytesoftype: usize, neblock: usize, src: &[u8], dest: &mut [u8]) -> usize {
+    assert!(src.len() >= bytesoftype * neblock && dest.len() >= bytesoftype * neblock);
+    #[allow(unused_mut)]
+    let mut done = 0;
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        if is_x86_feature_detected!("avx2") {
+            done = dispatch_typesize!(avx2::unshuffle, bytesoftype, src, dest, neblock, done);
+        }
+        done = dispatch_typesize!(sse2::unshuffle, bytesoftype, src, dest, neblock, done);
+    }
+    #[cfg(all(target_arch = "aarch64", target_feature = "neon"))]
+    unsafe {
+        done = dispatch_typesize!(neon::unshuffle, bytesoftype, src, dest, neblock, done);
+    }
+    #[cfg(all(target_arch = "wasm32", target_feature = "simd128"))]
+    unsafe {
+        done = dispatch_typesize!(simd128::unshuffle, bytesoftype, src, dest, neblock, done);
+    }
+    done
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Checks one vector kernel pair against the generic code for every typesize it supports.
+    macro_rules! check_kernels {
+        ($isa:ident) => {
+            for bytesoftype in [2usize, 4, 8, 16] {
+                for neblock in [0, $isa::LANES - 1, $isa::LANES, 3 * $isa::LANES + 5] {
+                    let blocksize = bytesoftype * neblock;
+                    let src: Vec<u8> = (0..blocksize).map(|i| (i * 131 + i / 7) as u8).collect();
+                    let mut expected = vec![0u8; blocksize];
+                    crate::filters::shuffle_generic(bytesoftype, blocksize, &src, &mut expected);
+
+                    let mut shuffled = vec![0u8; blocksize];
+                    let done = unsafe {
+                        dispatch_typesize!(
+                            $isa::shuffle,
+                            bytesoftype,
+                            &src,
+                            &mut shuffled,
+                            neblock,
+                            0
+                        )
+                    };
+                    assert_eq!(done, neblock - neblock % $isa::LANES);
+                    for j in 0..bytesoftype {
+                        let row = j * neblock;
+                        assert_eq!(
+                            shuffled[row..row + done],
+                            expected[row..row + done],
+                            "{} shuffle bytesoftype={} neblock={}",
+                            stringify!($isa),
+                            bytesoftype,
+                            neblock
+                        );
+                    }
+
+                    let mut unshuffled = vec![0u8; blocksize];
+                    let done = unsafe {
+                        dispatch_typesize!(
+                            $isa::unshuffle,
+                            bytesoftype,
+                            &expected,
+                            &mut unshuffled,
+                            neblock,
+                            0
+                        )
+                    };
+                    assert_eq!(
+                        unshuffled[..done * bytesoftype],
+                        src[..done * bytesoftype],
+                        "{} unshuffle bytesoftype={} neblock={}",
+                        stringify!($isa),
+                        bytesoftype,
+                        neblock
+                    );
+                }
+            }
+        };
+    }
+
+    #[cfg(target_arch = "x86_64")]
+    #[test]
+    fn test_sse2_kernels() {
+        check_kernels!(sse2);
+    }
+
+    #[cfg(target_arch = "x86_64")]
+    #[test]
+    fn test_avx2_kernels() {
+        if is_x86_feature_detected!("avx2") {
+            check_kernels!(avx2);
+        }
+    }
+
+    #[cfg(all(target_arch = "aarch64", target_feature = "neon"))]
+    #[test]
+    fn test_neon_kernels() {
+        check_kernels!(neon);
+    }
+
+    #[cfg(all(target_arch = "wasm32", target_feature = "simd128"))]
+    #[test]
+    fn test_simd128_kernels() {
+        check_kernels!(simd128);
+    }
+}
@@ -0,0 +1,105 @@
+//! Precision truncation filter (C `trunc-prec.c`): zeroes the low mantissa bits of
+//! float32 and float64 items so that the codec finds longer matches. It is lossy, so
+//! there is nothing to undo when decompressing.
+
+use crate::internal::constants::BLOSC2_ERROR_INVALID_PARAM;
+
+const BITS_MANTISSA_FLOAT: i32 = 23;
+const BITS_MANTISSA_DOUBLE: i32 = 52;
+
+/// Number of low mantissa bits to zero for `prec_bits`: a positive value keeps that many
+/// bits, a negative one zeroes that many. C refuses anything that would zero the whole
+/// mantissa, which would turn NaNs into infinities.
+fn zeroed_bits(prec_bits: i8, mantissa_bits: i32) -> Result<u32, i32> {
+    let prec_bits = prec_bits as i32;
+    if prec_bits.abs() > mantissa_bits {
+        return Err(BLOSC2_ERROR_INVALID_PARAM);
+    }
+    let zeroed = if prec_bits >= 0 {
+        mantissa_bits - prec_bits
+    } else {
+        -prec_bits
+    };
+    if zeroed >= mantissa_bits {
+        return Err(BLOSC2_ERROR_INVALID_PARAM);
+    }
+    Ok(zeroed as u32)
+}
+
+/// Copies the `nbytes` bytes of `src` to `dest` with the mantissa of every item cut to
+/// `prec_bits` bits (C `truncate_precision`). Only typesizes 4 and 8 are handled; bytes
+/// past the last whole item are copied as they are.
+pub fn truncate_precision(
+    prec_bits: i8,
+    typesize: usize,
+    nbytes: usize,
+    src: &[u8],
+    dest: &mut [u8],
+) -> Result<(), i32> {
+    let items = nbytes - nbytes % typesize.max(1);
+    match typesize {
+        4 => {
+            let mask = !((1u32 << zeroed_bits(prec_bits, BITS_MANTISSA_FLOAT)?) - 1);
+            for (d, s) in dest[..items]
+                .chunks_exact_mut(4)
+                .zip(src[..items].chunks_exact(4))
+            {
+                let x = u32::from_le_bytes(s.try_into().unwrap()) & mask;
+                d.copy_from_slice(&x.to_le_bytes());
+            }
+        }
+        8 => {
+            let mask = !((1u64 << zeroed_bits(prec_bits, BITS_MANTISSA_DOUBLE)?) - 1);
+            for (d, s) in dest[..items]
+                .chunks_exact_mut(8)
+                .zip(src[..items].chunks_exact(8))
+            {
+                let x = u64::from_le_bytes(s.try_into().unwrap()) & mask;
+                d.copy_from_slice(&x.to_le_bytes());
+            }
+        }
+        _ => return Err(BLOSC2_ERROR_INVALID_PARAM),
+    }
+    dest[items..nbytes].copy_from_slice(&src[items..nbytes]);
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn keeps_the_requested_bits() {
+        let values = [1.0f32 / 3.0, -123.456, f32::NAN, f32::INFINITY, 0.0];
+        let src: Vec<u8> = values.iter().flat_map(|v| v.to_le_bytes()).collect();
+        let mut dest = vec![0u8; src.len()];
+        truncate_precision(10, 4, src.len(), &src, &mut dest).unwrap();
+        for (v, d) in values.iter().zip(dest.chunks_exact(4)) {
+            let t = u32::from_le_bytes(d.try_into().unwrap());
+            assert_eq!(t, v.to_bits() & !((1 << 13) - 1));
+        }
+        assert!(f32::from_le_bytes(dest[8..12].try_into().unwrap()).is_nan());
+
+        // Zeroing 10 bits is keeping 42 of a double's 52
+        let src: Vec<u8> = (0..100)
+            .flat_map(|i| (i as f64 * 0.1).to_le_bytes())
+            .collect();
+        let (mut a, mut b) = (vec![0u8; src.len()], vec![0u8; src.len()]);
+        truncate_precision(-10, 8, src.len(), &src, &mut a).unwrap();
+        truncate_precision(42, 8, src.len(), &src, &mut b).unwrap();
+        assert_eq!(a, b);
+    }
+
+    #[test]
+    fn rejects_what_c_rejects() {
+        let src = [0u8; 16];
+        let mut dest = [0u8; 16];
+        for (prec, typesize) in [(0, 4), (24, 4), (-23, 4), (53, 8), (10, 2), (10, 16)] {
+            assert_eq!(
+                truncate_precision(prec, typesize, 16, &src, &mut dest),
+                Err(BLOSC2_ERROR_INVALID_PARAM)
+            );
+        }
+        assert!(truncate_precision(23, 4, 16, &src, &mut dest).is_ok());
+    }
+}
@@ -0,0 +1,384 @@
+//! Reading contiguous frames (`.b2frame`): a serialized super-chunk in one buffer.
+//!
+//! A frame (C `frame.c`, `README_CFRAME_FORMAT.rst`) is a msgpack header with the fixed
+//! fields of the super-chunk, the chunks back to back, then the chunk offsets index and a
+//! trailer. The index is itself a blosc chunk of little-endian `i64` offsets, counted from
+//! the end of the header, and it starts right after the chunks, `header_len + cbytes`
+//! into the frame.
+//!
+//! [`Frame::open`](crate::frame::Frame::open) reads only the header. The index is
+//! decoded the first time a chunk is asked for. Chunks are handed out as slices of the
+//! storage, where there is nothing to copy. The storage can be anything that can be
+//! viewed as bytes, such as a `Vec<u8>` or a memory map of the file (`memmap2::Mmap`
+//! implements `AsRef<[u8]>`). It can also be a [`RangeFetch`](crate::frame::RangeFetch)
+//! callback for targets without one, such as WASM reading over HTTP.
+//!
+//! The trailer holds the variable-length metalayers only; chunk access does not need it
+//! and it is not parsed.
+
+use crate::api::{
+    blosc2_create_dctx, Blosc2Context, BLOSC2_CPARAMS_DEFAULTS, BLOSC2_DPARAMS_DEFAULTS,
+};
+use crate::internal::constants::*;
+use crate::internal::{self, ChunkInfo};
+use std::borrow::Cow;
+use std::cell::OnceCell;
+
+/// Offsets of the fixed header fields (C `frame.h`). Each value follows its msgpack
+/// marker byte and is big-endian.
+const FRAME_HEADER_MAGIC: usize = 2;
+const FRAME_HEADER_LEN: usize = FRAME_HEADER_MAGIC + 8 + 1;
+const FRAME_LEN: usize = FRAME_HEADER_LEN + 4 + 1;
+const FRAME_FLAGS: usize = FRAME_LEN + 8 + 1;
+const FRAME_TYPE: usize = FRAME_FLAGS + 1;
+const FRAME_CODECS: usize = FRAME_FLAGS + 2;
+const FRAME_NBYTES: usize = FRAME_FLAGS + 4 + 1;
+const FRAME_CBYTES: usize = FRAME_NBYTES + 8 + 1;
+const FRAME_TYPESIZE: usize = FRAME_CBYTES + 8 + 1;
+const FRAME_BLOCKSIZE: usize = FRAME_TYPESIZE + 4 + 1;
+const FRAME_CHUNKSIZE: usize = FRAME_BLOCKSIZE + 4 + 1;
+const FRAME_FILTER_PIPELINE: usize = 70;
+/// Filter slots in the header; C only fills the first `BLOSC2_MAX_FILTERS`.
+const FRAME_FILTER_PIPELINE_MAX: usize = 8;
+const FRAME_HEADER_MINLEN: usize = FRAME_FILTER_PIPELINE + 1 + 16;
+
+const FRAME_MAGIC: &[u8; 8] = b"b2frame\0";
+/// `FRAME_TYPE` of a frame whose chunks live in separate files (C `sframe`).
+const FRAME_DIRECTORY_TYPE: u8 = 1;
+
+/// Where the bytes of a frame come from.
+pub trait FrameStorage {
+    /// Total number of bytes available.
+    fn size(&self) -> u64;
+
+    /// Bytes `offset..offset + len`, borrowed from the storage when it is in memory.
+    /// Returns `BLOSC2_ERROR_READ_BUFFER` if they are not all there.
+    fn read_at(&self, offset: u64, len: usize) -> Result<Cow<'_, [u8]>, i32>;
+}
+
+impl<T: AsRef<[u8]> + ?Sized> FrameStorage for T {
+    fn size(&self) -> u64 {
+        self.as_ref().len() as u64
+    }
+
+    fn read_at(&self, offset: u64, len: usize) -> Result<Cow<'_, [u8]>, i32> {
+        let bytes = self.as_ref();
+        usize::try_from(offset)
+            .ok()
+            .and_then(|start| bytes.get(start..start.checked_add(len)?))
+            .map(Cow::Borrowed)
+            .ok_or(BLOSC2_ERROR_READ_BUFFER)
+    }
+}
+
+/// Frame storage served by a callback that fills a buffer with the bytes at an offset,
+/// e.g. an HTTP range request. Every read is one call, into a fresh buffer.
+pub struct RangeFetch<F> {
+    len: u64,
+    fetch: F,
+}
+
+impl<F: Fn(u64, &mut [u8]) -> Result<(), i32>> RangeFetch<F> {
+    /// Storage of `len` bytes, read with `fetch(offset, buf)`, which fills all of `buf`
+    /// with the bytes starting at `offset` or returns a negative `BLOSC2_ERROR_*` code.
+    pub fn new(len: u64, fetch: F) -> Self {
+        RangeFetch { len, fetch }
+    }
+}
+
+impl<F: Fn(u64, &mut [u8]) -> Result<(), i32>> FrameStorage for RangeFetch<F> {
+    fn size(&self) -> u64 {
+        self.len
+    }
+
+    fn read_at(&self, offset: u64, len: usize) -> Result<Cow<'_, [u8]>, i32> {
+        if offset
+            .checked_add(len as u64)
+            .map_or(true, |end| end > self.len)
+        {
+            return Err(BLOSC2_ERROR_READ_BUFFER);
+        }
+        let mut buf = vec![0u8; len];
+        (self.fetch)(offset, &mut buf)?;
+        Ok(Cow::Owned(buf))
+    }
+}
+
+/// A contiguous frame opened for reading (C `blosc2_schunk_open` / `frame_from_cframe`).
+///
+/// ```rust
+/// use blusc::frame::Frame;
+///
+/// fn first_chunk(path: &str) -> Result<Vec<u8>, i32> {
+///     let bytes = std::fs::read(path).map_err(|_| blusc::BLOSC2_ERROR_FILE_READ)?;
+///     let frame = Frame::open(bytes)?;
+///     let mut dest = vec![0u8; frame.chunksize()];
+///     let n = frame.decompress_chunk(0, &mut dest)?;
+///     dest.truncate(n);
+///     Ok(dest)
+/// }
+/// ```
+pub struct Frame<S: FrameStorage> {
+    storage: S,
+    header_len: u64,
+    nbytes: u64,
+    cbytes: u64,
+    typesize: usize,
+    blocksize: usize,
+    chunksize: usize,
+    compcode: u8,
+    clevel: u8,
+    filters: [u8; BLOSC2_MAX_FILTERS as usize],
+    filters_meta: [u8; BLOSC2_MAX_FILTERS as usize],
+    /// The decoded offsets index, once a chunk has been asked for.
+    offsets: OnceCell<Result<Vec<i64>, i32>>,
+    dctx: Blosc2Context,
+}
+
+fn be_u32(bytes: &[u8], at: usize) -> u32 {
+    u32::from_be_bytes(bytes[at..at + 4].try_into().unwrap())
+}
+
+fn be_u64(bytes: &[u8], at: usize) -> u64 {
+    u64::from_be_bytes(bytes[at..at + 8].try_into().unwrap())
+}
+
+impl<S: FrameStorage> Frame<S> {
+    /// Parses the fixed part of the frame header (C `get_header_info`), the only read
+    /// until a chunk is asked for.
+    ///
+    /// Returns `BLOSC2_ERROR_FRAME_TYPE` for anything that is not a contiguous frame and
+    /// `BLOSC2_ERROR_INVALID_HEADER` for inconsistent sizes.
+    pub fn open(storage: S) -> Result<Self, i32> {
+        let header = storage.read_at(0, FRAME_HEADER_MINLEN)?;
+        if &header[FRAME_HEADER_MAGIC..FRAME_HEADER_MAGIC + 8] != FRAME_MAGIC
+            || header[FRAME_TYPE] == FRAME_DIRECTORY_TYPE
+        {
+            return Err(BLOSC2_ERROR_FRAME_TYPE);
+        }
+
+        let header_len = be_u32(&header, FRAME_HEADER_LEN) as u64;
+        let frame_len = be_u64(&header, FRAME_LEN);
+        let nbytes = be_u64(&header, FRAME_NBYTES);
+        let cbytes = be_u64(&header, FRAME_CBYTES);
+        let typesize = be_u32(&header, FRAME_TYPESIZE) as i32;
+        let blocksize = be_u32(&header, FRAME_BLOCKSIZE) as i32;
+        let chunksize = be_u32(&header, FRAME_CHUNKSIZE) as i32;
+        if header_len < FRAME_HEADER_MINLEN as u64
+            || frame_len > storage.size()
+            || header_len
+                .checked_add(cbytes)
+                .map_or(true, |end| end > frame_len)
+            || nbytes > i64::MAX as u64
+            || typesize <= 0
+            || typesize > u8::MAX as i32
+            || blocksize < 0
+            || chunksize < 0
+        {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
+        }
+
+        let codecs = header[FRAME_CODECS];
+        let nfilters = std::cmp::min(
+            header[FRAME_FILTER_PIPELINE] as usize,
+            BLOSC2_MAX_FILTERS as usize,
+        );
+        let mut filters = [BLOSC_NOFILTER; BLOSC2_MAX_FILTERS as usize];
+        let mut filters_meta = [0; BLOSC2_MAX_FILTERS as usize];
+        let pipeline = FRAME_FILTER_PIPELINE + 1;
+        filters[..nfilters].copy_from_slice(&header[pipeline..pipeline + nfilters]);
+        let meta = pipeline + FRAME_FILTER_PIPELINE_MAX;
+        filters_meta[..nfilters].copy_from_slice(&header[meta..meta + nfilters]);
+
+        drop(header);
+        Ok(Frame {
+            storage,
+            header_len,
+            nbytes,
+            cbytes,
+            typesize: typesize as usize,
+            blocksize: blocksize as usize,
+            chunksize: chunksize as usize,
+            compcode: codecs & 0x0f,
+            clevel: codecs >> 4,
+            filters,
+            filters_meta,
+            offsets: OnceCell::new(),
+            dctx: blosc2_create_dctx(BLOSC2_DPARAMS_DEFAULTS),
+        })
+    }
+
+    /// Uncompressed size of all chunks together.
+    pub fn nbytes(&self) -> u64 {
+        self.nbytes
+    }
+
+    /// Compressed size of all chunks together, without the header, index and trailer.
+    pub fn cbytes(&self) -> u64 {
+        self.cbytes
+    }
+
+    /// Size of one item.
+    pub fn typesize(&self) -> usize {
+        self.typesize
+    }
+
+    /// Block size the super-chunk was created with (0 for automatic).
+    pub fn blocksize(&self) -> usize {
+        self.blocksize
+    }
+
+    /// Uncompressed size of every chunk but the last.
+    pub fn chunksize(&self) -> usize {
+        self.chunksize
+    }
+
+    /// Codec the super-chunk compresses new chunks with.
+    pub fn compcode(&self) -> u8 {
+        self.compcode
+    }
+
+    /// Compression level the super-chunk compresses new chunks with.
+    pub fn clevel(&self) -> u8 {
+        self.clevel
+    }
+
+    /// Filter pipeline of the super-chunk.
+    pub fn filters(&self) -> &[u8; BLOSC2_MAX_FILTERS as usize] {
+        &self.filters
+    }
+
+    /// Filter metadata of the super-chunk.
+    pub fn filters_meta(&self) -> &[u8; BLOSC2_MAX_FILTERS as usize] {
+        &self.filters_meta
+    }
+
+    /// Number of chunks (C `get_header_info` derives it from `nbytes` and `chunksize`).
+    pub fn nchunks(&self) -> usize {
+        if self.nbytes == 0 {
+            0
+        } else if self.chunksize == 0 {
+            // Variable-length chunks: only the index knows
+            self.offsets().map_or(0, |offsets| offsets.len())
+        } else {
+            self.nbytes.div_ceil(self.chunksize as u64) as usize
+        }
+    }
+
+    /// The offsets index, decoded on first use (C `get_coffsets`).
+    fn offsets(&self) -> Result<&[i64], i32> {
+        let offsets = self.offsets.get_or_init(|| {
+            if self.nbytes == 0 {
+                return Ok(Vec::new());
+            }
+            let index = self.read_chunk(self.header_len + self.cbytes)?;
+            let info = ChunkInfo::parse(&index)?;
+            if info.nbytes % 8 != 0 {
+                return Err(BLOSC2_ERROR_INVALID_HEADER);
+            }
+            let mut raw = vec![0u8; info.nbytes];
+            internal::decompress_ctx(&self.dctx, &index, &mut raw)
+                .map_err(|_| BLOSC2_ERROR_DATA)?;
+            Ok(raw
+                .chunks_exact(8)
+                .map(|offset| i64::from_le_bytes(offset.try_into().unwrap()))
+                .collect())
+        });
+        offsets.as_deref().map_err(|&code| code)
+    }
+
+    /// The blosc chunk starting at frame offset `start`: its header gives its length.
+    fn read_chunk(&self, start: u64) -> Result<Cow<'_, [u8]>, i32> {
+        let header = self.storage.read_at(start, BLOSC_MIN_HEADER_LENGTH)?;
+        let (_, cbytes, _) = crate::api::blosc2_cbuffer_sizes(&header);
+        if cbytes < BLOSC_MIN_HEADER_LENGTH {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
+        }
+        drop(header);
+        self.storage.read_at(start, cbytes)
+    }
+
+    /// Uncompressed size of chunk `nchunk`, from the frame header alone.
+    fn chunk_nbytes(&self, nchunk: usize) -> usize {
+        let start = nchunk as u64 * self.chunksize as u64;
+        std::cmp::min(self.chunksize as u64, self.nbytes - start) as usize
+    }
+
+    /// The compressed bytes of chunk `nchunk` (C `frame_get_lazychunk`): a slice of the
+    /// storage when it is in memory. Special chunks, which the index marks with a
+    /// negative offset instead of storing them, come back as a freshly made header.
+    pub fn get_chunk(&self, nchunk: usize) -> Result<Cow<'_, [u8]>, i32> {
+        // The index of a malformed frame can have more entries than `nbytes` has chunks
+        if nchunk >= self.nchunks() {
+            return Err(BLOSC2_ERROR_INVALID_INDEX);
+        }
+        let offsets = self.offsets()?;
+        let &offset = offsets.get(nchunk).ok_or(BLOSC2_ERROR_INVALID_INDEX)?;
+        if offset < 0 {
+            return self.special_chunk(offset, nchunk).map(Cow::Owned);
+        }
+        let offset = offset as u64;
+        if offset >= self.cbytes {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
+        }
+        let chunk = self.read_chunk(self.header_len + offset)?;
+        if offset + chunk.len() as u64 > self.cbytes {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
+        }
+        Ok(chunk)
+    }
+
+    /// The chunk an index entry with the special bits set stands for (C
+    /// `frame_special_chunk`, which tests each kind's bit in the top byte).
+    fn special_chunk(&self, offset: i64, nchunk: usize) -> Result<Vec<u8>, i32> {
+        let top = (offset as u64 >> 56) as u8;
+        let special = if top & BLOSC2_SPECIAL_ZERO != 0 {
+            BLOSC2_SPECIAL_ZERO
+        } else if top & BLOSC2_SPECIAL_NAN != 0 {
+            BLOSC2_SPECIAL_NAN
+        } else if top & BLOSC2_SPECIAL_UNINIT != 0 {
+            BLOSC2_SPECIAL_UNINIT
+        } else {
+            return Err(BLOSC2_ERROR_DATA);
+        };
+        if self.chunksize == 0 {
+            // Its size would have to come from somewhere else
+            return Err(BLOSC2_ERROR_FRAME_SPECIAL);
+        }
+        let mut cparams = BLOSC2_CPARAMS_DEFAULTS;
+        cparams.typesize = self.typesize as i32;
+        let mut chunk = vec![0u8; BLOSC_EXTENDED_HEADER_LENGTH];
+        internal::chunk_special(
+            &cparams,
+            special,
+            self.chunk_nbytes(nchunk),
+            &[],
+            &mut chunk,
+        )?;
+        Ok(chunk)
+    }
+
+    /// Decompresses chunk `nchunk` into `dest` and returns its uncompressed size (C
+    /// `frame_decompress_chunk`).
+    pub fn decompress_chunk(&self, nchunk: usize, dest: &mut [u8]) -> Result<usize, i32> {
+        let chunk = self.get_chunk(nchunk)?;
+        let (nbytes, _, _) = crate::api::blosc2_cbuffer_sizes(&chunk);
+        if dest.len() < nbytes {
+            return Err(BLOSC2_ERROR_WRITE_BUFFER);
+        }
+        internal::decompress_ctx(&self.dctx, &chunk, dest).map_err(|_| BLOSC2_ERROR_DATA)
+    }
+
+    /// Copies `nitems` items starting at item `start` of chunk `nchunk` into `dest`,
+    /// decoding only the blocks they are in, and returns the number of bytes written.
+    pub fn getitem(
+        &self,
+        nchunk: usize,
+        start: usize,
+        nitems: usize,
+        dest: &mut [u8],
+    ) -> Result<usize, i32> {
+        let chunk = self.get_chunk(nchunk)?;
+        internal::getitem_ctx(&self.dctx, &chunk, start, nitems, dest)
+    }
+}
@@ -0,0 +1,195 @@
+//! Where compression time goes: per-stage counters of a context, and the instrumented
+//! chunks of C blosc2's `instr_codec`.
+//!
+//! With the `instrument` cargo feature, every block a context compresses or decompresses
+//! adds its filter time, codec time and stream counts to
+//! [`CodecStats`](crate::instr::CodecStats), which `codec_stats` returns. Without the
+//! feature the counters and their clocks compile to nothing.
+//!
+//! `cparams.instr_codec` is independent of the feature, as in C. It makes
+//! [`crate::blosc2_compress_ctx`] write an instrumented chunk (`BLOSC2_INSTR_CODEC` in the
+//! blosc2 flags), where each stream holds a [`Blosc2Instr`](crate::instr::Blosc2Instr)
+//! record instead of its data. Decompressing such a chunk returns the records, one per
+//! stream, in block order.
+//!
+//! Timings are wall-clock and zero on `wasm32-unknown-unknown`, which has no clock.
+
+use std::time::Duration;
+
+/// Counters for one direction, summed over every chunk since the last reset.
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct StageStats {
+    /// Chunks compressed or decompressed, special and memcpyed ones included.
+    pub chunks: u64,
+    /// Uncompressed bytes of those chunks.
+    pub nbytes: u64,
+    /// Compressed bytes of those chunks.
+    pub cbytes: u64,
+    /// Blocks that went through the filters and the codec.
+    pub blocks: u64,
+    /// Streams of those blocks.
+    pub streams: u64,
+    /// Streams stored as a run of one byte value (C `get_run`), which skip the codec.
+    pub run_streams: u64,
+    /// Streams stored as is because the codec could not shrink them.
+    pub raw_streams: u64,
+    /// Special chunks (zeros, NaNs, uninit or a repeated value), which have no blocks.
+    pub special_chunks: u64,
+    /// Chunks stored uncompressed after the header (`BLOSC_MEMCPYED`), including the
+    /// ones the codec gave up on.
+    pub memcpyed_chunks: u64,
+    /// Time spent in the filter pipeline (shuffle, delta, truncation).
+    pub filter_time: Duration,
+    /// Time spent in the codec.
+    pub codec_time: Duration,
+}
+
+impl StageStats {
+    /// Adds the counters of `other` to these.
+    pub fn add(&mut self, other: &StageStats) {
+        self.chunks += other.chunks;
+        self.nbytes += other.nbytes;
+        self.cbytes += other.cbytes;
+        self.blocks += other.blocks;
+        self.streams += other.streams;
+        self.run_streams += other.run_streams;
+        self.raw_streams += other.raw_streams;
+        self.special_chunks += other.special_chunks;
+        self.memcpyed_chunks += other.memcpyed_chunks;
+        self.filter_time += other.filter_time;
+        self.codec_time += other.codec_time;
+    }
+}
+
+/// Counters of a context. Trial compressions of [`crate::tune`] and of
+/// `BLOSC_AUTO_SPLIT` count as well, as they take time like any other.
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct CodecStats {
+    pub compress: StageStats,
+    pub decompress: StageStats,
+}
+
+impl CodecStats {
+    /// Adds the counters of `other` to these, for totals over several contexts.
+    pub fn add(&mut self, other: &CodecStats) {
+        self.compress.add(&other.compress);
+        self.decompress.add(&other.decompress);
+    }
+}
+
+/// The counters of `context`, worker threads included, since it was created or last
+/// reset.
+#[cfg(feature = "instrument")]
+pub fn codec_stats(context: &crate::api::Blosc2Context) -> CodecStats {
+    context.scratch.borrow().stats()
+}
+
+/// Zeroes the counters of `context`.
+#[cfg(feature = "instrument")]
+pub fn reset_codec_stats(context: &crate::api::Blosc2Context) {
+    context.scratch.borrow_mut().reset_stats();
+}
+
+/// Which side of [`CodecStats`] a [`Recorder`] updates.
+#[derive(Clone, Copy)]
+pub(crate) enum Stage {
+    Compress,
+    Decompress,
+}
+
+/// The counters kept in a [`crate::internal::ScratchArena`]; empty without the
+/// `instrument` feature, where [`Recorder::record`] does nothing.
+#[derive(Default)]
+pub(crate) struct Recorder {
+    #[cfg(feature = "instrument")]
+    pub(crate) stats: CodecStats,
+}
+
+impl Recorder {
+    /// Applies `f` to the counters of `stage`.
+    #[inline(always)]
+    #[allow(unused_variables)]
+    pub(crate) fn record(&mut self, stage: Stage, f: impl FnOnce(&mut StageStats)) {
+        #[cfg(feature = "instrument")]
+        f(match stage {
+            Stage::Compress => &mut self.stats.compress,
+            Stage::Decompress => &mut self.stats.decompress,
+        });
+    }
+}
+
+/// A stopwatch that only runs when asked to: for the `instrument` counters, or for
+/// `instr_codec` records (C `blosc_set_timestamp`).
+#[derive(Clone, Copy)]
+pub(crate) struct Clock(Option<std::time::Instant>);
+
+impl Clock {
+    /// Starts timing if `on` or the `instrument` feature is enabled.
+    #[inline(always)]
+    pub(crate) fn start(on: bool) -> Self {
+        #[cfg(not(all(target_arch = "wasm32", target_os = "unknown")))]
+        if on || cfg!(feature = "instrument") {
+            return Clock(Some(std::time::Instant::now()));
+        }
+        let _ = on;
+        Clock(None)
+    }
+
+    /// Time since [`Clock::start`], or zero if it was not started.
+    #[inline(always)]
+    pub(crate) fn elapsed(&self) -> Duration {
+        self.0.map_or(Duration::ZERO, |start| start.elapsed())
+    }
+}
+
+/// Size of a [`Blosc2Instr`] record in a chunk (C `sizeof(blosc2_instr)`).
+pub const BLOSC2_INSTR_SIZE: usize = 16;
+
+/// What `instr_codec` stores for a stream instead of its data (C `blosc2_instr`), as
+/// four little-endian fields. Speeds are in bytes per second, and infinite when the
+/// stage took no measurable time.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Blosc2Instr {
+    /// Stream size over its compressed size with the 4-byte size prefix.
+    pub cratio: f32,
+    /// Codec speed on the stream.
+    pub cspeed: f32,
+    /// Filter pipeline speed on the stream's block.
+    pub filter_speed: f32,
+    /// `flags[0]` is 1 for a run stream (C `special_lvalue`), `flags[1]` is 1 when the
+    /// codec could not shrink the stream (C `memcpyed`).
+    pub flags: [u8; 4],
+}
+
+impl Blosc2Instr {
+    /// Reads the records out of the output of decompressing an instrumented chunk.
+    pub fn parse(records: &[u8]) -> Vec<Blosc2Instr> {
+        let f32_at = |record: &[u8], i: usize| {
+            f32::from_le_bytes(record[i * 4..i * 4 + 4].try_into().unwrap())
+        };
+        records
+            .chunks_exact(BLOSC2_INSTR_SIZE)
+            .map(|record| Blosc2Instr {
+                cratio: f32_at(record, 0),
+                cspeed: f32_at(record, 1),
+                filter_speed: f32_at(record, 2),
+                flags: record[12..16].try_into().unwrap(),
+            })
+            .collect()
+    }
+
+    pub(crate) fn to_bytes(self) -> [u8; BLOSC2_INSTR_SIZE] {
+        let mut record = [0u8; BLOSC2_INSTR_SIZE];
+        record[0..4].copy_from_slice(&self.cratio.to_le_bytes());
+        record[4..8].copy_from_slice(&self.cspeed.to_le_bytes());
+        record[8..12].copy_from_slice(&self.filter_speed.to_le_bytes());
+        record[12..16].copy_from_slice(&self.flags);
+        record
+    }
+}
+
+/// Bytes per second, as C computes `neblock / ctime`.
+pub(crate) fn speed(nbytes: usize, time: Duration) -> f32 {
+    nbytes as f32 / time.as_secs_f32()
+}
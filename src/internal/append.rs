@@ -0,0 +1,249 @@
+//! Compressing and decompressing onto the end of a `Vec`, for the allocation-free
+//! convenience functions ([`crate::convenience::blosc2_compress_into`] and
+//! [`crate::convenience::blosc2_decompress_into`]).
+//!
+//! [`super::compress_internal`] and [`super::decompress_internal`] write into a `&mut [u8]`
+//! of the worst-case size, which a caller holding a `Vec` has to zero first. Here each
+//! block goes through `scratch.block` instead, which stays small enough to be in cache,
+//! and is appended to the `Vec`: the capacity of the `Vec` is reused and nothing past
+//! the bytes actually written is touched. The chunks and data are the same as theirs.
+
+use super::{
+    block_scratch_len, compress_block, grow, plan_chunk, write_header, BlockError, BlockRole,
+    BlockSizing, ChunkInfo, ChunkPlan, DeltaRefs, Pipeline, ScratchArena, Special,
+};
+use crate::instr::Stage;
+use crate::internal::constants::*;
+
+/// [`super::compress_internal`] on one thread, without a dictionary or `instr_codec`, and
+/// with the split mode and block sizes of [`super::compress`] and
+/// [`super::compress_extended`]. The chunk is appended to `dest`; it is the one
+/// [`super::compress_internal`] writes into a `dest` of `bound` bytes, and it fails the
+/// same way. `dest` is left as it was on failure.
+pub(crate) fn compress_append(
+    clevel: i32,
+    typesize: usize,
+    src: &[u8],
+    bound: usize,
+    dest: &mut Vec<u8>,
+    compressor: u8,
+    extended_header: bool,
+    filters: &[u8; 6],
+    filters_meta: &[u8; 6],
+    scratch: &mut ScratchArena,
+) -> Result<usize, i32> {
+    let start = dest.len();
+    dest.reserve(bound);
+    let mut staging = std::mem::take(&mut scratch.block);
+    let result = append_chunk(
+        clevel,
+        typesize,
+        src,
+        bound,
+        dest,
+        start,
+        compressor,
+        extended_header,
+        filters,
+        filters_meta,
+        &mut staging,
+        scratch,
+    );
+    scratch.block = staging;
+    if result.is_err() {
+        dest.truncate(start);
+    }
+    result
+}
+
+fn append_chunk(
+    clevel: i32,
+    typesize: usize,
+    src: &[u8],
+    bound: usize,
+    dest: &mut Vec<u8>,
+    start: usize,
+    compressor: u8,
+    extended_header: bool,
+    filters: &[u8; 6],
+    filters_meta: &[u8; 6],
+    staging: &mut Vec<u8>,
+    scratch: &mut ScratchArena,
+) -> Result<usize, i32> {
+    let nbytes = src.len();
+    let ChunkPlan {
+        blocksize,
+        nblocks,
+        header_len,
+        mut flags,
+        split,
+        ..
+    } = plan_chunk(
+        clevel,
+        typesize,
+        nbytes,
+        compressor,
+        extended_header,
+        filters,
+        BLOSC_FORWARD_COMPAT_SPLIT,
+        BlockSizing::Table,
+    );
+    let pipeline = Pipeline::new(filters, filters_meta);
+
+    let mut delta_refs = DeltaRefs::default();
+    if pipeline.has_delta() && nblocks > 1 {
+        pipeline.delta_refs(
+            typesize,
+            &src[..blocksize],
+            &mut delta_refs,
+            &mut scratch.filter,
+        )?;
+    }
+    scratch.codecs.set_zstd_cdict(None);
+
+    // The header and `bstarts` are written once the blocks are in
+    let data_offset = header_len + nblocks * 4;
+    dest.resize(start + data_offset, 0);
+    let mut incompressible = clevel == 0;
+
+    if !incompressible {
+        for i in 0..nblocks {
+            let offset = dest.len() - start;
+            if offset + 4 > bound {
+                incompressible = true;
+                break;
+            }
+            let block_start = i * blocksize;
+            let block_end = std::cmp::min(block_start + blocksize, nbytes);
+            let leftoverblock = i == nblocks - 1 && (nbytes % blocksize) != 0;
+            let role = match i {
+                0 => BlockRole::First(None),
+                _ => BlockRole::Other(&delta_refs),
+            };
+            // What is left of `bound`, as in the serial path, but no more than a block
+            // can take (see `block_scratch_len`)
+            let room = std::cmp::min(
+                bound - offset,
+                block_scratch_len(block_end - block_start, typesize),
+            );
+            match compress_block(
+                clevel,
+                &pipeline,
+                role,
+                typesize,
+                compressor,
+                extended_header,
+                split,
+                &src[block_start..block_end],
+                leftoverblock,
+                false,
+                false,
+                grow(staging, room),
+                scratch,
+            )? {
+                Some(n) => {
+                    let bstart = start + header_len + i * 4;
+                    dest[bstart..bstart + 4].copy_from_slice(&(offset as u32).to_le_bytes());
+                    dest.extend_from_slice(&staging[..n]);
+                }
+                None => {
+                    incompressible = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    let compressed_size = dest.len() - start - data_offset;
+    if incompressible || compressed_size >= nbytes {
+        if header_len + nbytes > bound {
+            return Err(-1);
+        }
+        dest.truncate(start + header_len);
+        dest.extend_from_slice(src);
+        flags |= BLOSC_MEMCPYED;
+    }
+
+    let cbytes = dest.len() - start;
+    scratch.recorder.record(Stage::Compress, |stats| {
+        stats.chunks += 1;
+        stats.nbytes += nbytes as u64;
+        stats.cbytes += cbytes as u64;
+        stats.memcpyed_chunks += (flags & BLOSC_MEMCPYED != 0) as u64;
+    });
+    write_header(
+        &mut dest[start..],
+        extended_header,
+        nbytes,
+        blocksize,
+        cbytes,
+        typesize,
+        flags,
+        compressor,
+        filters,
+        filters_meta,
+        0,
+    );
+    Ok(cbytes)
+}
+
+/// [`super::decompress`] that appends the data of `src` to `dest`. Chunks written with
+/// `instr_codec` have no data and fail with `BLOSC2_ERROR_INVALID_HEADER` (as
+/// [`ChunkInfo`] has them), and blocks that do not decode with `BLOSC2_ERROR_DATA`.
+/// `dest` is left as it was on failure.
+pub(crate) fn decompress_append(
+    src: &[u8],
+    dest: &mut Vec<u8>,
+    scratch: &mut ScratchArena,
+) -> Result<usize, i32> {
+    let info = ChunkInfo::parse(src)?;
+    let nbytes = info.nbytes;
+    scratch.recorder.record(Stage::Decompress, |stats| {
+        stats.chunks += 1;
+        stats.nbytes += nbytes as u64;
+        stats.cbytes += info.cbytes as u64;
+        stats.special_chunks += info.special.is_some() as u64;
+        stats.memcpyed_chunks += (info.special.is_none() && info.memcpyed) as u64;
+    });
+
+    let start = dest.len();
+    dest.reserve(nbytes);
+    match &info.special {
+        // Uninit chunks have no bytes to keep, so they read as zeros here
+        Some(Special::Zero | Special::Uninit) => dest.resize(start + nbytes, 0),
+        Some(special) => {
+            let mut staging = std::mem::take(&mut scratch.block);
+            // Filled 64 KB at a time, each piece starting where the last one ended
+            let piece_len = std::cmp::min(nbytes, 1 << 16);
+            while dest.len() - start < nbytes {
+                let offset = dest.len() - start;
+                let piece = grow(&mut staging, std::cmp::min(piece_len, nbytes - offset));
+                special.fill(offset, piece);
+                dest.extend_from_slice(piece);
+            }
+            scratch.block = staging;
+        }
+        None if info.memcpyed => {
+            dest.extend_from_slice(&src[info.header_len..info.header_len + nbytes])
+        }
+        None => {
+            info.select_dict(src, scratch);
+            let mut refs = DeltaRefs::default();
+            let mut staging = std::mem::take(&mut scratch.block);
+            // Blocks go in order, so block 0 has recorded the delta references by the
+            // time the others need them
+            let result = (0..info.nblocks).try_for_each(|i| {
+                let block = grow(&mut staging, info.block_len(i));
+                info.decode_block(src, i, block, &mut refs, scratch)?;
+                dest.extend_from_slice(block);
+                Ok::<(), BlockError>(())
+            });
+            scratch.block = staging;
+            if result.is_err() {
+                dest.truncate(start);
+                return Err(BLOSC2_ERROR_DATA);
+            }
+        }
+    }
+    Ok(nbytes)
+}
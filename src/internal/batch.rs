@@ -0,0 +1,118 @@
+//! Compressing and decompressing many chunks in one call, for callers such as Zarr
+//! stores that handle thousands of small chunks at a time. C blosc2 has no batch entry
+//! point; each item here is what [`super::compress_ctx`] or [`super::decompress_ctx`]
+//! would make of it.
+//!
+//! `cparams` are worked out once per batch rather than once per chunk, and every item
+//! reuses the context's [`ScratchArena`]. With the `parallel` feature and more than one
+//! thread, whole items go to the workers instead of blocks. Workers take the next item
+//! as they finish one, largest first, so that items of uneven size still share the
+//! work evenly.
+
+use super::{decompress_internal, CompressArgs, ScratchArena};
+use crate::api::Blosc2Context;
+use crate::internal::constants::*;
+
+/// Compresses every `srcs[i]` into `dests[i]` with `context.cparams`. Items beyond the
+/// shorter of the two slices fail with `BLOSC2_ERROR_INVALID_PARAM`.
+pub(crate) fn compress_batch(
+    context: &Blosc2Context,
+    srcs: &[&[u8]],
+    dests: &mut [&mut [u8]],
+) -> Vec<Result<usize, i32>> {
+    let mut scratch = context.scratch.borrow_mut();
+    let args = match CompressArgs::from_context(context) {
+        Ok(args) => args,
+        Err(code) => return vec![Err(code); srcs.len()],
+    };
+    // The tuner sees the chunks in order, as it would from one call per chunk
+    let args: Vec<CompressArgs> = srcs
+        .iter()
+        .map(|src| args.tuned(context, src, &mut scratch))
+        .collect();
+    let nthreads = context.cparams.nthreads.max(1) as usize;
+
+    run(
+        srcs,
+        dests,
+        nthreads,
+        &mut scratch,
+        |i, src, dest, nthreads, arena| args[i].compress(src, dest, nthreads, arena),
+    )
+}
+
+/// Decompresses every `srcs[i]` into `dests[i]`. Items beyond the shorter of the two
+/// slices fail with `BLOSC2_ERROR_INVALID_PARAM`, and items that do not decode with
+/// `BLOSC2_ERROR_DATA`.
+pub(crate) fn decompress_batch(
+    context: &Blosc2Context,
+    srcs: &[&[u8]],
+    dests: &mut [&mut [u8]],
+) -> Vec<Result<usize, i32>> {
+    let nthreads = context.dparams.nthreads.max(1) as usize;
+    run(
+        srcs,
+        dests,
+        nthreads,
+        &mut context.scratch.borrow_mut(),
+        |_, src, dest, nthreads, arena| {
+            decompress_internal(src, dest, nthreads, arena).map_err(|_| BLOSC2_ERROR_DATA)
+        },
+    )
+}
+
+/// Runs `f(i, srcs[i], dests[i], nthreads, arena)` for every item. A batch of one item
+/// keeps `nthreads` for its blocks; larger ones spread their items over the workers of
+/// `scratch`, each item on one thread.
+fn run<F>(
+    srcs: &[&[u8]],
+    dests: &mut [&mut [u8]],
+    nthreads: usize,
+    scratch: &mut ScratchArena,
+    f: F,
+) -> Vec<Result<usize, i32>>
+where
+    F: Fn(usize, &[u8], &mut [u8], usize, &mut ScratchArena) -> Result<usize, i32> + Sync,
+{
+    let mut results = vec![Err(BLOSC2_ERROR_INVALID_PARAM); srcs.len()];
+
+    #[cfg(feature = "parallel")]
+    if nthreads > 1 && srcs.len().min(dests.len()) > 1 {
+        use std::sync::Mutex;
+
+        let nitems = srcs.len().min(dests.len());
+        let mut items: Vec<_> = srcs.iter().zip(dests.iter_mut()).enumerate().collect();
+        items.sort_by_key(|(_, (src, _))| std::cmp::Reverse(src.len()));
+        let work = Mutex::new(items.into_iter());
+        // Until a worker reports it: the items of a worker that panics stay this way
+        results[..nitems].fill(Err(BLOSC2_ERROR_THREAD_CREATE));
+        let worker = |arena: &mut ScratchArena| {
+            let mut done = Vec::new();
+            loop {
+                let next = work.lock().unwrap().next();
+                let Some((i, (src, dest))) = next else {
+                    return done;
+                };
+                done.push((i, f(i, src, dest, 1, arena)));
+            }
+        };
+
+        let per_worker: Vec<_> = std::thread::scope(|s| {
+            let handles: Vec<_> = scratch
+                .workers(nthreads.min(nitems))
+                .iter_mut()
+                .map(|arena| s.spawn(|| worker(arena)))
+                .collect();
+            handles.into_iter().map(|h| h.join()).collect()
+        });
+        for (i, result) in per_worker.into_iter().flatten().flatten() {
+            results[i] = result;
+        }
+        return results;
+    }
+
+    for (i, (src, dest)) in srcs.iter().zip(dests.iter_mut()).enumerate() {
+        results[i] = f(i, src, dest, nthreads, scratch);
+    }
+    results
+}
@@ -0,0 +1,91 @@
+//! Cache sizes of the running CPU, for [`super::BlockSizing::Cache`].
+//!
+//! C blosc2 never looks: `stune.c` sizes blocks from `L1` and `L2` compiled in as 32 KB
+//! and 256 KB. Here they are read once from
+//! `/sys/devices/system/cpu/cpu0/cache` on Linux, and fall back to those constants
+//! elsewhere or when sysfs says nothing useful.
+
+use super::constants::{L1, L2};
+use std::sync::OnceLock;
+
+/// Per-core data cache sizes in bytes.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) struct CacheSizes {
+    pub(crate) l1: usize,
+    pub(crate) l2: usize,
+}
+
+impl Default for CacheSizes {
+    /// The sizes C assumes.
+    fn default() -> Self {
+        CacheSizes { l1: L1, l2: L2 }
+    }
+}
+
+/// The cache sizes of this machine, detected on the first call.
+pub(crate) fn cache_sizes() -> CacheSizes {
+    static SIZES: OnceLock<CacheSizes> = OnceLock::new();
+    *SIZES.get_or_init(detect)
+}
+
+#[cfg(target_os = "linux")]
+fn detect() -> CacheSizes {
+    let mut sizes = CacheSizes::default();
+    let Ok(entries) = std::fs::read_dir("/sys/devices/system/cpu/cpu0/cache") else {
+        return sizes;
+    };
+    for entry in entries.flatten() {
+        let read = |name: &str| std::fs::read_to_string(entry.path().join(name)).ok();
+        let (Some(level), Some(kind), Some(size)) = (read("level"), read("type"), read("size"))
+        else {
+            continue;
+        };
+        let Some(size) = parse_size(&size) else {
+            continue;
+        };
+        match (level.trim(), kind.trim()) {
+            ("1", "Data" | "Unified") => sizes.l1 = size,
+            ("2", "Unified" | "Data") => sizes.l2 = size,
+            _ => {}
+        }
+    }
+    // An L2 no larger than L1 is not worth sizing for
+    sizes.l2 = sizes.l2.max(sizes.l1);
+    sizes
+}
+
+#[cfg(not(target_os = "linux"))]
+fn detect() -> CacheSizes {
+    CacheSizes::default()
+}
+
+/// Parses a sysfs cache size such as `48K` or `2M`. Sizes under 4 KB are not believed.
+#[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+fn parse_size(size: &str) -> Option<usize> {
+    let size = size.trim();
+    let (digits, unit) = match size.as_bytes().last()? {
+        b'K' => (&size[..size.len() - 1], 1 << 10),
+        b'M' => (&size[..size.len() - 1], 1 << 20),
+        b'G' => (&size[..size.len() - 1], 1 << 30),
+        _ => (size, 1),
+    };
+    let bytes = digits.parse::<usize>().ok()?.checked_mul(unit)?;
+    (bytes >= 4096).then_some(bytes)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn sysfs_sizes() {
+        assert_eq!(parse_size("48K\n"), Some(48 << 10));
+        assert_eq!(parse_size("2M"), Some(2 << 20));
+        assert_eq!(parse_size("65536"), Some(65536));
+        assert_eq!(parse_size("1K"), None);
+        assert_eq!(parse_size("lots"), None);
+
+        let sizes = cache_sizes();
+        assert!(sizes.l1 >= 4096 && sizes.l2 >= sizes.l1);
+    }
+}
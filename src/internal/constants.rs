@@ -328,7 +328,8 @@ pub const BLOSC_UDCODEC_VERSION_FORMAT: u8 = 1;
 pub const BLOSC_ALWAYS_SPLIT: u8 = 1;
 /// Never split blocks (experimental).
 pub const BLOSC_NEVER_SPLIT: u8 = 2;
-/// Automatically decide whether to split based on heuristics.
+/// Decide per chunk by compressing its first block both ways and keeping the smaller.
+/// C treats it as `BLOSC_FORWARD_COMPAT_SPLIT`.
 pub const BLOSC_AUTO_SPLIT: u8 = 3;
 /// Forward-compatible split mode (default). Behaves like `ALWAYS_SPLIT` for
 /// codecs that benefit from it, ensuring older Blosc versions can still read the output.
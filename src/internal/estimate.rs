@@ -0,0 +1,193 @@
+//! Block pre-analysis for the compressor.
+//!
+//! C blosc2 hands every block straight to the codec: BloscLZ first runs its own
+//! entropy probe (`get_cratio`, over the whole block at clevel >= 7) and then starts
+//! again from scratch, and the other codecs simply try. [`estimate_block`] looks at a
+//! small sample of the filtered block instead, so that `compress_block` can settle
+//! constant blocks without calling a codec at all, and can let BloscLZ skip its probe
+//! when the sample already shows plenty of matches. Its `Incompressible` verdict is
+//! only a hint: the codec still has to give up on the block.
+
+/// Sample windows per block, one in each of as many equal slices of it.
+const WINDOWS: usize = 16;
+/// Bytes per sample window.
+const WINDOW_LEN: usize = 128;
+/// Blocks shorter than this are not sampled (only checked for being constant): the
+/// sample would be most of the block, and the codec is cheap there anyway.
+const MIN_SAMPLED_LEN: usize = 4 * WINDOWS * WINDOW_LEN;
+/// Log2 of the number of slots of the match table, about two per sampled position.
+const HASH_LOG: u32 = 12;
+
+/// Bytes spot-checked before scanning a block for being constant.
+const CONSTANT_PROBES: usize = 64;
+
+/// Sampled entropy (bits per byte) at or above which a block counts as incompressible.
+/// A uniform sample of 2048 bytes measures about 7.9.
+const INCOMPRESSIBLE_ENTROPY: f64 = 7.8;
+
+/// What the sample says about a filtered block.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub(crate) enum Estimate {
+    /// Every byte of the block is this value.
+    Constant(u8),
+    /// Random-looking bytes with no repeats in the sample. Long-period repeats are not
+    /// seen, so a codec may still shrink it.
+    Incompressible,
+    /// A good share of the sampled positions start a 4-byte repeat within their
+    /// window, so the BloscLZ probe would pass anyway.
+    Compressible,
+    /// Nothing conclusive; let the codec decide.
+    Unknown,
+}
+
+/// Returns the value of every byte of `bytes` if they are all equal.
+pub(crate) fn constant_value(bytes: &[u8]) -> Option<u8> {
+    let (&value, _) = bytes.split_first()?;
+    // OR-folding fixed-size chunks vectorizes, unlike a byte loop that stops early
+    let differs = |chunk: &[u8]| chunk.iter().fold(0, |acc, &b| acc | (b ^ value)) != 0;
+    let mut chunks = bytes.chunks_exact(64);
+    if chunks.by_ref().any(differs) || differs(chunks.remainder()) {
+        return None;
+    }
+    Some(value)
+}
+
+/// Classifies a filtered block from a sample of it.
+///
+/// The constant check is exact: a few spot checks rule out most blocks, and only the
+/// ones that pass them are scanned in full. The other verdicts come from
+/// [`WINDOWS`] windows of [`WINDOW_LEN`] bytes: their byte entropy, and how many of
+/// their positions start a 4-byte sequence seen before in the same window (`local`,
+/// what an LZ codec finds nearby) or in any window (`global`, which catches some
+/// blocks that repeat with a long period, but not all of them: random bytes repeated
+/// every few KiB can pass as incompressible, which is why the codec has the last
+/// word).
+pub(crate) fn estimate_block(block: &[u8]) -> Estimate {
+    let len = block.len();
+    if len == 0 {
+        return Estimate::Unknown;
+    }
+    let first = block[0];
+    let probe_step = len.div_ceil(CONSTANT_PROBES);
+    if (0..len).step_by(probe_step).all(|i| block[i] == first) && block[len - 1] == first {
+        if let Some(value) = constant_value(block) {
+            return Estimate::Constant(value);
+        }
+    }
+    if len < MIN_SAMPLED_LEN {
+        return Estimate::Unknown;
+    }
+
+    let mut histogram = [0u32; 256];
+    // Slot: the 4-byte sequence in the high half, its window + 1 in the low half
+    let mut table = [0u64; 1 << HASH_LOG];
+    let mut local = 0usize;
+    let mut global = 0usize;
+    let stride = len / WINDOWS;
+    for w in 0..WINDOWS {
+        // Where in its slice a window goes varies (Weyl sequence), so that it does not
+        // line up with the slices of a shuffled block: the 16 rows of a 2-byte
+        // bitshuffle would otherwise all be sampled at the same element
+        let jitter = (w as u64 * 0x9e37_79b9 % (stride - WINDOW_LEN) as u64) as usize;
+        let start = w * stride + jitter;
+        let window = &block[start..start + WINDOW_LEN];
+        for &b in window {
+            histogram[b as usize] += 1;
+        }
+        let tag = w as u64 + 1;
+        for seq in window.windows(4) {
+            let seq = u32::from_le_bytes([seq[0], seq[1], seq[2], seq[3]]);
+            let slot = &mut table[(seq.wrapping_mul(2_654_435_761) >> (32 - HASH_LOG)) as usize];
+            if *slot >> 32 == seq as u64 && *slot != 0 {
+                global += 1;
+                if *slot & 0xffff_ffff == tag {
+                    local += 1;
+                }
+            }
+            *slot = (seq as u64) << 32 | tag;
+        }
+    }
+
+    let positions = WINDOWS * (WINDOW_LEN - 3);
+    if local * 4 >= positions {
+        return Estimate::Compressible;
+    }
+    if global * 256 <= positions
+        && entropy(&histogram, WINDOWS * WINDOW_LEN) >= INCOMPRESSIBLE_ENTROPY
+    {
+        return Estimate::Incompressible;
+    }
+    Estimate::Unknown
+}
+
+/// Shannon entropy, in bits per byte, of `total` bytes counted in `histogram`.
+fn entropy(histogram: &[u32; 256], total: usize) -> f64 {
+    let total = total as f64;
+    histogram
+        .iter()
+        .filter(|&&c| c > 0)
+        .map(|&c| {
+            let p = c as f64 / total;
+            -p * p.log2()
+        })
+        .sum()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn random(n: usize, mut x: u64) -> Vec<u8> {
+        (0..n)
+            .map(|_| {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                x as u8
+            })
+            .collect()
+    }
+
+    #[test]
+    fn constant_blocks() {
+        assert_eq!(estimate_block(&[0u8; 100]), Estimate::Constant(0));
+        assert_eq!(estimate_block(&vec![7u8; 1 << 16]), Estimate::Constant(7));
+        assert_eq!(estimate_block(&[]), Estimate::Unknown);
+
+        // A single odd byte between the spot checks
+        let mut block = vec![7u8; 1 << 16];
+        block[12_345] = 8;
+        assert_ne!(estimate_block(&block), Estimate::Constant(7));
+        assert_eq!(estimate_block(&block[..12_345]), Estimate::Constant(7));
+    }
+
+    #[test]
+    fn random_blocks() {
+        assert_eq!(
+            estimate_block(&random(1 << 16, 1)),
+            Estimate::Incompressible
+        );
+        // Too small to sample
+        assert_eq!(estimate_block(&random(4096, 2)), Estimate::Unknown);
+
+        // A random period shorter than a window is found
+        let period = random(40, 3);
+        let block: Vec<u8> = period.iter().cycle().take(1 << 16).copied().collect();
+        assert_eq!(estimate_block(&block), Estimate::Compressible);
+    }
+
+    #[test]
+    fn compressible_blocks() {
+        let text: Vec<u8> = b"the quick brown fox jumps over the lazy dog "
+            .iter()
+            .cycle()
+            .take(1 << 16)
+            .copied()
+            .collect();
+        assert_eq!(estimate_block(&text), Estimate::Compressible);
+
+        // Low-entropy noise: no repeats to speak of, but not incompressible either
+        let noise: Vec<u8> = random(1 << 16, 4).iter().map(|b| b & 0x0f).collect();
+        assert_eq!(estimate_block(&noise), Estimate::Unknown);
+    }
+}
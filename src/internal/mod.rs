@@ -1,9 +1,27 @@
+use crate::api::{Blosc2Context, Blosc2Cparams, BLOSC2_BLOCKSIZE_CACHE};
 use crate::codecs::blosclz;
-use crate::filters;
+use crate::codecs::lz4hc;
+use crate::codecs::state::{self, CodecState};
+use crate::instr::{self, Blosc2Instr, Clock, Stage, BLOSC2_INSTR_SIZE};
 use crate::internal::constants::*;
-use std::io::Write;
+use crate::tune::BLOSC_BTUNE;
 
+mod append;
+mod batch;
+mod cache;
 pub mod constants;
+mod estimate;
+mod pipeline;
+mod slice;
+mod special;
+
+use estimate::Estimate;
+pub(crate) use pipeline::{BlockRole, DeltaRefs, Pipeline};
+use pipeline::FilterBuffers;
+pub(crate) use append::{compress_append, decompress_append};
+pub(crate) use batch::{compress_batch, decompress_batch};
+pub(crate) use special::{chunk_special, special_type, Special};
+pub(crate) use slice::{getslice, DimSelection};
 
 /// Convert compressor code to compressor format (for header flags byte).
 ///
@@ -85,6 +103,7 @@ fn create_header_blosc2(
     compressor: u8,
     filters: &[u8; 6],
     filters_meta: &[u8; 6],
+    blosc2_flags: u8,
 ) -> [u8; BLOSC_EXTENDED_HEADER_LENGTH] {
     let mut header = [0u8; BLOSC_EXTENDED_HEADER_LENGTH];
     // First 16 bytes: standard Blosc header
@@ -107,8 +126,8 @@ fn create_header_blosc2(
     header[24..30].copy_from_slice(filters_meta);
     // Byte 30: reserved
     header[30] = 0;
-    // Byte 31: blosc2 flags
-    header[31] = 0;
+    // Byte 31: blosc2 flags (BLOSC2_USEDICT)
+    header[31] = blosc2_flags;
 
     header
 }
@@ -136,7 +155,6 @@ pub fn compress(
 
     compress_internal(
         clevel,
-        doshuffle,
         typesize,
         src,
         dest,
@@ -144,16 +162,24 @@ pub fn compress(
         false,
         &filters,
         &[0; 6],
+        false,
+        1,
+        BLOSC_FORWARD_COMPAT_SPLIT,
+        BlockSizing::Table,
+        false,
+        Probe::Off,
+        &mut ScratchArena::default(),
     )
 }
 
 /// Like [`compress`], but accepts an explicit filter pipeline and filter metadata.
 ///
 /// Used by [`crate::blosc2_compress_ctx`] to support custom filter configurations
-/// beyond the simple shuffle modes.
+/// beyond the simple shuffle modes. Every filter of `filters` runs, in slot order;
+/// `_doshuffle` is only kept for compatibility with callers of the single-filter API.
 pub fn compress_extended(
     clevel: i32,
-    doshuffle: i32,
+    _doshuffle: i32,
     typesize: usize,
     src: &[u8],
     dest: &mut [u8],
@@ -163,7 +189,6 @@ pub fn compress_extended(
 ) -> Result<usize, i32> {
     compress_internal(
         clevel,
-        doshuffle,
         typesize,
         src,
         dest,
@@ -171,9 +196,175 @@ pub fn compress_extended(
         true,
         filters,
         filters_meta,
+        false,
+        1,
+        BLOSC_FORWARD_COMPAT_SPLIT,
+        BlockSizing::Table,
+        false,
+        Probe::Off,
+        &mut ScratchArena::default(),
     )
 }
 
+/// Compresses `src` into `dest` with the codec, filters and thread count held in
+/// `context.cparams`, writing a Blosc2 (extended header) chunk.
+///
+/// This is the entry point behind [`crate::blosc2_compress_ctx`]. With the `parallel`
+/// feature enabled, `cparams.nthreads > 1` compresses blocks on a pool of scoped
+/// threads; the output is byte-identical to the single-threaded path. Working buffers
+/// come from the context's [`ScratchArena`] and are kept for the next call.
+///
+/// With `cparams.tuner_id` set to [`BLOSC_BTUNE`], the codec, shuffle and clevel are the
+/// ones [`crate::tune`] settles on instead, and so is the split mode. A `cparams.blocksize` outside
+/// `0..=BLOSC2_MAXBLOCKSIZE` (other than [`BLOSC2_BLOCKSIZE_CACHE`]) fails with
+/// `BLOSC2_ERROR_INVALID_PARAM`. With `cparams.instr_codec`, the chunk holds
+/// [`crate::instr`] records instead of the data.
+///
+/// A chunk that follows one the codec gave up on, or any chunk once
+/// [`crate::blosc2_set_incompressible_hint`] is set, is sampled first, so that
+/// incompressible data goes to the memcpy path without compressing any block.
+pub fn compress_ctx(context: &Blosc2Context, src: &[u8], dest: &mut [u8]) -> Result<usize, i32> {
+    let scratch = &mut context.scratch.borrow_mut();
+    let args = CompressArgs::from_context(context)?.tuned(context, src, scratch);
+    args.compress(src, dest, context.cparams.nthreads.max(1) as usize, scratch)
+}
+
+/// The [`compress_internal`] arguments that `cparams` stand for, worked out once per
+/// [`compress_ctx`] call or once per batch.
+#[derive(Clone, Copy)]
+pub(crate) struct CompressArgs {
+    clevel: i32,
+    typesize: usize,
+    compressor: u8,
+    filters: [u8; 6],
+    filters_meta: [u8; 6],
+    use_dict: bool,
+    splitmode: u8,
+    sizing: BlockSizing,
+    instr_codec: bool,
+    incompressible_hint: bool,
+}
+
+impl CompressArgs {
+    pub(crate) fn from_context(context: &Blosc2Context) -> Result<Self, i32> {
+        let mut args = Self::from_cparams(&context.cparams)?;
+        args.incompressible_hint = context.incompressible_hint;
+        Ok(args)
+    }
+
+    pub(crate) fn from_cparams(cparams: &Blosc2Cparams) -> Result<Self, i32> {
+        Ok(CompressArgs {
+            clevel: cparams.clevel as i32,
+            typesize: cparams.typesize as usize,
+            compressor: cparams.compcode,
+            filters: cparams.filters,
+            filters_meta: cparams.filters_meta,
+            use_dict: cparams.use_dict != 0,
+            splitmode: splitmode(cparams),
+            sizing: BlockSizing::from_cparams(cparams)?,
+            instr_codec: cparams.instr_codec,
+            incompressible_hint: false,
+        })
+    }
+
+    /// With `cparams.tuner_id` set to [`BLOSC_BTUNE`], the arguments the tuner picks for
+    /// `src`, the next chunk of `context`.
+    pub(crate) fn tuned(
+        mut self,
+        context: &Blosc2Context,
+        src: &[u8],
+        scratch: &mut ScratchArena,
+    ) -> Self {
+        if context.cparams.tuner_id == BLOSC_BTUNE as i32 {
+            if let Some(decision) = crate::tune::next_decision(context, src, scratch) {
+                self.clevel = decision.clevel as i32;
+                self.compressor = decision.compcode;
+                self.splitmode = decision.splitmode;
+                (self.filters, self.filters_meta) =
+                    crate::tune::with_shuffle(&self.filters, &self.filters_meta, decision.filter);
+            }
+        }
+        self
+    }
+
+    pub(crate) fn compress(
+        &self,
+        src: &[u8],
+        dest: &mut [u8],
+        nthreads: usize,
+        scratch: &mut ScratchArena,
+    ) -> Result<usize, i32> {
+        let probe = match (self.incompressible_hint, scratch.gave_up) {
+            (true, _) => Probe::Trusting,
+            (false, true) => Probe::Exact,
+            (false, false) => Probe::Off,
+        };
+        let result = compress_internal(
+            self.clevel,
+            self.typesize,
+            src,
+            dest,
+            self.compressor,
+            true,
+            &self.filters,
+            &self.filters_meta,
+            self.use_dict,
+            nthreads,
+            self.splitmode,
+            self.sizing,
+            self.instr_codec,
+            probe,
+            scratch,
+        );
+        // At clevel 0 (and for empty chunks) the chunk is memcpyed without asking the
+        // codec, and a `Trusting` probe may memcpy it on the sample alone
+        scratch.gave_up = self.clevel > 0
+            && probe != Probe::Trusting
+            && !src.is_empty()
+            && matches!(result, Ok(_) if dest[2] & BLOSC_MEMCPYED != 0);
+        result
+    }
+}
+
+/// `cparams.splitmode` as a split mode constant. Values that are none of them end up
+/// following `BLOSC_FORWARD_COMPAT_SPLIT`, as C does after a warning.
+pub(crate) fn splitmode(cparams: &Blosc2Cparams) -> u8 {
+    u8::try_from(cparams.splitmode).unwrap_or(BLOSC_FORWARD_COMPAT_SPLIT)
+}
+
+/// How the blocksize of a chunk is picked, from `cparams.blocksize`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum BlockSizing {
+    /// `blocksize == 0`: the table of C `stune.c`, for a 32 KB L1.
+    Table,
+    /// An explicit blocksize, taken as is like C `blosc_stune_next_blocksize` does
+    /// (clamped to the chunk and rounded down to whole items).
+    Fixed(usize),
+    /// [`BLOSC2_BLOCKSIZE_CACHE`]: the same table for the detected L1, blocks no larger
+    /// than L2, and at least [`BLOCKS_PER_THREAD`] blocks for each of `nthreads`.
+    Cache { nthreads: usize },
+}
+
+/// Blocks each worker gets at least, with [`BlockSizing::Cache`].
+const BLOCKS_PER_THREAD: usize = 4;
+
+impl BlockSizing {
+    /// Like C `initialize_context_compression`, blocksizes outside
+    /// `0..=BLOSC2_MAXBLOCKSIZE` fail with `BLOSC2_ERROR_INVALID_PARAM`.
+    pub(crate) fn from_cparams(cparams: &Blosc2Cparams) -> Result<Self, i32> {
+        match cparams.blocksize {
+            0 => Ok(BlockSizing::Table),
+            BLOSC2_BLOCKSIZE_CACHE => Ok(BlockSizing::Cache {
+                nthreads: cparams.nthreads.max(1) as usize,
+            }),
+            blocksize if blocksize > 0 && blocksize as u32 <= BLOSC2_MAXBLOCKSIZE => {
+                Ok(BlockSizing::Fixed(blocksize as usize))
+            }
+            _ => Err(BLOSC2_ERROR_INVALID_PARAM),
+        }
+    }
+}
+
 fn compute_blocksize(
     clevel: i32,
     typesize: usize,
@@ -181,18 +372,88 @@ fn compute_blocksize(
     compressor: u8,
     filter_flags: u8,
     extended_header: bool,
+    splitmode: u8,
+    sizing: BlockSizing,
 ) -> usize {
     if nbytes < typesize {
         return nbytes.max(1);
     }
 
+    let mut blocksize = match sizing {
+        BlockSizing::Table => table_blocksize(
+            clevel,
+            typesize,
+            nbytes,
+            compressor,
+            filter_flags,
+            extended_header,
+            splitmode,
+            L1,
+        ),
+        BlockSizing::Fixed(blocksize) => blocksize,
+        BlockSizing::Cache { nthreads } => {
+            let caches = cache::cache_sizes();
+            let mut blocksize = table_blocksize(
+                clevel,
+                typesize,
+                nbytes,
+                compressor,
+                filter_flags,
+                extended_header,
+                splitmode,
+                caches.l1,
+            );
+            // The table goes past L2 at high clevels; the block, its filter output and
+            // the codec output then no longer stay in it
+            blocksize = blocksize.min(caches.l2);
+            // Leave every worker several blocks to balance, but never under L1
+            if nthreads > 1 {
+                let per_thread = nbytes / (nthreads * BLOCKS_PER_THREAD);
+                blocksize = blocksize.min(per_thread.max(caches.l1));
+            }
+            blocksize
+        }
+    };
+
+    if blocksize > nbytes {
+        blocksize = nbytes;
+    }
+
+    // blocksize must be a multiple of typesize (matching C's stune.c)
+    if typesize > 0 && blocksize > typesize {
+        blocksize = (blocksize / typesize) * typesize;
+    }
+
+    blocksize
+}
+
+/// The automatic blocksize of C `blosc_stune_next_blocksize`, with every size in it
+/// scaled from the 32 KB that C assumes for `l1`.
+fn table_blocksize(
+    clevel: i32,
+    typesize: usize,
+    nbytes: usize,
+    compressor: u8,
+    filter_flags: u8,
+    extended_header: bool,
+    splitmode: u8,
+    l1: usize,
+) -> usize {
     let mut blocksize = nbytes;
 
     // Check splitmode using the initial blocksize (= nbytes), matching C behavior
-    let splitmode = split_block(compressor, clevel, typesize, blocksize, filter_flags, extended_header);
+    let split = split_block(
+        compressor,
+        clevel,
+        typesize,
+        blocksize,
+        filter_flags,
+        extended_header,
+        splitmode,
+    );
 
-    if nbytes >= L1 {
-        blocksize = L1;
+    if nbytes >= l1 {
+        blocksize = l1;
 
         let is_hcr = match compressor {
             BLOSC_LZ4HC | BLOSC_ZLIB | BLOSC_ZSTD => true,
@@ -221,35 +482,26 @@ fn compute_blocksize(
     }
 
     // Override blocksize for splittable codecs (matching C stune.c)
-    if clevel > 0 && splitmode {
+    if clevel > 0 && split {
         blocksize = match clevel {
-            1 | 2 | 3 => 32 * 1024,
-            4 | 5 | 6 => 64 * 1024,
-            7 => 128 * 1024,
-            8 => 256 * 1024,
-            _ => 512 * 1024, // clevel 9 and above
+            1 | 2 | 3 => l1,
+            4 | 5 | 6 => 2 * l1,
+            7 => 4 * l1,
+            8 => 8 * l1,
+            _ => 16 * l1, // clevel 9 and above
         };
         // Multiply by typesize to get proper split sizes
         blocksize *= typesize;
-        // But do not exceed 4 MB
-        if blocksize > 4 * 1024 * 1024 {
-            blocksize = 4 * 1024 * 1024;
+        // But do not exceed 4 MB (for a 32 KB L1)
+        if blocksize > 128 * l1 {
+            blocksize = 128 * l1;
         }
-        if blocksize < 32 * 1024 {
+        if blocksize < l1 {
             // Do not use a too small blocksize (< 32 KB) when typesize is small
-            blocksize = 32 * 1024;
+            blocksize = l1;
         }
     }
 
-    if blocksize > nbytes {
-        blocksize = nbytes;
-    }
-
-    // blocksize must be a multiple of typesize (matching C's stune.c)
-    if typesize > 0 && blocksize > typesize {
-        blocksize = (blocksize / typesize) * typesize;
-    }
-
     blocksize
 }
 
@@ -260,6 +512,7 @@ fn filters_to_flags(filters: &[u8; 6]) -> u8 {
         match f {
             BLOSC_SHUFFLE => flags |= BLOSC_DOSHUFFLE,
             BLOSC_BITSHUFFLE => flags |= BLOSC_DOBITSHUFFLE,
+            BLOSC_DELTA => flags |= BLOSC_DODELTA,
             _ => {}
         }
     }
@@ -298,6 +551,10 @@ fn split_block_blosc1(
         && (blocksize / typesize >= BLOSC_MIN_BUFFERSIZE)
 }
 
+/// Whether full blocks are split into one stream per byte of the items (C `split_block`).
+/// `BLOSC_ALWAYS_SPLIT` and `BLOSC_NEVER_SPLIT` decide alone; any other `splitmode`
+/// (`BLOSC_AUTO_SPLIT` included, which [`measure_split`] settles later) follows the
+/// `BLOSC_FORWARD_COMPAT_SPLIT` rules.
 fn split_block(
     compressor: u8,
     clevel: i32,
@@ -305,7 +562,13 @@ fn split_block(
     blocksize: usize,
     filter_flags: u8,
     extended_header: bool,
+    splitmode: u8,
 ) -> bool {
+    match splitmode {
+        BLOSC_ALWAYS_SPLIT => return true,
+        BLOSC_NEVER_SPLIT => return false,
+        _ => {}
+    }
     if extended_header {
         split_block_blosc2(compressor, clevel, typesize, blocksize, filter_flags)
     } else {
@@ -313,24 +576,443 @@ fn split_block(
     }
 }
 
-fn compress_internal(
+/// Reusable working buffers for block compression and decompression.
+///
+/// A [`Blosc2Context`] owns one of these so that repeated `*_ctx` calls reuse the
+/// filter buffers, the bitshuffle working space and the BloscLZ and LZ4HC match
+/// tables instead of allocating (and zeroing) them for every block, as C does with
+/// the `tmp`/`tmp2` buffers of its `thread_context`. Buffers only ever grow.
+#[derive(Default)]
+pub struct ScratchArena {
+    /// The pipeline's pair of block buffers: filter output (compression) or codec
+    /// output before the filters are undone (decompression), and the stage in between.
+    filter: FilterBuffers,
+    /// BloscLZ match hash table.
+    htab: Vec<u32>,
+    /// LZ4HC hash and chain tables.
+    lz4hc: lz4hc::MatchTables,
+    /// zstd/zlib/snappy contexts, reset between streams instead of recreated.
+    codecs: CodecState,
+    /// A decoded block (or stream), for [`getitem`] requests that cover only part of it.
+    pub(crate) block: Vec<u8>,
+    /// Counters of the `instrument` feature.
+    pub(crate) recorder: instr::Recorder,
+    /// The last chunk compressed through [`CompressArgs`] was memcpyed because the codec
+    /// gave up on a block, so the next one gets a [`Probe::Exact`].
+    gave_up: bool,
+    /// One arena per worker thread, for the parallel paths.
+    #[cfg(feature = "parallel")]
+    workers: Vec<ScratchArena>,
+}
+
+impl ScratchArena {
+    /// Returns the first `n` worker arenas, creating any that do not exist yet.
+    #[cfg(feature = "parallel")]
+    pub(crate) fn workers(&mut self, n: usize) -> &mut [ScratchArena] {
+        if self.workers.len() < n {
+            self.workers.resize_with(n, ScratchArena::default);
+        }
+        &mut self.workers[..n]
+    }
+
+    /// The counters of this arena and of its workers, added up.
+    #[cfg(feature = "instrument")]
+    pub(crate) fn stats(&self) -> instr::CodecStats {
+        let stats = self.recorder.stats;
+        #[cfg(feature = "parallel")]
+        let stats = self.workers.iter().fold(stats, |mut stats, worker| {
+            stats.add(&worker.stats());
+            stats
+        });
+        stats
+    }
+
+    /// Zeroes the counters of this arena and of its workers.
+    #[cfg(feature = "instrument")]
+    pub(crate) fn reset_stats(&mut self) {
+        self.recorder.stats = instr::CodecStats::default();
+        #[cfg(feature = "parallel")]
+        for worker in &mut self.workers {
+            worker.reset_stats();
+        }
+    }
+}
+
+/// Returns `buf[..len]`, growing `buf` first if it is shorter.
+pub(crate) fn grow(buf: &mut Vec<u8>, len: usize) -> &mut [u8] {
+    if buf.len() < len {
+        buf.resize(len, 0);
+    }
+    &mut buf[..len]
+}
+
+/// Worst-case size of a block compressed into a buffer of its own: a 4-byte size
+/// prefix per stream plus each stream's codec bound. Snappy's `32 + n + n / 6` is
+/// the largest bound, and BloscLZ refuses outputs smaller than 66 bytes.
+///
+/// Any stream that compresses below its own size in the serial path also fits in
+/// a buffer this large, which is what keeps the parallel path byte-identical.
+pub(crate) fn block_scratch_len(block_len: usize, typesize: usize) -> usize {
+    let nstreams = typesize.max(1);
+    block_len + block_len / 6 + nstreams * (4 + 66)
+}
+
+/// Compresses a single block into `dest`, which starts at the block's first
+/// stream-size prefix. Mirrors C `blosc_c`: the block goes through `pipeline` first,
+/// as the chunk's first block or against the references of `role`.
+///
+/// Each stream gets all of the remaining space in `dest` as its output limit.
+/// Returns `Ok(Some(n))` with the number of bytes written, or `Ok(None)` when a
+/// stream does not compress (the caller then falls back to memcpy for the whole chunk).
+///
+/// With `store_incompressible`, a stream that does not compress is stored as is
+/// (size prefix equal to the stream length), as C does, instead of giving up; `None` then
+/// only means `dest` is too small. `split` is the split of the chunk ([`ChunkPlan`]).
+///
+/// With `instr` (C `instr_codec`), each stream is compressed into `scratch` and only its
+/// [`Blosc2Instr`] record is written, which never gives up on a stream.
+pub(crate) fn compress_block(
     clevel: i32,
-    doshuffle: i32,
+    pipeline: &Pipeline,
+    role: BlockRole<'_>,
     typesize: usize,
-    src: &[u8],
+    compressor: u8,
+    extended_header: bool,
+    split: bool,
+    src_block: &[u8],
+    leftoverblock: bool,
+    store_incompressible: bool,
+    instr: bool,
     dest: &mut [u8],
+    scratch: &mut ScratchArena,
+) -> Result<Option<usize>, i32> {
+    let block_len = src_block.len();
+    let clock = Clock::start(instr);
+    let filtered_src = pipeline.forward(typesize, src_block, role, &mut scratch.filter)?;
+    let filter_time = clock.elapsed();
+
+    // C does not split the leftover (last partial) block
+    let nstreams = block_nstreams(!split, leftoverblock, typesize);
+    let neblock = block_len / nstreams;
+    scratch.recorder.record(Stage::Compress, |stats| {
+        stats.blocks += 1;
+        stats.streams += nstreams as u64;
+        stats.filter_time += filter_time;
+    });
+
+    // Settle what the sample can before calling a codec. Runs are a blosc2 feature
+    // (C only writes them with `header_blosc2`). BloscLZ only skips its probe from
+    // clevel 4 on, where it covers half the block or more; below that its thresholds are
+    // stricter than the sample can vouch for. An `Incompressible` sample is only a
+    // guess (random bytes repeated every few KiB look the same to it), so the codec
+    // still runs and is the one to give up. At clevel 0 no codec runs: where streams
+    // can be stored (the stream encoder), they all are, as the memcpy of
+    // `compress_internal` would; elsewhere the caller memcpys the chunk.
+    let estimate = match clevel {
+        0 => Estimate::Unknown,
+        _ => match estimate::estimate_block(filtered_src) {
+            Estimate::Compressible if clevel < 4 => Estimate::Unknown,
+            estimate => estimate,
+        },
+    };
+    let store_all = clevel == 0 && store_incompressible;
+    let runs = extended_header && clevel > 0;
+
+    let mut current_dest_offset = 0;
+
+    for j in 0..nstreams {
+        let stream_offset = j * neblock;
+        let stream_src = &filtered_src[stream_offset..stream_offset + neblock];
+
+        if current_dest_offset + 4 > dest.len() {
+            return Ok(None);
+        }
+        let clock = Clock::start(instr);
+        // Instrumented streams may give `dest` no more than their record
+        let record = |stored: usize, flags: [u8; 4]| Blosc2Instr {
+            cratio: neblock as f32 / stored as f32,
+            cspeed: instr::speed(neblock, clock.elapsed()),
+            filter_speed: instr::speed(neblock, filter_time),
+            flags,
+        };
+
+        // C `blosc_c` checks every stream with `get_run`: after a split, a block that is
+        // not constant can still have constant streams (the high bytes of small values)
+        if runs {
+            let run = match estimate {
+                Estimate::Constant(value) => Some(value),
+                _ => estimate::constant_value(stream_src),
+            };
+            if let Some(value) = run {
+                scratch.recorder.record(Stage::Compress, |stats| stats.run_streams += 1);
+                let written = match instr {
+                    false => write_run(value, &mut dest[current_dest_offset..]),
+                    true => {
+                        let stored = if value == 0 { 4 } else { 5 };
+                        let record = record(stored, [1, 0, 0, 0]);
+                        write_instr(record, &mut dest[current_dest_offset..])
+                    }
+                };
+                match written {
+                    Some(n) => current_dest_offset += n,
+                    None => return Ok(None),
+                }
+                continue;
+            }
+        }
+
+        let out = match instr {
+            false => &mut dest[current_dest_offset + 4..],
+            true => grow(&mut scratch.block, block_scratch_len(neblock, 1)),
+        };
+        let mut stream_csize;
+
+        let codec_clock = Clock::start(false);
+        match compressor {
+            _ if store_all => stream_csize = 0,
+            BLOSC_BLOSCLZ if estimate == Estimate::Compressible => {
+                stream_csize =
+                    blosclz::compress_without_probe(clevel, stream_src, out, &mut scratch.htab);
+            }
+            BLOSC_BLOSCLZ => {
+                stream_csize =
+                    blosclz::compress_with_htab(clevel, stream_src, out, &mut scratch.htab);
+            }
+            BLOSC_LZ4HC => {
+                stream_csize =
+                    lz4hc::compress_with_tables(clevel, stream_src, out, &mut scratch.lz4hc);
+            }
+            BLOSC_LZ4 => match lz4_flex::block::compress_into(stream_src, out) {
+                Ok(size) => stream_csize = size,
+                Err(_) => stream_csize = 0,
+            },
+            BLOSC_SNAPPY => {
+                stream_csize = scratch.codecs.snappy_compress(stream_src, out);
+            }
+            BLOSC_ZLIB => {
+                stream_csize = scratch.codecs.zlib_compress(clevel, stream_src, out);
+            }
+            BLOSC_ZSTD => {
+                stream_csize = scratch.codecs.zstd_compress(clevel, stream_src, out)?;
+            }
+            _ => return Err(-1),
+        }
+        let codec_time = codec_clock.elapsed();
+        let raw = stream_csize == 0 || stream_csize >= neblock;
+        scratch.recorder.record(Stage::Compress, |stats| {
+            stats.codec_time += codec_time;
+            stats.raw_streams += raw as u64;
+        });
+
+        if instr {
+            let record = match raw {
+                false => record(4 + stream_csize, [0; 4]),
+                true => record(4 + neblock, [0, 1, 0, 0]),
+            };
+            match write_instr(record, &mut dest[current_dest_offset..]) {
+                Some(n) => current_dest_offset += n,
+                None => return Ok(None),
+            }
+            continue;
+        }
+
+        if raw {
+            if !store_incompressible || current_dest_offset + 4 + neblock > dest.len() {
+                return Ok(None);
+            }
+            dest[current_dest_offset + 4..current_dest_offset + 4 + neblock]
+                .copy_from_slice(stream_src);
+            stream_csize = neblock;
+        }
+
+        dest[current_dest_offset..current_dest_offset + 4]
+            .copy_from_slice(&(stream_csize as u32).to_le_bytes());
+        current_dest_offset += 4 + stream_csize;
+    }
+
+    Ok(Some(current_dest_offset))
+}
+
+/// Writes the stream of an instrumented chunk (C `blosc_c` with `instr_codec`): a size
+/// prefix of [`BLOSC2_INSTR_SIZE`] and the record. Returns the bytes written, or `None`
+/// if `dest` is too small.
+fn write_instr(record: Blosc2Instr, dest: &mut [u8]) -> Option<usize> {
+    let dest = dest.get_mut(..4 + BLOSC2_INSTR_SIZE)?;
+    dest[..4].copy_from_slice(&(BLOSC2_INSTR_SIZE as i32).to_le_bytes());
+    dest[4..].copy_from_slice(&record.to_bytes());
+    Some(dest.len())
+}
+
+/// Writes the stream of a run of `value` (C `blosc_c`, `get_run` branch): a zero size
+/// for zeros, else `-value` followed by a token byte with bit 0 set. Returns the bytes
+/// written, or `None` if `dest` is too small.
+fn write_run(value: u8, dest: &mut [u8]) -> Option<usize> {
+    let len = if value == 0 { 4 } else { 5 };
+    let dest = dest.get_mut(..len)?;
+    dest[..4].copy_from_slice(&(-(value as i32)).to_le_bytes());
+    if value != 0 {
+        dest[4] = 0x1;
+    }
+    Some(len)
+}
+
+/// Outcome of compressing one block on a worker thread.
+#[cfg(feature = "parallel")]
+enum BlockOutput {
+    /// The block's streams (size prefixes included), ready to be copied into `dest`.
+    Compressed(Vec<u8>),
+    /// A stream did not compress; the chunk will be memcpy'ed.
+    Incompressible,
+    /// Not attempted because an earlier block was already incompressible.
+    Skipped,
+}
+
+/// Compresses every block of `src` on up to `nthreads` scoped worker threads.
+///
+/// Blocks are handed out in index order from a shared counter, and each one is
+/// compressed into its own [`block_scratch_len`]-sized buffer. Each worker filters
+/// through one of `arenas`, so there is one thread per arena. Once any block turns
+/// out incompressible, workers stop picking up new blocks, since the chunk will be
+/// memcpy'ed anyway.
+#[cfg(feature = "parallel")]
+fn compress_blocks_parallel(
+    clevel: i32,
+    pipeline: &Pipeline,
+    delta_refs: &DeltaRefs,
+    typesize: usize,
     compressor: u8,
     extended_header: bool,
-    filters: &[u8; 6],
-    filters_meta: &[u8; 6],
-) -> Result<usize, i32> {
+    split: bool,
+    instr: bool,
+    src: &[u8],
+    blocksize: usize,
+    nblocks: usize,
+    arenas: &mut [ScratchArena],
+) -> Result<Vec<BlockOutput>, i32> {
+    use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+
     let nbytes = src.len();
+    let next_block = AtomicUsize::new(0);
+    let stop = AtomicBool::new(false);
+
+    let worker = |arena: &mut ScratchArena| -> Result<Vec<(usize, BlockOutput)>, i32> {
+        let mut done = Vec::new();
+        while !stop.load(Ordering::Relaxed) {
+            let i = next_block.fetch_add(1, Ordering::Relaxed);
+            if i >= nblocks {
+                break;
+            }
+            let start = i * blocksize;
+            let end = std::cmp::min(start + blocksize, nbytes);
+            let leftoverblock = i == nblocks - 1 && (nbytes % blocksize) != 0;
+            let role = match i {
+                0 => BlockRole::First(None),
+                _ => BlockRole::Other(delta_refs),
+            };
+
+            let mut scratch = vec![0u8; block_scratch_len(end - start, typesize)];
+            let result = compress_block(
+                clevel,
+                pipeline,
+                role,
+                typesize,
+                compressor,
+                extended_header,
+                split,
+                &src[start..end],
+                leftoverblock,
+                false,
+                instr,
+                &mut scratch,
+                arena,
+            );
+            match result {
+                Ok(Some(n)) => {
+                    scratch.truncate(n);
+                    done.push((i, BlockOutput::Compressed(scratch)));
+                }
+                Ok(None) => {
+                    stop.store(true, Ordering::Relaxed);
+                    done.push((i, BlockOutput::Incompressible));
+                }
+                Err(e) => {
+                    stop.store(true, Ordering::Relaxed);
+                    return Err(e);
+                }
+            }
+        }
+        Ok(done)
+    };
+
+    let per_worker = std::thread::scope(|s| {
+        let handles: Vec<_> = arenas
+            .iter_mut()
+            .map(|arena| s.spawn(|| worker(arena)))
+            .collect();
+        handles
+            .into_iter()
+            .map(|h| h.join().unwrap_or(Err(BLOSC2_ERROR_THREAD_CREATE)))
+            .collect::<Vec<_>>()
+    });
+
+    let mut outputs: Vec<BlockOutput> = (0..nblocks).map(|_| BlockOutput::Skipped).collect();
+    for done in per_worker {
+        for (i, output) in done? {
+            outputs[i] = output;
+        }
+    }
+    Ok(outputs)
+}
+
+/// Block layout and header flags of a chunk, fixed by its size and compression
+/// parameters before any block is compressed.
+pub(crate) struct ChunkPlan {
+    pub(crate) blocksize: usize,
+    pub(crate) nblocks: usize,
+    pub(crate) header_len: usize,
+    /// Header flags byte, without `BLOSC_MEMCPYED` (decided after compressing).
+    pub(crate) flags: u8,
+    /// Whether full blocks are split into one stream per byte of the items.
+    pub(crate) split: bool,
+    /// `BLOSC_AUTO_SPLIT` with a choice to make: [`measure_split`] on block 0 decides.
+    pub(crate) measure_split: bool,
+}
+
+impl ChunkPlan {
+    /// Changes the split of the chunk, and the `dont_split` header flag with it.
+    pub(crate) fn set_split(&mut self, split: bool) {
+        self.split = split;
+        self.flags &= !0x10;
+        if !split {
+            self.flags |= 0x10;
+        }
+    }
+}
 
+pub(crate) fn plan_chunk(
+    clevel: i32,
+    typesize: usize,
+    nbytes: usize,
+    compressor: u8,
+    extended_header: bool,
+    filters: &[u8; 6],
+    splitmode: u8,
+    sizing: BlockSizing,
+) -> ChunkPlan {
     // Compute actual filter flags from the filters array (matching C's filters_to_flags)
     // Must be computed before blocksize since split_block depends on it.
     let filter_flags = filters_to_flags(filters);
 
-    let blocksize = compute_blocksize(clevel, typesize, nbytes, compressor, filter_flags, extended_header);
+    let blocksize = compute_blocksize(
+        clevel,
+        typesize,
+        nbytes,
+        compressor,
+        filter_flags,
+        extended_header,
+        splitmode,
+        sizing,
+    );
     let nblocks = if nbytes == 0 {
         0
     } else {
@@ -350,7 +1032,15 @@ fn compress_internal(
     }
 
     // Use actual filter_flags (not header flags) for split decision, matching C behavior
-    let split = split_block(compressor, clevel, typesize, blocksize, filter_flags, extended_header);
+    let split = split_block(
+        compressor,
+        clevel,
+        typesize,
+        blocksize,
+        filter_flags,
+        extended_header,
+        splitmode,
+    );
 
     if !split {
         // For blosc2, only set dont_split when clevel > 0 (matching C blosc2 stune.c)
@@ -360,151 +1050,187 @@ fn compress_internal(
         }
     }
 
-    // Calculate data start offset
-    let mut data_offset = header_len;
-    // Always add bstarts if nblocks > 0 (Blosc1 behavior)
-    if nblocks > 0 {
-        data_offset += nblocks * 4;
+    // Only full blocks split, and one stream per byte is no choice
+    let full_block = nblocks > 1 || nbytes % blocksize.max(1) == 0;
+    let measure_split = splitmode == BLOSC_AUTO_SPLIT
+        && extended_header
+        && clevel > 0
+        && typesize > 1
+        && nbytes >= BLOSC_MIN_BUFFERSIZE
+        && nblocks > 0
+        && full_block;
+
+    ChunkPlan {
+        blocksize,
+        nblocks,
+        header_len,
+        flags,
+        split,
+        measure_split,
     }
+}
+
+/// The split of a `BLOSC_AUTO_SPLIT` chunk: block 0 (which must be a full block) is
+/// compressed both ways, as [`compress_block`] will with `store_incompressible`, and the
+/// smaller one wins, splitting on a tie since split streams decode faster. A way that gives
+/// up on a stream loses. `None` when both give up, and the plan can stay as it is. C
+/// treats `BLOSC_AUTO_SPLIT` as `BLOSC_FORWARD_COMPAT_SPLIT`.
+pub(crate) fn measure_split(
+    clevel: i32,
+    pipeline: &Pipeline,
+    typesize: usize,
+    compressor: u8,
+    block: &[u8],
+    store_incompressible: bool,
+    scratch: &mut ScratchArena,
+) -> Result<Option<bool>, i32> {
+    let mut out = std::mem::take(&mut scratch.block);
+    let mut csize = |split: bool, scratch: &mut ScratchArena| {
+        let dest = grow(&mut out, block_scratch_len(block.len(), typesize));
+        let role = BlockRole::First(None);
+        compress_block(
+            clevel,
+            pipeline,
+            role,
+            typesize,
+            compressor,
+            true,
+            split,
+            block,
+            false,
+            store_incompressible,
+            false,
+            dest,
+            scratch,
+        )
+    };
+    let split = csize(true, scratch);
+    let unsplit = csize(false, scratch);
+    scratch.block = out;
+    Ok(match (split?, unsplit?) {
+        (Some(split), Some(unsplit)) => Some(split <= unsplit),
+        (None, None) => None,
+        (split, _) => Some(split.is_some()),
+    })
+}
 
-    let mut current_dest_offset = data_offset;
-    let mut incompressible = false;
+/// How [`compress_internal`] looks for incompressible data before it compresses any
+/// block. C has no such step: it finds out block by block, and memcpys the chunk once a
+/// stream does not compress, with the work on the earlier blocks thrown away.
+#[derive(Clone, Copy, PartialEq)]
+pub(crate) enum Probe {
+    /// The blocks find out as they go.
+    Off,
+    /// [`PROBE_BLOCKS`] blocks spread over the chunk are filtered and sampled, and a
+    /// block whose sample looks random is compressed on its own. The chunk is memcpyed at
+    /// once if [`compress_block`] gives up on it there, with more room than in place, so
+    /// the chunk is the same as without the probe. zlib and zstd are not asked: their
+    /// entropy coders often save a few percent on such blocks, and the work would be
+    /// done twice.
+    Exact,
+    /// The sample alone decides, for every codec, without calling one. Random bytes
+    /// repeated every few KiB look random to it, so such a chunk may be memcpyed where
+    /// the codec would have compressed it.
+    Trusting,
+}
 
-    let mut bstarts = vec![0usize; nblocks];
+/// Blocks a [`Probe`] samples, at most.
+const PROBE_BLOCKS: usize = 4;
 
-    for i in 0..nblocks {
+/// Whether `probe` finds a block of `src` that [`compress_block`] would give up on. Its
+/// filtered sample must be [`Estimate::Incompressible`]; then `Exact` asks the codec, and
+/// `Trusting` only wants a stream that is not a run.
+fn probe_incompressible(
+    probe: Probe,
+    clevel: i32,
+    pipeline: &Pipeline,
+    delta_refs: &DeltaRefs,
+    typesize: usize,
+    compressor: u8,
+    extended_header: bool,
+    split: bool,
+    src: &[u8],
+    blocksize: usize,
+    nblocks: usize,
+    scratch: &mut ScratchArena,
+) -> Result<bool, i32> {
+    let believed = match compressor {
+        BLOSC_ZLIB | BLOSC_ZSTD => probe == Probe::Trusting,
+        _ => probe != Probe::Off,
+    };
+    if !believed || clevel == 0 || nblocks == 0 {
+        return Ok(false);
+    }
+    let nbytes = src.len();
+    let mut blocks: Vec<usize> = (0..PROBE_BLOCKS).map(|k| k * nblocks / PROBE_BLOCKS).collect();
+    blocks.dedup();
+    for i in blocks {
         let start = i * blocksize;
         let end = std::cmp::min(start + blocksize, nbytes);
-        let block_len = end - start;
-        let src_block = &src[start..end];
-
-        bstarts[i] = current_dest_offset;
-
-        let mut filtered_buf = if doshuffle != BLOSC_NOSHUFFLE as i32 {
-            vec![0u8; block_len]
-        } else {
-            Vec::new()
+        let leftoverblock = i == nblocks - 1 && (nbytes % blocksize) != 0;
+        let role = match i {
+            0 => BlockRole::First(None),
+            _ => BlockRole::Other(delta_refs),
         };
-
-        let mut filtered_src = src_block;
-
-        if doshuffle == BLOSC_SHUFFLE as i32 {
-            filters::shuffle(typesize, block_len, src_block, &mut filtered_buf);
-            filtered_src = &filtered_buf;
-        } else if doshuffle == BLOSC_BITSHUFFLE as i32 {
-            filters::bitshuffle(typesize, block_len, src_block, &mut filtered_buf)
-                .map_err(|_| -1)?;
-            filtered_src = &filtered_buf;
+        let filtered = pipeline.forward(typesize, &src[start..end], role, &mut scratch.filter)?;
+        if estimate::estimate_block(filtered) != Estimate::Incompressible {
+            continue;
         }
-
-        // C does not split the leftover (last partial) block
-        let leftoverblock = i == nblocks - 1 && (nbytes % blocksize) != 0;
-        let block_split =
-            !leftoverblock && split_block(compressor, clevel, typesize, block_len, filter_flags, extended_header);
-        let nstreams = if block_split { typesize } else { 1 };
-        let neblock = block_len / nstreams;
-
-        for j in 0..nstreams {
-            let stream_offset = j * neblock;
-            let stream_src = &filtered_src[stream_offset..stream_offset + neblock];
-
-            if current_dest_offset + 4 > dest.len() {
-                incompressible = true;
-                break;
-            }
-
-            let stream_csize;
-
-            match compressor {
-                BLOSC_BLOSCLZ => {
-                    stream_csize =
-                        blosclz::compress(clevel, stream_src, &mut dest[current_dest_offset + 4..]);
-                }
-                BLOSC_LZ4 | BLOSC_LZ4HC => {
-                    match lz4_flex::block::compress_into(
-                        stream_src,
-                        &mut dest[current_dest_offset + 4..],
-                    ) {
-                        Ok(size) => stream_csize = size,
-                        Err(_) => stream_csize = 0,
-                    }
-                }
-                BLOSC_SNAPPY => {
-                    let mut encoder = snap::raw::Encoder::new();
-                    match encoder.compress(stream_src, &mut dest[current_dest_offset + 4..]) {
-                        Ok(size) => stream_csize = size,
-                        Err(_) => stream_csize = 0,
-                    }
-                }
-                BLOSC_ZLIB => {
-                    let cursor = std::io::Cursor::new(&mut dest[current_dest_offset + 4..]);
-                    let mut encoder = flate2::write::ZlibEncoder::new(
-                        cursor,
-                        flate2::Compression::new(clevel as u32),
-                    );
-                    if encoder.write_all(stream_src).is_ok() {
-                        match encoder.finish() {
-                            Ok(cursor) => {
-                                stream_csize = cursor.position() as usize;
-                            }
-                            Err(_) => stream_csize = 0,
-                        }
-                    } else {
-                        stream_csize = 0;
-                    }
-                }
-                BLOSC_ZSTD => {
-                    let cursor = std::io::Cursor::new(&mut dest[current_dest_offset + 4..]);
-                    let mut encoder =
-                        zstd::stream::write::Encoder::new(cursor, clevel).map_err(|_| -1)?;
-                    if encoder.write_all(stream_src).is_ok() {
-                        match encoder.finish() {
-                            Ok(cursor) => {
-                                stream_csize = cursor.position() as usize;
-                            }
-                            Err(_) => stream_csize = 0,
-                        }
-                    } else {
-                        stream_csize = 0;
-                    }
-                }
-                _ => return Err(-1),
+        let gives_up = match probe {
+            Probe::Exact => {
+                let role = match i {
+                    0 => BlockRole::First(None),
+                    _ => BlockRole::Other(delta_refs),
+                };
+                let mut out = std::mem::take(&mut scratch.block);
+                let dest = grow(&mut out, block_scratch_len(end - start, typesize));
+                let csize = compress_block(
+                    clevel,
+                    pipeline,
+                    role,
+                    typesize,
+                    compressor,
+                    extended_header,
+                    split,
+                    &src[start..end],
+                    leftoverblock,
+                    false,
+                    false,
+                    dest,
+                    scratch,
+                );
+                scratch.block = out;
+                csize?.is_none()
             }
-
-            if stream_csize == 0 || stream_csize >= neblock {
-                incompressible = true;
-                break;
+            // Runs are written before the codec is asked (`runs` in `compress_block`)
+            _ => {
+                let nstreams = block_nstreams(!split, leftoverblock, typesize);
+                let mut streams = filtered.chunks_exact(filtered.len() / nstreams);
+                !extended_header || streams.any(|stream| estimate::constant_value(stream).is_none())
             }
-
-            dest[current_dest_offset..current_dest_offset + 4]
-                .copy_from_slice(&(stream_csize as u32).to_le_bytes());
-            current_dest_offset += 4 + stream_csize;
-        }
-
-        if incompressible {
-            break;
+        };
+        if gives_up {
+            return Ok(true);
         }
     }
+    Ok(false)
+}
 
-    let compressed_size = current_dest_offset - data_offset;
-
-    if incompressible || compressed_size >= nbytes {
-        if nbytes > dest.len() - header_len {
-            return Err(-1);
-        }
-        dest[header_len..header_len + nbytes].copy_from_slice(src);
-        flags |= BLOSC_MEMCPYED;
-        current_dest_offset = header_len + nbytes;
-    } else {
-        if nblocks > 0 {
-            for i in 0..nblocks {
-                let offset = header_len + i * 4;
-                dest[offset..offset + 4].copy_from_slice(&(bstarts[i] as u32).to_le_bytes());
-            }
-        }
-    }
-
-    let cbytes = current_dest_offset;
+/// Writes the chunk header (blosc1 or blosc2 layout) at the start of `dest`.
+/// `blosc2_flags` only exists in the blosc2 layout.
+pub(crate) fn write_header(
+    dest: &mut [u8],
+    extended_header: bool,
+    nbytes: usize,
+    blocksize: usize,
+    cbytes: usize,
+    typesize: usize,
+    flags: u8,
+    compressor: u8,
+    filters: &[u8; 6],
+    filters_meta: &[u8; 6],
+    blosc2_flags: u8,
+) {
     if extended_header {
         let header = create_header_blosc2(
             nbytes,
@@ -515,516 +1241,1245 @@ fn compress_internal(
             compressor,
             filters,
             filters_meta,
+            blosc2_flags,
         );
         dest[0..BLOSC_EXTENDED_HEADER_LENGTH].copy_from_slice(&header);
     } else {
         let header = create_header_blosc1(nbytes, blocksize, cbytes, typesize, flags, compressor);
         dest[0..BLOSC_MIN_HEADER_LENGTH].copy_from_slice(&header);
     }
-
-    Ok(cbytes)
 }
 
-/// Decompresses a Blosc/Blosc2 compressed buffer (including header) into `dest`.
-///
-/// Automatically detects the format version, codec, and filter pipeline from the
-/// header. Supports both Blosc1 (16-byte header) and Blosc2 (32-byte extended header)
-/// formats.
+/// Trains the zstd dictionary for a chunk with `use_dict` set, like C
+/// `blosc_compress_context`: the samples are the first 1/8 of each of `max(nblocks, 8)`
+/// equal slices of the filtered chunk (zstd wants at least 8 samples), and the dictionary
+/// is at most 5% of the chunk and at most `BLOSC2_MAXDICTSIZE`.
 ///
-/// Returns the number of decompressed bytes written to `dest`.
-pub fn decompress(src: &[u8], dest: &mut [u8]) -> Result<usize, Box<dyn std::error::Error>> {
-    if src.len() < BLOSC_MIN_HEADER_LENGTH {
-        return Err("Source buffer too small for header".into());
+/// Returns `None` when zstd fails to train a dictionary, which happens when there is
+/// too little data; the chunk is then compressed without one.
+fn train_dict(
+    pipeline: &Pipeline,
+    delta_refs: &DeltaRefs,
+    typesize: usize,
+    src: &[u8],
+    blocksize: usize,
+    nblocks: usize,
+    filter: &mut FilterBuffers,
+) -> Result<Option<Vec<u8>>, i32> {
+    let nbytes = src.len();
+    let nsamples = std::cmp::max(nblocks, 8);
+    let slice_len = nbytes / nsamples;
+    let sample_len = slice_len / 8;
+    let dict_maxsize = std::cmp::min(BLOSC2_MAXDICTSIZE as usize, nbytes / 20);
+    if sample_len == 0 || dict_maxsize == 0 {
+        return Ok(None);
     }
 
-    // Read version to determine header size
-    let version = src[0];
-    let header_len = if version == BLOSC2_VERSION_FORMAT_STABLE
-        || version == BLOSC2_VERSION_FORMAT_BETA1
-        || version == BLOSC2_VERSION_FORMAT_ALPHA
-    {
-        BLOSC_EXTENDED_HEADER_LENGTH
-    } else {
-        BLOSC_MIN_HEADER_LENGTH
-    };
+    // C trains on the filter output, which it first writes to `dest` uncompressed
+    let mut filtered_chunk = Vec::with_capacity(nbytes);
+    for (i, block) in src.chunks(blocksize).enumerate() {
+        let role = match i {
+            0 => BlockRole::First(None),
+            _ => BlockRole::Other(delta_refs),
+        };
+        let filtered = pipeline.forward(typesize, block, role, filter)?;
+        filtered_chunk.extend_from_slice(filtered);
+    }
+    let mut samples = Vec::with_capacity(nsamples * sample_len);
+    for k in 0..nsamples {
+        samples.extend_from_slice(&filtered_chunk[k * slice_len..k * slice_len + sample_len]);
+    }
 
-    if src.len() < header_len {
-        return Err("Source buffer too small for extended header".into());
+    let sample_sizes = vec![sample_len; nsamples];
+    let dict = zstd::dict::from_continuous(&samples, &sample_sizes, dict_maxsize).ok();
+    Ok(dict.filter(|dict| !dict.is_empty()))
+}
+
+pub(crate) fn compress_internal(
+    clevel: i32,
+    typesize: usize,
+    src: &[u8],
+    dest: &mut [u8],
+    compressor: u8,
+    extended_header: bool,
+    filters: &[u8; 6],
+    filters_meta: &[u8; 6],
+    use_dict: bool,
+    nthreads: usize,
+    splitmode: u8,
+    sizing: BlockSizing,
+    instr_codec: bool,
+    probe: Probe,
+    scratch: &mut ScratchArena,
+) -> Result<usize, i32> {
+    let nbytes = src.len();
+    let mut plan = plan_chunk(
+        clevel,
+        typesize,
+        nbytes,
+        compressor,
+        extended_header,
+        filters,
+        splitmode,
+        sizing,
+    );
+    let pipeline = Pipeline::new(filters, filters_meta);
+    // Instrumented streams all take the same room, so there is nothing to measure
+    if plan.measure_split && !instr_codec {
+        let block = &src[..plan.blocksize];
+        if let Some(split) =
+            measure_split(clevel, &pipeline, typesize, compressor, block, false, scratch)?
+        {
+            plan.set_split(split);
+        }
+    }
+    let ChunkPlan {
+        blocksize,
+        nblocks,
+        header_len,
+        mut flags,
+        split,
+        ..
+    } = plan;
+
+    // Blocks other than the first are delta coded against the first one (C
+    // `pipeline_forward` with `context->src` as `dref`), so its references come first
+    let mut delta_refs = DeltaRefs::default();
+    if pipeline.has_delta() && nblocks > 1 {
+        pipeline.delta_refs(typesize, &src[..blocksize], &mut delta_refs, &mut scratch.filter)?;
     }
+    let delta_refs = &delta_refs;
+
+    // Compression level 0 means the buffer is memcpy'ed (C `write_compression_header`)
+    let mut incompressible = clevel == 0
+        || (!instr_codec
+            && probe_incompressible(
+                probe,
+                clevel,
+                &pipeline,
+                delta_refs,
+                typesize,
+                compressor,
+                extended_header,
+                split,
+                src,
+                blocksize,
+                nblocks,
+                scratch,
+            )?);
 
-    let (nbytes, cbytes, blocksize) = crate::api::blosc2_cbuffer_sizes(src);
+    // Calculate data start offset
+    let mut data_offset = header_len;
+    // Always add bstarts if nblocks > 0 (Blosc1 behavior)
+    if nblocks > 0 {
+        data_offset += nblocks * 4;
+    }
 
-    if dest.len() < nbytes {
-        return Err("Destination buffer too small".into());
+    // With `use_dict` (blosc2 only), a dictionary trained on this chunk goes after
+    // `bstarts` as an i32 size plus its bytes, and every zstd stream is compressed with it
+    let mut dict = None;
+    if use_dict && extended_header && clevel > 0 && nblocks > 0 {
+        if compressor != BLOSC_ZSTD {
+            // Neither does C support dictionaries for any other codec
+            return Err(BLOSC2_ERROR_CODEC_DICT);
+        }
+        // A chunk the probe found incompressible is memcpyed without one
+        if !incompressible {
+            dict = train_dict(&pipeline, delta_refs, typesize, src, blocksize, nblocks, &mut scratch.filter)?
+                .filter(|dict| data_offset + 4 + dict.len() <= dest.len());
+        }
     }
+    if let Some(dict) = &dict {
+        dest[data_offset..data_offset + 4].copy_from_slice(&(dict.len() as i32).to_le_bytes());
+        dest[data_offset + 4..data_offset + 4 + dict.len()].copy_from_slice(dict);
+    }
+    let cdict = dict.as_deref().map(|dict| state::new_cdict(dict, clevel));
+    scratch.codecs.set_zstd_cdict(cdict.clone());
 
-    let flags = src[2];
-    let is_blosc1 = header_len == BLOSC_MIN_HEADER_LENGTH;
-    // Flags byte bits 5-7 store compformat, not compcode
-    let compressor = if !is_blosc1 {
-        // Extended header byte 22 has the actual compressor code
-        src[22]
-    } else {
-        compformat_to_compcode((flags >> 5) & 0x7, is_blosc1)
-    };
-    let typesize = src[3] as usize;
-
-    let mut doshuffle = (flags & BLOSC_DOSHUFFLE) != 0;
-    let mut dobitshuffle = (flags & BLOSC_DOBITSHUFFLE) != 0;
-
-    // Check for extended header marker (both flags set)
-    if (flags & BLOSC_DOSHUFFLE) != 0 && (flags & BLOSC_DOBITSHUFFLE) != 0 {
-        doshuffle = false;
-        dobitshuffle = false;
-
-        if !is_blosc1 {
-            let filters = &src[16..22];
-            for &f in filters {
-                if f == BLOSC_SHUFFLE {
-                    doshuffle = true;
-                } else if f == BLOSC_BITSHUFFLE {
-                    dobitshuffle = true;
+    let mut current_dest_offset = data_offset + dict.as_ref().map_or(0, |dict| 4 + dict.len());
+
+    let mut bstarts = vec![0usize; nblocks];
+
+    // Blocks before `first_serial_block` have already been placed by the parallel path.
+    #[allow(unused_mut)]
+    let mut first_serial_block = 0;
+
+    #[cfg(feature = "parallel")]
+    if nthreads > 1 && nblocks > 1 && !incompressible {
+        let arenas = scratch.workers(nthreads.min(nblocks));
+        for arena in arenas.iter_mut() {
+            arena.codecs.set_zstd_cdict(cdict.clone());
+        }
+        let outputs = compress_blocks_parallel(
+            clevel,
+            &pipeline,
+            delta_refs,
+            typesize,
+            compressor,
+            extended_header,
+            split,
+            instr_codec,
+            src,
+            blocksize,
+            nblocks,
+            arenas,
+        )?;
+
+        // Stitch the per-block buffers into `dest` in order. A worker buffer is only
+        // trusted while `dest` still has at least as much room left as the worker had;
+        // past that point the serial loop below takes over, so that output stays
+        // byte-identical to the serial path when `dest` is tight.
+        first_serial_block = nblocks;
+        for (i, output) in outputs.into_iter().enumerate() {
+            let start = i * blocksize;
+            let end = std::cmp::min(start + blocksize, nbytes);
+            if dest.len().saturating_sub(current_dest_offset) < block_scratch_len(end - start, typesize) {
+                first_serial_block = i;
+                break;
+            }
+            match output {
+                BlockOutput::Compressed(buf) => {
+                    bstarts[i] = current_dest_offset;
+                    dest[current_dest_offset..current_dest_offset + buf.len()]
+                        .copy_from_slice(&buf);
+                    current_dest_offset += buf.len();
+                }
+                BlockOutput::Incompressible | BlockOutput::Skipped => {
+                    incompressible = true;
+                    break;
                 }
             }
         }
     }
+    #[cfg(not(feature = "parallel"))]
+    let _ = nthreads;
 
-    doshuffle = doshuffle && typesize > 1;
-    dobitshuffle = dobitshuffle && blocksize >= typesize;
+    if !incompressible {
+        for i in first_serial_block..nblocks {
+            let start = i * blocksize;
+            let end = std::cmp::min(start + blocksize, nbytes);
 
-    if (flags & BLOSC_MEMCPYED) != 0 {
-        // Copy from after header to dest
-        dest[0..nbytes].copy_from_slice(&src[header_len..header_len + nbytes]);
-        return Ok(nbytes);
+            bstarts[i] = current_dest_offset;
+
+            if current_dest_offset + 4 > dest.len() {
+                incompressible = true;
+                break;
+            }
+
+            let leftoverblock = i == nblocks - 1 && (nbytes % blocksize) != 0;
+            let role = match i {
+                0 => BlockRole::First(None),
+                _ => BlockRole::Other(delta_refs),
+            };
+            match compress_block(
+                clevel,
+                &pipeline,
+                role,
+                typesize,
+                compressor,
+                extended_header,
+                split,
+                &src[start..end],
+                leftoverblock,
+                false,
+                instr_codec,
+                &mut dest[current_dest_offset..],
+                scratch,
+            )? {
+                Some(n) => current_dest_offset += n,
+                None => {
+                    incompressible = true;
+                    break;
+                }
+            }
+        }
     }
 
-    // Calculate number of blocks
-    let nblocks = if blocksize == 0 {
-        0
+    let compressed_size = current_dest_offset - data_offset;
+    let mut blosc2_flags = 0;
+
+    // Instrumented chunks stay instrumented as long as their records fit
+    if incompressible || (compressed_size >= nbytes && !instr_codec) {
+        if header_len + nbytes > dest.len() {
+            return Err(-1);
+        }
+        dest[header_len..header_len + nbytes].copy_from_slice(src);
+        flags |= BLOSC_MEMCPYED;
+        current_dest_offset = header_len + nbytes;
     } else {
-        (nbytes + blocksize - 1) / blocksize
+        if nblocks > 0 {
+            for i in 0..nblocks {
+                let offset = header_len + i * 4;
+                dest[offset..offset + 4].copy_from_slice(&(bstarts[i] as u32).to_le_bytes());
+            }
+        }
+        if dict.is_some() {
+            blosc2_flags |= BLOSC2_USEDICT;
+        }
+        if instr_codec {
+            blosc2_flags |= BLOSC2_INSTR_CODEC;
+        }
+    }
+
+    let cbytes = current_dest_offset;
+    scratch.recorder.record(Stage::Compress, |stats| {
+        stats.chunks += 1;
+        stats.nbytes += nbytes as u64;
+        stats.cbytes += cbytes as u64;
+        stats.memcpyed_chunks += (flags & BLOSC_MEMCPYED != 0) as u64;
+    });
+    write_header(
+        dest,
+        extended_header,
+        nbytes,
+        blocksize,
+        cbytes,
+        typesize,
+        flags,
+        compressor,
+        filters,
+        filters_meta,
+        blosc2_flags,
+    );
+
+    Ok(cbytes)
+}
+
+/// Error type for per-block decompression. `Send + Sync` so that worker threads can
+/// hand it back to the caller.
+pub(crate) type BlockError = Box<dyn std::error::Error + Send + Sync>;
+
+/// One stream of a block, as announced by its 4-byte size prefix.
+enum Stream<'a> {
+    /// A run of zeros.
+    Zeros,
+    /// A run of one non-zero byte value.
+    Run(u8),
+    /// Incompressible data stored as is.
+    Raw(&'a [u8]),
+    /// Codec output.
+    Compressed(&'a [u8]),
+}
+
+/// Returns the compressed bytes of block `i` (its streams), located by `bstarts` and
+/// `cbytes`.
+fn block_content<'a>(
+    src: &'a [u8],
+    i: usize,
+    bstarts: &[usize],
+    cbytes: usize,
+) -> Result<&'a [u8], BlockError> {
+    let nblocks = bstarts.len();
+    let src_offset = bstarts[i];
+
+    // Determine block size in compressed buffer
+    let block_cbytes = if i + 1 < nblocks {
+        bstarts[i + 1] - src_offset
+    } else {
+        cbytes - src_offset
     };
 
-    // For extended headers with actual compression (not memcpy), read bstarts array
-    let mut bstarts = Vec::new();
+    if src_offset + block_cbytes > src.len() {
+        return Err("Compressed data is truncated".into());
+    }
 
-    if nblocks > 0 {
-        // Always read bstarts array if nblocks > 0
-        // Note: This assumes Blosc1 format also includes bstarts for nblocks=1.
-        // c-blosc implementation suggests it does.
-        if src.len() < header_len + nblocks * 4 {
-            return Err("Buffer too small for bstarts array".into());
+    Ok(&src[src_offset..src_offset + block_cbytes])
+}
+
+/// Parses the stream starting at `content[*content_offset]` for a stream of `neblock`
+/// uncompressed bytes, and advances `content_offset` past it.
+fn next_stream<'a>(
+    content: &'a [u8],
+    content_offset: &mut usize,
+    neblock: usize,
+) -> Result<Stream<'a>, BlockError> {
+    let block_cbytes = content.len();
+    if *content_offset + 4 > block_cbytes {
+        return Err("Block too small for chunk size".into());
+    }
+    // Read stream size as signed i32 (C uses sw32_ which returns signed)
+    let stream_cbytes = i32::from_le_bytes(
+        content[*content_offset..*content_offset + 4]
+            .try_into()
+            .unwrap(),
+    );
+    *content_offset += 4;
+
+    if stream_cbytes == 0 {
+        // A run of zeros
+        Ok(Stream::Zeros)
+    } else if stream_cbytes < 0 {
+        // Run-length encoding: negative value encodes the byte value
+        if *content_offset >= block_cbytes {
+            return Err("Not enough input for run-length token".into());
         }
+        let token = content[*content_offset];
+        *content_offset += 1;
 
-        for i in 0..nblocks {
-            let offset = header_len + i * 4;
-            let bstart = u32::from_le_bytes([
-                src[offset],
-                src[offset + 1],
-                src[offset + 2],
-                src[offset + 3],
-            ]) as usize;
-            bstarts.push(bstart);
+        if token & 0x1 != 0 {
+            // A run of a non-zero byte value
+            Ok(Stream::Run((-stream_cbytes) as u8))
+        } else {
+            Err("Invalid run-length token".into())
+        }
+    } else {
+        let sc = stream_cbytes as usize;
+        if *content_offset + sc > block_cbytes {
+            return Err("Chunk size exceeds block size".into());
+        }
+        let data = &content[*content_offset..*content_offset + sc];
+        *content_offset += sc;
+        if sc == neblock {
+            // Incompressible: raw data stored directly
+            Ok(Stream::Raw(data))
+        } else {
+            Ok(Stream::Compressed(data))
         }
     }
+}
 
-    // Determine split mode from header flags (bit 4 = dont_split)
-    let dont_split = (flags & 0x10) != 0;
+/// Decodes `stream` into `dest` (the stream's `neblock` bytes) and returns how many
+/// bytes it produced.
+fn decode_stream(
+    compressor: u8,
+    stream: Stream,
+    dest: &mut [u8],
+    codecs: &mut CodecState,
+) -> Result<usize, BlockError> {
+    match stream {
+        Stream::Zeros => {
+            dest.fill(0);
+            Ok(dest.len())
+        }
+        Stream::Run(value) => {
+            dest.fill(value);
+            Ok(dest.len())
+        }
+        Stream::Raw(data) => {
+            dest.copy_from_slice(data);
+            Ok(dest.len())
+        }
+        Stream::Compressed(chunk_content) => {
+            let dest_slice = dest;
+            let chunk_decompressed_size = match compressor {
+                BLOSC_BLOSCLZ => blosclz::decompress(chunk_content, dest_slice),
+                BLOSC_LZ4 | BLOSC_LZ4HC => lz4_flex::decompress_into(chunk_content, dest_slice)
+                    .map_err(|e| format!("LZ4 error: {}", e))?,
+                BLOSC_SNAPPY => codecs.snappy_decompress(chunk_content, dest_slice)?,
+                BLOSC_ZLIB => codecs.zlib_decompress(chunk_content, dest_slice)?,
+                BLOSC_ZSTD => codecs.zstd_decompress(chunk_content, dest_slice)?,
+                _ => return Err(format!("Unsupported compressor: {}", compressor).into()),
+            };
+            Ok(chunk_decompressed_size)
+        }
+    }
+}
 
-    // Decompress each block
-    let mut dest_offset = 0;
+/// Number of streams a block is stored in (matching C: dont_split or leftoverblock → 1
+/// stream).
+fn block_nstreams(dont_split: bool, leftoverblock: bool, typesize: usize) -> usize {
+    if !dont_split && !leftoverblock {
+        typesize
+    } else {
+        1
+    }
+}
 
-    for i in 0..nblocks {
-        let src_offset = bstarts[i];
 
-        // Determine block size in compressed buffer
-        let block_cbytes = if i + 1 < nblocks {
-            bstarts[i + 1] - src_offset
-        } else {
-            cbytes - src_offset
+/// Returns the byte value if all `nstreams` streams of a block are runs of it.
+fn uniform_run(content: &[u8], nstreams: usize, neblock: usize) -> Result<Option<u8>, BlockError> {
+    let mut content_offset = 0;
+    let mut value = None;
+    for _ in 0..nstreams {
+        let run = match next_stream(content, &mut content_offset, neblock)? {
+            Stream::Zeros => 0,
+            Stream::Run(v) => v,
+            _ => return Ok(None),
         };
+        if *value.get_or_insert(run) != run {
+            return Ok(None);
+        }
+    }
+    Ok(value)
+}
 
-        // Determine uncompressed block size
-        let leftoverblock = i == nblocks - 1 && nbytes % blocksize != 0;
-        let block_nbytes = if leftoverblock {
-            nbytes % blocksize // Last block may be smaller
+/// The part of [`decompress_block`] after the block's compressed bytes (`content`) have
+/// been located.
+fn decompress_block_content(
+    content: &[u8],
+    i: usize,
+    compressor: u8,
+    typesize: usize,
+    pipeline: &Pipeline,
+    role: BlockRole<'_>,
+    dont_split: bool,
+    leftoverblock: bool,
+    block_dest: &mut [u8],
+    scratch: &mut ScratchArena,
+) -> Result<(), BlockError> {
+    let block_nbytes = block_dest.len();
+
+    let nstreams = block_nstreams(dont_split, leftoverblock, typesize);
+    let neblock = block_nbytes / nstreams;
+
+    let mut content_offset = 0;
+    let mut block_dest_offset = 0;
+    scratch.recorder.record(Stage::Decompress, |stats| {
+        stats.blocks += 1;
+        stats.streams += nstreams as u64;
+    });
+
+    let use_temp = !pipeline.decodes_as_is(typesize, block_nbytes);
+    if use_temp {
+        // Runs of one value unshuffle to that value (bitshuffle: only all-0 or all-1
+        // bits), so fill the block directly instead of filling and unshuffling
+        if let Some(value) = uniform_run(content, nstreams, neblock)? {
+            if pipeline.keeps_runs(typesize, block_nbytes, value) {
+                block_dest.fill(value);
+                scratch.recorder.record(Stage::Decompress, |stats| {
+                    stats.run_streams += nstreams as u64;
+                });
+                return Ok(());
+            }
+        }
+    }
+    {
+        let target_slice = if use_temp {
+            grow(&mut scratch.filter.a, block_nbytes)
         } else {
-            blocksize
+            &mut block_dest[..]
         };
 
-        // Determine number of streams (matching C: dont_split or leftoverblock → 1 stream)
-        let nstreams = if !dont_split && !leftoverblock {
-            typesize
-        } else {
-            1
-        };
-        let neblock = block_nbytes / nstreams;
+        for _j in 0..nstreams {
+            let stream = next_stream(content, &mut content_offset, neblock)?;
+            let (run, raw) = match stream {
+                Stream::Zeros | Stream::Run(_) => (1, 0),
+                Stream::Raw(_) => (0, 1),
+                Stream::Compressed(_) => (0, 0),
+            };
+            let dest_slice = &mut target_slice[block_dest_offset..block_dest_offset + neblock];
+            let clock = Clock::start(false);
+            block_dest_offset +=
+                decode_stream(compressor, stream, dest_slice, &mut scratch.codecs)?;
+            let codec_time = clock.elapsed();
+            scratch.recorder.record(Stage::Decompress, |stats| {
+                stats.run_streams += run;
+                stats.raw_streams += raw;
+                stats.codec_time += codec_time;
+            });
+        }
 
-        if src_offset + block_cbytes > src.len() {
-            return Err("Compressed data is truncated".into());
+        if block_dest_offset != block_nbytes {
+            return Err(format!(
+                "Block {} decompression size mismatch: expected {}, got {}",
+                i, block_nbytes, block_dest_offset
+            )
+            .into());
         }
+    }
 
-        let content = &src[src_offset..src_offset + block_cbytes];
+    if use_temp {
+        let clock = Clock::start(false);
+        pipeline
+            .backward(typesize, block_dest, role, &mut scratch.filter)
+            .map_err(|code| format!("Block {} filter pipeline error {}", i, code))?;
+        let filter_time = clock.elapsed();
+        scratch.recorder.record(Stage::Decompress, |stats| stats.filter_time += filter_time);
+    }
 
-        let mut content_offset = 0;
-        let mut block_dest_offset = 0;
+    Ok(())
+}
 
-        let use_temp = doshuffle || dobitshuffle;
-        let mut temp_buf = if use_temp {
-            vec![0u8; block_nbytes]
-        } else {
-            Vec::new()
-        };
-        {
-            let target_slice = if use_temp {
-                &mut temp_buf[..]
-            } else {
-                &mut dest[dest_offset..dest_offset + block_nbytes]
-            };
+/// Decompresses a Blosc/Blosc2 compressed buffer (including header) into `dest`.
+///
+/// Automatically detects the format version, codec, and filter pipeline from the
+/// header. Supports both Blosc1 (16-byte header) and Blosc2 (32-byte extended header)
+/// formats.
+///
+/// Returns the number of decompressed bytes written to `dest`.
+pub fn decompress(src: &[u8], dest: &mut [u8]) -> Result<usize, Box<dyn std::error::Error>> {
+    decompress_internal(src, dest, 1, &mut ScratchArena::default())
+}
 
-            for _j in 0..nstreams {
-                if content_offset + 4 > block_cbytes {
-                    return Err("Block too small for chunk size".into());
-                }
-                // Read stream size as signed i32 (C uses sw32_ which returns signed)
-                let stream_cbytes = i32::from_le_bytes([
-                    content[content_offset],
-                    content[content_offset + 1],
-                    content[content_offset + 2],
-                    content[content_offset + 3],
-                ]);
-                content_offset += 4;
-
-                if stream_cbytes == 0 {
-                    // A run of zeros
-                    target_slice[block_dest_offset..block_dest_offset + neblock].fill(0);
-                    block_dest_offset += neblock;
-                } else if stream_cbytes < 0 {
-                    // Run-length encoding: negative value encodes the byte value
-                    if content_offset >= block_cbytes {
-                        return Err("Not enough input for run-length token".into());
-                    }
-                    let token = content[content_offset];
-                    content_offset += 1;
-
-                    if token & 0x1 != 0 {
-                        // A run of a non-zero byte value
-                        let value = (-stream_cbytes) as u8;
-                        target_slice[block_dest_offset..block_dest_offset + neblock].fill(value);
-                    } else {
-                        return Err("Invalid run-length token".into());
-                    }
-                    block_dest_offset += neblock;
-                } else if stream_cbytes as usize == neblock {
-                    // Incompressible: raw data stored directly
-                    if content_offset + neblock > block_cbytes {
-                        return Err("Chunk size exceeds block size".into());
-                    }
-                    target_slice[block_dest_offset..block_dest_offset + neblock]
-                        .copy_from_slice(&content[content_offset..content_offset + neblock]);
-                    content_offset += neblock;
-                    block_dest_offset += neblock;
-                } else {
-                    // Compressed data
-                    let sc = stream_cbytes as usize;
-                    if content_offset + sc > block_cbytes {
-                        return Err("Chunk size exceeds block size".into());
-                    }
+/// Like [`decompress`], but uses the thread count held in `context.dparams`.
+///
+/// This is the entry point behind [`crate::blosc2_decompress_ctx`]. With the `parallel`
+/// feature enabled, `dparams.nthreads > 1` decodes blocks on a pool of scoped threads,
+/// each writing straight into its own disjoint region of `dest`. Working buffers come
+/// from the context's [`ScratchArena`].
+pub fn decompress_ctx(
+    context: &Blosc2Context,
+    src: &[u8],
+    dest: &mut [u8],
+) -> Result<usize, Box<dyn std::error::Error>> {
+    decompress_internal(
+        src,
+        dest,
+        context.dparams.nthreads.max(1) as usize,
+        &mut context.scratch.borrow_mut(),
+    )
+}
 
-                    let chunk_content = &content[content_offset..content_offset + sc];
-                    content_offset += sc;
-
-                    let dest_slice =
-                        &mut target_slice[block_dest_offset..block_dest_offset + neblock];
-
-                    let chunk_decompressed_size = match compressor {
-                        BLOSC_BLOSCLZ => blosclz::decompress(chunk_content, dest_slice),
-                        BLOSC_LZ4 | BLOSC_LZ4HC => {
-                            lz4_flex::decompress_into(chunk_content, dest_slice)
-                                .map_err(|e| format!("LZ4 error: {}", e))?
-                        }
-                        BLOSC_SNAPPY => {
-                            let mut decoder = snap::raw::Decoder::new();
-                            decoder
-                                .decompress(chunk_content, dest_slice)
-                                .map_err(|e| format!("Snappy error: {}", e))?
-                        }
-                        BLOSC_ZLIB => {
-                            let mut decoder = flate2::read::ZlibDecoder::new(chunk_content);
-                            let mut writer = std::io::Cursor::new(dest_slice);
-                            std::io::copy(&mut decoder, &mut writer)
-                                .map_err(|e| format!("Zlib error: {}", e))?
-                                as usize
-                        }
-                        BLOSC_ZSTD => zstd::bulk::decompress_to_buffer(chunk_content, dest_slice)
-                            .map_err(|e| format!("Zstd error: {}", e))?,
-                        _ => return Err(format!("Unsupported compressor: {}", compressor).into()),
-                    };
-
-                    block_dest_offset += chunk_decompressed_size;
-                }
-            }
+pub(crate) fn decompress_internal(
+    src: &[u8],
+    dest: &mut [u8],
+    nthreads: usize,
+    scratch: &mut ScratchArena,
+) -> Result<usize, Box<dyn std::error::Error>> {
+    let info = ChunkInfo::parse_any(src)
+        .map_err(|code| format!("Invalid chunk (error {})", code))?;
+    let nbytes = info.nbytes;
+    if dest.len() < nbytes {
+        return Err("Destination buffer too small".into());
+    }
 
-            if block_dest_offset != block_nbytes {
-                return Err(format!(
-                    "Block {} decompression size mismatch: expected {}, got {}",
-                    i, block_nbytes, block_dest_offset
-                )
-                .into());
-            }
+    scratch.recorder.record(Stage::Decompress, |stats| {
+        stats.chunks += 1;
+        stats.nbytes += nbytes as u64;
+        stats.cbytes += info.cbytes as u64;
+        stats.special_chunks += info.special.is_some() as u64;
+        stats.memcpyed_chunks += (info.special.is_none() && info.memcpyed) as u64;
+    });
+    // Special chunks have no blocks, whatever the other flags say (C checks
+    // `special_type` before `memcpyed` too)
+    if let Some(special) = &info.special {
+        special.fill(0, &mut dest[..nbytes]);
+        return Ok(nbytes);
+    }
+    if info.memcpyed {
+        dest[0..nbytes].copy_from_slice(&src[info.header_len..info.header_len + nbytes]);
+        return Ok(nbytes);
+    }
+
+    if info.instrumented {
+        let records = instr_records(src, &info).map_err(|e| -> Box<dyn std::error::Error> { e })?;
+        if dest.len() < records.len() {
+            return Err("Destination buffer too small for the instrumentation records".into());
         }
+        dest[..records.len()].copy_from_slice(&records);
+        return Ok(records.len());
+    }
 
-        if use_temp {
-            if doshuffle {
-                filters::unshuffle(
-                    typesize,
-                    block_nbytes,
-                    &temp_buf,
-                    &mut dest[dest_offset..dest_offset + block_nbytes],
-                );
-            } else {
-                filters::bitunshuffle(
-                    typesize,
-                    block_nbytes,
-                    &temp_buf,
-                    &mut dest[dest_offset..dest_offset + block_nbytes],
-                )
-                .map_err(|e| format!("Bitunshuffle error: {}", e))?;
-            }
+    info.select_dict(src, scratch);
+    let blocksize = info.blocksize;
+
+    // The first block holds the delta references of the others
+    let mut delta_refs = DeltaRefs::default();
+
+    // Every block decodes into its own disjoint `blocksize` region of `dest` (the last
+    // one may be shorter), so blocks can be handed to worker threads independently,
+    // once the first one is done if the others are delta coded against it.
+    #[cfg(feature = "parallel")]
+    if nthreads > 1 && info.nblocks > 1 {
+        use std::sync::Mutex;
+
+        let first_parallel_block = info.pipeline.has_delta() as usize;
+        if first_parallel_block == 1 {
+            info.decode_block(src, 0, &mut dest[..blocksize], &mut delta_refs, scratch)
+                .map_err(|e| -> Box<dyn std::error::Error> { e })?;
         }
+        let delta_refs = &delta_refs;
+        let dict = info.dict.clone().map(|range| &src[range]);
+
+        let work = Mutex::new(
+            dest[..nbytes]
+                .chunks_mut(blocksize)
+                .enumerate()
+                .skip(first_parallel_block),
+        );
+        let worker = |arena: &mut ScratchArena| -> Result<(), BlockError> {
+            arena.codecs.set_zstd_ddict(dict);
+            loop {
+                let next = work.lock().unwrap().next();
+                let Some((i, block_dest)) = next else {
+                    return Ok(());
+                };
+                let role = match i {
+                    0 => BlockRole::First(None),
+                    _ => BlockRole::Other(delta_refs),
+                };
+                info.decode_block_as(src, i, role, block_dest, arena)?;
+            }
+        };
+
+        std::thread::scope(|s| {
+            let handles: Vec<_> = scratch
+                .workers(nthreads.min(info.nblocks))
+                .iter_mut()
+                .map(|arena| s.spawn(|| worker(arena)))
+                .collect();
+            handles.into_iter().try_for_each(|h| {
+                h.join()
+                    .unwrap_or_else(|_| Err("Decompression worker panicked".into()))
+            })
+        })
+        .map_err(|e| -> Box<dyn std::error::Error> { e })?;
+
+        return Ok(nbytes);
+    }
+    #[cfg(not(feature = "parallel"))]
+    let _ = nthreads;
 
-        dest_offset += block_dest_offset;
+    // Decompress each block
+    for (i, block_dest) in dest[..nbytes].chunks_mut(blocksize.max(1)).enumerate() {
+        info.decode_block(src, i, block_dest, &mut delta_refs, scratch)
+            .map_err(|e| -> Box<dyn std::error::Error> { e })?;
     }
 
     Ok(nbytes)
 }
 
+/// The [`Blosc2Instr`] records of an instrumented chunk, one per stream in block order
+/// (C `blosc_d` copies them out instead of decoding when `instr_codec` is set).
+fn instr_records(src: &[u8], info: &ChunkInfo) -> Result<Vec<u8>, BlockError> {
+    let mut records = Vec::new();
+    for i in 0..info.nblocks {
+        let content = block_content(src, i, &info.bstarts, info.cbytes)?;
+        let mut offset = 0;
+        for _ in 0..block_nstreams(info.dont_split, info.is_leftover(i), info.typesize) {
+            let record = content
+                .get(offset..offset + 4 + BLOSC2_INSTR_SIZE)
+                .filter(|s| s[..4] == (BLOSC2_INSTR_SIZE as i32).to_le_bytes())
+                .ok_or("Invalid instrumentation record")?;
+            records.extend_from_slice(&record[4..]);
+            offset += record.len();
+        }
+    }
+    Ok(records)
+}
+
 /// Partially decompresses a Blosc buffer, extracting `nitems` elements starting
 /// at element index `start`.
 ///
 /// This avoids decompressing the entire buffer when only a subset of elements is
 /// needed. Returns the number of bytes written to `dest`.
 pub fn getitem(src: &[u8], start: usize, nitems: usize, dest: &mut [u8]) -> Result<usize, i32> {
-    if src.len() < BLOSC_MIN_HEADER_LENGTH {
+    getitem_internal(src, start, nitems, dest, &mut ScratchArena::default())
+}
+
+/// Like [`getitem`], but decodes through the context's [`ScratchArena`], so repeated
+/// calls on the same context do not allocate block buffers.
+///
+/// This is the entry point behind [`crate::blosc2_getitem_ctx`].
+pub fn getitem_ctx(
+    context: &Blosc2Context,
+    src: &[u8],
+    start: usize,
+    nitems: usize,
+    dest: &mut [u8],
+) -> Result<usize, i32> {
+    getitem_internal(src, start, nitems, dest, &mut context.scratch.borrow_mut())
+}
+
+fn getitem_internal(
+    src: &[u8],
+    start: usize,
+    nitems: usize,
+    dest: &mut [u8],
+    scratch: &mut ScratchArena,
+) -> Result<usize, i32> {
+    let info = ChunkInfo::parse(src).map_err(|_| -1)?;
+    info.select_dict(src, scratch);
+    let (start_byte, end_byte) = info.item_range(start, nitems).map_err(|_| -1)?;
+    if dest.len() < end_byte - start_byte {
         return Err(-1);
     }
 
-    // Check version to determine header size
-    let version = src[0];
-    let header_len = if version == BLOSC2_VERSION_FORMAT_STABLE
+    if let Some(special) = &info.special {
+        let len = end_byte - start_byte;
+        special.fill(start_byte, &mut dest[..len]);
+        return Ok(len);
+    }
+    if info.memcpyed {
+        let len = end_byte - start_byte;
+        dest[..len].copy_from_slice(&src[info.header_len + start_byte..info.header_len + end_byte]);
+        return Ok(len);
+    }
+
+    // Blocks covered entirely by the request decode (and unfilter) straight into `dest`;
+    // see `ChunkInfo::decode_block_range` for the partially covered edge blocks.
+    let mut refs = DeltaRefs::default();
+    let mut dest_offset = 0;
+    for (i, local_start, local_end) in info.block_spans(start_byte, end_byte) {
+        let len = local_end - local_start;
+        let out = &mut dest[dest_offset..dest_offset + len];
+        let result = if len == info.block_len(i) {
+            info.decode_block(src, i, out, &mut refs, scratch)
+        } else {
+            info.decode_block_range(src, i, local_start, out, &mut refs, scratch)
+        };
+        if result.is_err() {
+            return Err(-1);
+        }
+        dest_offset += len;
+    }
+
+    Ok(dest_offset)
+}
+
+/// Header length implied by the format version in the first byte of a chunk.
+fn header_len(version: u8) -> usize {
+    if version == BLOSC2_VERSION_FORMAT_STABLE
         || version == BLOSC2_VERSION_FORMAT_BETA1
         || version == BLOSC2_VERSION_FORMAT_ALPHA
     {
         BLOSC_EXTENDED_HEADER_LENGTH
     } else {
         BLOSC_MIN_HEADER_LENGTH
-    };
+    }
+}
 
-    let flags = src[2];
-    let is_blosc1 = header_len == BLOSC_MIN_HEADER_LENGTH;
-    // Flags byte bits 5-7 store compformat, not compcode
-    let compressor = if !is_blosc1 {
-        src[22]
-    } else {
-        compformat_to_compcode((flags >> 5) & 0x7, is_blosc1)
-    };
-    let typesize = src[3] as usize;
-    let nbytes = u32::from_le_bytes(src[4..8].try_into().unwrap()) as usize;
-    let blocksize = u32::from_le_bytes(src[8..12].try_into().unwrap()) as usize;
-    let cbytes = u32::from_le_bytes(src[12..16].try_into().unwrap()) as usize;
+/// Whether `src` is a blosc2 chunk compressed with a dictionary.
+fn uses_dict(src: &[u8], header_len: usize) -> bool {
+    header_len == BLOSC_EXTENDED_HEADER_LENGTH && (src[31] & BLOSC2_USEDICT) != 0
+}
 
-    if src.len() < cbytes {
-        return Err(-1);
+/// Whether a chunk holds `instr_codec` records instead of data (`BLOSC2_INSTR_CODEC`).
+fn is_instrumented(src: &[u8], header_len: usize) -> bool {
+    header_len == BLOSC_EXTENDED_HEADER_LENGTH && (src[31] & BLOSC2_INSTR_CODEC) != 0
+}
+
+/// Location in `src` of the dictionary of a chunk with `BLOSC2_USEDICT` set: an i32 size
+/// at `bstarts_end`, just past `bstarts`, then the dictionary itself (C
+/// `initialize_context_decompression`).
+fn dict_range(src: &[u8], bstarts_end: usize) -> Result<std::ops::Range<usize>, i32> {
+    if src.len() < bstarts_end + 4 {
+        return Err(BLOSC2_ERROR_READ_BUFFER);
     }
+    let size = i32::from_le_bytes(src[bstarts_end..bstarts_end + 4].try_into().unwrap());
+    if size <= 0 || size as u32 > BLOSC2_MAXDICTSIZE {
+        return Err(BLOSC2_ERROR_CODEC_DICT);
+    }
+    let start = bstarts_end + 4;
+    let end = start + size as usize;
+    if src.len() < end {
+        return Err(BLOSC2_ERROR_READ_BUFFER);
+    }
+    Ok(start..end)
+}
 
-    let start_byte = start * typesize;
-    let end_byte = (start + nitems) * typesize;
-    if end_byte > nbytes {
-        return Err(-1);
+/// Header fields and block offsets of a compressed chunk, parsed once so that several
+/// item ranges can be served from the same chunk (see [`crate::reader::ChunkReader`]).
+pub(crate) struct ChunkInfo {
+    pub(crate) header_len: usize,
+    pub(crate) nbytes: usize,
+    pub(crate) cbytes: usize,
+    pub(crate) blocksize: usize,
+    pub(crate) typesize: usize,
+    pub(crate) compressor: u8,
+    pub(crate) pipeline: Pipeline,
+    pub(crate) dont_split: bool,
+    /// The chunk stores the data uncompressed right after the header.
+    pub(crate) memcpyed: bool,
+    /// What the chunk holds if it is a special chunk, which has no blocks.
+    pub(crate) special: Option<Special>,
+    pub(crate) nblocks: usize,
+    /// Offset of each block's streams; empty for memcpyed chunks.
+    pub(crate) bstarts: Vec<usize>,
+    /// Where the chunk's dictionary is, if it was compressed with one.
+    pub(crate) dict: Option<std::ops::Range<usize>>,
+    /// The streams hold `instr_codec` records instead of data
+    /// ([`ChunkInfo::parse_any`] only).
+    pub(crate) instrumented: bool,
+}
+
+impl ChunkInfo {
+    /// Parses the header and `bstarts` of `src` (same rules as [`decompress`]), which
+    /// must hold the whole chunk.
+    pub(crate) fn parse(src: &[u8]) -> Result<Self, i32> {
+        Self::parse_prefix(src)?.check_len(src)
     }
-    if dest.len() < end_byte - start_byte {
-        return Err(-1);
+
+    /// Like [`ChunkInfo::parse`], but accepts `instr_codec` chunks too, whose records only
+    /// [`decompress`] reads.
+    pub(crate) fn parse_any(src: &[u8]) -> Result<Self, i32> {
+        Self::read_prefix(src)?.check_len(src)
     }
 
-    if (flags & BLOSC_MEMCPYED) != 0 {
-        dest.copy_from_slice(&src[header_len + start_byte..header_len + end_byte]);
-        return Ok(end_byte - start_byte);
+    /// Checks that `src` holds the whole chunk.
+    fn check_len(self, src: &[u8]) -> Result<Self, i32> {
+        if src.len() < self.cbytes {
+            return Err(BLOSC2_ERROR_READ_BUFFER);
+        }
+        Ok(self)
     }
 
-    // Determine shuffle mode (same logic as decompress)
-    let mut doshuffle = (flags & BLOSC_DOSHUFFLE) != 0;
-    let mut dobitshuffle = (flags & BLOSC_DOBITSHUFFLE) != 0;
-    if (flags & BLOSC_DOSHUFFLE) != 0 && (flags & BLOSC_DOBITSHUFFLE) != 0 {
-        doshuffle = false;
-        dobitshuffle = false;
-        if !is_blosc1 {
-            for &f in &src[16..22] {
-                if f == BLOSC_SHUFFLE {
-                    doshuffle = true;
-                } else if f == BLOSC_BITSHUFFLE {
-                    dobitshuffle = true;
+    /// Number of leading bytes of a chunk that [`ChunkInfo::parse_prefix`] needs: the
+    /// header, the `bstarts` array and the dictionary, if any, or the whole of a special
+    /// chunk. `src` must hold at least the `BLOSC_MIN_HEADER_LENGTH` bytes that every
+    /// header starts with.
+    ///
+    /// The dictionary size is stored after `bstarts`, and whether the chunk is special
+    /// at the end of the extended header, so while `src` is shorter than those the
+    /// result is only a lower bound; call again once that many bytes are in.
+    pub(crate) fn prefix_len(src: &[u8]) -> usize {
+        let header_len = header_len(src[0]);
+        let (nbytes, cbytes, blocksize) = crate::api::blosc2_cbuffer_sizes(src);
+        if src.len() < header_len {
+            return header_len;
+        }
+        if special::special_type(src) != BLOSC2_NO_SPECIAL {
+            return std::cmp::max(cbytes, header_len);
+        }
+        if (src[2] & BLOSC_MEMCPYED) != 0 || nbytes == 0 || blocksize == 0 {
+            return header_len;
+        }
+        let bstarts_end = header_len + (nbytes + blocksize - 1) / blocksize * 4;
+        if !uses_dict(src, header_len) {
+            return bstarts_end;
+        }
+        match src.get(bstarts_end..bstarts_end + 4) {
+            Some(size) => {
+                let size = i32::from_le_bytes(size.try_into().unwrap());
+                if size > 0 && size as u32 <= BLOSC2_MAXDICTSIZE {
+                    bstarts_end + 4 + size as usize
+                } else {
+                    // Let `parse_prefix` report the bad size
+                    bstarts_end + 4
                 }
             }
+            None => bstarts_end + 4,
         }
     }
-    doshuffle = doshuffle && typesize > 1;
-    dobitshuffle = dobitshuffle && blocksize >= typesize;
-
-    let dont_split = (flags & 0x10) != 0;
-
-    let nblocks = if nbytes == 0 {
-        0
-    } else {
-        (nbytes + blocksize - 1) / blocksize
-    };
-
-    let start_block = start_byte / blocksize;
-    let end_block = (end_byte - 1) / blocksize;
 
-    // Read bstarts array
-    let mut bstarts = Vec::new();
-    if nblocks > 0 {
-        if src.len() < header_len + nblocks * 4 {
-            return Err(-1);
-        }
-        for i in 0..nblocks {
-            let off = header_len + i * 4;
-            let bstart = u32::from_le_bytes(src[off..off + 4].try_into().unwrap()) as usize;
-            bstarts.push(bstart);
+    /// Like [`ChunkInfo::parse`], but `src` only needs to hold the first
+    /// [`ChunkInfo::prefix_len`] bytes of the chunk.
+    pub(crate) fn parse_prefix(src: &[u8]) -> Result<Self, i32> {
+        let info = Self::read_prefix(src)?;
+        // Instrumented chunks have no items to read, only what `decompress` returns
+        if info.instrumented {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
         }
+        Ok(info)
     }
 
-    let mut dest_offset = 0;
+    fn read_prefix(src: &[u8]) -> Result<Self, i32> {
+        if src.len() < BLOSC_MIN_HEADER_LENGTH {
+            return Err(BLOSC2_ERROR_READ_BUFFER);
+        }
+
+        // Check version to determine header size
+        let header_len = header_len(src[0]);
+        if src.len() < header_len {
+            return Err(BLOSC2_ERROR_READ_BUFFER);
+        }
 
-    for i in start_block..=end_block {
-        let block_start_off = bstarts[i];
-        let block_end_off = if i + 1 < nblocks {
-            bstarts[i + 1]
+        let flags = src[2];
+        let is_blosc1 = header_len == BLOSC_MIN_HEADER_LENGTH;
+        // Flags byte bits 5-7 store compformat, not compcode
+        let compressor = if !is_blosc1 {
+            src[22]
         } else {
-            cbytes
+            compformat_to_compcode((flags >> 5) & 0x7, is_blosc1)
         };
-        let block_cbytes = block_end_off - block_start_off;
+        let typesize = src[3] as usize;
+        let (nbytes, cbytes, blocksize) = crate::api::blosc2_cbuffer_sizes(src);
+
+        if nbytes > 0 && blocksize == 0 {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
+        }
 
-        let leftoverblock = i == nblocks - 1 && nbytes % blocksize != 0;
-        let current_block_size = if leftoverblock {
-            nbytes % blocksize
+        let pipeline = Pipeline::from_header(src, header_len);
+        let dont_split = (flags & 0x10) != 0;
+        let memcpyed = (flags & BLOSC_MEMCPYED) != 0;
+        let special = Special::parse(src)?;
+        let instrumented = !memcpyed && special.is_none() && is_instrumented(src, header_len);
+
+        let nblocks = if nbytes == 0 {
+            0
         } else {
-            blocksize
+            (nbytes + blocksize - 1) / blocksize
         };
 
-        let nstreams = if !dont_split && !leftoverblock {
-            typesize
+        // Read bstarts array
+        let mut bstarts = Vec::new();
+        if !memcpyed && special.is_none() && nblocks > 0 {
+            if src.len() < header_len + nblocks * 4 {
+                return Err(BLOSC2_ERROR_READ_BUFFER);
+            }
+            bstarts.reserve(nblocks);
+            for i in 0..nblocks {
+                let off = header_len + i * 4;
+                let bstart = u32::from_le_bytes(src[off..off + 4].try_into().unwrap()) as usize;
+                bstarts.push(bstart);
+            }
+        }
+
+        let dict = if !memcpyed && special.is_none() && nblocks > 0 && uses_dict(src, header_len) {
+            Some(dict_range(src, header_len + nblocks * 4)?)
         } else {
-            1
+            None
         };
-        let neblock = current_block_size / nstreams;
 
-        // Decompress the whole block using stream-aware logic
-        let content = &src[block_start_off..block_start_off + block_cbytes];
-        let use_temp = doshuffle || dobitshuffle;
-        let mut raw_buf = vec![0u8; current_block_size];
-        {
-            let target = if use_temp {
-                &mut raw_buf[..]
-            } else {
-                &mut raw_buf[..]
-            };
+        if memcpyed && special.is_none() && cbytes < header_len + nbytes {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
+        }
 
-            let mut coff = 0usize;
-            let mut doff = 0usize;
-            for _j in 0..nstreams {
-                if coff + 4 > block_cbytes {
-                    return Err(-1);
-                }
-                let stream_cb = i32::from_le_bytes(content[coff..coff + 4].try_into().unwrap());
-                coff += 4;
-
-                if stream_cb == 0 {
-                    target[doff..doff + neblock].fill(0);
-                    doff += neblock;
-                } else if stream_cb < 0 {
-                    if coff >= block_cbytes {
-                        return Err(-1);
-                    }
-                    let token = content[coff];
-                    coff += 1;
-                    if token & 0x1 != 0 {
-                        let value = (-stream_cb) as u8;
-                        target[doff..doff + neblock].fill(value);
-                    } else {
-                        return Err(-1);
-                    }
-                    doff += neblock;
-                } else if stream_cb as usize == neblock {
-                    if coff + neblock > block_cbytes {
-                        return Err(-1);
-                    }
-                    target[doff..doff + neblock].copy_from_slice(&content[coff..coff + neblock]);
-                    coff += neblock;
-                    doff += neblock;
-                } else {
-                    let sc = stream_cb as usize;
-                    if coff + sc > block_cbytes {
-                        return Err(-1);
-                    }
-                    let chunk = &content[coff..coff + sc];
-                    coff += sc;
-                    let ds = &mut target[doff..doff + neblock];
-                    let n = match compressor {
-                        BLOSC_BLOSCLZ => blosclz::decompress(chunk, ds),
-                        BLOSC_LZ4 | BLOSC_LZ4HC => {
-                            lz4_flex::decompress_into(chunk, ds).map_err(|_| -1)?
-                        }
-                        BLOSC_SNAPPY => {
-                            let mut dec = snap::raw::Decoder::new();
-                            dec.decompress(chunk, ds).map_err(|_| -1)?
-                        }
-                        BLOSC_ZLIB => {
-                            let mut dec = flate2::read::ZlibDecoder::new(chunk);
-                            let mut w = std::io::Cursor::new(ds);
-                            std::io::copy(&mut dec, &mut w).map_err(|_| -1)? as usize
-                        }
-                        BLOSC_ZSTD => {
-                            zstd::bulk::decompress_to_buffer(chunk, ds).map_err(|_| -1)?
-                        }
-                        _ => return Err(-1),
-                    };
-                    doff += n;
-                }
-            }
-            if doff != current_block_size {
-                return Err(-1);
+        let info = ChunkInfo {
+            header_len,
+            nbytes,
+            cbytes,
+            blocksize,
+            typesize,
+            compressor,
+            pipeline,
+            dont_split,
+            memcpyed,
+            special,
+            nblocks,
+            bstarts,
+            dict,
+            instrumented,
+        };
+        // Block `i` is taken to end where block `i + 1` starts (`block_content`), so the
+        // blocks must follow each other between the first stream and the end of the chunk
+        let mut prev = info.streams_start();
+        for &bstart in &info.bstarts {
+            if bstart < prev || bstart > cbytes {
+                return Err(BLOSC2_ERROR_INVALID_HEADER);
             }
+            prev = bstart;
         }
+        Ok(info)
+    }
 
-        // Apply unshuffle if needed
-        let block_buf = if use_temp {
-            let mut buf = vec![0u8; current_block_size];
-            if doshuffle {
-                filters::unshuffle(typesize, current_block_size, &raw_buf, &mut buf);
-            } else if dobitshuffle {
-                filters::bitunshuffle(typesize, current_block_size, &raw_buf, &mut buf)
-                    .map_err(|_| -1)?;
+    /// Offset of the first block's streams: past `bstarts` and the dictionary.
+    pub(crate) fn streams_start(&self) -> usize {
+        match &self.dict {
+            Some(dict) => dict.end,
+            None => self.header_len + self.bstarts.len() * 4,
+        }
+    }
+
+    /// Makes `scratch` decode with this chunk's dictionary, or with none. `src` must hold
+    /// at least the first [`ChunkInfo::prefix_len`] bytes of the chunk; after this the
+    /// dictionary bytes are no longer needed.
+    pub(crate) fn select_dict(&self, src: &[u8], scratch: &mut ScratchArena) {
+        scratch
+            .codecs
+            .set_zstd_ddict(self.dict.clone().map(|range| &src[range]));
+    }
+
+    /// Whether block `i` is the shorter last block.
+    pub(crate) fn is_leftover(&self, i: usize) -> bool {
+        i == self.nblocks - 1 && self.nbytes % self.blocksize != 0
+    }
+
+    /// Uncompressed length of block `i`.
+    pub(crate) fn block_len(&self, i: usize) -> usize {
+        if self.is_leftover(i) {
+            self.nbytes % self.blocksize
+        } else {
+            self.blocksize
+        }
+    }
+
+    /// Number of streams block `i` is stored as: `typesize` for split blocks, else 1.
+    pub(crate) fn nstreams(&self, i: usize) -> usize {
+        block_nstreams(self.dont_split, self.is_leftover(i), self.typesize)
+    }
+
+    /// Converts an item range to a byte range, checking it lies inside the chunk.
+    pub(crate) fn item_range(&self, start: usize, nitems: usize) -> Result<(usize, usize), i32> {
+        let start_byte = start.checked_mul(self.typesize);
+        let end_byte = start
+            .checked_add(nitems)
+            .and_then(|end| end.checked_mul(self.typesize));
+        match (start_byte, end_byte) {
+            (Some(start_byte), Some(end_byte)) if end_byte <= self.nbytes => {
+                Ok((start_byte, end_byte))
             }
-            buf
+            _ => Err(BLOSC2_ERROR_INVALID_PARAM),
+        }
+    }
+
+    /// The blocks overlapping `start_byte..end_byte`, as `(block, local_start, local_end)`
+    /// with the overlap given relative to the start of the block.
+    pub(crate) fn block_spans(
+        &self,
+        start_byte: usize,
+        end_byte: usize,
+    ) -> impl Iterator<Item = (usize, usize, usize)> + '_ {
+        let blocks = if start_byte < end_byte {
+            start_byte / self.blocksize..(end_byte - 1) / self.blocksize + 1
         } else {
-            raw_buf
+            0..0
         };
+        blocks.map(move |i| {
+            let block_start = i * self.blocksize;
+            let block_end = block_start + self.block_len(i);
+            let copy_start = std::cmp::max(start_byte, block_start);
+            let copy_end = std::cmp::min(end_byte, block_end);
+            (i, copy_start - block_start, copy_end - block_start)
+        })
+    }
 
-        // Copy relevant part
-        let block_start = i * blocksize;
-        let block_end = block_start + current_block_size;
+    /// Range of `src` holding block `i`: its streams, or its raw bytes for memcpyed chunks.
+    /// Blocks of special chunks have no bytes of their own; their range is empty, at the
+    /// end of the chunk.
+    pub(crate) fn block_src_range(&self, i: usize) -> std::ops::Range<usize> {
+        if self.special.is_some() {
+            self.cbytes..self.cbytes
+        } else if self.memcpyed {
+            let start = self.header_len + i * self.blocksize;
+            start..start + self.block_len(i)
+        } else if i + 1 < self.nblocks {
+            self.bstarts[i]..self.bstarts[i + 1]
+        } else {
+            self.bstarts[i]..self.cbytes
+        }
+    }
 
-        let copy_start = std::cmp::max(start_byte, block_start);
-        let copy_end = std::cmp::min(end_byte, block_end);
+    /// Decodes block `i` from its compressed bytes alone (`src[block_src_range(i)]`) into
+    /// `block_dest`, which must be exactly [`ChunkInfo::block_len`] bytes long.
+    ///
+    /// Block 0 records the chunk's delta references in `refs`; the other blocks of a
+    /// delta chunk need them recorded already.
+    pub(crate) fn decode_block_content(
+        &self,
+        content: &[u8],
+        i: usize,
+        block_dest: &mut [u8],
+        refs: &mut DeltaRefs,
+        scratch: &mut ScratchArena,
+    ) -> Result<(), BlockError> {
+        let role = match i {
+            0 => BlockRole::First(Some(refs)),
+            _ => BlockRole::Other(refs),
+        };
+        decompress_block_content(
+            content,
+            i,
+            self.compressor,
+            self.typesize,
+            &self.pipeline,
+            role,
+            self.dont_split,
+            self.is_leftover(i),
+            block_dest,
+            scratch,
+        )
+    }
 
-        let local_start = copy_start - block_start;
-        let local_end = copy_end - block_start;
-        let len = local_end - local_start;
+    /// Decodes block `i` of `src` into `block_dest`, which must be exactly
+    /// [`ChunkInfo::block_len`] bytes long. `refs` holds the delta references of the
+    /// chunk, which are recorded first (by decoding block 0) if a delta block needs them.
+    pub(crate) fn decode_block(
+        &self,
+        src: &[u8],
+        i: usize,
+        block_dest: &mut [u8],
+        refs: &mut DeltaRefs,
+        scratch: &mut ScratchArena,
+    ) -> Result<(), BlockError> {
+        if i > 0 && self.pipeline.has_delta() && !refs.is_ready() {
+            let mut block0 = std::mem::take(&mut scratch.block);
+            let result = self.decode_block(src, 0, grow(&mut block0, self.block_len(0)), refs, scratch);
+            scratch.block = block0;
+            result?;
+        }
+        let content = block_content(src, i, &self.bstarts, self.cbytes)?;
+        self.decode_block_content(content, i, block_dest, refs, scratch)
+    }
 
-        dest[dest_offset..dest_offset + len].copy_from_slice(&block_buf[local_start..local_end]);
-        dest_offset += len;
+    /// Decodes block `i` of `src` into `block_dest` (exactly [`ChunkInfo::block_len`]
+    /// bytes long) as `role`, for callers that keep the delta references themselves, such
+    /// as the workers of [`decompress_internal`]. Mirrors C `blosc_d`.
+    #[cfg(feature = "parallel")]
+    pub(crate) fn decode_block_as(
+        &self,
+        src: &[u8],
+        i: usize,
+        role: BlockRole<'_>,
+        block_dest: &mut [u8],
+        scratch: &mut ScratchArena,
+    ) -> Result<(), BlockError> {
+        let content = block_content(src, i, &self.bstarts, self.cbytes)?;
+        decompress_block_content(
+            content,
+            i,
+            self.compressor,
+            self.typesize,
+            &self.pipeline,
+            role,
+            self.dont_split,
+            self.is_leftover(i),
+            block_dest,
+            scratch,
+        )
     }
 
-    Ok(dest_offset)
+    /// Decodes bytes `local_start..local_start + out.len()` of block `i` into `out`.
+    ///
+    /// A filtered block has to be decoded whole (into `scratch.block`) before the range can
+    /// be picked out. An unfiltered block is a plain concatenation of its streams, so only
+    /// the streams overlapping the range are decoded, and stored streams, runs and fully
+    /// covered compressed streams are written straight into `out`.
+    pub(crate) fn decode_block_range(
+        &self,
+        src: &[u8],
+        i: usize,
+        local_start: usize,
+        out: &mut [u8],
+        refs: &mut DeltaRefs,
+        scratch: &mut ScratchArena,
+    ) -> Result<(), BlockError> {
+        let block_len = self.block_len(i);
+        let local_end = local_start + out.len();
+
+        if !self.pipeline.decodes_as_is(self.typesize, block_len) {
+            let mut block_buf = std::mem::take(&mut scratch.block);
+            let result = self.decode_block(src, i, grow(&mut block_buf, block_len), refs, scratch);
+            if result.is_ok() {
+                out.copy_from_slice(&block_buf[local_start..local_end]);
+            }
+            scratch.block = block_buf;
+            return result;
+        }
+
+        let content = block_content(src, i, &self.bstarts, self.cbytes)?;
+        let nstreams = block_nstreams(self.dont_split, self.is_leftover(i), self.typesize);
+        let neblock = block_len / nstreams;
+
+        let mut content_offset = 0;
+        for j in 0..nstreams {
+            let stream = next_stream(content, &mut content_offset, neblock)?;
+            let stream_start = j * neblock;
+            let stream_end = stream_start + neblock;
+            if stream_end <= local_start {
+                continue;
+            }
+            if stream_start >= local_end {
+                break;
+            }
+
+            let copy_start = std::cmp::max(local_start, stream_start);
+            let copy_end = std::cmp::min(local_end, stream_end);
+            let out_slice = &mut out[copy_start - local_start..copy_end - local_start];
+            let stream_range = copy_start - stream_start..copy_end - stream_start;
+            match stream {
+                Stream::Zeros => out_slice.fill(0),
+                Stream::Run(value) => out_slice.fill(value),
+                Stream::Raw(data) => out_slice.copy_from_slice(&data[stream_range]),
+                Stream::Compressed(_) if stream_range.len() == neblock => {
+                    if decode_stream(self.compressor, stream, out_slice, &mut scratch.codecs)?
+                        != neblock
+                    {
+                        return Err(format!("Block {} decompression size mismatch", i).into());
+                    }
+                }
+                Stream::Compressed(_) => {
+                    let stream_buf = grow(&mut scratch.block, neblock);
+                    if decode_stream(self.compressor, stream, stream_buf, &mut scratch.codecs)?
+                        != neblock
+                    {
+                        return Err(format!("Block {} decompression size mismatch", i).into());
+                    }
+                    out_slice.copy_from_slice(&stream_buf[stream_range]);
+                }
+            }
+        }
+
+        Ok(())
+    }
 }
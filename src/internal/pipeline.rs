@@ -0,0 +1,425 @@
+//! The filter pipeline of a chunk: `filters[i]`, with `filters_meta[i]`, run in slot
+//! order on each block before the codec, and undone in reverse order after it (C
+//! `pipeline_forward` and `pipeline_backward`).
+//!
+//! Each stage reads one buffer and writes the other of a pair owned by the scratch
+//! arena, so a block goes through any number of stages without allocating. The first
+//! stage reads the caller's block and, when decoding, the last one writes straight into
+//! the destination. Delta decoding works in place.
+//!
+//! The delta filter codes every block against the chunk's first block, so blocks other
+//! than the first need that block's bytes as they were at the delta stage, which
+//! [`DeltaRefs`] holds. C takes the raw first block as the reference, which is the same as
+//! long as delta is the first filter to run; that is the only order that C can decode.
+//! Here the reference is the stage input, so any order round-trips.
+
+use super::grow;
+use crate::filters;
+use crate::internal::constants::*;
+
+/// The filters and their metadata, as stored in a blosc2 header.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub(crate) struct Pipeline {
+    filters: [u8; 6],
+    filters_meta: [u8; 6],
+}
+
+/// The two block buffers stages alternate between, and the bitshuffle working space.
+#[derive(Default)]
+pub(crate) struct FilterBuffers {
+    /// Filter output (compression) or codec output (decompression).
+    pub(crate) a: Vec<u8>,
+    b: Vec<u8>,
+    bitshuffle_tmp: Vec<u8>,
+}
+
+/// The first block of a chunk as each delta stage saw it, indexed by filter slot.
+#[derive(Default)]
+pub(crate) struct DeltaRefs {
+    /// Set once the first block has gone through the pipeline.
+    ready: bool,
+    refs: [Vec<u8>; BLOSC2_MAX_FILTERS as usize],
+}
+
+impl DeltaRefs {
+    fn store(&mut self, slot: usize, block: &[u8]) {
+        self.refs[slot].clear();
+        self.refs[slot].extend_from_slice(block);
+    }
+
+    /// The reference for a block of `n` bytes at `slot`.
+    fn get(&self, slot: usize, n: usize) -> Result<&[u8], i32> {
+        match self.refs[slot].get(..n) {
+            Some(dref) if self.ready => Ok(dref),
+            _ => Err(BLOSC2_ERROR_FILTER_PIPELINE),
+        }
+    }
+
+    pub(crate) fn is_ready(&self) -> bool {
+        self.ready
+    }
+}
+
+/// Which block of the chunk is being filtered, for the delta filter.
+pub(crate) enum BlockRole<'r> {
+    /// The first block, which is its own reference; its references are recorded in the
+    /// given [`DeltaRefs`], if any.
+    First(Option<&'r mut DeltaRefs>),
+    /// Any other block, coded against these references.
+    Other(&'r DeltaRefs),
+}
+
+/// Where the data of a block is between two stages.
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Loc {
+    Input,
+    A,
+    B,
+    Dest,
+}
+
+impl Loc {
+    fn next(self) -> Loc {
+        match self {
+            Loc::A => Loc::B,
+            _ => Loc::A,
+        }
+    }
+}
+
+/// How many passes filter `filter` makes over a block of `n` bytes: a byte shuffle is
+/// repeated `meta` more times (C cycles buffers between rounds), and stages that leave
+/// the block as it is (a shuffle of 1-byte items, a bitshuffle of fewer than 8 items, a
+/// truncation when decoding) are skipped. Any other filter is not supported, like
+/// user-defined filters in C without a registered implementation.
+fn passes(filter: u8, meta: u8, typesize: usize, n: usize, decoding: bool) -> Result<usize, i32> {
+    Ok(match filter {
+        BLOSC_NOFILTER => 0,
+        BLOSC_SHUFFLE if typesize <= 1 => 0,
+        BLOSC_SHUFFLE => meta as usize + 1,
+        BLOSC_BITSHUFFLE if n / typesize.max(1) < 8 => 0,
+        BLOSC_BITSHUFFLE | BLOSC_DELTA => 1,
+        BLOSC_TRUNC_PREC if decoding => 0,
+        BLOSC_TRUNC_PREC => 1,
+        _ => return Err(BLOSC2_ERROR_FILTER_PIPELINE),
+    })
+}
+
+impl Pipeline {
+    pub(crate) fn new(filters: &[u8; 6], filters_meta: &[u8; 6]) -> Self {
+        Pipeline {
+            filters: *filters,
+            filters_meta: *filters_meta,
+        }
+    }
+
+    /// The pipeline a chunk was compressed with. Blosc2 chunks set both shuffle flags
+    /// and keep the pipeline in the extended header; otherwise the flags byte says which
+    /// filters ran (C `flags_to_filters`). A blosc1 chunk with both shuffle flags set is
+    /// read as unshuffled.
+    pub(crate) fn from_header(src: &[u8], header_len: usize) -> Self {
+        let flags = src[2];
+        let marker = BLOSC_DOSHUFFLE | BLOSC_DOBITSHUFFLE;
+        let mut pipeline = Pipeline::default();
+        if flags & marker == marker && header_len == BLOSC_EXTENDED_HEADER_LENGTH {
+            pipeline.filters.copy_from_slice(&src[16..22]);
+            pipeline.filters_meta.copy_from_slice(&src[24..30]);
+            return pipeline;
+        }
+        let last = BLOSC2_MAX_FILTERS as usize - 1;
+        if flags & marker == BLOSC_DOSHUFFLE {
+            pipeline.filters[last] = BLOSC_SHUFFLE;
+        } else if flags & marker == BLOSC_DOBITSHUFFLE {
+            pipeline.filters[last] = BLOSC_BITSHUFFLE;
+        }
+        if flags & BLOSC_DODELTA != 0 {
+            pipeline.filters[last - 1] = BLOSC_DELTA;
+        }
+        pipeline
+    }
+
+    /// The filter of each slot, applied from slot 0 on compression.
+    pub(crate) fn filters(&self) -> [u8; 6] {
+        self.filters
+    }
+
+    /// The metadata byte of each filter slot.
+    pub(crate) fn filters_meta(&self) -> [u8; 6] {
+        self.filters_meta
+    }
+
+    pub(crate) fn has_delta(&self) -> bool {
+        self.filters.contains(&BLOSC_DELTA)
+    }
+
+    /// Whether decoding a block of `n` bytes needs no filter at all, so that the codec
+    /// output is the data.
+    pub(crate) fn decodes_as_is(&self, typesize: usize, n: usize) -> bool {
+        self.filters
+            .iter()
+            .zip(&self.filters_meta)
+            .all(|(&f, &m)| passes(f, m, typesize, n, true) == Ok(0))
+    }
+
+    /// Whether a block of `n` bytes of `value` decodes to itself: byte shuffles move
+    /// bytes around, and bitshuffles only keep all-0 and all-1 bits in place.
+    pub(crate) fn keeps_runs(&self, typesize: usize, n: usize, value: u8) -> bool {
+        self.filters.iter().zip(&self.filters_meta).all(|(&f, &m)| {
+            match passes(f, m, typesize, n, true) {
+                Ok(0) => true,
+                Ok(_) => {
+                    f == BLOSC_SHUFFLE || (f == BLOSC_BITSHUFFLE && (value == 0 || value == 0xff))
+                }
+                Err(_) => false,
+            }
+        })
+    }
+
+    /// Runs the pipeline forward on the block `src`. Returns the filtered bytes: `src`
+    /// itself when no filter applies, else one of `bufs`.
+    pub(crate) fn forward<'a>(
+        &self,
+        typesize: usize,
+        src: &'a [u8],
+        mut role: BlockRole<'_>,
+        bufs: &'a mut FilterBuffers,
+    ) -> Result<&'a [u8], i32> {
+        let n = src.len();
+        let FilterBuffers {
+            a,
+            b,
+            bitshuffle_tmp,
+        } = bufs;
+        let mut cur = Loc::Input;
+        for slot in 0..BLOSC2_MAX_FILTERS as usize {
+            let (filter, meta) = (self.filters[slot], self.filters_meta[slot]);
+            for _ in 0..passes(filter, meta, typesize, n, false)? {
+                let (input, output): (&[u8], &mut [u8]) = match cur {
+                    Loc::A => (&a[..n], grow(b, n)),
+                    Loc::B => (&b[..n], grow(a, n)),
+                    _ => (src, grow(a, n)),
+                };
+                match filter {
+                    BLOSC_SHUFFLE => filters::shuffle(typesize, n, input, output),
+                    BLOSC_BITSHUFFLE => {
+                        filters::bitshuffle_tmp(typesize, n, input, output, bitshuffle_tmp)
+                            .map_err(|_| BLOSC2_ERROR_FILTER_PIPELINE)?
+                    }
+                    BLOSC_DELTA => match &mut role {
+                        BlockRole::First(capture) => {
+                            if let Some(refs) = capture {
+                                refs.store(slot, input);
+                            }
+                            filters::delta_encoder(input, 0, n, typesize, input, output);
+                        }
+                        BlockRole::Other(refs) => {
+                            filters::delta_encoder(
+                                refs.get(slot, n)?,
+                                n,
+                                n,
+                                typesize,
+                                input,
+                                output,
+                            );
+                        }
+                    },
+                    _ => filters::truncate_precision(meta as i8, typesize, n, input, output)
+                        .map_err(|_| BLOSC2_ERROR_FILTER_PIPELINE)?,
+                }
+                cur = cur.next();
+            }
+        }
+        if let BlockRole::First(Some(refs)) = role {
+            refs.ready = true;
+        }
+        Ok(match cur {
+            Loc::A => &a[..n],
+            Loc::B => &b[..n],
+            _ => src,
+        })
+    }
+
+    /// Records the delta references of a chunk whose first block is `block0`, for
+    /// filtering the other blocks with [`BlockRole::Other`].
+    pub(crate) fn delta_refs(
+        &self,
+        typesize: usize,
+        block0: &[u8],
+        refs: &mut DeltaRefs,
+        bufs: &mut FilterBuffers,
+    ) -> Result<(), i32> {
+        refs.ready = false;
+        self.forward(typesize, block0, BlockRole::First(Some(refs)), bufs)?;
+        Ok(())
+    }
+
+    /// Undoes the pipeline on a block that the codec decoded into `bufs.a[..dest.len()]`
+    /// and writes the result to `dest`.
+    pub(crate) fn backward(
+        &self,
+        typesize: usize,
+        dest: &mut [u8],
+        mut role: BlockRole<'_>,
+        bufs: &mut FilterBuffers,
+    ) -> Result<(), i32> {
+        let n = dest.len();
+        let FilterBuffers {
+            a,
+            b,
+            bitshuffle_tmp,
+        } = bufs;
+        let mut moves = 0;
+        for slot in 0..BLOSC2_MAX_FILTERS as usize {
+            let (filter, meta) = (self.filters[slot], self.filters_meta[slot]);
+            if filter != BLOSC_DELTA {
+                moves += passes(filter, meta, typesize, n, true)?;
+            }
+        }
+
+        let mut cur = Loc::A;
+        for slot in (0..BLOSC2_MAX_FILTERS as usize).rev() {
+            let (filter, meta) = (self.filters[slot], self.filters_meta[slot]);
+            for _ in 0..passes(filter, meta, typesize, n, true)? {
+                if filter == BLOSC_DELTA {
+                    let buf: &mut [u8] = match cur {
+                        Loc::A => &mut a[..n],
+                        Loc::B => &mut b[..n],
+                        _ => &mut *dest,
+                    };
+                    match &mut role {
+                        BlockRole::First(capture) => {
+                            filters::delta_decoder(&[], 0, n, typesize, buf);
+                            if let Some(refs) = capture {
+                                refs.store(slot, buf);
+                            }
+                        }
+                        BlockRole::Other(refs) => {
+                            filters::delta_decoder(refs.get(slot, n)?, n, n, typesize, buf);
+                        }
+                    }
+                    continue;
+                }
+
+                // The last stage that moves data writes the result
+                moves -= 1;
+                let next = if moves == 0 { Loc::Dest } else { cur.next() };
+                let (input, output): (&[u8], &mut [u8]) = match (cur, next) {
+                    (Loc::A, Loc::Dest) => (&a[..n], &mut *dest),
+                    (Loc::B, Loc::Dest) => (&b[..n], &mut *dest),
+                    (Loc::A, _) => (&a[..n], grow(b, n)),
+                    _ => (&b[..n], grow(a, n)),
+                };
+                if filter == BLOSC_SHUFFLE {
+                    filters::unshuffle(typesize, n, input, output);
+                } else {
+                    filters::bitunshuffle_tmp(typesize, n, input, output, bitshuffle_tmp)
+                        .map_err(|_| BLOSC2_ERROR_FILTER_PIPELINE)?;
+                }
+                cur = next;
+            }
+        }
+        match cur {
+            Loc::A => dest.copy_from_slice(&a[..n]),
+            Loc::B => dest.copy_from_slice(&b[..n]),
+            _ => {}
+        }
+        if let BlockRole::First(Some(refs)) = role {
+            refs.ready = true;
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn roundtrip(filters: [u8; 6], meta: [u8; 6], typesize: usize, blocks: &[Vec<u8>]) {
+        let pipeline = Pipeline::new(&filters, &meta);
+        let mut bufs = FilterBuffers::default();
+        let mut refs = DeltaRefs::default();
+        pipeline
+            .delta_refs(typesize, &blocks[0], &mut refs, &mut bufs)
+            .unwrap();
+        let filtered: Vec<Vec<u8>> = blocks
+            .iter()
+            .enumerate()
+            .map(|(i, block)| {
+                let role = match i {
+                    0 => BlockRole::First(None),
+                    _ => BlockRole::Other(&refs),
+                };
+                pipeline
+                    .forward(typesize, block, role, &mut bufs)
+                    .unwrap()
+                    .to_vec()
+            })
+            .collect();
+
+        let mut decoded_refs = DeltaRefs::default();
+        for (i, (block, filtered)) in blocks.iter().zip(&filtered).enumerate() {
+            grow(&mut bufs.a, filtered.len()).copy_from_slice(filtered);
+            let mut dest = vec![0u8; block.len()];
+            let role = match i {
+                0 => BlockRole::First(Some(&mut decoded_refs)),
+                _ => BlockRole::Other(&decoded_refs),
+            };
+            pipeline
+                .backward(typesize, &mut dest, role, &mut bufs)
+                .unwrap();
+            assert!(
+                &dest == block,
+                "{filters:?} {meta:?} typesize {typesize} block {i}"
+            );
+        }
+    }
+
+    #[test]
+    fn any_order_roundtrips() {
+        let blocks: Vec<Vec<u8>> = (0..3u32)
+            .map(|b| {
+                (0..1024u32)
+                    .flat_map(|i| (b * 3000 + i * 3 + (i % 7)).to_le_bytes())
+                    .collect()
+            })
+            .collect();
+        let d = BLOSC_DELTA;
+        let s = BLOSC_SHUFFLE;
+        let bs = BLOSC_BITSHUFFLE;
+        for (filters, meta) in [
+            ([0, 0, 0, 0, 0, 0], [0; 6]),
+            ([0, 0, 0, 0, d, s], [0; 6]),
+            ([0, 0, 0, 0, s, d], [0; 6]),
+            ([0, 0, 0, d, bs, d], [0; 6]),
+            ([s, 0, s, 0, 0, 0], [1, 0, 2, 0, 0, 0]),
+            ([d, s, bs, 0, 0, 0], [0; 6]),
+        ] {
+            for typesize in [1, 2, 4, 8] {
+                roundtrip(filters, meta, typesize, &blocks);
+            }
+        }
+    }
+
+    #[test]
+    fn blosc1_flags() {
+        let mut header = [0u8; 16];
+        header[2] = BLOSC_DOSHUFFLE | BLOSC_DODELTA;
+        let pipeline = Pipeline::from_header(&header, 16);
+        assert_eq!(pipeline.filters, [0, 0, 0, 0, BLOSC_DELTA, BLOSC_SHUFFLE]);
+        header[2] = BLOSC_DOSHUFFLE | BLOSC_DOBITSHUFFLE;
+        assert_eq!(Pipeline::from_header(&header, 16), Pipeline::default());
+    }
+
+    #[test]
+    fn unknown_filters_fail() {
+        let pipeline = Pipeline::new(&[0, 0, 0, 0, 0, 40], &[0; 6]);
+        let mut bufs = FilterBuffers::default();
+        let src = [0u8; 64];
+        assert_eq!(
+            pipeline
+                .forward(4, &src, BlockRole::First(None), &mut bufs)
+                .err(),
+            Some(BLOSC2_ERROR_FILTER_PIPELINE)
+        );
+    }
+}
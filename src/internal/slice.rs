@@ -0,0 +1,220 @@
+//! Strided N-d selections from one chunk, for [`crate::api::blosc2_getslice_ctx`].
+//!
+//! The chunk holds a C-order array of `shape` items. A selection takes
+//! `start..stop` with a step along each dimension, as C `b2nd_get_slice_cbuffer`
+//! does without steps. Reading it row by row with `getitem` decodes a block once per
+//! row that touches it. Here the selected items are read in C order, which is also
+//! increasing order in the chunk. So the blocks are needed in increasing order, each one
+//! is decoded once into `scratch.block` and dropped when the next one is needed, and
+//! the blocks between the selected items are never decoded.
+
+use super::{grow, BlockError, ChunkInfo, DeltaRefs, ScratchArena};
+use crate::internal::constants::*;
+
+/// One dimension of a selection, in items: `start`, `start + step`, ... below `stop`.
+#[derive(Clone, Copy, Debug)]
+pub(crate) struct DimSelection {
+    pub(crate) len: usize,
+    pub(crate) start: usize,
+    pub(crate) stop: usize,
+    pub(crate) step: usize,
+}
+
+impl DimSelection {
+    /// Number of selected indices.
+    fn count(&self) -> usize {
+        (self.stop - self.start).div_ceil(self.step)
+    }
+
+    /// Whether every index is selected.
+    fn is_full(&self) -> bool {
+        self.start == 0 && self.stop == self.len && self.step == 1
+    }
+}
+
+/// Checks a selection and merges the dimensions whose rows are contiguous in the chunk:
+/// a fully selected dimension after one with step 1 turns the two into a single
+/// dimension. Returns `BLOSC2_ERROR_INVALID_PARAM` for more than `BLOSC2_MAX_DIM`
+/// dimensions, steps of 0 and ranges outside their dimension.
+fn normalize(dims: &[DimSelection]) -> Result<Vec<DimSelection>, i32> {
+    if dims.is_empty() || dims.len() > BLOSC2_MAX_DIM as usize {
+        return Err(BLOSC2_ERROR_INVALID_PARAM);
+    }
+    let mut merged: Vec<DimSelection> = Vec::with_capacity(dims.len());
+    for dim in dims {
+        if dim.step == 0 || dim.start > dim.stop || dim.stop > dim.len {
+            return Err(BLOSC2_ERROR_INVALID_PARAM);
+        }
+        match merged.last_mut() {
+            Some(prev) if prev.step == 1 && dim.is_full() => {
+                let len = prev
+                    .len
+                    .checked_mul(dim.len)
+                    .ok_or(BLOSC2_ERROR_INVALID_PARAM)?;
+                *prev = DimSelection {
+                    len,
+                    start: prev.start * dim.len,
+                    stop: prev.stop * dim.len,
+                    step: 1,
+                };
+            }
+            _ => merged.push(*dim),
+        }
+    }
+    Ok(merged)
+}
+
+/// Reads byte ranges of a chunk in increasing order, decoding each block at most once.
+struct Reader<'a> {
+    src: &'a [u8],
+    info: &'a ChunkInfo,
+    refs: DeltaRefs,
+    /// The block decoded into `block`, if any.
+    current: Option<usize>,
+    block: Vec<u8>,
+}
+
+impl Reader<'_> {
+    /// Copies the chunk bytes `start_byte..start_byte + out.len()` into `out`. Blocks
+    /// before the current one are no longer available.
+    fn read(
+        &mut self,
+        start_byte: usize,
+        out: &mut [u8],
+        scratch: &mut ScratchArena,
+    ) -> Result<(), BlockError> {
+        let info = self.info;
+        if let Some(special) = &info.special {
+            special.fill(start_byte, out);
+            return Ok(());
+        }
+        if info.memcpyed {
+            let start = info.header_len + start_byte;
+            out.copy_from_slice(&self.src[start..start + out.len()]);
+            return Ok(());
+        }
+
+        // Most strided items are inside the block the last one came from
+        if let Some(i) = self.current {
+            let local_start = start_byte.wrapping_sub(i * info.blocksize);
+            let block_len = info.block_len(i);
+            if local_start < block_len && block_len - local_start >= out.len() {
+                out.copy_from_slice(&self.block[local_start..local_start + out.len()]);
+                return Ok(());
+            }
+        }
+
+        let mut offset = 0;
+        for (i, local_start, local_end) in info.block_spans(start_byte, start_byte + out.len()) {
+            let n = local_end - local_start;
+            let piece = &mut out[offset..offset + n];
+            offset += n;
+            if self.current == Some(i) {
+                piece.copy_from_slice(&self.block[local_start..local_end]);
+            } else if n == info.block_len(i) {
+                // Later reads start past this block, so it goes straight to `out`
+                info.decode_block(self.src, i, piece, &mut self.refs, scratch)?;
+            } else {
+                let block = grow(&mut self.block, info.block_len(i));
+                info.decode_block(self.src, i, block, &mut self.refs, scratch)?;
+                self.current = Some(i);
+                piece.copy_from_slice(&block[local_start..local_end]);
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Copies the items of `src` selected by `dims` (one per dimension of the array of items
+/// the chunk holds, in C order) into `dest`, as a C-order array of the selected shape,
+/// and returns the number of bytes written.
+///
+/// Returns `BLOSC2_ERROR_INVALID_PARAM` for a bad selection or one whose shape does not
+/// match the chunk's `nbytes`, `BLOSC2_ERROR_WRITE_BUFFER` if `dest` is too small, the
+/// errors of [`ChunkInfo::parse`] for a bad chunk and `BLOSC2_ERROR_DATA` if a block does
+/// not decode.
+pub(crate) fn getslice(
+    src: &[u8],
+    dims: &[DimSelection],
+    dest: &mut [u8],
+    scratch: &mut ScratchArena,
+) -> Result<usize, i32> {
+    let info = ChunkInfo::parse(src)?;
+    let dims = normalize(dims)?;
+    let typesize = info.typesize;
+    let nitems = dims
+        .iter()
+        .try_fold(1usize, |n, dim| n.checked_mul(dim.len))
+        .ok_or(BLOSC2_ERROR_INVALID_PARAM)?;
+    if nitems.checked_mul(typesize) != Some(info.nbytes) {
+        return Err(BLOSC2_ERROR_INVALID_PARAM);
+    }
+    let nselected: usize = dims.iter().map(DimSelection::count).product();
+    let len = nselected * typesize;
+    if dest.len() < len {
+        return Err(BLOSC2_ERROR_WRITE_BUFFER);
+    }
+    if len == 0 {
+        return Ok(0);
+    }
+
+    info.select_dict(src, scratch);
+    let mut reader = Reader {
+        src,
+        info: &info,
+        refs: DeltaRefs::default(),
+        current: None,
+        block: std::mem::take(&mut scratch.block),
+    };
+    let result = scatter(&dims, typesize, &mut reader, &mut dest[..len], scratch);
+    scratch.block = reader.block;
+    result.map_err(|_| BLOSC2_ERROR_DATA)?;
+    Ok(len)
+}
+
+/// Walks the rows of the selection (every dimension but the last) in C order and reads
+/// the selected items of each one into `dest`.
+fn scatter(
+    dims: &[DimSelection],
+    typesize: usize,
+    reader: &mut Reader,
+    dest: &mut [u8],
+    scratch: &mut ScratchArena,
+) -> Result<(), BlockError> {
+    let (last, outer) = dims.split_last().unwrap();
+    // Items between consecutive indices of each dimension
+    let mut strides = vec![1usize; dims.len()];
+    for d in (0..dims.len() - 1).rev() {
+        strides[d] = strides[d + 1] * dims[d + 1].len;
+    }
+    let row_len = last.count() * typesize;
+    let mut index = vec![0usize; outer.len()];
+
+    for row in dest.chunks_exact_mut(row_len) {
+        let base: usize = outer
+            .iter()
+            .zip(&index)
+            .zip(&strides)
+            .map(|((dim, &k), &stride)| (dim.start + k * dim.step) * stride)
+            .sum();
+        let first = (base + last.start) * typesize;
+        if last.step == 1 {
+            reader.read(first, row, scratch)?;
+        } else {
+            let step_bytes = last.step * typesize;
+            for (k, item) in row.chunks_exact_mut(typesize).enumerate() {
+                reader.read(first + k * step_bytes, item, scratch)?;
+            }
+        }
+
+        // Next row, last outer dimension first
+        for d in (0..outer.len()).rev() {
+            index[d] += 1;
+            if index[d] < outer[d].count() {
+                break;
+            }
+            index[d] = 0;
+        }
+    }
+    Ok(())
+}
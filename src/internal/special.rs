@@ -0,0 +1,182 @@
+//! Special chunks: a blosc2 header with no blocks, standing for a chunk of zeros, NaNs,
+//! one repeated item or uninitialized bytes.
+//!
+//! C keeps the kind in bits 4-6 of `blosc2_flags` (header byte 31) and makes such chunks
+//! with `blosc2_chunk_zeros`, `blosc2_chunk_nans`, `blosc2_chunk_repeatval` and
+//! `blosc2_chunk_uninit`. A `BLOSC2_SPECIAL_VALUE` chunk stores its item right after the
+//! header, and its `cbytes` is the header length plus `typesize`. Decoding fills the
+//! destination without looking at any block (C `set_nans`, `set_values`).
+
+use super::{create_header_blosc2, header_len, plan_chunk, splitmode, BlockSizing};
+use crate::api::Blosc2Cparams;
+use crate::internal::constants::*;
+
+/// What a special chunk decodes to.
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) enum Special {
+    /// `BLOSC2_SPECIAL_ZERO`: all zero bytes.
+    Zero,
+    /// `BLOSC2_SPECIAL_NAN` and `BLOSC2_SPECIAL_VALUE`: this item, over and over.
+    Repeat(Vec<u8>),
+    /// `BLOSC2_SPECIAL_UNINIT`: nothing is written; C leaves the destination as it was.
+    Uninit,
+}
+
+/// The special kind of a chunk, `BLOSC2_NO_SPECIAL` for a regular one. `src` must hold
+/// at least `BLOSC_MIN_HEADER_LENGTH` bytes; blosc1 chunks are never special.
+pub(crate) fn special_type(src: &[u8]) -> u8 {
+    if header_len(src[0]) != BLOSC_EXTENDED_HEADER_LENGTH
+        || src.len() < BLOSC_EXTENDED_HEADER_LENGTH
+    {
+        return BLOSC2_NO_SPECIAL;
+    }
+    (src[BLOSC2_CHUNK_BLOSC2_FLAGS as usize] >> 4) & BLOSC2_SPECIAL_MASK
+}
+
+/// The bytes of f32 or f64 NaN as C `nanf("")` / `nan("")` store them.
+fn nan_item(typesize: usize) -> Option<Vec<u8>> {
+    match typesize {
+        4 => Some(f32::NAN.to_le_bytes().to_vec()),
+        8 => Some(f64::NAN.to_le_bytes().to_vec()),
+        _ => None,
+    }
+}
+
+impl Special {
+    /// Reads the special kind of the chunk at the start of `src` and, for
+    /// `BLOSC2_SPECIAL_VALUE`, its item, with the checks of C `read_chunk_header`.
+    /// `src` must hold the header and the item.
+    pub(crate) fn parse(src: &[u8]) -> Result<Option<Special>, i32> {
+        let typesize = src[3] as usize;
+        let special = match special_type(src) {
+            BLOSC2_NO_SPECIAL => return Ok(None),
+            BLOSC2_SPECIAL_ZERO => Special::Zero,
+            BLOSC2_SPECIAL_UNINIT => Special::Uninit,
+            // C only finds out in `set_nans`, when decoding
+            BLOSC2_SPECIAL_NAN => Special::Repeat(nan_item(typesize).ok_or(BLOSC2_ERROR_DATA)?),
+            BLOSC2_SPECIAL_VALUE => {
+                // The item is the only thing after the header
+                let (_, cbytes, _) = crate::api::blosc2_cbuffer_sizes(src);
+                if typesize == 0 || cbytes != BLOSC_EXTENDED_HEADER_LENGTH + typesize {
+                    return Err(BLOSC2_ERROR_INVALID_HEADER);
+                }
+                match src.get(BLOSC_EXTENDED_HEADER_LENGTH..cbytes) {
+                    Some(item) => Special::Repeat(item.to_vec()),
+                    None => return Err(BLOSC2_ERROR_READ_BUFFER),
+                }
+            }
+            _ => return Err(BLOSC2_ERROR_INVALID_HEADER),
+        };
+        Ok(Some(special))
+    }
+
+    /// Writes what the chunk holds at bytes `offset..offset + out.len()` into `out`.
+    pub(crate) fn fill(&self, offset: usize, out: &mut [u8]) {
+        match self {
+            Special::Zero => out.fill(0),
+            Special::Uninit => {}
+            Special::Repeat(item) => fill_repeat(item, offset, out),
+        }
+    }
+}
+
+/// Fills `out` with `item` repeated, as the bytes starting at `offset` of a run of it.
+fn fill_repeat(item: &[u8], offset: usize, out: &mut [u8]) {
+    let first = item[0];
+    if item.iter().all(|&b| b == first) {
+        out.fill(first);
+        return;
+    }
+    // One item (rotated to `offset`), then doubling copies of whole items, so every copy
+    // is a memcpy of the growing prefix
+    let typesize = item.len();
+    let head = std::cmp::min(typesize, out.len());
+    for (k, b) in out[..head].iter_mut().enumerate() {
+        *b = item[(offset + k) % typesize];
+    }
+    let mut filled = head;
+    while filled < out.len() {
+        let n = std::cmp::min(filled, out.len() - filled);
+        out.copy_within(..n, filled);
+        filled += n;
+    }
+}
+
+/// Writes a special chunk of `nbytes` bytes to `dest` and returns its length: the
+/// header, followed by `value` for `BLOSC2_SPECIAL_VALUE`.
+///
+/// Like C, the header carries the block size that regular compression would pick for
+/// `cparams`, but no filters and the BloscLZ codec, and `nbytes` must be a whole
+/// number of items.
+pub(crate) fn chunk_special(
+    cparams: &Blosc2Cparams,
+    special: u8,
+    nbytes: usize,
+    value: &[u8],
+    dest: &mut [u8],
+) -> Result<usize, i32> {
+    let typesize = cparams.typesize;
+    if typesize <= 0 || typesize > u8::MAX as i32 {
+        return Err(BLOSC2_ERROR_INVALID_PARAM);
+    }
+    let typesize = typesize as usize;
+    if nbytes > BLOSC2_MAX_BUFFERSIZE {
+        return Err(BLOSC2_ERROR_MAX_BUFSIZE_EXCEEDED);
+    }
+    if nbytes % typesize != 0 {
+        return Err(BLOSC2_ERROR_DATA);
+    }
+    let cbytes = match special {
+        BLOSC2_SPECIAL_ZERO | BLOSC2_SPECIAL_UNINIT => BLOSC_EXTENDED_HEADER_LENGTH,
+        BLOSC2_SPECIAL_NAN if nan_item(typesize).is_some() => BLOSC_EXTENDED_HEADER_LENGTH,
+        BLOSC2_SPECIAL_VALUE if value.len() == typesize => BLOSC_EXTENDED_HEADER_LENGTH + typesize,
+        _ => return Err(BLOSC2_ERROR_INVALID_PARAM),
+    };
+    if dest.len() < cbytes {
+        return Err(BLOSC2_ERROR_DATA);
+    }
+
+    let plan = plan_chunk(
+        cparams.clevel as i32,
+        typesize,
+        nbytes,
+        cparams.compcode,
+        true,
+        &cparams.filters,
+        splitmode(cparams),
+        BlockSizing::from_cparams(cparams)?,
+    );
+    let header = create_header_blosc2(
+        nbytes,
+        plan.blocksize,
+        cbytes,
+        typesize,
+        BLOSC_DOSHUFFLE | BLOSC_DOBITSHUFFLE,
+        BLOSC_BLOSCLZ,
+        &[0; 6],
+        &[0; 6],
+        special << 4,
+    );
+    dest[..BLOSC_EXTENDED_HEADER_LENGTH].copy_from_slice(&header);
+    dest[BLOSC_EXTENDED_HEADER_LENGTH..cbytes]
+        .copy_from_slice(&value[..cbytes - BLOSC_EXTENDED_HEADER_LENGTH]);
+    Ok(cbytes)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn repeat_fill_keeps_item_phase() {
+        let item = [1u8, 2, 3];
+        for offset in 0..3 {
+            for len in [0, 1, 2, 3, 7, 100] {
+                let mut out = vec![0u8; len];
+                fill_repeat(&item, offset, &mut out);
+                let expected: Vec<u8> = (0..len).map(|k| item[(offset + k) % 3]).collect();
+                assert_eq!(out, expected);
+            }
+        }
+    }
+}
@@ -24,10 +24,26 @@ pub mod api;
 pub mod convenience;
 /// Compression codec implementations (BloscLZ, etc.).
 pub mod codecs;
-/// Pre-compression filter implementations (byte shuffle, bitshuffle).
+/// Pre-compression filter implementations (byte shuffle, bitshuffle, delta, precision
+/// truncation).
 pub mod filters;
+/// Reading c-blosc2 contiguous frames (`.b2frame`) chunk by chunk.
+pub mod frame;
+/// Per-stage counters (`instrument` feature) and instrumented chunks (`instr_codec`).
+pub mod instr;
 /// Low-level compression/decompression internals and protocol constants.
 pub mod internal;
+/// Cached item reader for repeated `getitem`-style reads of one chunk.
+pub mod reader;
+/// Super-chunks: many compressed chunks stored and indexed as one object.
+pub mod schunk;
+/// Incremental decoding of a chunk as its compressed bytes arrive.
+pub mod stream;
+/// Automatic codec, shuffle and clevel selection from measurements (btune-lite).
+pub mod tune;
+/// Borrowed views of a chunk's header and block offsets, with single-block decoding.
+pub mod view;
 
 pub use crate::internal::constants::*;
 pub use api::*;
+pub use tune::BLOSC_BTUNE;
@@ -0,0 +1,213 @@
+//! Stateful item reader for one compressed chunk.
+//!
+//! `blosc1_getitem` re-parses the header and `bstarts` and decodes every touched block on
+//! each call, so many small reads into the same block decode it many times. A
+//! [`ChunkReader`](crate::reader::ChunkReader) parses the chunk once and keeps the most
+//! recently used decoded blocks (already unshuffled) within a memory budget, serving
+//! later ranges from memory.
+//!
+//! ```rust
+//! use blusc::reader::ChunkReader;
+//! use blusc::{blosc2_compress, BLOSC2_MAX_OVERHEAD, BLOSC_SHUFFLE};
+//!
+//! let input: Vec<u8> = (0..4096u32).flat_map(|i| i.to_le_bytes()).collect();
+//! let mut compressed = vec![0u8; input.len() + BLOSC2_MAX_OVERHEAD];
+//! let cbytes = blosc2_compress(5, BLOSC_SHUFFLE as i32, 4, &input, &mut compressed);
+//! compressed.truncate(cbytes as usize);
+//!
+//! let mut reader = ChunkReader::new(&compressed[..], 1 << 20).unwrap();
+//! let mut item = [0u8; 4];
+//! for i in 0..4096 {
+//!     reader.getitem(i, 1, &mut item).unwrap();
+//!     assert_eq!(u32::from_le_bytes(item), i as u32);
+//! }
+//! ```
+
+use crate::internal::constants::*;
+use crate::internal::{ChunkInfo, DeltaRefs, ScratchArena};
+
+/// A decoded block held by the cache.
+struct CachedBlock {
+    index: usize,
+    last_used: u64,
+    data: Vec<u8>,
+}
+
+/// Least-recently-used cache of decoded blocks, bounded by the total size of the blocks.
+/// A chunk holds at most a few hundred blocks, so a linear scan beats a map here.
+struct BlockCache {
+    budget: usize,
+    used: usize,
+    tick: u64,
+    entries: Vec<CachedBlock>,
+}
+
+impl BlockCache {
+    fn new(budget: usize) -> Self {
+        BlockCache {
+            budget,
+            used: 0,
+            tick: 0,
+            entries: Vec::new(),
+        }
+    }
+
+    /// Returns the cached copy of block `index`, marking it as the most recently used.
+    fn get(&mut self, index: usize) -> Option<&[u8]> {
+        self.tick += 1;
+        let tick = self.tick;
+        self.entries.iter_mut().find(|e| e.index == index).map(|e| {
+            e.last_used = tick;
+            &e.data[..]
+        })
+    }
+
+    /// Makes room for a block of `len` bytes by evicting the least recently used blocks,
+    /// and returns a buffer for it (recycled from an evicted block when possible).
+    /// Returns `None` when `len` exceeds the whole budget.
+    fn reserve(&mut self, len: usize) -> Option<Vec<u8>> {
+        if len > self.budget {
+            return None;
+        }
+        let mut buf = Vec::new();
+        while self.used + len > self.budget {
+            let lru = self
+                .entries
+                .iter()
+                .enumerate()
+                .min_by_key(|(_, e)| e.last_used)
+                .map(|(i, _)| i)?;
+            let evicted = self.entries.swap_remove(lru);
+            self.used -= evicted.data.len();
+            if evicted.data.capacity() > buf.capacity() {
+                buf = evicted.data;
+            }
+        }
+        Some(buf)
+    }
+
+    /// Stores `data` (exactly the decoded block) as block `index`.
+    fn insert(&mut self, index: usize, data: Vec<u8>) {
+        self.used += data.len();
+        self.entries.push(CachedBlock {
+            index,
+            last_used: self.tick,
+            data,
+        });
+    }
+}
+
+/// Serves item ranges from one compressed chunk, like `blosc1_getitem`, but parses the
+/// chunk only once and caches decoded blocks up to `cache_bytes` of decoded data.
+///
+/// `S` is anything that can be viewed as the chunk bytes (`&[u8]`, `Vec<u8>`, ...).
+pub struct ChunkReader<S: AsRef<[u8]>> {
+    src: S,
+    info: ChunkInfo,
+    cache: BlockCache,
+    /// Delta references of the chunk, recorded the first time a block needs them.
+    delta_refs: DeltaRefs,
+    scratch: ScratchArena,
+}
+
+impl<S: AsRef<[u8]>> ChunkReader<S> {
+    /// Parses the header and block offsets of `src`. At most `cache_bytes` bytes of
+    /// decoded blocks are kept; with a budget smaller than one block nothing is cached
+    /// and every read decodes, as `blosc1_getitem` does.
+    ///
+    /// Returns a negative `BLOSC2_ERROR_*` code if `src` is not a valid chunk.
+    pub fn new(src: S, cache_bytes: usize) -> Result<Self, i32> {
+        let info = ChunkInfo::parse(src.as_ref())?;
+        // The scratch arena is ours alone, so the dictionary stays selected
+        let mut scratch = ScratchArena::default();
+        info.select_dict(src.as_ref(), &mut scratch);
+        Ok(ChunkReader {
+            src,
+            info,
+            cache: BlockCache::new(cache_bytes),
+            delta_refs: DeltaRefs::default(),
+            scratch,
+        })
+    }
+
+    /// Uncompressed size of the chunk in bytes.
+    pub fn nbytes(&self) -> usize {
+        self.info.nbytes
+    }
+
+    /// Size of one item in bytes.
+    pub fn typesize(&self) -> usize {
+        self.info.typesize
+    }
+
+    /// Uncompressed size of a block in bytes (the unit of caching).
+    pub fn blocksize(&self) -> usize {
+        self.info.blocksize
+    }
+
+    /// Bytes of decoded blocks currently held by the cache.
+    pub fn cached_bytes(&self) -> usize {
+        self.cache.used
+    }
+
+    /// Copies `nitems` items starting at item `start` into `dest` and returns the number
+    /// of bytes written.
+    ///
+    /// Returns `BLOSC2_ERROR_INVALID_PARAM` if the range is outside the chunk,
+    /// `BLOSC2_ERROR_WRITE_BUFFER` if `dest` is too small and `BLOSC2_ERROR_DATA` if a
+    /// block fails to decode.
+    pub fn getitem(&mut self, start: usize, nitems: usize, dest: &mut [u8]) -> Result<usize, i32> {
+        let src = self.src.as_ref();
+        let info = &self.info;
+        let (start_byte, end_byte) = info.item_range(start, nitems)?;
+        let len = end_byte - start_byte;
+        if dest.len() < len {
+            return Err(BLOSC2_ERROR_WRITE_BUFFER);
+        }
+
+        // Special or uncompressed chunk: nothing to decode or cache
+        if let Some(special) = &info.special {
+            special.fill(start_byte, &mut dest[..len]);
+            return Ok(len);
+        }
+        if info.memcpyed {
+            let data = &src[info.header_len..];
+            dest[..len].copy_from_slice(&data[start_byte..end_byte]);
+            return Ok(len);
+        }
+
+        let mut dest_offset = 0;
+        for (i, local_start, local_end) in info.block_spans(start_byte, end_byte) {
+            let n = local_end - local_start;
+            let out = &mut dest[dest_offset..dest_offset + n];
+            dest_offset += n;
+
+            if let Some(block) = self.cache.get(i) {
+                out.copy_from_slice(&block[local_start..local_end]);
+                continue;
+            }
+
+            let block_len = info.block_len(i);
+            match self.cache.reserve(block_len) {
+                Some(mut buf) => {
+                    buf.resize(block_len, 0);
+                    info.decode_block(src, i, &mut buf, &mut self.delta_refs, &mut self.scratch)
+                        .map_err(|_| BLOSC2_ERROR_DATA)?;
+                    out.copy_from_slice(&buf[local_start..local_end]);
+                    self.cache.insert(i, buf);
+                }
+                // Not cacheable: decode into `dest` as `getitem` does
+                None if n == block_len => {
+                    info.decode_block(src, i, out, &mut self.delta_refs, &mut self.scratch)
+                        .map_err(|_| BLOSC2_ERROR_DATA)?;
+                }
+                None => {
+                    info.decode_block_range(src, i, local_start, out, &mut self.delta_refs, &mut self.scratch)
+                        .map_err(|_| BLOSC2_ERROR_DATA)?;
+                }
+            }
+        }
+
+        Ok(dest_offset)
+    }
+}
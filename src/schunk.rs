@@ -0,0 +1,293 @@
+//! Super-chunks: a sequence of compressed chunks stored as one object.
+//!
+//! C `blosc2_schunk` keeps an in-memory super-chunk as an array of chunk pointers plus
+//! its `cparams`/`dparams`, and every chunk but the last holds exactly `chunksize`
+//! bytes. [`Schunk`](crate::schunk::Schunk) does the same. Chunk `i` is `chunks[i]`, and
+//! its data starts at byte `i * chunksize` of the uncompressed array, so both
+//! lookups take O(1). Chunks are ordinary blosc chunks and are decoded with
+//! [`crate::blosc2_decompress_ctx`].
+//!
+//! ```rust
+//! use blusc::schunk::Schunk;
+//! use blusc::{BLOSC2_CPARAMS_DEFAULTS, BLOSC2_DPARAMS_DEFAULTS};
+//!
+//! let mut cparams = BLOSC2_CPARAMS_DEFAULTS;
+//! cparams.typesize = 4;
+//! let mut schunk = Schunk::new(cparams, BLOSC2_DPARAMS_DEFAULTS);
+//! for c in 0..10u32 {
+//!     let data: Vec<u8> = (0..1000).flat_map(|i| (c * 1000 + i).to_le_bytes()).collect();
+//!     schunk.append_buffer(&data).unwrap();
+//! }
+//!
+//! let mut chunk = vec![0u8; schunk.chunksize()];
+//! schunk.decompress_chunk(7, &mut chunk).unwrap();
+//! assert_eq!(&chunk[..4], &7000u32.to_le_bytes());
+//! ```
+
+use crate::api::{
+    blosc2_create_cctx, blosc2_create_dctx, Blosc2Context, Blosc2Cparams, Blosc2Dparams,
+};
+use crate::internal::constants::*;
+use crate::internal::{self, ChunkInfo};
+
+/// An in-memory super-chunk: compressed chunks indexed by position, with the
+/// parameters used to compress new ones and to decompress them all.
+pub struct Schunk {
+    cctx: Blosc2Context,
+    dctx: Blosc2Context,
+    chunks: Vec<Vec<u8>>,
+    /// Uncompressed size of every chunk but the last, set by the first chunk added.
+    chunksize: Option<usize>,
+    nbytes: usize,
+    cbytes: usize,
+}
+
+impl Schunk {
+    /// Creates an empty super-chunk (C `blosc2_schunk_new` with an in-memory, sparse
+    /// storage).
+    pub fn new(cparams: Blosc2Cparams, dparams: Blosc2Dparams) -> Self {
+        Schunk {
+            cctx: blosc2_create_cctx(cparams),
+            dctx: blosc2_create_dctx(dparams),
+            chunks: Vec::new(),
+            chunksize: None,
+            nbytes: 0,
+            cbytes: 0,
+        }
+    }
+
+    /// Parameters new chunks are compressed with.
+    pub fn cparams(&self) -> &Blosc2Cparams {
+        &self.cctx.cparams
+    }
+
+    /// Parameters chunks are decompressed with.
+    pub fn dparams(&self) -> &Blosc2Dparams {
+        &self.dctx.dparams
+    }
+
+    /// Number of chunks.
+    pub fn nchunks(&self) -> usize {
+        self.chunks.len()
+    }
+
+    /// Uncompressed size of a chunk (the last one may be shorter), or 0 before the first
+    /// chunk is added.
+    pub fn chunksize(&self) -> usize {
+        self.chunksize.unwrap_or(0)
+    }
+
+    /// Size of one item, from the compression parameters.
+    pub fn typesize(&self) -> usize {
+        self.cctx.cparams.typesize as usize
+    }
+
+    /// Uncompressed size of all chunks together.
+    pub fn nbytes(&self) -> usize {
+        self.nbytes
+    }
+
+    /// Compressed size of all chunks together.
+    pub fn cbytes(&self) -> usize {
+        self.cbytes
+    }
+
+    /// Compresses `src` with the super-chunk's `cparams` and appends it as a new chunk
+    /// (C `blosc2_schunk_append_buffer`). Returns the new number of chunks.
+    pub fn append_buffer(&mut self, src: &[u8]) -> Result<usize, i32> {
+        if !self.fits_at_end(src.len()) {
+            return Err(BLOSC2_ERROR_CHUNK_APPEND);
+        }
+        let mut chunk = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+        let cbytes = internal::compress_ctx(&self.cctx, src, &mut chunk)?;
+        chunk.truncate(cbytes);
+        self.append_chunk(chunk)
+    }
+
+    /// Appends an already compressed chunk (C `blosc2_schunk_append_chunk`) and returns
+    /// the new number of chunks. Every chunk but the last must hold exactly
+    /// [`Schunk::chunksize`] bytes, so a chunk cannot follow a shorter one.
+    pub fn append_chunk(&mut self, chunk: Vec<u8>) -> Result<usize, i32> {
+        let nchunks = self.chunks.len();
+        self.insert_chunk(nchunks, chunk)?;
+        Ok(self.chunks.len())
+    }
+
+    /// Inserts an already compressed chunk at position `nchunk` (C
+    /// `blosc2_schunk_insert_chunk`). Unless it goes at the end, it must hold exactly
+    /// [`Schunk::chunksize`] bytes. Returns the new number of chunks.
+    pub fn insert_chunk(&mut self, nchunk: usize, chunk: Vec<u8>) -> Result<usize, i32> {
+        let nchunks = self.chunks.len();
+        if nchunk > nchunks {
+            return Err(BLOSC2_ERROR_INVALID_INDEX);
+        }
+        let (nbytes, chunk) = checked_chunk(chunk)?;
+        let fits = if nchunk == nchunks {
+            self.fits_at_end(nbytes)
+        } else {
+            Some(nbytes) == self.chunksize
+        };
+        if !fits {
+            return Err(if nchunk == nchunks {
+                BLOSC2_ERROR_CHUNK_APPEND
+            } else {
+                BLOSC2_ERROR_CHUNK_INSERT
+            });
+        }
+
+        self.chunksize.get_or_insert(nbytes);
+        self.nbytes += nbytes;
+        self.cbytes += chunk.len();
+        self.chunks.insert(nchunk, chunk);
+        Ok(self.chunks.len())
+    }
+
+    /// Replaces chunk `nchunk` with an already compressed chunk of the same uncompressed
+    /// size, or no larger for the last chunk (C `blosc2_schunk_update_chunk`). Returns
+    /// the number of chunks.
+    pub fn update_chunk(&mut self, nchunk: usize, chunk: Vec<u8>) -> Result<usize, i32> {
+        if nchunk >= self.chunks.len() {
+            return Err(BLOSC2_ERROR_INVALID_INDEX);
+        }
+        let (nbytes, chunk) = checked_chunk(chunk)?;
+        let old_nbytes = chunk_nbytes(&self.chunks[nchunk]);
+        let fits = match self.chunksize {
+            // The only chunk may take any size; it sets `chunksize` anew
+            _ if self.chunks.len() == 1 => true,
+            Some(chunksize) if nchunk + 1 == self.chunks.len() => nbytes <= chunksize,
+            chunksize => Some(nbytes) == chunksize,
+        };
+        if !fits {
+            return Err(BLOSC2_ERROR_CHUNK_UPDATE);
+        }
+
+        if self.chunks.len() == 1 {
+            self.chunksize = Some(nbytes);
+        }
+        self.nbytes = self.nbytes - old_nbytes + nbytes;
+        self.cbytes = self.cbytes - self.chunks[nchunk].len() + chunk.len();
+        self.chunks[nchunk] = chunk;
+        Ok(self.chunks.len())
+    }
+
+    /// Removes chunk `nchunk` (C `blosc2_schunk_delete_chunk`) and returns the new number
+    /// of chunks. `chunksize` is kept even when the last chunk goes.
+    pub fn delete_chunk(&mut self, nchunk: usize) -> Result<usize, i32> {
+        if nchunk >= self.chunks.len() {
+            return Err(BLOSC2_ERROR_INVALID_INDEX);
+        }
+        let chunk = self.chunks.remove(nchunk);
+        self.nbytes -= chunk_nbytes(&chunk);
+        self.cbytes -= chunk.len();
+        Ok(self.chunks.len())
+    }
+
+    /// The compressed bytes of chunk `nchunk` (C `blosc2_schunk_get_chunk`).
+    pub fn get_chunk(&self, nchunk: usize) -> Result<&[u8], i32> {
+        self.chunks
+            .get(nchunk)
+            .map(|chunk| &chunk[..])
+            .ok_or(BLOSC2_ERROR_INVALID_INDEX)
+    }
+
+    /// Decompresses chunk `nchunk` into `dest` with the super-chunk's `dparams` (C
+    /// `blosc2_schunk_decompress_chunk`) and returns its uncompressed size.
+    pub fn decompress_chunk(&self, nchunk: usize, dest: &mut [u8]) -> Result<usize, i32> {
+        let chunk = self.get_chunk(nchunk)?;
+        if dest.len() < chunk_nbytes(chunk) {
+            return Err(BLOSC2_ERROR_WRITE_BUFFER);
+        }
+        internal::decompress_ctx(&self.dctx, chunk, dest).map_err(|_| BLOSC2_ERROR_DATA)
+    }
+
+    /// Decompresses every chunk, in order, into `dest`, which must hold at least
+    /// [`Schunk::nbytes`] bytes. Returns the number of bytes written.
+    ///
+    /// With the `parallel` feature enabled and `dparams.nthreads > 1`, whole chunks are
+    /// decoded on a pool of scoped threads, each into its own `chunksize` region of
+    /// `dest`. A super-chunk of a single chunk decodes that chunk's blocks in parallel
+    /// instead.
+    pub fn decompress(&self, dest: &mut [u8]) -> Result<usize, i32> {
+        if dest.len() < self.nbytes {
+            return Err(BLOSC2_ERROR_WRITE_BUFFER);
+        }
+        let chunksize = self.chunksize();
+        if self.nbytes == 0 {
+            return Ok(0);
+        }
+        let dest = &mut dest[..self.nbytes];
+
+        #[cfg(feature = "parallel")]
+        {
+            let nthreads = self.dctx.dparams.nthreads.max(1) as usize;
+            if nthreads > 1 && self.chunks.len() > 1 {
+                return self.decompress_parallel(dest, nthreads);
+            }
+        }
+
+        for (chunk, chunk_dest) in self.chunks.iter().zip(dest.chunks_mut(chunksize)) {
+            internal::decompress_ctx(&self.dctx, chunk, chunk_dest)
+                .map_err(|_| BLOSC2_ERROR_DATA)?;
+        }
+        Ok(self.nbytes)
+    }
+
+    /// Whole chunks on `nthreads` workers, the way `decompress_internal` spreads blocks.
+    #[cfg(feature = "parallel")]
+    fn decompress_parallel(&self, dest: &mut [u8], nthreads: usize) -> Result<usize, i32> {
+        use std::sync::Mutex;
+
+        let work = Mutex::new(self.chunks.iter().zip(dest.chunks_mut(self.chunksize())));
+        let worker = |arena: &mut internal::ScratchArena| -> Result<(), i32> {
+            loop {
+                let next = work.lock().unwrap().next();
+                let Some((chunk, chunk_dest)) = next else {
+                    return Ok(());
+                };
+                internal::decompress_internal(chunk, chunk_dest, 1, arena)
+                    .map_err(|_| BLOSC2_ERROR_DATA)?;
+            }
+        };
+
+        let mut scratch = self.dctx.scratch.borrow_mut();
+        std::thread::scope(|s| {
+            let handles: Vec<_> = scratch
+                .workers(nthreads.min(self.chunks.len()))
+                .iter_mut()
+                .map(|arena| s.spawn(|| worker(arena)))
+                .collect();
+            handles
+                .into_iter()
+                .try_for_each(|h| h.join().unwrap_or(Err(BLOSC2_ERROR_THREAD_CREATE)))
+        })?;
+        Ok(self.nbytes)
+    }
+
+    /// Uncompressed size of the last chunk, if there is one.
+    fn last_nbytes(&self) -> Option<usize> {
+        self.chunks.last().map(|chunk| chunk_nbytes(chunk))
+    }
+
+    /// Whether a chunk of `nbytes` can be appended: the current last chunk must be full
+    /// and the new one no larger.
+    fn fits_at_end(&self, nbytes: usize) -> bool {
+        match self.chunksize {
+            None => true,
+            Some(chunksize) if self.chunks.is_empty() => nbytes <= chunksize,
+            Some(chunksize) => self.last_nbytes() == Some(chunksize) && nbytes <= chunksize,
+        }
+    }
+}
+
+/// Checks that `chunk` is a valid chunk and returns its uncompressed size, with `chunk`
+/// cut down to its `cbytes`.
+fn checked_chunk(mut chunk: Vec<u8>) -> Result<(usize, Vec<u8>), i32> {
+    let info = ChunkInfo::parse(&chunk)?;
+    chunk.truncate(info.cbytes);
+    Ok((info.nbytes, chunk))
+}
+
+/// Uncompressed size of a chunk that passed [`checked_chunk`].
+fn chunk_nbytes(chunk: &[u8]) -> usize {
+    crate::api::blosc2_cbuffer_sizes(chunk).0
+}
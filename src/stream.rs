@@ -0,0 +1,442 @@
+//! Push-style compression and decompression of a chunk, a piece at a time.
+//!
+//! [`crate::blosc2_decompress`] needs the whole chunk in memory and a destination for all
+//! of `nbytes`. A chunk is a header, the `bstarts` offsets, then one run of compressed
+//! bytes per block, in order. So once the header and `bstarts` are in, each block can be
+//! decoded as soon as its own bytes are complete.
+//! [`ChunkDecoder`](crate::stream::ChunkDecoder) buffers at most one compressed block plus
+//! one decoded block.
+//!
+//! [`ChunkEncoder`](crate::stream::ChunkEncoder) is the other direction. It compresses each
+//! block as soon as it has been pushed, writes it to a seekable sink and back-patches the
+//! header and `bstarts` at the end.
+//!
+//! ```rust
+//! use blusc::stream::ChunkDecoder;
+//! use blusc::{blosc2_compress, BLOSC2_MAX_OVERHEAD, BLOSC_SHUFFLE};
+//!
+//! let input: Vec<u8> = (0..100_000u32).flat_map(|i| i.to_le_bytes()).collect();
+//! let mut compressed = vec![0u8; input.len() + BLOSC2_MAX_OVERHEAD];
+//! let cbytes = blosc2_compress(5, BLOSC_SHUFFLE as i32, 4, &input, &mut compressed);
+//! compressed.truncate(cbytes as usize);
+//!
+//! let mut decoder = ChunkDecoder::new();
+//! let mut output = Vec::new();
+//! for piece in compressed.chunks(1000) {
+//!     decoder
+//!         .push(piece, |offset, block| {
+//!             assert_eq!(offset, output.len());
+//!             output.extend_from_slice(block);
+//!         })
+//!         .unwrap();
+//! }
+//! assert!(decoder.is_finished());
+//! assert_eq!(input, output);
+//! ```
+
+use crate::api::Blosc2Cparams;
+use crate::internal::constants::*;
+use crate::internal::{
+    block_scratch_len, compress_block, grow, measure_split, plan_chunk, splitmode, write_header,
+    BlockRole, BlockSizing, ChunkInfo, ChunkPlan, DeltaRefs, Pipeline, ScratchArena,
+};
+use std::io::{Seek, SeekFrom, Write};
+
+/// Incremental decoder for one chunk. Feed it the chunk bytes in order with
+/// [`ChunkDecoder::push`]; every block is handed out, in order, as soon as it is decoded.
+pub struct ChunkDecoder {
+    /// Received bytes not consumed yet; `buf[0]` is chunk byte `base`.
+    buf: Vec<u8>,
+    base: usize,
+    /// Set once the header and `bstarts` are in.
+    info: Option<ChunkInfo>,
+    /// Next block to decode.
+    next_block: usize,
+    block: Vec<u8>,
+    /// Recorded from block 0, for the blocks of a delta chunk after it.
+    delta_refs: DeltaRefs,
+    scratch: ScratchArena,
+}
+
+impl Default for ChunkDecoder {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl ChunkDecoder {
+    /// Creates a decoder waiting for the first bytes of a chunk.
+    pub fn new() -> Self {
+        ChunkDecoder {
+            buf: Vec::new(),
+            base: 0,
+            info: None,
+            next_block: 0,
+            block: Vec::new(),
+            delta_refs: DeltaRefs::default(),
+            scratch: ScratchArena::default(),
+        }
+    }
+
+    /// Uncompressed size of the chunk, once its header has been received.
+    pub fn nbytes(&self) -> Option<usize> {
+        self.info.as_ref().map(|info| info.nbytes)
+    }
+
+    /// Total size of the chunk, once its header has been received.
+    pub fn cbytes(&self) -> Option<usize> {
+        self.info.as_ref().map(|info| info.cbytes)
+    }
+
+    /// Whether every block has been decoded.
+    pub fn is_finished(&self) -> bool {
+        self.info
+            .as_ref()
+            .map_or(false, |info| self.next_block == info.nblocks)
+    }
+
+    /// Appends the next bytes of the chunk and decodes every block that is now complete,
+    /// calling `on_block(offset, data)` for each one, where `offset` is the position of
+    /// `data` in the uncompressed chunk.
+    ///
+    /// Returns how many bytes of `data` belong to this chunk; anything after the chunk's
+    /// `cbytes` is left unconsumed (it may be the start of the next chunk). Returns a
+    /// negative `BLOSC2_ERROR_*` code if the header is invalid or a block fails to
+    /// decode; the decoder is then unusable.
+    pub fn push<F: FnMut(usize, &[u8])>(
+        &mut self,
+        data: &[u8],
+        mut on_block: F,
+    ) -> Result<usize, i32> {
+        let received = self.base + self.buf.len();
+        let consumed = match &self.info {
+            Some(info) => std::cmp::min(data.len(), info.cbytes.saturating_sub(received)),
+            None => data.len(),
+        };
+        self.buf.extend_from_slice(&data[..consumed]);
+
+        if self.info.is_none() {
+            if self.buf.len() < BLOSC_MIN_HEADER_LENGTH {
+                return Ok(consumed);
+            }
+            let prefix_len = ChunkInfo::prefix_len(&self.buf);
+            let (_, cbytes, _) = crate::api::blosc2_cbuffer_sizes(&self.buf);
+            if prefix_len > cbytes {
+                return Err(BLOSC2_ERROR_INVALID_HEADER);
+            }
+            if self.buf.len() < prefix_len {
+                return Ok(consumed);
+            }
+            let info = ChunkInfo::parse_prefix(&self.buf)?;
+            info.select_dict(&self.buf, &mut self.scratch);
+            // Bytes past the chunk are not ours
+            let extra = (self.base + self.buf.len()).saturating_sub(info.cbytes);
+            self.buf.truncate(self.buf.len() - extra);
+            self.info = Some(info);
+            return self.decode_ready(&mut on_block).map(|()| consumed - extra);
+        }
+
+        self.decode_ready(&mut on_block).map(|()| consumed)
+    }
+
+    /// Decodes the complete blocks at the front of `buf` and drops their bytes.
+    fn decode_ready<F: FnMut(usize, &[u8])>(&mut self, on_block: &mut F) -> Result<(), i32> {
+        let info = self.info.as_ref().unwrap();
+        while self.next_block < info.nblocks {
+            let i = self.next_block;
+            let range = info.block_src_range(i);
+            if range.end > self.base + self.buf.len() {
+                break;
+            }
+
+            let content = &self.buf[range.start - self.base..range.end - self.base];
+            let offset = i * info.blocksize;
+            if let Some(special) = &info.special {
+                let block = grow(&mut self.block, info.block_len(i));
+                special.fill(offset, block);
+                on_block(offset, block);
+            } else if info.memcpyed {
+                on_block(offset, content);
+            } else {
+                let block = grow(&mut self.block, info.block_len(i));
+                info.decode_block_content(content, i, block, &mut self.delta_refs, &mut self.scratch)
+                    .map_err(|_| BLOSC2_ERROR_DATA)?;
+                on_block(offset, block);
+            }
+
+            self.buf.drain(..range.end - self.base);
+            self.base = range.end;
+            self.next_block += 1;
+        }
+        Ok(())
+    }
+}
+
+/// Incremental compressor for one chunk of a known uncompressed size.
+///
+/// The chunk is written to `sink` as it goes: a placeholder header and `bstarts` table
+/// first, then each block as soon as its bytes have been pushed. [`ChunkEncoder::finish`]
+/// seeks back to fill in the header and `bstarts`. Working memory is one block of input,
+/// one compressed block and the `bstarts` table.
+///
+/// Blocks are laid out as by [`crate::blosc2_compress_ctx`] with the same parameters, and
+/// the bytes are identical whenever every stream compresses. The whole chunk is never
+/// seen at once, so there is no memcpy fallback for incompressible data. Like C
+/// `blosc_c`, a stream that does not compress is stored as is, so the chunk can be up to
+/// 4 bytes per stream larger than `nbytes + BLOSC2_MAX_OVERHEAD`. At clevel 0, where
+/// `blosc2_compress_ctx` memcpys, every stream is stored without running the codec.
+///
+/// ```rust
+/// use blusc::stream::ChunkEncoder;
+/// use blusc::{blosc2_decompress, BLOSC2_CPARAMS_DEFAULTS};
+/// use std::io::Cursor;
+///
+/// let input: Vec<u8> = (0..100_000u32).flat_map(|i| i.to_le_bytes()).collect();
+/// let mut cparams = BLOSC2_CPARAMS_DEFAULTS;
+/// cparams.typesize = 4;
+///
+/// let mut encoder = ChunkEncoder::new(&cparams, input.len(), Cursor::new(Vec::new())).unwrap();
+/// for piece in input.chunks(1000) {
+///     encoder.push(piece).unwrap();
+/// }
+/// let (sink, cbytes) = encoder.finish().unwrap();
+/// let compressed = sink.into_inner();
+/// assert_eq!(compressed.len(), cbytes);
+///
+/// let mut output = vec![0u8; input.len()];
+/// blosc2_decompress(&compressed, &mut output);
+/// assert_eq!(input, output);
+/// ```
+pub struct ChunkEncoder<W: Write + Seek> {
+    sink: W,
+    /// Sink position of the first byte of the chunk.
+    start: u64,
+    clevel: i32,
+    pipeline: Pipeline,
+    /// Recorded from block 0, for the blocks after it.
+    delta_refs: DeltaRefs,
+    typesize: usize,
+    compressor: u8,
+    filters: [u8; 6],
+    filters_meta: [u8; 6],
+    nbytes: usize,
+    plan: ChunkPlan,
+    bstarts: Vec<u32>,
+    /// Bytes of the chunk written so far.
+    written: usize,
+    /// Input bytes received so far.
+    received: usize,
+    /// Pushed bytes of the block being filled.
+    pending: Vec<u8>,
+    out: Vec<u8>,
+    scratch: ScratchArena,
+}
+
+impl<W: Write + Seek> ChunkEncoder<W> {
+    /// Starts a chunk of `nbytes` uncompressed bytes at the current position of `sink`,
+    /// compressed with the codec, level, typesize and filters of `cparams` (`nthreads`
+    /// and `use_dict` are ignored; a dictionary is trained from the whole chunk, which the
+    /// encoder never holds). `nbytes` has to be known up front because it fixes the block
+    /// layout and the size of the `bstarts` table, which sit before the data.
+    pub fn new(cparams: &Blosc2Cparams, nbytes: usize, mut sink: W) -> Result<Self, i32> {
+        if nbytes > BLOSC2_MAX_BUFFERSIZE || cparams.typesize < 1 || cparams.typesize > 255 {
+            return Err(BLOSC2_ERROR_INVALID_PARAM);
+        }
+        let clevel = cparams.clevel as i32;
+        let typesize = cparams.typesize as usize;
+        let compressor = cparams.compcode;
+        let sizing = BlockSizing::from_cparams(cparams)?;
+        let plan = plan_chunk(
+            clevel,
+            typesize,
+            nbytes,
+            compressor,
+            true,
+            &cparams.filters,
+            splitmode(cparams),
+            sizing,
+        );
+
+        let start = sink
+            .stream_position()
+            .map_err(|_| BLOSC2_ERROR_FILE_WRITE)?;
+        let prefix_len = plan.header_len + plan.nblocks * 4;
+        sink.write_all(&vec![0u8; prefix_len])
+            .map_err(|_| BLOSC2_ERROR_FILE_WRITE)?;
+
+        Ok(ChunkEncoder {
+            sink,
+            start,
+            clevel,
+            pipeline: Pipeline::new(&cparams.filters, &cparams.filters_meta),
+            delta_refs: DeltaRefs::default(),
+            typesize,
+            compressor,
+            filters: cparams.filters,
+            filters_meta: cparams.filters_meta,
+            nbytes,
+            bstarts: Vec::with_capacity(plan.nblocks),
+            written: prefix_len,
+            received: 0,
+            pending: Vec::with_capacity(plan.blocksize),
+            out: Vec::new(),
+            scratch: ScratchArena::default(),
+            plan,
+        })
+    }
+
+    /// Appends the next bytes of the input, compressing and writing out every block
+    /// that is now complete. Pushing more than `nbytes` in total is an error.
+    pub fn push(&mut self, mut data: &[u8]) -> Result<(), i32> {
+        if data.len() > self.nbytes - self.received {
+            return Err(BLOSC2_ERROR_INVALID_PARAM);
+        }
+        self.received += data.len();
+
+        while !data.is_empty() {
+            let block_len = self.next_block_len();
+            if self.pending.is_empty() && data.len() >= block_len {
+                // A whole block in `data`: compress it in place
+                let (block, rest) = data.split_at(block_len);
+                self.write_block(block, self.pending_block_is_last())?;
+                data = rest;
+            } else {
+                let n = std::cmp::min(block_len - self.pending.len(), data.len());
+                self.pending.extend_from_slice(&data[..n]);
+                data = &data[n..];
+                if self.pending.len() == block_len {
+                    let block = std::mem::take(&mut self.pending);
+                    let result = self.write_block(&block, self.pending_block_is_last());
+                    self.pending = block;
+                    self.pending.clear();
+                    result?;
+                }
+            }
+        }
+        Ok(())
+    }
+
+    /// Writes the header and `bstarts` once all `nbytes` have been pushed, leaves the
+    /// sink positioned after the chunk and returns it with the chunk size (`cbytes`).
+    pub fn finish(mut self) -> Result<(W, usize), i32> {
+        if self.received != self.nbytes {
+            return Err(BLOSC2_ERROR_INVALID_PARAM);
+        }
+
+        // An empty chunk comes out of `compress_internal` flagged as memcpyed. Any other
+        // chunk has blocks of streams (stored as is at clevel 0), so `dont_split` has to
+        // say how they were laid out.
+        let mut flags = self.plan.flags;
+        if self.nbytes == 0 {
+            flags |= BLOSC_MEMCPYED;
+        } else if !self.plan.split {
+            flags |= 0x10;
+        }
+
+        let header_len = self.plan.header_len;
+        let mut prefix = vec![0u8; header_len + self.bstarts.len() * 4];
+        write_header(
+            &mut prefix,
+            true,
+            self.nbytes,
+            self.plan.blocksize,
+            self.written,
+            self.typesize,
+            flags,
+            self.compressor,
+            &self.filters,
+            &self.filters_meta,
+            0,
+        );
+        for (i, bstart) in self.bstarts.iter().enumerate() {
+            let offset = header_len + i * 4;
+            prefix[offset..offset + 4].copy_from_slice(&bstart.to_le_bytes());
+        }
+
+        let io = |sink: &mut W| -> std::io::Result<()> {
+            sink.seek(SeekFrom::Start(self.start))?;
+            sink.write_all(&prefix)?;
+            sink.seek(SeekFrom::Start(self.start + self.written as u64))?;
+            Ok(())
+        };
+        io(&mut self.sink).map_err(|_| BLOSC2_ERROR_FILE_WRITE)?;
+        Ok((self.sink, self.written))
+    }
+
+    /// Length of the block currently being filled.
+    fn next_block_len(&self) -> usize {
+        let block_start = self.bstarts.len() * self.plan.blocksize;
+        std::cmp::min(self.plan.blocksize, self.nbytes - block_start)
+    }
+
+    /// Whether the block being filled is the shorter last block.
+    fn pending_block_is_last(&self) -> bool {
+        self.bstarts.len() == self.plan.nblocks - 1 && self.nbytes % self.plan.blocksize != 0
+    }
+
+    fn write_block(&mut self, block: &[u8], leftoverblock: bool) -> Result<(), i32> {
+        // At clevel 0 every stream is stored, whatever the split
+        if self.bstarts.is_empty() && self.plan.measure_split && self.clevel > 0 {
+            if let Some(split) = measure_split(
+                self.clevel,
+                &self.pipeline,
+                self.typesize,
+                self.compressor,
+                block,
+                true,
+                &mut self.scratch,
+            )? {
+                self.plan.set_split(split);
+            }
+        }
+        let out = grow(&mut self.out, block_scratch_len(block.len(), self.typesize));
+        let role = match self.bstarts.len() {
+            0 => BlockRole::First(Some(&mut self.delta_refs)),
+            _ => BlockRole::Other(&self.delta_refs),
+        };
+        let n = compress_block(
+            self.clevel,
+            &self.pipeline,
+            role,
+            self.typesize,
+            self.compressor,
+            true,
+            self.plan.split,
+            block,
+            leftoverblock,
+            true,
+            false,
+            out,
+            &mut self.scratch,
+        )?
+        .ok_or(BLOSC2_ERROR_WRITE_BUFFER)?;
+        if self.written + n > BLOSC2_MAX_BUFFERSIZE + BLOSC2_MAX_OVERHEAD {
+            return Err(BLOSC2_ERROR_WRITE_BUFFER);
+        }
+
+        self.sink
+            .write_all(&out[..n])
+            .map_err(|_| BLOSC2_ERROR_FILE_WRITE)?;
+        self.bstarts.push(self.written as u32);
+        self.written += n;
+        Ok(())
+    }
+}
+
+impl<W: Write + Seek> Write for ChunkEncoder<W> {
+    /// Same as [`ChunkEncoder::push`], so a reader can be streamed in with
+    /// `std::io::copy`.
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        self.push(buf).map_err(|code| {
+            std::io::Error::new(
+                std::io::ErrorKind::Other,
+                format!("blosc2 chunk encoder error {}", code),
+            )
+        })?;
+        Ok(buf.len())
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        self.sink.flush()
+    }
+}
@@ -0,0 +1,363 @@
+//! Btune-lite: picks the codec, shuffle and clevel of a context by trying them out on the
+//! data, a small take on the Btune plugin of c-blosc2 (C `btune_init`,
+//! `btune_next_cparams`).
+//!
+//! With `cparams.tuner_id` set to [`BLOSC_BTUNE`], the first chunk compressed through
+//! [`crate::blosc2_compress_ctx`] (or a [`crate::schunk::Schunk`]) is tuned. A sample of
+//! its blocks is compressed and decompressed with each candidate, and the candidate that
+//! scores best for the goal in [`BtuneConfig`](crate::tune::BtuneConfig) wins. The search
+//! runs in two rounds, as Btune does: every codec, shuffle and split mode at clevel 5,
+//! then other clevels for the winner. The decision is kept in the context, so later chunks are
+//! compressed with it straight away.
+//!
+//! Scores depend on timings, so tuned chunks can differ from run to run. On
+//! `wasm32-unknown-unknown`, which has no clock, only the ratio counts.
+//!
+//! ```rust
+//! use blusc::tune::{btune_decision, btune_init, BtuneConfig, BtunePerfMode};
+//! use blusc::{blosc2_compress_ctx, blosc2_create_cctx, BLOSC2_CPARAMS_DEFAULTS, BLOSC2_MAX_OVERHEAD};
+//!
+//! let mut cparams = BLOSC2_CPARAMS_DEFAULTS;
+//! cparams.typesize = 4;
+//! let mut cctx = blosc2_create_cctx(cparams);
+//! let config = BtuneConfig {
+//!     perf_mode: BtunePerfMode::Decomp,
+//!     ..BtuneConfig::default()
+//! };
+//! btune_init(config, &mut cctx);
+//!
+//! let input: Vec<u8> = (0..100_000u32).flat_map(|i| i.to_le_bytes()).collect();
+//! let mut chunk = vec![0u8; input.len() + BLOSC2_MAX_OVERHEAD];
+//! assert!(blosc2_compress_ctx(&cctx, &input, &mut chunk) > 0);
+//! let decision = btune_decision(&cctx).unwrap();
+//! assert_eq!(chunk[22], decision.compcode);
+//! ```
+
+use crate::api::Blosc2Context;
+use crate::internal::constants::*;
+use crate::internal::{self, BlockSizing, ScratchArena};
+use std::borrow::Cow;
+
+/// `cparams.tuner_id` of this tuner: the first globally-registered tuner ID. c-blosc2
+/// registers no global tuner of its own (`BLOSC2_GLOBAL_REGISTERED_TUNERS` is 0), so this
+/// is not a C constant.
+pub const BLOSC_BTUNE: u8 = BLOSC2_GLOBAL_REGISTERED_TUNER_START;
+
+/// What the tuner weighs against the ratio (C `btune_performance_mode`).
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum BtunePerfMode {
+    /// Compression time.
+    Comp,
+    /// Decompression time.
+    Decomp,
+    /// Compression plus decompression time.
+    Balanced,
+}
+
+/// Tuner settings (C `btune_config`).
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct BtuneConfig {
+    pub perf_mode: BtunePerfMode,
+    /// Weight of the ratio against speed, from 0 (speed only) to 1 (ratio only): every
+    /// candidate scores `ratio^tradeoff / time^(1 - tradeoff)`.
+    pub tradeoff: f64,
+    /// Number of `L1`-sized pieces sampled from the chunk being tuned.
+    pub sample_blocks: usize,
+    /// Search again every that many chunks; 0 keeps the first decision.
+    pub retune_every: usize,
+}
+
+impl Default for BtuneConfig {
+    /// Balanced, with ratio and speed weighing the same.
+    fn default() -> Self {
+        BtuneConfig {
+            perf_mode: BtunePerfMode::Balanced,
+            tradeoff: 0.5,
+            sample_blocks: 4,
+            retune_every: 0,
+        }
+    }
+}
+
+/// The parameters a search settled on.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct BtuneDecision {
+    pub compcode: u8,
+    /// [`BLOSC_NOSHUFFLE`], [`BLOSC_SHUFFLE`] or [`BLOSC_BITSHUFFLE`], which takes the last
+    /// filter slot. Other filters in `cparams.filters` are kept.
+    pub filter: u8,
+    pub clevel: u8,
+    /// [`BLOSC_ALWAYS_SPLIT`] or [`BLOSC_NEVER_SPLIT`], or `cparams.splitmode` for
+    /// 1-byte items, which have a single stream either way.
+    pub splitmode: u8,
+}
+
+/// Per-context tuner state.
+pub(crate) struct Btune {
+    config: BtuneConfig,
+    decision: Option<BtuneDecision>,
+    /// Chunks compressed since the last search.
+    chunks: usize,
+}
+
+/// Makes `cctx` tune its parameters with `config` (C `btune_init`). A context whose
+/// `tuner_id` is set to [`BLOSC_BTUNE`] without this uses [`BtuneConfig::default`].
+pub fn btune_init(config: BtuneConfig, cctx: &mut Blosc2Context) {
+    cctx.cparams.tuner_id = BLOSC_BTUNE as i32;
+    *cctx.tuner.get_mut() = Some(Btune {
+        config,
+        decision: None,
+        chunks: 0,
+    });
+}
+
+/// The decision `cctx` currently compresses with, once it has tuned a chunk.
+pub fn btune_decision(cctx: &Blosc2Context) -> Option<BtuneDecision> {
+    cctx.tuner
+        .borrow()
+        .as_ref()
+        .and_then(|tuner| tuner.decision)
+}
+
+/// The clevel of the first round.
+const FIRST_CLEVEL: u8 = 5;
+/// The clevels of the second round.
+const CLEVELS: [u8; 4] = [1, 3, 7, 9];
+
+/// The codecs worth trying for `perf_mode`: the slow ones only decompress fast.
+fn candidate_codecs(perf_mode: BtunePerfMode, use_dict: bool) -> &'static [u8] {
+    match perf_mode {
+        // Neither does C support dictionaries for any other codec
+        _ if use_dict => &[BLOSC_ZSTD],
+        BtunePerfMode::Comp => &[BLOSC_LZ4, BLOSC_BLOSCLZ],
+        BtunePerfMode::Decomp => &[BLOSC_LZ4, BLOSC_BLOSCLZ, BLOSC_LZ4HC, BLOSC_ZSTD],
+        BtunePerfMode::Balanced => &[BLOSC_LZ4, BLOSC_BLOSCLZ, BLOSC_ZSTD],
+    }
+}
+
+/// `filters` with the shuffles taken out and `filter` in the last slot.
+pub(crate) fn with_shuffle(
+    filters: &[u8; 6],
+    filters_meta: &[u8; 6],
+    filter: u8,
+) -> ([u8; 6], [u8; 6]) {
+    let (mut filters, mut filters_meta) = (*filters, *filters_meta);
+    for (f, meta) in filters.iter_mut().zip(filters_meta.iter_mut()) {
+        if *f == BLOSC_SHUFFLE || *f == BLOSC_BITSHUFFLE {
+            *f = BLOSC_NOFILTER;
+            *meta = 0;
+        }
+    }
+    filters[5] = filter;
+    filters_meta[5] = 0;
+    (filters, filters_meta)
+}
+
+/// Runs `f` and returns its result with the seconds it took.
+#[cfg(not(all(target_arch = "wasm32", target_os = "unknown")))]
+fn timed<T>(f: impl FnOnce() -> T) -> (T, f64) {
+    let start = std::time::Instant::now();
+    let result = f();
+    (result, start.elapsed().as_secs_f64())
+}
+
+/// `wasm32-unknown-unknown` has no clock: every candidate takes the same time.
+#[cfg(all(target_arch = "wasm32", target_os = "unknown"))]
+fn timed<T>(f: impl FnOnce() -> T) -> (T, f64) {
+    (f(), 1.0)
+}
+
+/// Up to `nblocks` pieces of `L1` bytes (whole items), evenly spread over `src`.
+fn sample(src: &[u8], typesize: usize, nblocks: usize) -> Cow<'_, [u8]> {
+    let nblocks = nblocks.max(1);
+    let block = std::cmp::max(L1 / typesize, 1) * typesize;
+    if src.len() <= block * nblocks {
+        return Cow::Borrowed(src);
+    }
+    let stride = (src.len() - block) / std::cmp::max(nblocks - 1, 1) / typesize * typesize;
+    let mut sample = Vec::with_capacity(block * nblocks);
+    for k in 0..nblocks {
+        sample.extend_from_slice(&src[k * stride..k * stride + block]);
+    }
+    Cow::Owned(sample)
+}
+
+/// Scores candidates on one sample, reusing the buffers.
+struct Trial<'a> {
+    context: &'a Blosc2Context,
+    config: BtuneConfig,
+    sample: &'a [u8],
+    sizing: BlockSizing,
+    chunk: Vec<u8>,
+    out: Vec<u8>,
+    scratch: &'a mut ScratchArena,
+}
+
+impl Trial<'_> {
+    /// The score of `candidate`, or `None` if it fails on the sample. Each step is
+    /// timed twice and the faster run counts, which takes most of the noise out.
+    fn score(&mut self, candidate: BtuneDecision) -> Option<f64> {
+        let cparams = &self.context.cparams;
+        let (filters, filters_meta) =
+            with_shuffle(&cparams.filters, &cparams.filters_meta, candidate.filter);
+        let (mut ctime, mut dtime) = (f64::MAX, f64::MAX);
+        let mut cbytes = 0;
+        for _ in 0..2 {
+            let (result, t) = timed(|| {
+                internal::compress_internal(
+                    candidate.clevel as i32,
+                    cparams.typesize as usize,
+                    self.sample,
+                    &mut self.chunk,
+                    candidate.compcode,
+                    true,
+                    &filters,
+                    &filters_meta,
+                    false,
+                    1,
+                    candidate.splitmode,
+                    self.sizing,
+                    false,
+                    internal::Probe::Off,
+                    self.scratch,
+                )
+            });
+            cbytes = result.ok()?;
+            ctime = ctime.min(t);
+
+            let (result, t) = timed(|| {
+                internal::decompress_internal(&self.chunk[..cbytes], &mut self.out, 1, self.scratch)
+            });
+            result.ok()?;
+            dtime = dtime.min(t);
+        }
+
+        let ratio = self.sample.len() as f64 / cbytes as f64;
+        let time = match self.config.perf_mode {
+            BtunePerfMode::Comp => ctime,
+            BtunePerfMode::Decomp => dtime,
+            BtunePerfMode::Balanced => ctime + dtime,
+        };
+        let tradeoff = self.config.tradeoff.clamp(0.0, 1.0);
+        Some(ratio.powf(tradeoff) / time.max(1e-9).powf(1.0 - tradeoff))
+    }
+
+    /// The best scoring of `candidates`, the first one on a tie.
+    fn best(
+        &mut self,
+        candidates: impl Iterator<Item = BtuneDecision>,
+        mut best: Option<(BtuneDecision, f64)>,
+    ) -> Option<(BtuneDecision, f64)> {
+        for candidate in candidates {
+            if let Some(score) = self.score(candidate) {
+                if best.map_or(true, |(_, best_score)| score > best_score) {
+                    best = Some((candidate, score));
+                }
+            }
+        }
+        best
+    }
+}
+
+/// Searches the parameters for `src`: every codec, shuffle and split mode at
+/// [`FIRST_CLEVEL`], then every clevel for the winner.
+fn search(
+    context: &Blosc2Context,
+    config: BtuneConfig,
+    src: &[u8],
+    scratch: &mut ScratchArena,
+) -> Option<BtuneDecision> {
+    let typesize = context.cparams.typesize.max(1) as usize;
+    let sample = sample(src, typesize, config.sample_blocks);
+    let mut trial = Trial {
+        context,
+        config,
+        sample: &sample,
+        // Explicit blocksizes are tried as the chunk will be compressed
+        sizing: BlockSizing::from_cparams(&context.cparams).ok()?,
+        chunk: vec![0u8; sample.len() + BLOSC2_MAX_OVERHEAD],
+        out: vec![0u8; sample.len()],
+        scratch,
+    };
+
+    // A byte shuffle of 1-byte items does nothing
+    let shuffles: &[u8] = match typesize {
+        1 => &[BLOSC_NOSHUFFLE, BLOSC_BITSHUFFLE],
+        _ => &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE],
+    };
+    // and neither does a split of them
+    let splitmodes: &[u8] = match typesize {
+        1 => &[internal::splitmode(&context.cparams)],
+        _ => &[BLOSC_ALWAYS_SPLIT, BLOSC_NEVER_SPLIT],
+    };
+    let codecs = candidate_codecs(config.perf_mode, context.cparams.use_dict != 0);
+    let first = codecs.iter().flat_map(|&compcode| {
+        shuffles.iter().flat_map(move |&filter| {
+            splitmodes.iter().map(move |&splitmode| BtuneDecision {
+                compcode,
+                filter,
+                clevel: FIRST_CLEVEL,
+                splitmode,
+            })
+        })
+    });
+    let best = trial.best(first, None)?;
+
+    let second = CLEVELS
+        .iter()
+        .map(|&clevel| BtuneDecision { clevel, ..best.0 });
+    trial.best(second, Some(best)).map(|(decision, _)| decision)
+}
+
+/// The parameters to compress `src` with on a [`BLOSC_BTUNE`] context (C
+/// `btune_next_cparams`): the cached decision, or a new one searched on `src` when there
+/// is none yet or `retune_every` chunks have gone by. `None` when every candidate failed,
+/// and the context's own parameters apply.
+pub(crate) fn next_decision(
+    context: &Blosc2Context,
+    src: &[u8],
+    scratch: &mut ScratchArena,
+) -> Option<BtuneDecision> {
+    let mut tuner = context.tuner.borrow_mut();
+    let tuner = tuner.get_or_insert_with(|| Btune {
+        config: BtuneConfig::default(),
+        decision: None,
+        chunks: 0,
+    });
+    let retune = tuner.config.retune_every > 0 && tuner.chunks >= tuner.config.retune_every;
+    if (tuner.decision.is_none() || retune) && !src.is_empty() {
+        tuner.decision = search(context, tuner.config, src, scratch);
+        tuner.chunks = 0;
+    }
+    tuner.chunks += 1;
+    tuner.decision
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn sample_spreads_whole_items() {
+        let src: Vec<u8> = (0..L1 * 10).map(|i| (i / 3) as u8).collect();
+        let sample = sample(&src, 3, 4);
+        let block = L1 / 3 * 3;
+        assert_eq!(sample.len(), block * 4);
+        let stride = (src.len() - block) / 3 / 3 * 3;
+        assert_eq!(&sample[block..block * 2], &src[stride..stride + block]);
+        assert_eq!(&sample[block * 3..], &src[stride * 3..stride * 3 + block]);
+
+        // Small chunks are their own sample
+        assert!(matches!(super::sample(&src[..L1], 4, 4), Cow::Borrowed(_)));
+    }
+
+    #[test]
+    fn shuffle_takes_the_last_slot() {
+        let filters = [BLOSC_SHUFFLE, 0, 0, 0, BLOSC_DELTA, BLOSC_BITSHUFFLE];
+        let meta = [1, 0, 0, 0, 0, 0];
+        assert_eq!(
+            with_shuffle(&filters, &meta, BLOSC_SHUFFLE),
+            ([0, 0, 0, 0, BLOSC_DELTA, BLOSC_SHUFFLE], [0; 6])
+        );
+    }
+}
@@ -0,0 +1,240 @@
+//! Borrowed views of compressed chunks, for planning reads before decoding anything.
+//!
+//! `blosc1_cbuffer_metainfo`, `blosc2_cbuffer_sizes` and `blosc1_cbuffer_validate` each
+//! read a few header fields again. A [`ChunkView`](crate::view::ChunkView) parses the
+//! header, `bstarts` and dictionary of a chunk once, the same way `blosc2_decompress` and
+//! `blosc2_getitem_ctx` do, and keeps borrowing the chunk bytes. It says where the
+//! compressed bytes of each block are and how long they decode to, so that a reader can
+//! pick the blocks covering a slice and decode them one at a time into its own buffers.
+//!
+//! ```rust
+//! use blusc::view::ChunkView;
+//! use blusc::{blosc2_compress, BLOSC2_MAX_OVERHEAD, BLOSC_SHUFFLE};
+//!
+//! let input: Vec<u8> = (0..1u32 << 16).flat_map(|i| i.to_le_bytes()).collect();
+//! let mut compressed = vec![0u8; input.len() + BLOSC2_MAX_OVERHEAD];
+//! let cbytes = blosc2_compress(5, BLOSC_SHUFFLE as i32, 4, &input, &mut compressed);
+//!
+//! let view = ChunkView::new(&compressed[..cbytes as usize]).unwrap();
+//! let mut block = vec![0u8; view.blocksize()];
+//! for i in view.blocks_for_items(40_000, 100).unwrap() {
+//!     let n = view.decode_block(i, &mut block).unwrap();
+//!     let start = i * view.blocksize();
+//!     assert_eq!(block[..n], input[start..start + n]);
+//! }
+//! ```
+
+use std::ops::Range;
+
+use crate::api::Blosc2Context;
+use crate::internal::constants::*;
+use crate::internal::{special_type, ChunkInfo, DeltaRefs, ScratchArena};
+
+/// The parsed header and block offsets of one chunk, borrowing its bytes.
+///
+/// Nothing is decoded or copied when the view is made: it holds a slice of the chunk and
+/// its block offsets. For many small reads of the same chunk, [`crate::reader::ChunkReader`]
+/// also keeps the decoded blocks.
+pub struct ChunkView<'a> {
+    src: &'a [u8],
+    info: ChunkInfo,
+}
+
+impl<'a> ChunkView<'a> {
+    /// Parses the chunk at the start of `src`, which must hold all of its `cbytes`.
+    ///
+    /// Returns `BLOSC2_ERROR_READ_BUFFER` if `src` is too short and
+    /// `BLOSC2_ERROR_INVALID_HEADER` if the header or the block offsets are not those of
+    /// a valid chunk. Chunks written with `instr_codec` have views too, but their
+    /// blocks hold records instead of data and do not decode.
+    pub fn new(src: &'a [u8]) -> Result<Self, i32> {
+        let info = ChunkInfo::parse_any(src)?;
+        Ok(ChunkView { src, info })
+    }
+
+    /// The bytes of the chunk, without anything `src` held past its `cbytes`.
+    pub fn as_bytes(&self) -> &'a [u8] {
+        &self.src[..self.info.cbytes]
+    }
+
+    /// Format version of the header (`BLOSC1_VERSION_FORMAT_*` or
+    /// `BLOSC2_VERSION_FORMAT_*`).
+    pub fn version(&self) -> u8 {
+        self.src[BLOSC2_CHUNK_VERSION as usize]
+    }
+
+    /// The raw flags byte of the header (`BLOSC_DOSHUFFLE`, `BLOSC_MEMCPYED`, ...).
+    pub fn flags(&self) -> u8 {
+        self.src[BLOSC2_CHUNK_FLAGS as usize]
+    }
+
+    /// Uncompressed size of the chunk in bytes.
+    pub fn nbytes(&self) -> usize {
+        self.info.nbytes
+    }
+
+    /// Size of the chunk in bytes, header included.
+    pub fn cbytes(&self) -> usize {
+        self.info.cbytes
+    }
+
+    /// Uncompressed size of a block in bytes; the last block may be shorter.
+    pub fn blocksize(&self) -> usize {
+        self.info.blocksize
+    }
+
+    /// Size of one item in bytes.
+    pub fn typesize(&self) -> usize {
+        self.info.typesize
+    }
+
+    /// Number of blocks the data is stored as. Memcpyed and special chunks count their
+    /// blocks too, although they have no `bstarts`.
+    pub fn nblocks(&self) -> usize {
+        self.info.nblocks
+    }
+
+    /// Codec of the blocks (`BLOSC_BLOSCLZ`, `BLOSC_ZSTD`, ...).
+    pub fn compcode(&self) -> u8 {
+        self.info.compressor
+    }
+
+    /// The filter of each pipeline slot, as `cparams.filters`. For blosc1 chunks this is
+    /// what the flags byte stands for (C `flags_to_filters`).
+    pub fn filters(&self) -> [u8; 6] {
+        self.info.pipeline.filters()
+    }
+
+    /// The metadata of each filter slot, as `cparams.filters_meta`.
+    pub fn filters_meta(&self) -> [u8; 6] {
+        self.info.pipeline.filters_meta()
+    }
+
+    /// The special kind of the chunk (`BLOSC2_SPECIAL_ZERO`, ...), `BLOSC2_NO_SPECIAL`
+    /// for a chunk with data.
+    pub fn special_type(&self) -> u8 {
+        special_type(self.src)
+    }
+
+    /// Whether the data is stored uncompressed right after the header.
+    pub fn is_memcpyed(&self) -> bool {
+        self.info.special.is_none() && self.info.memcpyed
+    }
+
+    /// Whether the blocks were compressed with a dictionary stored in the chunk.
+    pub fn uses_dict(&self) -> bool {
+        self.info.dict.is_some()
+    }
+
+    /// Whether the chunk was written with `instr_codec` and holds records, not data.
+    pub fn is_instrumented(&self) -> bool {
+        self.info.instrumented
+    }
+
+    /// Uncompressed length of block `i`. Panics if `i >= self.nblocks()`.
+    pub fn block_len(&self, i: usize) -> usize {
+        assert!(
+            i < self.info.nblocks,
+            "block {i} out of {}",
+            self.info.nblocks
+        );
+        self.info.block_len(i)
+    }
+
+    /// Number of streams block `i` is stored as: one per byte of an item for split
+    /// blocks, else one. Panics if `i >= self.nblocks()`.
+    pub fn block_nstreams(&self, i: usize) -> usize {
+        assert!(
+            i < self.info.nblocks,
+            "block {i} out of {}",
+            self.info.nblocks
+        );
+        self.info.nstreams(i)
+    }
+
+    /// Where the compressed bytes of block `i` are in the chunk: its streams, or its raw
+    /// bytes in a memcpyed chunk. Blocks of special chunks have no bytes; their range is
+    /// empty, at `cbytes`. Panics if `i >= self.nblocks()`.
+    pub fn block_range(&self, i: usize) -> Range<usize> {
+        assert!(
+            i < self.info.nblocks,
+            "block {i} out of {}",
+            self.info.nblocks
+        );
+        self.info.block_src_range(i)
+    }
+
+    /// The compressed bytes of block `i` ([`ChunkView::block_range`] of the chunk).
+    pub fn block_bytes(&self, i: usize) -> &'a [u8] {
+        &self.src[self.block_range(i)]
+    }
+
+    /// The blocks holding items `start..start + nitems`, as `blosc2_getitem_ctx` would
+    /// decode them. Returns `BLOSC2_ERROR_INVALID_PARAM` if the items are outside the
+    /// chunk.
+    pub fn blocks_for_items(&self, start: usize, nitems: usize) -> Result<Range<usize>, i32> {
+        let (start_byte, end_byte) = self.info.item_range(start, nitems)?;
+        if start_byte == end_byte {
+            return Ok(0..0);
+        }
+        let blocksize = self.info.blocksize;
+        Ok(start_byte / blocksize..(end_byte - 1) / blocksize + 1)
+    }
+
+    /// Decodes block `i` into the start of `dest` and returns its length
+    /// ([`ChunkView::block_len`]). Blocks after the first of a delta chunk need block 0,
+    /// which is decoded first (into scratch space) on every call.
+    ///
+    /// Returns `BLOSC2_ERROR_INVALID_PARAM` if there is no block `i`,
+    /// `BLOSC2_ERROR_WRITE_BUFFER` if `dest` is too small, `BLOSC2_ERROR_INVALID_HEADER`
+    /// for instrumented chunks and `BLOSC2_ERROR_DATA` if the block does not decode.
+    pub fn decode_block(&self, i: usize, dest: &mut [u8]) -> Result<usize, i32> {
+        self.decode_block_with(i, dest, &mut ScratchArena::default())
+    }
+
+    /// [`ChunkView::decode_block`] with the codec state and scratch buffers of `context`,
+    /// which are kept between calls.
+    pub fn decode_block_ctx(
+        &self,
+        context: &Blosc2Context,
+        i: usize,
+        dest: &mut [u8],
+    ) -> Result<usize, i32> {
+        self.decode_block_with(i, dest, &mut context.scratch.borrow_mut())
+    }
+
+    fn decode_block_with(
+        &self,
+        i: usize,
+        dest: &mut [u8],
+        scratch: &mut ScratchArena,
+    ) -> Result<usize, i32> {
+        let info = &self.info;
+        if i >= info.nblocks {
+            return Err(BLOSC2_ERROR_INVALID_PARAM);
+        }
+        let len = info.block_len(i);
+        if dest.len() < len {
+            return Err(BLOSC2_ERROR_WRITE_BUFFER);
+        }
+        let out = &mut dest[..len];
+
+        if let Some(special) = &info.special {
+            special.fill(i * info.blocksize, out);
+            return Ok(len);
+        }
+        if info.memcpyed {
+            out.copy_from_slice(&self.src[info.block_src_range(i)]);
+            return Ok(len);
+        }
+        if info.instrumented {
+            return Err(BLOSC2_ERROR_INVALID_HEADER);
+        }
+
+        // A shared arena may have been left with another chunk's dictionary
+        info.select_dict(self.src, scratch);
+        info.decode_block(self.src, i, out, &mut DeltaRefs::default(), scratch)
+            .map_err(|_| BLOSC2_ERROR_DATA)?;
+        Ok(len)
+    }
+}
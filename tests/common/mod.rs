@@ -0,0 +1,64 @@
+//! Helpers shared by the test files, each of which has `mod common;`. Not every file
+//! uses every helper.
+#![allow(dead_code)]
+
+use blusc::api::{
+    blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_create_cctx as blusc_blosc2_create_cctx, blosc2_decompress as blusc_blosc2_decompress,
+    Blosc2Context, BLOSC2_CPARAMS_DEFAULTS as BLUSC_BLOSC2_CPARAMS_DEFAULTS,
+};
+use blusc::{Blosc2Cparams, BLOSC2_MAX_OVERHEAD, BLOSC_BLOSCLZ};
+
+/// `num_elements` little-endian u32 values `i * seed / 7` (wrapping): slowly varying data
+/// that spans many blocks and compresses well. A `seed` of 7 gives `i` itself.
+pub fn make_data(num_elements: usize, seed: u32) -> Vec<u8> {
+    let mut src = Vec::with_capacity(num_elements * 4);
+    for i in 0..num_elements {
+        src.extend_from_slice(&((i as u32).wrapping_mul(seed) / 7).to_le_bytes());
+    }
+    src
+}
+
+/// The default cparams with `typesize`, `compcode` and the last filter slot set. Other
+/// fields go in with struct update syntax: `Blosc2Cparams { nthreads: 4, ..cparams(...) }`.
+pub fn cparams(typesize: i32, compcode: u8, filter: u8) -> Blosc2Cparams {
+    let mut cparams = BLUSC_BLOSC2_CPARAMS_DEFAULTS;
+    cparams.typesize = typesize;
+    cparams.compcode = compcode;
+    cparams.filters[5] = filter;
+    cparams
+}
+
+/// Compresses `src` with a new context for `cparams` and returns the chunk.
+pub fn compress(cparams: Blosc2Cparams, src: &[u8]) -> Vec<u8> {
+    compress_ctx(&blusc_blosc2_create_cctx(cparams), src)
+}
+
+/// [`compress`] for 4-byte items with BloscLZ at the default clevel and `filter`.
+pub fn compress_u32(src: &[u8], filter: u8) -> Vec<u8> {
+    compress(cparams(4, BLOSC_BLOSCLZ, filter), src)
+}
+
+/// [`compress`], checking that the chunk decodes back to `src`.
+pub fn compress_checked(cparams: Blosc2Cparams, src: &[u8]) -> Vec<u8> {
+    let chunk = compress(cparams, src);
+    assert!(decompress(&chunk, src.len()) == src);
+    chunk
+}
+
+/// Compresses `src` with `cctx`, which keeps its state between calls, and returns the
+/// chunk.
+pub fn compress_ctx(cctx: &Blosc2Context, src: &[u8]) -> Vec<u8> {
+    let mut chunk = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    let cbytes = blusc_blosc2_compress_ctx(cctx, src, &mut chunk);
+    assert!(cbytes > 0, "blosc2_compress_ctx returned {cbytes}");
+    chunk.truncate(cbytes as usize);
+    chunk
+}
+
+/// Decompresses `chunk`, checking that it holds `nbytes`.
+pub fn decompress(chunk: &[u8], nbytes: usize) -> Vec<u8> {
+    let mut dest = vec![0u8; nbytes];
+    assert_eq!(blusc_blosc2_decompress(chunk, &mut dest), nbytes as i32);
+    dest
+}
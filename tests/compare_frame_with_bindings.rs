@@ -0,0 +1,138 @@
+/// Reads contiguous frames written by c-blosc2 itself (`blosc2_schunk_new`,
+/// `blosc2_schunk_append_buffer`, `blosc2_schunk_to_buffer`) with `Frame`, so that the
+/// header and index layout are checked against C rather than against `build_frame` in
+/// test_frame.rs.
+use blosc2_src::{
+    blosc2_chunk_zeros as bound_blosc2_chunk_zeros, blosc2_destroy as bound_blosc2_destroy,
+    blosc2_init as bound_blosc2_init,
+    blosc2_schunk_append_buffer as bound_blosc2_schunk_append_buffer,
+    blosc2_schunk_append_chunk as bound_blosc2_schunk_append_chunk,
+    blosc2_schunk_free as bound_blosc2_schunk_free, blosc2_schunk_new as bound_blosc2_schunk_new,
+    blosc2_schunk_to_buffer as bound_blosc2_schunk_to_buffer, blosc2_storage as BoundBlosc2Storage,
+    BLOSC2_CPARAMS_DEFAULTS as BOUND_BLOSC2_CPARAMS_DEFAULTS,
+    BLOSC2_DPARAMS_DEFAULTS as BOUND_BLOSC2_DPARAMS_DEFAULTS,
+    BLOSC_EXTENDED_HEADER_LENGTH as BOUND_BLOSC_EXTENDED_HEADER_LENGTH,
+};
+use blusc::frame::Frame;
+use blusc::{BLOSC_SHUFFLE, BLOSC_ZSTD};
+use std::os::raw::c_void;
+
+use ctor::{ctor, dtor};
+
+extern "C" {
+    fn free(ptr: *mut c_void);
+}
+
+#[ctor]
+fn blosc2_init() {
+    unsafe {
+        bound_blosc2_init();
+    }
+}
+
+#[dtor]
+fn blosc2_cleanup() {
+    unsafe {
+        bound_blosc2_destroy();
+    }
+}
+
+const CHUNK_ITEMS: usize = 40_000;
+
+fn chunk_data(c: usize, nitems: usize) -> Vec<u8> {
+    (0..nitems)
+        .flat_map(|i| ((c * CHUNK_ITEMS + i) as f32 * 0.25).to_le_bytes())
+        .collect()
+}
+
+/// A frame of float32 chunks written by C: `chunks[i]` is appended as a buffer, or as a
+/// zeros chunk from `blosc2_chunk_zeros` when it is `None`.
+fn c_frame(chunks: &[Option<Vec<u8>>], zeros_len: usize) -> Vec<u8> {
+    unsafe {
+        let mut cparams = BOUND_BLOSC2_CPARAMS_DEFAULTS;
+        cparams.typesize = 4;
+        cparams.compcode = BLOSC_ZSTD as _;
+        cparams.clevel = 5;
+        cparams.nthreads = 1;
+        let mut dparams = BOUND_BLOSC2_DPARAMS_DEFAULTS;
+        let mut storage = BoundBlosc2Storage {
+            contiguous: true,
+            cparams: &mut cparams,
+            dparams: &mut dparams,
+            ..std::mem::zeroed()
+        };
+        let schunk = bound_blosc2_schunk_new(&mut storage);
+        assert!(!schunk.is_null());
+
+        for chunk in chunks {
+            match chunk {
+                Some(data) => {
+                    let n = bound_blosc2_schunk_append_buffer(
+                        schunk,
+                        data.as_ptr().cast(),
+                        data.len() as i32,
+                    );
+                    assert!(n > 0);
+                }
+                None => {
+                    let mut zeros = vec![0u8; BOUND_BLOSC_EXTENDED_HEADER_LENGTH as usize];
+                    let cbytes = bound_blosc2_chunk_zeros(
+                        cparams,
+                        zeros_len as i32,
+                        zeros.as_mut_ptr().cast(),
+                        zeros.len() as i32,
+                    );
+                    assert!(cbytes > 0);
+                    let n = bound_blosc2_schunk_append_chunk(schunk, zeros.as_mut_ptr(), true);
+                    assert!(n > 0);
+                }
+            }
+        }
+
+        let mut cframe: *mut u8 = std::ptr::null_mut();
+        let mut needs_free = false;
+        let len = bound_blosc2_schunk_to_buffer(schunk, &mut cframe, &mut needs_free);
+        assert!(len > 0);
+        let frame = std::slice::from_raw_parts(cframe, len as usize).to_vec();
+        if needs_free {
+            free(cframe.cast());
+        }
+        bound_blosc2_schunk_free(schunk);
+        frame
+    }
+}
+
+#[test]
+fn read_c_frame() {
+    let data: Vec<Vec<u8>> = (0..3).map(|c| chunk_data(c, CHUNK_ITEMS)).collect();
+    let tail = chunk_data(5, 777);
+    let chunks = [
+        Some(data[0].clone()),
+        None,
+        Some(data[1].clone()),
+        Some(data[2].clone()),
+        Some(tail.clone()),
+    ];
+    let frame_bytes = c_frame(&chunks, CHUNK_ITEMS * 4);
+
+    let frame = Frame::open(&frame_bytes[..]).unwrap();
+    assert_eq!(frame.nchunks(), 5);
+    assert_eq!(frame.nbytes(), (CHUNK_ITEMS * 4 * 4 + tail.len()) as u64);
+    assert_eq!(frame.typesize(), 4);
+    assert_eq!(frame.chunksize(), CHUNK_ITEMS * 4);
+    assert_eq!((frame.compcode(), frame.clevel()), (BLOSC_ZSTD, 5));
+    assert_eq!(frame.filters()[5], BLOSC_SHUFFLE);
+
+    let expected = [
+        data[0].clone(),
+        vec![0u8; CHUNK_ITEMS * 4],
+        data[1].clone(),
+        data[2].clone(),
+        tail,
+    ];
+    let mut dest = vec![0u8; frame.chunksize()];
+    for (i, expected) in expected.iter().enumerate() {
+        assert_eq!(frame.decompress_chunk(i, &mut dest), Ok(expected.len()));
+        assert!(dest[..expected.len()] == expected[..]);
+    }
+}
@@ -0,0 +1,152 @@
+/// Tests for `blosc2_compress_batch` and `blosc2_decompress_batch`: the same chunks as
+/// one call per chunk, on one thread or several, and per-item errors.
+use blusc::api::{
+    blosc2_compress_batch as blusc_blosc2_compress_batch,
+    blosc2_create_cctx as blusc_blosc2_create_cctx, blosc2_create_dctx as blusc_blosc2_create_dctx,
+    blosc2_decompress_batch as blusc_blosc2_decompress_batch,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::tune::btune_decision;
+use blusc::{
+    Blosc2Cparams, BLOSC2_MAX_OVERHEAD, BLOSC_BLOSCLZ, BLOSC_BTUNE, BLOSC_SHUFFLE, BLOSC_ZSTD,
+};
+
+mod common;
+
+fn cparams(compcode: u8, nthreads: i16) -> Blosc2Cparams {
+    Blosc2Cparams {
+        nthreads,
+        ..common::cparams(4, compcode, BLOSC_SHUFFLE)
+    }
+}
+
+/// Chunks of 0 to 64 KB holding slowly varying u32 values.
+fn chunks() -> Vec<Vec<u8>> {
+    (0..40u32)
+        .map(|k| {
+            let nitems = (k * 7919 % 41) * 400;
+            (0..nitems)
+                .flat_map(|i| (i / (k % 5 + 1) + k * 1000).to_le_bytes())
+                .collect()
+        })
+        .collect()
+}
+
+fn buffers(lens: impl Iterator<Item = usize>) -> Vec<Vec<u8>> {
+    lens.map(|len| vec![0u8; len]).collect()
+}
+
+#[test]
+fn batch_matches_single_calls() {
+    let srcs = chunks();
+    let src_refs: Vec<&[u8]> = srcs.iter().map(|src| src.as_slice()).collect();
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+        let cctx = blusc_blosc2_create_cctx(cparams(compcode, 1));
+        let expected: Vec<Vec<u8>> = srcs
+            .iter()
+            .map(|src| common::compress_ctx(&cctx, src))
+            .collect();
+
+        for nthreads in [1, 4] {
+            let cctx = blusc_blosc2_create_cctx(cparams(compcode, nthreads));
+            let mut dests = buffers(srcs.iter().map(|src| src.len() + BLOSC2_MAX_OVERHEAD));
+            let mut dest_refs: Vec<&mut [u8]> =
+                dests.iter_mut().map(|d| d.as_mut_slice()).collect();
+            let sizes = blusc_blosc2_compress_batch(&cctx, &src_refs, &mut dest_refs);
+            assert_eq!(sizes.len(), srcs.len());
+            for ((dest, size), expected) in dests.iter().zip(&sizes).zip(&expected) {
+                assert!(dest[..*size as usize] == expected[..]);
+            }
+
+            let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+            dparams.nthreads = nthreads;
+            let dctx = blusc_blosc2_create_dctx(dparams);
+            let chunk_refs: Vec<&[u8]> = expected.iter().map(|chunk| chunk.as_slice()).collect();
+            let mut outs = buffers(srcs.iter().map(|src| src.len()));
+            let mut out_refs: Vec<&mut [u8]> = outs.iter_mut().map(|o| o.as_mut_slice()).collect();
+            let sizes = blusc_blosc2_decompress_batch(&dctx, &chunk_refs, &mut out_refs);
+            for ((out, size), src) in outs.iter().zip(sizes).zip(&srcs) {
+                assert_eq!(size as usize, src.len());
+                assert!(out == src);
+            }
+        }
+    }
+}
+
+#[test]
+fn errors_stay_with_their_item() {
+    let srcs = chunks();
+    let src_refs: Vec<&[u8]> = srcs[..6].iter().map(|src| src.as_slice()).collect();
+    assert!(srcs[2].len() > 1000);
+    for nthreads in [1, 4] {
+        let cctx = blusc_blosc2_create_cctx(cparams(BLOSC_ZSTD, nthreads));
+        // Item 2 gets no room, and item 5 no buffer at all
+        let mut dests = buffers(srcs[..5].iter().map(|src| src.len() + BLOSC2_MAX_OVERHEAD));
+        dests[2].truncate(20);
+        let mut dest_refs: Vec<&mut [u8]> = dests.iter_mut().map(|d| d.as_mut_slice()).collect();
+        let sizes = blusc_blosc2_compress_batch(&cctx, &src_refs, &mut dest_refs);
+        assert_eq!(sizes.len(), 6);
+        assert_eq!((sizes[2], sizes[5]), (0, 0));
+        assert!(sizes
+            .iter()
+            .enumerate()
+            .all(|(i, &size)| (size > 0) != (i == 2 || i == 5)));
+
+        // and then fails to decode, unlike its neighbours
+        let mut chunks: Vec<&[u8]> = dests
+            .iter()
+            .zip(&sizes)
+            .map(|(d, &n)| &d[..n as usize])
+            .collect();
+        chunks[2] = &[1, 2, 3];
+        let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+        dparams.nthreads = nthreads;
+        let dctx = blusc_blosc2_create_dctx(dparams);
+        let mut outs = buffers(srcs[..5].iter().map(|src| src.len()));
+        let mut out_refs: Vec<&mut [u8]> = outs.iter_mut().map(|o| o.as_mut_slice()).collect();
+        let sizes = blusc_blosc2_decompress_batch(&dctx, &chunks, &mut out_refs);
+        assert_eq!(sizes[2], -1);
+        assert!(outs[4] == srcs[4] && sizes[4] == srcs[4].len() as i32);
+    }
+
+    // Parameters that no chunk can use fail every item
+    let mut cparams = cparams(BLOSC_ZSTD, 1);
+    cparams.blocksize = -7;
+    let cctx = blusc_blosc2_create_cctx(cparams);
+    let mut dests = buffers(srcs[..3].iter().map(|src| src.len() + BLOSC2_MAX_OVERHEAD));
+    let mut dest_refs: Vec<&mut [u8]> = dests.iter_mut().map(|d| d.as_mut_slice()).collect();
+    assert_eq!(
+        blusc_blosc2_compress_batch(&cctx, &src_refs[..3], &mut dest_refs),
+        [0, 0, 0]
+    );
+}
+
+#[test]
+fn tuner_sees_every_chunk() {
+    let srcs = chunks();
+    let src_refs: Vec<&[u8]> = srcs.iter().map(|src| src.as_slice()).collect();
+    let mut cparams = cparams(BLOSC_BLOSCLZ, 4);
+    cparams.tuner_id = BLOSC_BTUNE as i32;
+    let cctx = blusc_blosc2_create_cctx(cparams);
+    let mut dests = buffers(srcs.iter().map(|src| src.len() + BLOSC2_MAX_OVERHEAD));
+    let mut dest_refs: Vec<&mut [u8]> = dests.iter_mut().map(|d| d.as_mut_slice()).collect();
+    let sizes = blusc_blosc2_compress_batch(&cctx, &src_refs, &mut dest_refs);
+
+    let decision = btune_decision(&cctx).unwrap();
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    for ((dest, size), src) in dests.iter().zip(sizes).zip(&srcs) {
+        // Empty chunks go by before there is anything to tune
+        let chunk = &dest[..size as usize];
+        if src.is_empty() {
+            continue;
+        }
+        assert_eq!(chunk[22], decision.compcode);
+        let mut out = vec![0u8; src.len()];
+        let mut out_refs = [out.as_mut_slice()];
+        assert_eq!(
+            blusc_blosc2_decompress_batch(&dctx, &[chunk], &mut out_refs),
+            [src.len() as i32]
+        );
+        assert!(out == *src);
+    }
+}
@@ -0,0 +1,161 @@
+/// Tests for the block pre-analysis in `compress_block`: constant blocks become run
+/// streams without a codec (blosc2 chunks only), random blocks are memcpyed once the
+/// codec gives up on them, periodic ones that the sample takes for random still
+/// compress, and BloscLZ skips its probe on blocks the sample shows to be compressible.
+use blusc::api::{
+    blosc1_compress as blusc_blosc1_compress, blosc1_getitem as blusc_blosc1_getitem,
+    blosc2_decompress as blusc_blosc2_decompress,
+};
+use blusc::{
+    Blosc2Cparams, BLOSC2_MAX_OVERHEAD, BLOSC_BLOSCLZ, BLOSC_EXTENDED_HEADER_LENGTH,
+    BLOSC_MEMCPYED, BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_ZSTD,
+};
+
+mod common;
+
+fn compress(src: &[u8], compcode: u8, clevel: u8, filter: u8, nthreads: i16) -> Vec<u8> {
+    let cparams = Blosc2Cparams {
+        clevel,
+        nthreads,
+        ..common::cparams(4, compcode, filter)
+    };
+    common::compress(cparams, src)
+}
+
+fn assert_roundtrip(compressed: &[u8], src: &[u8]) {
+    let mut dest = vec![0u8; src.len()];
+    assert_eq!(
+        blusc_blosc2_decompress(compressed, &mut dest) as usize,
+        src.len()
+    );
+    assert!(dest == src);
+}
+
+/// Size prefix of the first stream of the first block.
+fn first_stream_size(compressed: &[u8], header_len: usize) -> i32 {
+    let bstart = u32::from_le_bytes(compressed[header_len..header_len + 4].try_into().unwrap());
+    let bstart = bstart as usize;
+    i32::from_le_bytes(compressed[bstart..bstart + 4].try_into().unwrap())
+}
+
+#[test]
+fn constant_blocks_become_runs() {
+    // Not a whole number of blocks, so the leftover block is a run too
+    let nbytes = (1 << 20) + 12;
+    for &value in &[0u8, 7] {
+        let src = vec![value; nbytes];
+        for &compcode in &[BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+            for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE] {
+                let compressed = compress(&src, compcode, 5, filter, 1);
+                let (_, _, blocksize) = blusc::blosc2_cbuffer_sizes(&compressed);
+                let nblocks = nbytes.div_ceil(blocksize);
+                // At most `typesize` runs of 5 bytes per block
+                assert!(compressed.len() <= BLOSC_EXTENDED_HEADER_LENGTH + nblocks * (4 + 4 * 5));
+                assert_eq!(
+                    first_stream_size(&compressed, BLOSC_EXTENDED_HEADER_LENGTH),
+                    -(value as i32)
+                );
+                assert_roundtrip(&compressed, &src);
+
+                let mut item = [0u8; 8];
+                assert_eq!(blusc_blosc1_getitem(&compressed, 1000, 2, &mut item), 8);
+                assert_eq!(item, [value; 8]);
+            }
+        }
+    }
+}
+
+/// Blosc1 chunks have no run streams, so constant blocks still go through the codec.
+#[test]
+fn blosc1_constant_blocks_use_codec() {
+    let src = vec![7u8; 1 << 18];
+    let mut compressed = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    let csize = blusc_blosc1_compress(5, BLOSC_SHUFFLE as i32, 4, &src, &mut compressed);
+    assert!(csize > 0);
+    compressed.truncate(csize as usize);
+    assert!(first_stream_size(&compressed, 16) > 0);
+    assert_roundtrip(&compressed, &src);
+}
+
+#[test]
+fn random_blocks_are_memcpyed() {
+    let mut x: u64 = 0x2545_f491;
+    let src: Vec<u8> = (0..1 << 20)
+        .map(|_| {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            x as u8
+        })
+        .collect();
+    for &clevel in &[1, 5, 9] {
+        let compressed = compress(&src, BLOSC_BLOSCLZ, clevel, BLOSC_SHUFFLE, 1);
+        assert_ne!(compressed[2] & BLOSC_MEMCPYED, 0);
+        assert_roundtrip(&compressed, &src);
+    }
+}
+
+/// Fill-value runs between smooth values: the sample finds matches everywhere, so
+/// BloscLZ compresses without probing first, the same way with any thread count.
+#[test]
+fn compressible_blocks_skip_probe() {
+    let src: Vec<u8> = (0..1 << 18)
+        .flat_map(|i| {
+            let v = if (i / 4096) % 5 < 3 {
+                -9999.0f32
+            } else {
+                (i as f32 * 0.01).sin()
+            };
+            v.to_le_bytes()
+        })
+        .collect();
+    for &clevel in &[4, 9] {
+        let compressed = compress(&src, BLOSC_BLOSCLZ, clevel, BLOSC_NOSHUFFLE, 1);
+        assert_eq!(compressed[2] & BLOSC_MEMCPYED, 0);
+        assert!(compressed.len() < src.len() / 2);
+        assert_roundtrip(&compressed, &src);
+        assert_eq!(
+            compress(&src, BLOSC_BLOSCLZ, clevel, BLOSC_NOSHUFFLE, 4),
+            compressed
+        );
+    }
+}
+
+/// Random bytes repeated with a period of a few KiB: the sample sees no repeats and
+/// high entropy, but every codec finds the period. The sample must not stop them.
+#[test]
+fn periodic_random_blocks_compress() {
+    for (blocksize, period, clevels) in [
+        (128 << 10, 8 << 10, &[4, 5][..]),
+        (256 << 10, 4 << 10, &[6, 7, 8][..]),
+        (256 << 10, 8 << 10, &[6, 7, 8][..]),
+    ] {
+        for seed in 1..4u64 {
+            let mut x = 0x2545_f491 * seed;
+            let pattern: Vec<u8> = (0..period)
+                .map(|_| {
+                    x ^= x << 13;
+                    x ^= x >> 7;
+                    x ^= x << 17;
+                    x as u8
+                })
+                .collect();
+            let src: Vec<u8> = pattern.iter().cycle().take(1 << 20).copied().collect();
+            for &clevel in clevels {
+                let cparams = Blosc2Cparams {
+                    clevel,
+                    blocksize,
+                    ..common::cparams(4, BLOSC_BLOSCLZ, BLOSC_NOSHUFFLE)
+                };
+                let compressed = common::compress(cparams, &src);
+                assert_eq!(
+                    compressed[2] & BLOSC_MEMCPYED,
+                    0,
+                    "period {period}, clevel {clevel}"
+                );
+                assert!(compressed.len() < src.len() / 4);
+                assert_roundtrip(&compressed, &src);
+            }
+        }
+    }
+}
@@ -0,0 +1,98 @@
+/// Tests for `cparams.blocksize`: explicit blocksizes, `BLOSC2_BLOCKSIZE_CACHE`, and
+/// the values that are rejected.
+use blusc::api::{
+    blosc2_chunk_zeros as blusc_blosc2_chunk_zeros,
+    blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_create_cctx as blusc_blosc2_create_cctx,
+};
+use blusc::stream::ChunkEncoder;
+use blusc::{
+    blosc2_cbuffer_sizes, Blosc2Cparams, BLOSC2_BLOCKSIZE_CACHE, BLOSC2_MAXBLOCKSIZE,
+    BLOSC2_MAX_OVERHEAD, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, BLOSC_ZSTD,
+};
+use std::io::Cursor;
+
+mod common;
+use common::compress_checked;
+
+fn cparams(typesize: i32, compcode: u8, blocksize: i32) -> Blosc2Cparams {
+    Blosc2Cparams {
+        blocksize,
+        ..common::cparams(typesize, compcode, BLOSC_SHUFFLE)
+    }
+}
+
+fn data(nbytes: usize) -> Vec<u8> {
+    (0..nbytes as u32 / 4)
+        .flat_map(|i| (i / 3 + (i / 1000 % 7) * 1000).to_le_bytes())
+        .collect()
+}
+
+#[test]
+fn explicit_blocksize_is_used() {
+    let src = data(1_000_000);
+    // The table would pick 256 KB: 64 KB per split stream of zstd at clevel 5
+    let automatic = compress_checked(cparams(4, BLOSC_ZSTD, 0), &src);
+    assert_eq!(blosc2_cbuffer_sizes(&automatic).2, 256 * 1024);
+
+    for (blocksize, expected) in [
+        (48 * 1024, 48 * 1024),
+        (1_000_001, 1_000_000),
+        (10_003, 10_000),
+        (1000, 1000),
+    ] {
+        for compcode in [BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+            let chunk = compress_checked(cparams(4, compcode, blocksize), &src);
+            assert_eq!(blosc2_cbuffer_sizes(&chunk).2, expected, "{blocksize}");
+
+            // Same chunk from the workers
+            let mut threaded = cparams(4, compcode, blocksize);
+            threaded.nthreads = 4;
+            assert!(compress_checked(threaded, &src) == chunk);
+        }
+    }
+
+    // and from the encoder
+    let cparams = cparams(4, BLOSC_ZSTD, 48 * 1024);
+    let mut encoder = ChunkEncoder::new(&cparams, src.len(), Cursor::new(Vec::new())).unwrap();
+    for piece in src.chunks(10_000) {
+        encoder.push(piece).unwrap();
+    }
+    let (sink, _) = encoder.finish().unwrap();
+    assert!(sink.into_inner() == compress_checked(cparams, &src));
+
+    // Special chunks record it as well
+    let mut zeros = [0u8; BLOSC2_MAX_OVERHEAD];
+    let cparams = self::cparams(4, BLOSC_ZSTD, 48 * 1024);
+    assert!(blusc_blosc2_chunk_zeros(&cparams, src.len(), &mut zeros) > 0);
+    assert_eq!(blosc2_cbuffer_sizes(&zeros).2, 48 * 1024);
+}
+
+#[test]
+fn cache_blocksize_feeds_every_thread() {
+    let src = data(4 << 20);
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+        let single = compress_checked(cparams(4, compcode, BLOSC2_BLOCKSIZE_CACHE), &src);
+        let blocksize = blosc2_cbuffer_sizes(&single).2;
+        assert!(blocksize >= 4096 && blocksize % 4 == 0);
+
+        let mut cparams = cparams(4, compcode, BLOSC2_BLOCKSIZE_CACHE);
+        cparams.nthreads = 8;
+        let threaded = compress_checked(cparams, &src);
+        let blocksize = blosc2_cbuffer_sizes(&threaded).2;
+        assert!(src.len().div_ceil(blocksize) >= 8 * 4, "{blocksize}");
+    }
+}
+
+#[test]
+fn invalid_blocksizes_are_rejected() {
+    let src = data(100_000);
+    let mut dest = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    for blocksize in [-2, BLOSC2_MAXBLOCKSIZE as i32 + 1, i32::MIN] {
+        let cparams = cparams(4, BLOSC_BLOSCLZ, blocksize);
+        let cctx = blusc_blosc2_create_cctx(cparams);
+        assert_eq!(blusc_blosc2_compress_ctx(&cctx, &src, &mut dest), 0);
+        assert!(blusc_blosc2_chunk_zeros(&cctx.cparams, src.len(), &mut dest) < 0);
+        assert!(ChunkEncoder::new(&cctx.cparams, src.len(), Cursor::new(Vec::new())).is_err());
+    }
+}
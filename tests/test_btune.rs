@@ -0,0 +1,170 @@
+/// Tests for the `BLOSC_BTUNE` tuner: tuned chunks decode like any other, the decision is
+/// cached in the context, and a ratio-only goal never does worse than the defaults.
+use blusc::api::{
+    blosc2_create_cctx as blusc_blosc2_create_cctx,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::schunk::Schunk;
+use blusc::tune::{btune_decision, btune_init, BtuneConfig, BtunePerfMode};
+use blusc::{
+    Blosc2Cparams, BLOSC_ALWAYS_SPLIT, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_BTUNE, BLOSC_DELTA,
+    BLOSC_LZ4, BLOSC_MEMCPYED, BLOSC_NEVER_SPLIT, BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_ZSTD,
+};
+
+mod common;
+use common::{compress_ctx, decompress};
+
+fn cparams(typesize: i32) -> Blosc2Cparams {
+    common::cparams(typesize, BLOSC_BLOSCLZ, BLOSC_SHUFFLE)
+}
+
+/// Sensor-like u32 readings: a slow drift plus noise in the low bits.
+fn readings(c: u32, nitems: usize) -> Vec<u8> {
+    let mut x = 0x2545_f491u32.wrapping_add(c);
+    (0..nitems as u32)
+        .flat_map(|i| {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            (100_000 + c * 1000 + i / 64 + (x & 0x7)).to_le_bytes()
+        })
+        .collect()
+}
+
+fn assert_roundtrip(chunk: &[u8], src: &[u8]) {
+    assert!(decompress(chunk, src.len()) == src);
+}
+
+#[test]
+fn tuned_chunks_roundtrip_and_record_the_decision() {
+    for perf_mode in [
+        BtunePerfMode::Comp,
+        BtunePerfMode::Decomp,
+        BtunePerfMode::Balanced,
+    ] {
+        let mut cctx = blusc_blosc2_create_cctx(cparams(4));
+        let config = BtuneConfig {
+            perf_mode,
+            ..BtuneConfig::default()
+        };
+        btune_init(config, &mut cctx);
+        assert_eq!(cctx.cparams.tuner_id, BLOSC_BTUNE as i32);
+        assert_eq!(btune_decision(&cctx), None);
+
+        let src = readings(0, 300_000);
+        let chunk = compress_ctx(&cctx, &src);
+        assert_roundtrip(&chunk, &src);
+        let decision = btune_decision(&cctx).unwrap();
+        // The header says what was picked
+        assert_eq!(chunk[22], decision.compcode);
+        assert_eq!(chunk[21], decision.filter);
+        assert!([BLOSC_ALWAYS_SPLIT, BLOSC_NEVER_SPLIT].contains(&decision.splitmode));
+        if chunk[2] & BLOSC_MEMCPYED == 0 {
+            assert_eq!(
+                chunk[2] & 0x10 == 0,
+                decision.splitmode == BLOSC_ALWAYS_SPLIT
+            );
+        }
+        if perf_mode == BtunePerfMode::Comp {
+            assert!([BLOSC_LZ4, BLOSC_BLOSCLZ].contains(&decision.compcode));
+        }
+
+        // Later chunks reuse it, whatever they hold
+        let zeros = vec![0u8; 300_000];
+        assert_roundtrip(&compress_ctx(&cctx, &zeros), &zeros);
+        assert_eq!(btune_decision(&cctx), Some(decision));
+    }
+}
+
+#[test]
+fn ratio_goal_beats_the_defaults() {
+    for typesize in [1, 4, 8] {
+        let src = readings(3, 25_000);
+        let defaults = compress_ctx(&blusc_blosc2_create_cctx(cparams(typesize)), &src);
+
+        let mut cctx = blusc_blosc2_create_cctx(cparams(typesize));
+        let config = BtuneConfig {
+            tradeoff: 1.0,
+            ..BtuneConfig::default()
+        };
+        btune_init(config, &mut cctx);
+        // The chunk is small enough to be its own sample, and the first round runs the
+        // default parameters too
+        let tuned = compress_ctx(&cctx, &src);
+        assert!(tuned.len() <= defaults.len(), "typesize {typesize}");
+        assert_roundtrip(&tuned, &src);
+        if typesize == 1 {
+            assert_ne!(btune_decision(&cctx).unwrap().filter, BLOSC_SHUFFLE);
+        }
+    }
+}
+
+#[test]
+fn tuner_id_alone_uses_the_defaults() {
+    let mut cparams = cparams(4);
+    cparams.tuner_id = BLOSC_BTUNE as i32;
+    // Other filters stay where they are
+    cparams.filters = [0, 0, 0, 0, BLOSC_DELTA, BLOSC_SHUFFLE];
+    let cctx = blusc_blosc2_create_cctx(cparams);
+    let src = readings(1, 100_000);
+    let chunk = compress_ctx(&cctx, &src);
+    assert_roundtrip(&chunk, &src);
+    let decision = btune_decision(&cctx).unwrap();
+    assert!([BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE].contains(&decision.filter));
+    assert_eq!(&chunk[16..22], &[0, 0, 0, 0, BLOSC_DELTA, decision.filter]);
+
+    // Dictionaries restrict the search to zstd
+    let mut cparams = self::cparams(4);
+    cparams.tuner_id = BLOSC_BTUNE as i32;
+    cparams.use_dict = 1;
+    let cctx = blusc_blosc2_create_cctx(cparams);
+    assert_roundtrip(&compress_ctx(&cctx, &src), &src);
+    assert_eq!(btune_decision(&cctx).unwrap().compcode, BLOSC_ZSTD);
+}
+
+#[test]
+fn retune_every() {
+    let mut cctx = blusc_blosc2_create_cctx(cparams(4));
+    let config = BtuneConfig {
+        tradeoff: 1.0,
+        retune_every: 1,
+        ..BtuneConfig::default()
+    };
+    btune_init(config, &mut cctx);
+    let src = readings(2, 50_000);
+    assert_roundtrip(&compress_ctx(&cctx, &src), &src);
+    // Constant data compresses the same with any codec and shuffle, so the first ones win,
+    // but one run per block beats one per split stream
+    let constant = vec![7u8; 200_000];
+    assert_roundtrip(&compress_ctx(&cctx, &constant), &constant);
+    let decision = btune_decision(&cctx).unwrap();
+    assert_eq!(
+        (
+            decision.compcode,
+            decision.filter,
+            decision.clevel,
+            decision.splitmode
+        ),
+        (BLOSC_LZ4, BLOSC_NOSHUFFLE, 5, BLOSC_NEVER_SPLIT)
+    );
+}
+
+#[test]
+fn tuned_schunk() {
+    let mut cparams = cparams(4);
+    cparams.tuner_id = BLOSC_BTUNE as i32;
+    cparams.compcode = BLOSC_BLOSCLZ;
+    let mut schunk = Schunk::new(cparams, BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    let data: Vec<u8> = (0..6).flat_map(|c| readings(c, 40_000)).collect();
+    for chunk in data.chunks(160_000) {
+        schunk.append_buffer(chunk).unwrap();
+    }
+    let mut dest = vec![0u8; data.len()];
+    assert_eq!(schunk.decompress(&mut dest), Ok(data.len()));
+    assert!(dest == data);
+    // Every chunk was compressed with the first decision
+    let codec = schunk.get_chunk(0).unwrap()[22];
+    for i in 1..6 {
+        assert_eq!(schunk.get_chunk(i).unwrap()[22], codec);
+    }
+}
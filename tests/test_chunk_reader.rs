@@ -0,0 +1,171 @@
+/// Tests for `reader::ChunkReader`, the cached item reader.
+/// Whatever the cache budget, every read must return the same bytes as `blosc1_getitem`
+/// and the full decode, and the cache must never hold more than its budget.
+use blusc::api::{
+    blosc1_compress as blusc_blosc1_compress, blosc1_getitem as blusc_blosc1_getitem,
+    blosc2_decompress as blusc_blosc2_decompress,
+};
+use blusc::reader::ChunkReader;
+use blusc::{
+    BLOSC2_ERROR_INVALID_PARAM, BLOSC2_ERROR_WRITE_BUFFER, BLOSC2_MAX_OVERHEAD, BLOSC_BITSHUFFLE,
+    BLOSC_NOSHUFFLE, BLOSC_SHUFFLE,
+};
+
+mod common;
+use common::{compress_u32, make_data};
+
+/// Item ranges inside one block, across block boundaries, whole chunk and the last items.
+const RANGES: [(usize, usize); 8] = [
+    (0, 1),
+    (10, 100),
+    (8_000, 40_000),
+    (11, 3),
+    (0, 300_000),
+    (299_990, 10),
+    (12, 1),
+    (8_000, 40_000),
+];
+
+#[test]
+fn reader_matches_getitem() {
+    let src = make_data(300_000, 3);
+
+    for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+        let compressed = compress_u32(&src, filter);
+        let mut full = vec![0u8; src.len()];
+        assert_eq!(
+            blusc_blosc2_decompress(&compressed, &mut full) as usize,
+            src.len()
+        );
+
+        for budget in [0, 1, 100_000, 1 << 30] {
+            let mut reader = ChunkReader::new(&compressed[..], budget).unwrap();
+            assert_eq!(reader.nbytes(), src.len());
+            assert_eq!(reader.typesize(), 4);
+
+            for &(start, nitems) in RANGES.iter() {
+                let mut dest = vec![0u8; nitems * 4];
+                assert_eq!(reader.getitem(start, nitems, &mut dest), Ok(nitems * 4));
+                assert_eq!(
+                    &dest[..],
+                    &full[start * 4..(start + nitems) * 4],
+                    "filter={}, budget={}, start={}, nitems={}",
+                    filter,
+                    budget,
+                    start,
+                    nitems
+                );
+
+                let mut dest1 = vec![0u8; nitems * 4];
+                let n1 = blusc_blosc1_getitem(&compressed, start as i32, nitems as i32, &mut dest1);
+                assert_eq!(n1 as usize, nitems * 4);
+                assert_eq!(dest1, dest);
+
+                assert!(reader.cached_bytes() <= budget);
+            }
+        }
+    }
+}
+
+/// Reading one item at a time through a small budget keeps the cache bounded and
+/// still returns every item.
+#[test]
+fn reader_evicts_within_budget() {
+    let src = make_data(300_000, 3);
+    let compressed = compress_u32(&src, BLOSC_SHUFFLE);
+    let blocksize = ChunkReader::new(&compressed[..], 0).unwrap().blocksize();
+    let budget = blocksize * 2;
+    let mut reader = ChunkReader::new(&compressed[..], budget).unwrap();
+
+    let mut item = [0u8; 4];
+    for pass in 0..2 {
+        for i in (0..300_000).step_by(97) {
+            reader.getitem(i, 1, &mut item).unwrap();
+            assert_eq!(&item[..], &src[i * 4..i * 4 + 4], "pass={}, i={}", pass, i);
+            assert!(reader.cached_bytes() <= budget);
+        }
+    }
+    assert!(reader.cached_bytes() > 0);
+}
+
+/// Unshuffled blosc1 chunks are split into one stream per byte of the type; partial reads
+/// of such blocks only decode the streams they touch. Mixes zero runs and compressed
+/// streams.
+#[test]
+fn getitem_partial_unshuffled_split_blocks() {
+    let mut src = make_data(200_000, 3);
+    src[100_000..200_000].fill(0);
+
+    let mut compressed = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    let csize = blusc_blosc1_compress(5, BLOSC_NOSHUFFLE as i32, 4, &src, &mut compressed);
+    assert!(csize > 0);
+    compressed.truncate(csize as usize);
+    // Neither memcpyed nor dont_split, so blocks hold 4 streams each
+    assert_eq!(compressed[2] & 0x12, 0);
+
+    let mut reader = ChunkReader::new(&compressed[..], 0).unwrap();
+    let mut rng: u32 = 7;
+    for _ in 0..500 {
+        rng = rng.wrapping_mul(1_103_515_245).wrapping_add(12_345);
+        let start = (rng >> 8) as usize % 200_000;
+        rng = rng.wrapping_mul(1_103_515_245).wrapping_add(12_345);
+        let nitems = 1 + (rng >> 8) as usize % std::cmp::min(20_000, 200_000 - start);
+
+        let mut dest = vec![0u8; nitems * 4];
+        let n = blusc_blosc1_getitem(&compressed, start as i32, nitems as i32, &mut dest);
+        assert_eq!(n as usize, nitems * 4);
+        assert_eq!(
+            &dest[..],
+            &src[start * 4..(start + nitems) * 4],
+            "start={}, nitems={}",
+            start,
+            nitems
+        );
+
+        let mut dest1 = vec![0u8; nitems * 4];
+        assert_eq!(reader.getitem(start, nitems, &mut dest1), Ok(nitems * 4));
+        assert_eq!(dest1, dest);
+    }
+}
+
+/// Uncompressible data is stored memcpyed and is served straight from the chunk.
+#[test]
+fn reader_memcpyed_chunk() {
+    let mut state: u64 = 0x9E3779B97F4A7C15;
+    let src: Vec<u8> = (0..100_000)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            state as u8
+        })
+        .collect();
+    let compressed = compress_u32(&src, BLOSC_SHUFFLE);
+
+    let mut reader = ChunkReader::new(&compressed, 1 << 20).unwrap();
+    let mut dest = vec![0u8; 400];
+    assert_eq!(reader.getitem(1_000, 100, &mut dest), Ok(400));
+    assert_eq!(&dest[..], &src[4_000..4_400]);
+    assert_eq!(reader.cached_bytes(), 0);
+}
+
+#[test]
+fn reader_errors() {
+    let src = make_data(10_000, 3);
+    let compressed = compress_u32(&src, BLOSC_SHUFFLE);
+    let mut reader = ChunkReader::new(&compressed, 1 << 20).unwrap();
+
+    let mut dest = vec![0u8; 40];
+    assert_eq!(
+        reader.getitem(9_995, 10, &mut dest),
+        Err(BLOSC2_ERROR_INVALID_PARAM)
+    );
+    assert_eq!(
+        reader.getitem(0, 11, &mut dest),
+        Err(BLOSC2_ERROR_WRITE_BUFFER)
+    );
+    assert_eq!(reader.getitem(5, 0, &mut dest), Ok(0));
+
+    assert!(ChunkReader::new(&compressed[..8], 0).is_err());
+    assert!(ChunkReader::new(&compressed[..compressed.len() - 1], 0).is_err());
+}
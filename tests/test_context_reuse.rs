@@ -0,0 +1,157 @@
+/// Tests that a single context can be reused across many calls.
+/// Contexts keep their working buffers between calls, so buffers of different sizes,
+/// filters and codecs must not leak state from one call into the next.
+use blusc::api::{
+    blosc1_getitem as blusc_blosc1_getitem, blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_create_cctx as blusc_blosc2_create_cctx, blosc2_create_dctx as blusc_blosc2_create_dctx,
+    blosc2_decompress as blusc_blosc2_decompress,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    blosc2_getitem_ctx as blusc_blosc2_getitem_ctx,
+    BLOSC2_CPARAMS_DEFAULTS as BLUSC_BLOSC2_CPARAMS_DEFAULTS,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::{
+    BLOSC2_MAX_OVERHEAD, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_NOSHUFFLE, BLOSC_SHUFFLE,
+    BLOSC_ZLIB, BLOSC_ZSTD,
+};
+
+mod common;
+use common::{compress_ctx, make_data};
+
+/// Compresses with a fresh context, i.e. with freshly allocated working buffers.
+fn compress_fresh(src: &[u8], compcode: u8, filter: u8) -> Vec<u8> {
+    common::compress(common::cparams(4, compcode, filter), src)
+}
+
+/// Reusing one compression context gives the same bytes as a fresh one, whether the
+/// buffers grow or shrink between calls.
+#[test]
+fn reused_cctx_matches_fresh() {
+    for &compcode in &[BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            let cctx = blusc_blosc2_create_cctx(common::cparams(4, compcode, filter));
+
+            for (num_elements, seed) in [(200_000, 3), (1_000, 5), (50_000, 11), (17, 13)] {
+                let src = make_data(num_elements, seed);
+                assert_eq!(
+                    compress_ctx(&cctx, &src),
+                    compress_fresh(&src, compcode, filter),
+                    "Mismatch: compcode={}, filter={}, elements={}",
+                    compcode,
+                    filter,
+                    num_elements
+                );
+            }
+        }
+    }
+}
+
+/// Reusing one decompression context across chunks with different filters and sizes.
+#[test]
+fn reused_dctx_roundtrip() {
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+
+    for &filter in &[
+        BLOSC_BITSHUFFLE,
+        BLOSC_SHUFFLE,
+        BLOSC_NOSHUFFLE,
+        BLOSC_BITSHUFFLE,
+    ] {
+        for (num_elements, seed) in [(150_000, 3), (2_000, 7), (80_000, 9)] {
+            let src = make_data(num_elements, seed);
+            let compressed = compress_fresh(&src, BLOSC_BLOSCLZ, filter);
+
+            let mut decompressed = vec![0u8; src.len()];
+            let dsize = blusc_blosc2_decompress_ctx(&dctx, &compressed, &mut decompressed);
+            assert_eq!(dsize as usize, src.len());
+            assert_eq!(
+                src, decompressed,
+                "filter={}, elements={}",
+                filter, num_elements
+            );
+        }
+    }
+}
+
+/// One decompression context reuses its zstd/zlib decoders across codecs and levels.
+#[test]
+fn reused_dctx_across_codecs() {
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    let src = make_data(100_000, 3);
+
+    for &compcode in &[
+        BLOSC_ZSTD,
+        BLOSC_ZLIB,
+        BLOSC_BLOSCLZ,
+        BLOSC_ZSTD,
+        BLOSC_ZLIB,
+    ] {
+        for &clevel in &[1u8, 9, 4] {
+            let mut cparams = BLUSC_BLOSC2_CPARAMS_DEFAULTS;
+            cparams.compcode = compcode;
+            cparams.clevel = clevel;
+            cparams.typesize = 4;
+            let cctx = blusc_blosc2_create_cctx(cparams);
+            let mut compressed = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+            let csize = blusc_blosc2_compress_ctx(&cctx, &src, &mut compressed);
+            assert!(csize > 0);
+            compressed.truncate(csize as usize);
+
+            let mut decompressed = vec![0u8; src.len()];
+            let dsize = blusc_blosc2_decompress_ctx(&dctx, &compressed, &mut decompressed);
+            assert_eq!(dsize as usize, src.len());
+            assert_eq!(
+                src, decompressed,
+                "compcode={}, clevel={}",
+                compcode, clevel
+            );
+        }
+    }
+}
+
+/// `blosc2_getitem_ctx` returns the same items as `blosc1_getitem` and the full decode,
+/// for slices inside one block, across block boundaries and covering whole blocks.
+#[test]
+fn getitem_ctx_matches_full_decode() {
+    let src = make_data(300_000, 3);
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+
+    for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+        let compressed = compress_fresh(&src, BLOSC_BLOSCLZ, filter);
+        let mut full = vec![0u8; src.len()];
+        assert_eq!(
+            blusc_blosc2_decompress(&compressed, &mut full) as usize,
+            src.len()
+        );
+
+        for (start, nitems) in [
+            (0, 1),
+            (10, 100),
+            (8_000, 40_000),
+            (0, 300_000),
+            (299_990, 10),
+        ] {
+            let mut dest = vec![0u8; nitems * 4];
+            let n = blusc_blosc2_getitem_ctx(
+                &dctx,
+                &compressed,
+                start as i32,
+                nitems as i32,
+                &mut dest,
+            );
+            assert_eq!(n as usize, nitems * 4);
+            assert_eq!(&dest[..], &full[start * 4..(start + nitems) * 4]);
+
+            let mut dest1 = vec![0u8; nitems * 4];
+            let n1 = blusc_blosc1_getitem(&compressed, start as i32, nitems as i32, &mut dest1);
+            assert_eq!(n1, n);
+            assert_eq!(dest1, dest);
+        }
+
+        let mut dest = vec![0u8; 40];
+        assert_eq!(
+            blusc_blosc2_getitem_ctx(&dctx, &compressed, 299_995, 10, &mut dest),
+            -1
+        );
+    }
+}
@@ -0,0 +1,233 @@
+/// Tests for the filter pipeline: `BLOSC_DELTA` and `BLOSC_TRUNC_PREC` combined with the
+/// shuffles in any slot, through whole-chunk decompression, `getitem`, `ChunkReader` and
+/// the stream encoder and decoder, single- and multi-threaded.
+use blusc::api::{
+    blosc1_getitem as blusc_blosc1_getitem, blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_create_cctx as blusc_blosc2_create_cctx, blosc2_create_dctx as blusc_blosc2_create_dctx,
+    blosc2_decompress as blusc_blosc2_decompress,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::reader::ChunkReader;
+use blusc::stream::{ChunkDecoder, ChunkEncoder};
+use blusc::{
+    Blosc2Cparams, BLOSC2_MAX_OVERHEAD, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_DELTA,
+    BLOSC_SHUFFLE, BLOSC_TRUNC_PREC, BLOSC_ZLIB, BLOSC_ZSTD,
+};
+use std::io::Cursor;
+
+/// Timestamps at a fixed rate, with the odd late sample: what the delta filter is for.
+fn timestamps(nitems: usize, typesize: usize) -> Vec<u8> {
+    let mut t: u64 = 1_700_000_000_000;
+    let mut x: u32 = 0x9e37_79b9;
+    let mut data = Vec::with_capacity(nitems * typesize);
+    for _ in 0..nitems {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        t += 16 + (x % 64 == 0) as u64;
+        data.extend_from_slice(&t.to_le_bytes()[..typesize]);
+    }
+    data
+}
+
+mod common;
+use common::compress;
+
+fn cparams(
+    typesize: usize,
+    compcode: u8,
+    filters: [u8; 6],
+    filters_meta: [u8; 6],
+) -> Blosc2Cparams {
+    Blosc2Cparams {
+        filters,
+        filters_meta,
+        ..common::cparams(typesize as i32, compcode, filters[5])
+    }
+}
+
+fn decompress(chunk: &[u8], nbytes: usize, nthreads: i16) -> Vec<u8> {
+    let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+    dparams.nthreads = nthreads;
+    let dctx = blusc_blosc2_create_dctx(dparams);
+    let mut dest = vec![0u8; nbytes];
+    assert_eq!(
+        blusc_blosc2_decompress_ctx(&dctx, chunk, &mut dest),
+        nbytes as i32
+    );
+    dest
+}
+
+const D: u8 = BLOSC_DELTA;
+const S: u8 = BLOSC_SHUFFLE;
+const BS: u8 = BLOSC_BITSHUFFLE;
+
+#[test]
+fn delta_roundtrips_in_any_slot() {
+    for typesize in [1, 2, 4, 8] {
+        let src = timestamps(300_000 / typesize + 17, typesize);
+        for filters in [
+            [0, 0, 0, 0, D, 0],
+            [0, 0, 0, 0, D, S],
+            [0, 0, 0, 0, D, BS],
+            [0, 0, 0, 0, S, D],
+            [0, 0, 0, D, S, D],
+        ] {
+            for compcode in [BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+                let chunk = compress(cparams(typesize, compcode, filters, [0; 6]), &src);
+                let mut dest = vec![0u8; src.len()];
+                assert_eq!(blusc_blosc2_decompress(&chunk, &mut dest), src.len() as i32);
+                assert!(
+                    dest == src,
+                    "{filters:?} typesize {typesize} codec {compcode}"
+                );
+                assert!(decompress(&chunk, src.len(), 4) == src);
+
+                // Blocks after the first are coded against it on the workers too
+                let mut threaded = cparams(typesize, compcode, filters, [0; 6]);
+                threaded.nthreads = 4;
+                assert!(compress(threaded, &src) == chunk);
+            }
+        }
+    }
+}
+
+#[test]
+fn delta_improves_timestamps() {
+    // Without the late samples
+    let src: Vec<u8> = (0..250_000u64)
+        .flat_map(|i| (1_700_000_000_000 + i * 16).to_le_bytes())
+        .collect();
+    let shuffled = compress(cparams(8, BLOSC_ZSTD, [0, 0, 0, 0, 0, S], [0; 6]), &src);
+    let delta = compress(cparams(8, BLOSC_ZSTD, [0, 0, 0, 0, D, S], [0; 6]), &src);
+    assert!(
+        delta.len() * 4 < shuffled.len(),
+        "{} vs {}",
+        delta.len(),
+        shuffled.len()
+    );
+    // The header keeps the pipeline and flags DODELTA
+    assert_eq!(&delta[16..22], &[0, 0, 0, 0, D, S]);
+    assert_ne!(delta[2] & 0x8, 0);
+}
+
+#[test]
+fn repeated_shuffles_follow_meta() {
+    let src = timestamps(100_000, 4);
+    let chunk = compress(
+        cparams(4, BLOSC_BLOSCLZ, [S, 0, 0, 0, D, S], [2, 0, 0, 0, 0, 0]),
+        &src,
+    );
+    assert!(decompress(&chunk, src.len(), 1) == src);
+}
+
+#[test]
+fn truncated_precision() {
+    let src: Vec<u8> = (0..200_000)
+        .flat_map(|i| ((i as f64) * 0.001).sin().to_le_bytes())
+        .collect();
+    let full = compress(cparams(8, BLOSC_ZSTD, [0, 0, 0, 0, 0, BS], [0; 6]), &src);
+    let trunc_filters = [0, 0, 0, 0, BLOSC_TRUNC_PREC, BS];
+    let chunk = compress(
+        cparams(8, BLOSC_ZSTD, trunc_filters, [0, 0, 0, 0, 20, 0]),
+        &src,
+    );
+    assert!(chunk.len() < full.len());
+
+    // 20 mantissa bits are kept: values are within one unit of the 20th bit
+    for (value, expected) in decompress(&chunk, src.len(), 1)
+        .chunks(8)
+        .zip(src.chunks(8))
+    {
+        let value = f64::from_le_bytes(value.try_into().unwrap());
+        let expected = f64::from_le_bytes(expected.try_into().unwrap());
+        assert!((value - expected).abs() <= expected.abs() * 2f64.powi(-20));
+        assert_eq!(value.to_bits() & ((1 << 32) - 1), 0);
+    }
+
+    // Negative precision zeroes that many bits
+    let chunk = compress(
+        cparams(8, BLOSC_ZSTD, trunc_filters, [0, 0, 0, 0, (-40i8) as u8, 0]),
+        &src,
+    );
+    for value in decompress(&chunk, src.len(), 1).chunks(8) {
+        assert_eq!(
+            u64::from_le_bytes(value.try_into().unwrap()) & ((1 << 40) - 1),
+            0
+        );
+    }
+
+    // More bits than the mantissa has, or a typesize that is not a float
+    let cctx = blusc_blosc2_create_cctx(cparams(8, BLOSC_ZSTD, trunc_filters, [0, 0, 0, 0, 60, 0]));
+    let mut dest = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    assert!(blusc_blosc2_compress_ctx(&cctx, &src, &mut dest) <= 0);
+    let cctx = blusc_blosc2_create_cctx(cparams(2, BLOSC_ZSTD, trunc_filters, [0, 0, 0, 0, 10, 0]));
+    assert!(blusc_blosc2_compress_ctx(&cctx, &src, &mut dest) <= 0);
+}
+
+#[test]
+fn unknown_filters_are_rejected() {
+    let src = timestamps(10_000, 4);
+    let cctx = blusc_blosc2_create_cctx(cparams(4, BLOSC_ZSTD, [0, 0, 0, 0, 0, 200], [0; 6]));
+    let mut dest = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    assert!(blusc_blosc2_compress_ctx(&cctx, &src, &mut dest) <= 0);
+}
+
+#[test]
+fn partial_reads_of_delta_chunks() {
+    let src = timestamps(400_000, 4);
+    let chunk = compress(cparams(4, BLOSC_ZLIB, [0, 0, 0, 0, D, S], [0; 6]), &src);
+    let (_, _, blocksize) = blusc::blosc2_cbuffer_sizes(&chunk);
+    assert!(blocksize < src.len() / 4);
+
+    // Ranges inside a later block, straddling blocks, and the last items
+    let nitems = src.len() / 4;
+    let ranges = [
+        (blocksize / 4 * 3 + 5, 100),
+        (blocksize / 4 - 10, 20),
+        (nitems - 7, 7),
+        (0, 50),
+    ];
+    for budget in [0, usize::MAX] {
+        let mut reader = ChunkReader::new(&chunk[..], budget).unwrap();
+        for &(start, n) in &ranges {
+            let expected = &src[start * 4..(start + n) * 4];
+            let mut items = vec![0u8; n * 4];
+            assert_eq!(
+                blusc_blosc1_getitem(&chunk, start as i32, n as i32, &mut items),
+                (n * 4) as i32
+            );
+            assert_eq!(&items[..], expected);
+            items.fill(0);
+            assert_eq!(reader.getitem(start, n, &mut items), Ok(n * 4));
+            assert_eq!(&items[..], expected);
+        }
+    }
+}
+
+#[test]
+fn streamed_delta_chunks() {
+    let src = timestamps(300_000, 8);
+    let cparams = cparams(8, BLOSC_ZSTD, [0, 0, 0, 0, D, BS], [0; 6]);
+    let mut encoder = ChunkEncoder::new(&cparams, src.len(), Cursor::new(Vec::new())).unwrap();
+    for piece in src.chunks(7777) {
+        encoder.push(piece).unwrap();
+    }
+    let (sink, cbytes) = encoder.finish().unwrap();
+    let chunk = sink.into_inner();
+    assert_eq!(chunk.len(), cbytes);
+    assert!(chunk == compress(cparams, &src));
+
+    let mut decoder = ChunkDecoder::new();
+    let mut output = vec![0u8; src.len()];
+    for piece in chunk.chunks(1000) {
+        decoder
+            .push(piece, |offset, block| {
+                output[offset..offset + block.len()].copy_from_slice(block)
+            })
+            .unwrap();
+    }
+    assert!(decoder.is_finished());
+    assert!(output == src);
+}
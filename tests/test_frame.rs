@@ -0,0 +1,221 @@
+/// Tests for `Frame`: contiguous frames laid out as c-blosc2 writes them (msgpack header,
+/// chunks, offsets index, trailer), read from memory and through a range callback.
+use blusc::frame::{Frame, RangeFetch};
+use blusc::{
+    BLOSC2_ERROR_FRAME_TYPE, BLOSC2_ERROR_INVALID_HEADER, BLOSC2_ERROR_INVALID_INDEX,
+    BLOSC2_ERROR_READ_BUFFER, BLOSC2_SPECIAL_NAN, BLOSC2_SPECIAL_ZERO, BLOSC_SHUFFLE, BLOSC_ZSTD,
+};
+use std::borrow::Cow;
+use std::cell::RefCell;
+
+const CHUNK_ITEMS: usize = 40_000;
+const HEADER_LEN: usize = 94;
+
+mod common;
+
+fn compress(data: &[u8], typesize: i32) -> Vec<u8> {
+    common::compress(common::cparams(typesize, BLOSC_ZSTD, BLOSC_SHUFFLE), data)
+}
+
+/// Index entry of a special chunk, as C `frame_insert_chunk` writes it.
+fn special_offset(special: u8) -> i64 {
+    ((special as u64) << 56 | 1 << 63) as i64
+}
+
+/// A frame of float32 chunks. `None` entries become special chunks of that kind instead
+/// of being stored.
+fn build_frame(chunks: &[(Option<Vec<u8>>, u8)], nbytes: usize) -> Vec<u8> {
+    let mut body = Vec::new();
+    let mut offsets = Vec::new();
+    for (chunk, special) in chunks {
+        match chunk {
+            Some(chunk) => {
+                offsets.push(body.len() as i64);
+                body.extend_from_slice(chunk);
+            }
+            None => offsets.push(special_offset(*special)),
+        }
+    }
+    let index_data: Vec<u8> = offsets.iter().flat_map(|o| o.to_le_bytes()).collect();
+    let index = compress(&index_data, 8);
+    let trailer = [0x94u8; 40];
+    let frame_len = HEADER_LEN + body.len() + index.len() + trailer.len();
+
+    let mut header = vec![0u8; HEADER_LEN];
+    header[0] = 0x9e;
+    header[1] = 0xa8;
+    header[2..10].copy_from_slice(b"b2frame\0");
+    header[10] = 0xd2;
+    header[11..15].copy_from_slice(&(HEADER_LEN as u32).to_be_bytes());
+    header[15] = 0xcf;
+    header[16..24].copy_from_slice(&(frame_len as u64).to_be_bytes());
+    header[24] = 0xa4;
+    header[25] = 0x22; // version 2, 64-bit offsets
+    header[26] = 0; // contiguous
+    header[27] = BLOSC_ZSTD | 5 << 4;
+    header[29] = 0xd3;
+    header[30..38].copy_from_slice(&(nbytes as u64).to_be_bytes());
+    header[38] = 0xd3;
+    header[39..47].copy_from_slice(&(body.len() as u64).to_be_bytes());
+    header[47] = 0xd2;
+    header[48..52].copy_from_slice(&4u32.to_be_bytes());
+    header[52] = 0xd2;
+    header[57] = 0xd2;
+    header[58..62].copy_from_slice(&((CHUNK_ITEMS * 4) as u32).to_be_bytes());
+    header[62] = 0xd1;
+    header[63..65].copy_from_slice(&1u16.to_be_bytes());
+    header[65] = 0xd1;
+    header[66..68].copy_from_slice(&1u16.to_be_bytes());
+    header[68] = 0xc2;
+    header[69] = 0xd8;
+    header[70] = 6;
+    header[76] = BLOSC_SHUFFLE;
+    // No metalayers
+    header[87..94].copy_from_slice(&[0x93, 0xcd, 0, 0, 0xde, 0, 0]);
+
+    [header, body, index, trailer.to_vec()].concat()
+}
+
+fn chunk_data(c: usize, nitems: usize) -> Vec<u8> {
+    (0..nitems)
+        .flat_map(|i| ((c * CHUNK_ITEMS + i) as f32 * 0.25).to_le_bytes())
+        .collect()
+}
+
+#[test]
+fn read_stored_and_special_chunks() {
+    let data: Vec<Vec<u8>> = (0..3).map(|c| chunk_data(c, CHUNK_ITEMS)).collect();
+    let tail = chunk_data(5, 777);
+    let nbytes = CHUNK_ITEMS * 4 * 5 + tail.len();
+    let chunks = [
+        (Some(compress(&data[0], 4)), 0),
+        (None, BLOSC2_SPECIAL_ZERO),
+        (Some(compress(&data[1], 4)), 0),
+        (Some(compress(&data[2], 4)), 0),
+        (None, BLOSC2_SPECIAL_NAN),
+        (Some(compress(&tail, 4)), 0),
+    ];
+    let frame_bytes = build_frame(&chunks, nbytes);
+    let frame = Frame::open(&frame_bytes[..]).unwrap();
+    assert_eq!(frame.nchunks(), 6);
+    assert_eq!(frame.nbytes(), nbytes as u64);
+    assert_eq!(frame.typesize(), 4);
+    assert_eq!(frame.chunksize(), CHUNK_ITEMS * 4);
+    assert_eq!((frame.compcode(), frame.clevel()), (BLOSC_ZSTD, 5));
+    assert_eq!(frame.filters()[5], BLOSC_SHUFFLE);
+
+    // Stored chunks are slices of the frame itself
+    for (i, (chunk, _)) in chunks.iter().enumerate() {
+        if let Some(chunk) = chunk {
+            let got = frame.get_chunk(i).unwrap();
+            assert!(matches!(got, Cow::Borrowed(_)));
+            assert_eq!(&got[..], &chunk[..]);
+        }
+    }
+
+    let mut dest = vec![0u8; frame.chunksize()];
+    let expected = [
+        data[0].clone(),
+        vec![0u8; CHUNK_ITEMS * 4],
+        data[1].clone(),
+        data[2].clone(),
+        f32::NAN.to_le_bytes().repeat(CHUNK_ITEMS),
+        tail.clone(),
+    ];
+    for (i, expected) in expected.iter().enumerate() {
+        assert_eq!(frame.decompress_chunk(i, &mut dest), Ok(expected.len()));
+        assert!(dest[..expected.len()] == expected[..]);
+    }
+
+    let mut items = [0u8; 40];
+    assert_eq!(frame.getitem(3, 1000, 10, &mut items), Ok(40));
+    assert_eq!(&items[..], &data[2][4000..4040]);
+    assert_eq!(frame.getitem(1, 1000, 10, &mut items), Ok(40));
+    assert_eq!(items, [0u8; 40]);
+    assert_eq!(frame.get_chunk(6), Err(BLOSC2_ERROR_INVALID_INDEX));
+}
+
+#[test]
+fn range_fetch_is_lazy() {
+    let chunks: Vec<_> = (0..8)
+        .map(|c| (Some(compress(&chunk_data(c, CHUNK_ITEMS), 4)), 0))
+        .collect();
+    let frame_bytes = build_frame(&chunks, CHUNK_ITEMS * 4 * 8);
+    let reads = RefCell::new(Vec::new());
+    let storage = RangeFetch::new(frame_bytes.len() as u64, |offset, buf: &mut [u8]| {
+        reads.borrow_mut().push((offset, buf.len()));
+        buf.copy_from_slice(&frame_bytes[offset as usize..offset as usize + buf.len()]);
+        Ok(())
+    });
+
+    let frame = Frame::open(storage).unwrap();
+    // Only the fixed part of the header
+    assert_eq!(reads.borrow().len(), 1);
+    assert_eq!(frame.nchunks(), 8);
+    assert_eq!(reads.borrow().len(), 1);
+
+    let mut dest = vec![0u8; frame.chunksize()];
+    assert_eq!(frame.decompress_chunk(6, &mut dest), Ok(dest.len()));
+    assert!(dest == chunk_data(6, CHUNK_ITEMS));
+    let read: usize = reads.borrow().iter().map(|&(_, len)| len).sum();
+    assert!(read < frame_bytes.len() / 4);
+
+    // The index is decoded once
+    let nreads = reads.borrow().len();
+    assert_eq!(frame.decompress_chunk(2, &mut dest), Ok(dest.len()));
+    assert!(dest == chunk_data(2, CHUNK_ITEMS));
+    assert_eq!(reads.borrow().len(), nreads + 2);
+}
+
+#[test]
+fn invalid_frames() {
+    let chunks = [(Some(compress(&chunk_data(0, CHUNK_ITEMS), 4)), 0)];
+    let frame_bytes = build_frame(&chunks, CHUNK_ITEMS * 4);
+    assert!(Frame::open(&frame_bytes[..]).is_ok());
+
+    let mut bad = frame_bytes.clone();
+    bad[2] = b'c';
+    assert_eq!(Frame::open(&bad[..]).err(), Some(BLOSC2_ERROR_FRAME_TYPE));
+    // A frame stored as a directory of chunk files
+    let mut bad = frame_bytes.clone();
+    bad[26] = 1;
+    assert_eq!(Frame::open(&bad[..]).err(), Some(BLOSC2_ERROR_FRAME_TYPE));
+
+    // Truncated: the header still claims the full length
+    let truncated = &frame_bytes[..frame_bytes.len() - 1];
+    assert_eq!(
+        Frame::open(truncated).err(),
+        Some(BLOSC2_ERROR_INVALID_HEADER)
+    );
+    assert_eq!(
+        Frame::open(&frame_bytes[..50]).err(),
+        Some(BLOSC2_ERROR_READ_BUFFER)
+    );
+
+    // An index entry pointing past the chunks
+    let mut bad = frame_bytes.clone();
+    bad[39..47].copy_from_slice(&10u64.to_be_bytes());
+    let frame = Frame::open(&bad[..]).unwrap();
+    assert!(frame.get_chunk(0).is_err());
+
+    // An index with trailing special entries that `nbytes` has no chunks for
+    let chunks = [
+        (Some(compress(&chunk_data(0, CHUNK_ITEMS), 4)), 0),
+        (None, BLOSC2_SPECIAL_ZERO),
+        (None, BLOSC2_SPECIAL_ZERO),
+    ];
+    let frame_bytes = build_frame(&chunks, CHUNK_ITEMS * 4);
+    let frame = Frame::open(&frame_bytes[..]).unwrap();
+    assert_eq!(frame.nchunks(), 1);
+    let mut dest = vec![0u8; frame.chunksize()];
+    for nchunk in [1, 2] {
+        assert_eq!(
+            frame.get_chunk(nchunk).err(),
+            Some(BLOSC2_ERROR_INVALID_INDEX)
+        );
+        assert_eq!(
+            frame.decompress_chunk(nchunk, &mut dest),
+            Err(BLOSC2_ERROR_INVALID_INDEX)
+        );
+    }
+}
@@ -0,0 +1,236 @@
+/// Tests for `blosc2_getslice_ctx`: strided N-d selections against a plain loop over the
+/// source, on regular, memcpyed and special chunks, and rejected selections.
+use blusc::api::{
+    blosc2_chunk_zeros as blusc_blosc2_chunk_zeros, blosc2_create_dctx as blusc_blosc2_create_dctx,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    blosc2_getslice_ctx as blusc_blosc2_getslice_ctx, Blosc2Context,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::view::ChunkView;
+use blusc::{
+    Blosc2Cparams, BLOSC2_ERROR_DATA, BLOSC2_ERROR_INVALID_PARAM, BLOSC2_ERROR_WRITE_BUFFER,
+    BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_DELTA, BLOSC_EXTENDED_HEADER_LENGTH, BLOSC_SHUFFLE,
+    BLOSC_ZSTD,
+};
+
+mod common;
+use common::compress;
+
+/// Blocks of 8 KB, so that a 200 x 300 u32 tile has 30 of them.
+fn cparams(compcode: u8, filter: u8, typesize: i32) -> Blosc2Cparams {
+    Blosc2Cparams {
+        blocksize: 8 << 10,
+        ..common::cparams(typesize, compcode, filter)
+    }
+}
+
+/// The selected items of `src`, picked one at a time.
+fn expected(
+    src: &[u8],
+    typesize: usize,
+    shape: &[i64],
+    start: &[i64],
+    stop: &[i64],
+    step: &[i64],
+) -> Vec<u8> {
+    let mut offsets = vec![0usize];
+    for d in 0..shape.len() {
+        offsets = offsets
+            .iter()
+            .flat_map(|&base| {
+                (start[d]..stop[d])
+                    .step_by(step[d] as usize)
+                    .map(move |k| base * shape[d] as usize + k as usize)
+            })
+            .collect();
+    }
+    offsets
+        .iter()
+        .flat_map(|&i| &src[i * typesize..(i + 1) * typesize])
+        .copied()
+        .collect()
+}
+
+fn getslice(
+    dctx: &Blosc2Context,
+    chunk: &[u8],
+    shape: &[i64],
+    start: &[i64],
+    stop: &[i64],
+    step: &[i64],
+) -> Result<Vec<u8>, i32> {
+    let mut dest = vec![0xAAu8; 1 << 20];
+    let n = blusc_blosc2_getslice_ctx(dctx, chunk, shape, start, stop, step, &mut dest);
+    if n < 0 {
+        return Err(n);
+    }
+    dest.truncate(n as usize);
+    Ok(dest)
+}
+
+/// 200 x 300 u32 values that vary slowly along rows.
+fn tile() -> Vec<u8> {
+    (0..200 * 300u32)
+        .flat_map(|i| (i / 7).to_le_bytes())
+        .collect()
+}
+
+#[test]
+fn selections_match_items() {
+    let src = tile();
+    let shape = [200, 300];
+    let selections: [([i64; 2], [i64; 2], [i64; 2]); 7] = [
+        ([0, 0], [200, 300], [1, 1]),
+        ([0, 17], [200, 18], [1, 1]),
+        ([10, 20], [150, 260], [1, 1]),
+        ([3, 5], [199, 290], [7, 11]),
+        ([0, 0], [200, 300], [200, 300]),
+        ([199, 299], [200, 300], [1, 1]),
+        ([50, 0], [50, 300], [1, 1]),
+    ];
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+        for filter in [BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            for delta in [false, true] {
+                let mut cparams = cparams(compcode, filter, 4);
+                if delta {
+                    cparams.filters[4] = BLOSC_DELTA;
+                }
+                let chunk = compress(cparams, &src);
+                let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+                for (start, stop, step) in &selections {
+                    let out = getslice(&dctx, &chunk, &shape, start, stop, step).unwrap();
+                    assert!(out == expected(&src, 4, &shape, start, stop, step));
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn three_dims_and_odd_typesize() {
+    // 3-byte items whose rows do not line up with the blocks
+    let shape = [9, 31, 47];
+    let src: Vec<u8> = (0..9 * 31 * 47 * 3u32).map(|i| (i / 5) as u8).collect();
+    let chunk = compress(cparams(BLOSC_ZSTD, BLOSC_SHUFFLE, 3), &src);
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    for (start, stop, step) in [
+        ([0, 0, 0], [9, 31, 47], [1, 1, 1]),
+        ([2, 0, 0], [7, 31, 47], [2, 1, 1]),
+        ([1, 3, 5], [8, 30, 40], [3, 4, 5]),
+        ([0, 10, 0], [9, 11, 47], [1, 1, 1]),
+        ([4, 0, 46], [5, 31, 47], [1, 1, 1]),
+    ] {
+        let out = getslice(&dctx, &chunk, &shape, &start, &stop, &step).unwrap();
+        assert!(out == expected(&src, 3, &shape, &start, &stop, &step));
+    }
+}
+
+#[test]
+fn memcpyed_and_special_chunks() {
+    let src = tile();
+    let shape = [200, 300];
+    let (start, stop, step) = ([3, 5], [199, 290], [7, 11]);
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+
+    let mut stored = cparams(BLOSC_ZSTD, BLOSC_SHUFFLE, 4);
+    stored.clevel = 0;
+    let chunk = compress(stored, &src);
+    let out = getslice(&dctx, &chunk, &shape, &start, &stop, &step).unwrap();
+    assert!(out == expected(&src, 4, &shape, &start, &stop, &step));
+
+    let mut chunk = vec![0u8; BLOSC_EXTENDED_HEADER_LENGTH];
+    let cparams = cparams(BLOSC_ZSTD, BLOSC_SHUFFLE, 4);
+    assert!(blusc_blosc2_chunk_zeros(&cparams, src.len(), &mut chunk) > 0);
+    let out = getslice(&dctx, &chunk, &shape, &start, &stop, &step).unwrap();
+    assert_eq!(out.len(), 28 * 26 * 4);
+    assert!(out.iter().all(|&b| b == 0));
+}
+
+#[test]
+fn rejected_selections() {
+    let src = tile();
+    let chunk = compress(cparams(BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 4), &src);
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    let bad = |shape: &[i64], start: &[i64], stop: &[i64], step: &[i64]| {
+        getslice(&dctx, &chunk, shape, start, stop, step).err()
+    };
+    let invalid = Some(BLOSC2_ERROR_INVALID_PARAM);
+    // Shape not matching the chunk, past the end, backwards, step 0, negative, ranks
+    assert_eq!(bad(&[200, 299], &[0, 0], &[1, 1], &[1, 1]), invalid);
+    assert_eq!(bad(&[200, 300], &[0, 0], &[201, 1], &[1, 1]), invalid);
+    assert_eq!(bad(&[200, 300], &[5, 0], &[4, 1], &[1, 1]), invalid);
+    assert_eq!(bad(&[200, 300], &[0, 0], &[1, 1], &[1, 0]), invalid);
+    assert_eq!(bad(&[200, 300], &[0, -1], &[1, 1], &[1, 1]), invalid);
+    assert_eq!(bad(&[200, 300], &[0], &[1, 1], &[1, 1]), invalid);
+    assert_eq!(bad(&[], &[], &[], &[]), invalid);
+    assert_eq!(bad(&[1; 9], &[0; 9], &[1; 9], &[1; 9]), invalid);
+    // Empty selections write nothing
+    assert_eq!(
+        getslice(&dctx, &chunk, &[200, 300], &[7, 0], &[7, 300], &[1, 1]),
+        Ok(Vec::new())
+    );
+
+    let mut dest = vec![0u8; 4 * 200 - 1];
+    assert_eq!(
+        blusc_blosc2_getslice_ctx(
+            &dctx,
+            &chunk,
+            &[200, 300],
+            &[0, 0],
+            &[200, 1],
+            &[1, 1],
+            &mut dest
+        ),
+        BLOSC2_ERROR_WRITE_BUFFER
+    );
+}
+
+#[test]
+fn unselected_blocks_are_not_decoded() {
+    let src = tile();
+    let shape = [200, 300];
+    let mut chunk = compress(cparams(BLOSC_ZSTD, BLOSC_SHUFFLE, 4), &src);
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+
+    // Wipe the streams of block 0 (rows 0 to 6), keeping their sizes and the block offsets
+    let view = ChunkView::new(&chunk).unwrap();
+    let (mut pos, nstreams) = (view.block_range(0).start, view.block_nstreams(0));
+    for _ in 0..nstreams {
+        let csize = i32::from_le_bytes(chunk[pos..pos + 4].try_into().unwrap()) as usize;
+        chunk[pos + 4..pos + 4 + csize].fill(0);
+        pos += 4 + csize;
+    }
+    let mut out = vec![0u8; src.len()];
+    let n = blusc_blosc2_decompress_ctx(&dctx, &chunk, &mut out);
+    assert!(n < 0 || out != src);
+
+    // Rows 100..110 are within blocks 14 to 16, so the slice never reads block 0
+    let (start, stop, step) = ([100, 0], [110, 300], [1, 2]);
+    let out = getslice(&dctx, &chunk, &shape, &start, &stop, &step).unwrap();
+    assert!(out == expected(&src, 4, &shape, &start, &stop, &step));
+    assert_eq!(
+        getslice(&dctx, &chunk, &shape, &[0, 0], &[1, 300], &[1, 1]),
+        Err(BLOSC2_ERROR_DATA)
+    );
+}
+
+#[cfg(feature = "instrument")]
+#[test]
+fn each_block_is_decoded_once() {
+    use blusc::instr::{codec_stats, reset_codec_stats};
+
+    let src = tile();
+    let shape = [200, 300];
+    let chunk = compress(cparams(BLOSC_ZSTD, BLOSC_SHUFFLE, 4), &src);
+    let nblocks = (src.len() as u64).div_ceil(8 << 10);
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+
+    // A column crosses every block, twice or more each
+    getslice(&dctx, &chunk, &shape, &[0, 17], &[200, 18], &[1, 1]).unwrap();
+    assert_eq!(codec_stats(&dctx).decompress.blocks, nblocks);
+
+    // Rows 100..110 are within bytes 120000..132000: blocks 14 to 16
+    reset_codec_stats(&dctx);
+    getslice(&dctx, &chunk, &shape, &[100, 0], &[110, 300], &[1, 2]).unwrap();
+    assert_eq!(codec_stats(&dctx).decompress.blocks, 3);
+}
@@ -0,0 +1,167 @@
+/// Tests for the incompressible-data probe of `blosc2_compress_ctx`: after a chunk the
+/// codec gave up on, and with `blosc2_set_incompressible_hint`.
+use blusc::api::{
+    blosc2_create_cctx as blusc_blosc2_create_cctx,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    blosc2_set_incompressible_hint as blusc_blosc2_set_incompressible_hint,
+};
+use blusc::{
+    Blosc2Cparams, BLOSC_BLOSCLZ, BLOSC_DELTA, BLOSC_MEMCPYED, BLOSC_SHUFFLE, BLOSC_ZLIB,
+    BLOSC_ZSTD,
+};
+
+mod common;
+use common::compress_ctx;
+
+fn cparams(compcode: u8, nthreads: i16) -> Blosc2Cparams {
+    Blosc2Cparams {
+        nthreads,
+        ..common::cparams(4, compcode, BLOSC_SHUFFLE)
+    }
+}
+
+fn noise(len: usize, mut state: u64) -> Vec<u8> {
+    (0..len)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            (state >> 32) as u8
+        })
+        .collect()
+}
+
+fn ramp(len: usize) -> Vec<u8> {
+    (0..len as u32 / 4)
+        .flat_map(|i| (i / 3).to_le_bytes())
+        .collect()
+}
+
+/// 2 MB of slowly varying u32 values whose last quarter is random bytes.
+fn mixed() -> Vec<u8> {
+    let mut data = ramp(3 << 19);
+    data.extend(noise(1 << 19, 7));
+    data
+}
+
+#[test]
+fn probe_keeps_chunks() {
+    let srcs = [
+        mixed(),
+        mixed(),
+        ramp(1 << 20),
+        noise(1 << 20, 3),
+        ramp(1 << 20),
+    ];
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for nthreads in [1, 4] {
+            for delta in [false, true] {
+                let cparams = || {
+                    let mut cparams = cparams(compcode, nthreads);
+                    if delta {
+                        cparams.filters[4] = BLOSC_DELTA;
+                    }
+                    cparams
+                };
+                let cctx = blusc_blosc2_create_cctx(cparams());
+                for src in &srcs {
+                    // A new context has no chunk before this one, so it does not probe
+                    let expected = compress_ctx(&blusc_blosc2_create_cctx(cparams()), src);
+                    let chunk = compress_ctx(&cctx, src);
+                    assert!(chunk == expected);
+
+                    let mut out = vec![0u8; src.len()];
+                    assert_eq!(
+                        blusc_blosc2_decompress_ctx(&cctx, &chunk, &mut out),
+                        src.len() as i32
+                    );
+                    assert!(out == *src);
+                }
+            }
+        }
+    }
+}
+
+/// Random bytes repeated with `period`: each block looks random to the sample, but the
+/// codec finds the repeats.
+fn periodic(len: usize, period: usize) -> Vec<u8> {
+    noise(period, 11).into_iter().cycle().take(len).collect()
+}
+
+#[test]
+fn probe_asks_the_codec() {
+    let src = periodic(1 << 20, 8 << 10);
+    let params = || Blosc2Cparams {
+        blocksize: 128 << 10,
+        ..cparams(BLOSC_BLOSCLZ, 1)
+    };
+    let plain = blusc_blosc2_create_cctx(params());
+    let probed = blusc_blosc2_create_cctx(params());
+    // The codec gives up on the noise, so the next chunk is probed
+    let random = compress_ctx(&probed, &noise(1 << 20, 3));
+    assert_eq!(random[2] & BLOSC_MEMCPYED, BLOSC_MEMCPYED);
+    let chunk = compress_ctx(&probed, &src);
+    assert_eq!(chunk[2] & BLOSC_MEMCPYED, 0);
+    assert!(chunk.len() < src.len() / 4);
+    assert!(chunk == compress_ctx(&plain, &src));
+    assert!(common::decompress(&chunk, src.len()) == src);
+}
+
+#[test]
+fn hint() {
+    let random = noise(1 << 20, 5);
+    let smooth = ramp(1 << 20);
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+        let plain = blusc_blosc2_create_cctx(cparams(compcode, 1));
+        let mut hinted = blusc_blosc2_create_cctx(cparams(compcode, 1));
+        blusc_blosc2_set_incompressible_hint(&mut hinted, true);
+
+        let chunk = compress_ctx(&hinted, &random);
+        assert_eq!(chunk[2] & BLOSC_MEMCPYED, BLOSC_MEMCPYED);
+        assert!(chunk == compress_ctx(&plain, &random));
+        // Data the sample does not rule out still compresses
+        let chunk = compress_ctx(&hinted, &smooth);
+        assert!(chunk.len() < smooth.len() / 10);
+        assert!(chunk == compress_ctx(&plain, &smooth));
+
+        blusc_blosc2_set_incompressible_hint(&mut hinted, false);
+        assert!(compress_ctx(&hinted, &random) == compress_ctx(&plain, &random));
+    }
+}
+
+#[cfg(feature = "instrument")]
+#[test]
+fn probed_chunks_skip_the_blocks() {
+    use blusc::instr::{codec_stats, reset_codec_stats};
+
+    // The codec starts on the 2 MB chunk and gives up in its last quarter. The next one
+    // is probed and memcpyed after compressing only the first block of that quarter, and
+    // so is the one after that.
+    let src = mixed();
+    let cctx = blusc_blosc2_create_cctx(cparams(BLOSC_BLOSCLZ, 1));
+    compress_ctx(&cctx, &src);
+    let stats = codec_stats(&cctx).compress;
+    assert!(stats.blocks > 1 && stats.memcpyed_chunks == 1);
+    reset_codec_stats(&cctx);
+    compress_ctx(&cctx, &src);
+    compress_ctx(&cctx, &src);
+    let stats = codec_stats(&cctx).compress;
+    assert_eq!((stats.blocks, stats.memcpyed_chunks), (2, 2));
+
+    // A chunk that compresses ends the probing
+    compress_ctx(&cctx, &ramp(1 << 20));
+    reset_codec_stats(&cctx);
+    compress_ctx(&cctx, &src);
+    assert!(codec_stats(&cctx).compress.blocks > 1);
+
+    // zstd is tried on random bytes unless the context is told
+    let random = noise(1 << 20, 9);
+    let mut cctx = blusc_blosc2_create_cctx(cparams(BLOSC_ZSTD, 1));
+    compress_ctx(&cctx, &random);
+    compress_ctx(&cctx, &random);
+    assert_eq!(codec_stats(&cctx).compress.blocks, 2);
+    blusc_blosc2_set_incompressible_hint(&mut cctx, true);
+    reset_codec_stats(&cctx);
+    compress_ctx(&cctx, &random);
+    assert_eq!(codec_stats(&cctx).compress.blocks, 0);
+}
@@ -0,0 +1,188 @@
+/// Tests for `cparams.instr_codec` chunks and, with the `instrument` feature, the
+/// per-context counters of `blusc::instr`.
+use blusc::api::{
+    blosc2_create_cctx as blusc_blosc2_create_cctx,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    blosc2_getitem_ctx as blusc_blosc2_getitem_ctx,
+    BLOSC2_CPARAMS_DEFAULTS as BLUSC_BLOSC2_CPARAMS_DEFAULTS,
+};
+use blusc::instr::{Blosc2Instr, BLOSC2_INSTR_SIZE};
+use blusc::{
+    blosc2_cbuffer_sizes, Blosc2Cparams, BLOSC2_INSTR_CODEC, BLOSC_BLOSCLZ, BLOSC_SHUFFLE,
+    BLOSC_ZSTD,
+};
+
+const DONT_SPLIT: u8 = 0x10;
+
+mod common;
+use common::compress;
+
+fn cparams(compcode: u8, instr_codec: bool) -> Blosc2Cparams {
+    Blosc2Cparams {
+        instr_codec,
+        ..common::cparams(4, compcode, BLOSC_SHUFFLE)
+    }
+}
+
+/// Slowly varying u32 values: the top byte stream of every block is a run of zeros, and
+/// so is the one below it in the full blocks.
+fn ramp() -> Vec<u8> {
+    (0..250_000u32)
+        .flat_map(|i| (i / 3).to_le_bytes())
+        .collect()
+}
+
+/// The records of an instrumented chunk, checking that its layout is one record per
+/// stream.
+fn read_records(chunk: &[u8]) -> Vec<Blosc2Instr> {
+    assert_eq!(chunk[31] & BLOSC2_INSTR_CODEC, BLOSC2_INSTR_CODEC);
+    let (nbytes, cbytes, blocksize) = blosc2_cbuffer_sizes(chunk);
+    assert_eq!(cbytes, chunk.len());
+    let nblocks = nbytes.div_ceil(blocksize);
+    let nstreams: usize = (0..nblocks)
+        .map(|i| {
+            let leftover = i == nblocks - 1 && nbytes % blocksize != 0;
+            if chunk[2] & DONT_SPLIT != 0 || leftover {
+                1
+            } else {
+                4
+            }
+        })
+        .sum();
+    assert_eq!(
+        cbytes,
+        32 + nblocks * 4 + nstreams * (4 + BLOSC2_INSTR_SIZE)
+    );
+
+    let dctx = blusc_blosc2_create_cctx(BLUSC_BLOSC2_CPARAMS_DEFAULTS);
+    let mut dest = vec![0u8; nbytes];
+    let n = blusc_blosc2_decompress_ctx(&dctx, chunk, &mut dest);
+    assert_eq!(n as usize, nstreams * BLOSC2_INSTR_SIZE);
+    Blosc2Instr::parse(&dest[..n as usize])
+}
+
+#[test]
+fn instr_codec_chunks() {
+    let src = ramp();
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+        let chunk = compress(cparams(compcode, true), &src);
+        let records = read_records(&chunk);
+        let (nbytes, _, blocksize) = blosc2_cbuffer_sizes(&chunk);
+        // Streams 0..3 of each full block: the changing low bytes, then the zero high byte
+        for block in records.chunks_exact(4) {
+            assert_eq!(block[3].flags, [1, 0, 0, 0]);
+            assert_eq!(block[3].cratio, (blocksize / 4) as f32 / 4.0);
+            assert_eq!(block[0].flags, [0; 4]);
+            assert!(block[0].cratio > 1.0 && block[0].cspeed > 0.0 && block[0].filter_speed > 0.0);
+        }
+
+        // The ratios add up to the streams of the plain chunk
+        let plain = compress(cparams(compcode, false), &src);
+        assert_eq!(plain[31] & BLOSC2_INSTR_CODEC, 0);
+        let nblocks = nbytes.div_ceil(blocksize);
+        let stored: f32 = records
+            .iter()
+            .enumerate()
+            .map(|(j, record)| {
+                let neblock = match j / 4 < nbytes / blocksize {
+                    true => blocksize / 4,
+                    false => nbytes % blocksize,
+                };
+                neblock as f32 / record.cratio
+            })
+            .sum();
+        let streams_cbytes = plain.len() - 32 - nblocks * 4;
+        assert!((stored - streams_cbytes as f32).abs() < records.len() as f32);
+
+        // Workers write the same records, timings aside
+        let mut threaded = cparams(compcode, true);
+        threaded.nthreads = 4;
+        let threaded = read_records(&compress(threaded, &src));
+        assert_eq!(threaded.len(), records.len());
+        for (a, b) in threaded.iter().zip(&records) {
+            assert_eq!((a.cratio, a.flags), (b.cratio, b.flags));
+        }
+
+        // There are no items to read
+        let cctx = blusc_blosc2_create_cctx(cparams(compcode, true));
+        let mut item = [0u8; 4];
+        assert!(blusc_blosc2_getitem_ctx(&cctx, &chunk, 0, 1, &mut item) < 0);
+    }
+}
+
+#[cfg(feature = "instrument")]
+#[test]
+fn codec_stats() {
+    use blusc::api::{
+        blosc2_chunk_zeros as blusc_blosc2_chunk_zeros,
+        blosc2_create_dctx as blusc_blosc2_create_dctx,
+        BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+    };
+    use blusc::instr::{codec_stats, reset_codec_stats, CodecStats};
+    use blusc::BLOSC2_MAX_OVERHEAD;
+    use common::compress_ctx;
+
+    let src = ramp();
+    for nthreads in [1, 4] {
+        let mut cparams = cparams(BLOSC_ZSTD, false);
+        cparams.nthreads = nthreads;
+        let cctx = blusc_blosc2_create_cctx(cparams);
+        let chunk = compress_ctx(&cctx, &src);
+        let (_, _, blocksize) = blosc2_cbuffer_sizes(&chunk);
+        let nblocks = src.len().div_ceil(blocksize) as u64;
+        // The leftover block is one stream of its own
+        let full = (src.len() / blocksize) as u64;
+        let nstreams = full * 4 + (nblocks - full);
+
+        let stats = codec_stats(&cctx).compress;
+        assert_eq!((stats.chunks, stats.nbytes), (1, src.len() as u64));
+        assert_eq!(
+            (stats.cbytes, stats.memcpyed_chunks),
+            (chunk.len() as u64, 0)
+        );
+        assert_eq!(stats.blocks, nblocks);
+        assert_eq!((stats.streams, stats.run_streams), (nstreams, full * 2));
+        assert!(stats.codec_time > stats.filter_time / 100);
+        assert_eq!(codec_stats(&cctx).decompress, Default::default());
+
+        let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+        dparams.nthreads = nthreads;
+        let dctx = blusc_blosc2_create_dctx(dparams);
+        let mut dest = vec![0u8; src.len()];
+        assert_eq!(
+            blusc_blosc2_decompress_ctx(&dctx, &chunk, &mut dest),
+            src.len() as i32
+        );
+        let stats = codec_stats(&dctx).decompress;
+        assert_eq!((stats.chunks, stats.blocks), (1, nblocks));
+        assert_eq!((stats.streams, stats.run_streams), (nstreams, full * 2));
+        assert!(stats.codec_time.as_nanos() > 0);
+
+        reset_codec_stats(&dctx);
+        assert_eq!(codec_stats(&dctx), CodecStats::default());
+    }
+
+    // Memcpy fallbacks and special chunks
+    let mut state = 0x2545_F491_4F6C_DD1Du64;
+    let noise: Vec<u8> = (0..100_000)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            (state >> 32) as u8
+        })
+        .collect();
+    let cctx = blusc_blosc2_create_cctx(cparams(BLOSC_BLOSCLZ, false));
+    compress_ctx(&cctx, &noise);
+    assert_eq!(codec_stats(&cctx).compress.memcpyed_chunks, 1);
+
+    let mut zeros = [0u8; BLOSC2_MAX_OVERHEAD];
+    assert!(blusc_blosc2_chunk_zeros(&cctx.cparams, 4000, &mut zeros) > 0);
+    let mut dest = vec![1u8; 4000];
+    assert_eq!(blusc_blosc2_decompress_ctx(&cctx, &zeros, &mut dest), 4000);
+    let stats = codec_stats(&cctx).decompress;
+    assert_eq!(
+        (stats.chunks, stats.special_chunks, stats.blocks),
+        (1, 1, 0)
+    );
+}
@@ -100,3 +100,101 @@ fn noinit_multiple_clevels() {
         );
     }
 }
+
+/// `compress_into` and `decompress_into` reuse the caller's `Vec` from one chunk to the
+/// next, and give the same chunks and data as the functions that allocate.
+#[test]
+fn noinit_into_reused_vecs() {
+    use blusc::api::{
+        blosc1_compress as blusc_blosc1_compress, blosc2_chunk_repeatval,
+        blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+        blosc2_create_cctx as blusc_blosc2_create_cctx,
+        BLOSC2_CPARAMS_DEFAULTS as BLUSC_BLOSC2_CPARAMS_DEFAULTS,
+    };
+    use blusc::convenience::{
+        blosc2_compress_into, blosc2_decompress, blosc2_decompress_into, compress_bound,
+    };
+    use blusc::{BLOSC_DELTA, BLOSC_MIN_HEADER_LENGTH, BLOSC_ZSTD};
+
+    let mut state = 0x2545_F491_4F6C_DD1Du64;
+    let mut noise = |len: usize| -> Vec<u8> {
+        (0..len)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                (state >> 32) as u8
+            })
+            .collect()
+    };
+    let ramp = |len: usize| -> Vec<u8> { (0..len).map(|i| (i / 64) as u8).collect() };
+    let srcs = [
+        ramp(1_000_000),
+        Vec::new(),
+        ramp(100),
+        noise(50_000),
+        ramp(300_001),
+        noise(7),
+    ];
+
+    let mut chunk = Vec::new();
+    let mut data = vec![0xAA; 10];
+    for src in &srcs {
+        let mut expected = vec![0u8; compress_bound(src.len())];
+        let csize = blusc_blosc2_compress(5, 1, 8, src, &mut expected);
+        assert!(csize > 0);
+        expected.truncate(csize as usize);
+
+        let capacity = chunk.capacity();
+        let cbytes = blosc2_compress_into(src, &mut chunk).unwrap();
+        assert!(cbytes == chunk.len() && chunk == expected);
+        // The first chunk is the largest, so the `Vec` never grows again
+        if capacity > 0 {
+            assert_eq!(chunk.capacity(), capacity);
+        }
+
+        let nbytes = blosc2_decompress_into(&chunk, &mut data).unwrap();
+        assert!(nbytes == src.len() && data == *src);
+        if capacity > 0 {
+            assert!(data.capacity() >= srcs[0].len());
+        }
+    }
+
+    // Blosc1 chunks, delta coded chunks and special chunks
+    let src = ramp(200_000);
+    let mut blosc1 = vec![0u8; src.len() + BLOSC_MIN_HEADER_LENGTH];
+    let csize = blusc_blosc1_compress(5, 1, 8, &src, &mut blosc1);
+    blosc1.truncate(csize as usize);
+    assert_eq!(
+        blosc2_decompress_into(&blosc1, &mut data).unwrap(),
+        src.len()
+    );
+    assert!(data == src);
+    assert!(blusc::convenience::blosc1_compress(&src).unwrap() == blosc1);
+
+    let mut cparams = BLUSC_BLOSC2_CPARAMS_DEFAULTS;
+    cparams.typesize = 4;
+    cparams.compcode = BLOSC_ZSTD;
+    cparams.filters[4] = BLOSC_DELTA;
+    let cctx = blusc_blosc2_create_cctx(cparams);
+    let mut delta = vec![0u8; compress_bound(src.len())];
+    let csize = blusc_blosc2_compress_ctx(&cctx, &src, &mut delta);
+    delta.truncate(csize as usize);
+    assert_eq!(
+        blosc2_decompress_into(&delta, &mut data).unwrap(),
+        src.len()
+    );
+    assert!(data == src);
+
+    let mut repeat = vec![0u8; BLOSC2_MAX_OVERHEAD + 4];
+    let item = 0x0102_0304u32.to_le_bytes();
+    assert!(blosc2_chunk_repeatval(&cctx.cparams, 400_000, &mut repeat, &item) > 0);
+    assert_eq!(blosc2_decompress_into(&repeat, &mut data).unwrap(), 400_000);
+    assert!(data.chunks_exact(4).all(|x| x == item));
+    assert!(blosc2_decompress(&repeat).unwrap() == data);
+
+    // A truncated chunk fails and leaves nothing behind
+    let cbytes = blosc2_compress_into(&srcs[0], &mut chunk).unwrap();
+    assert!(blosc2_decompress_into(&chunk[..cbytes / 2], &mut data).is_err());
+    assert!(data.is_empty());
+}
@@ -0,0 +1,207 @@
+/// Tests multi-threaded compression and decompression through `Blosc2Cparams::nthreads`
+/// and `Blosc2Dparams::nthreads`.
+/// The parallel paths (cargo feature `parallel`) must produce byte-identical output
+/// to the single-threaded paths; without the feature `nthreads` is ignored and these
+/// tests still hold trivially.
+use blusc::api::{
+    blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_create_cctx as blusc_blosc2_create_cctx, blosc2_create_dctx as blusc_blosc2_create_dctx,
+    blosc2_decompress as blusc_blosc2_decompress,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::{
+    Blosc2Cparams, BLOSC2_MAX_OVERHEAD, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_NOSHUFFLE,
+    BLOSC_SHUFFLE, BLOSC_ZLIB, BLOSC_ZSTD,
+};
+
+mod common;
+
+/// Sequential u32 values, large enough to span many blocks.
+fn make_data(num_elements: usize) -> Vec<u8> {
+    common::make_data(num_elements, 7)
+}
+
+/// Compresses `src` with a context and returns the raw return code and output bytes.
+fn try_compress_with_threads(
+    src: &[u8],
+    compcode: u8,
+    filter: u8,
+    clevel: u8,
+    nthreads: i16,
+    dest_len: usize,
+) -> (i32, Vec<u8>) {
+    let cctx = blusc_blosc2_create_cctx(Blosc2Cparams {
+        clevel,
+        nthreads,
+        ..common::cparams(4, compcode, filter)
+    });
+
+    let mut compressed = vec![0u8; dest_len];
+    let csize = blusc_blosc2_compress_ctx(&cctx, src, &mut compressed);
+    compressed.truncate(csize.max(0) as usize);
+    (csize, compressed)
+}
+
+fn compress_with_threads(
+    src: &[u8],
+    compcode: u8,
+    filter: u8,
+    clevel: u8,
+    nthreads: i16,
+    dest_len: usize,
+) -> Vec<u8> {
+    let (csize, compressed) =
+        try_compress_with_threads(src, compcode, filter, clevel, nthreads, dest_len);
+    assert!(csize > 0, "Compression failed with nthreads={}", nthreads);
+    compressed
+}
+
+/// Output with several threads matches the single-threaded output for every codec/filter.
+#[test]
+fn parallel_compress_matches_serial() {
+    let src = make_data(300_000);
+
+    for &compcode in &[BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            for &clevel in &[1u8, 5, 9] {
+                let serial = compress_with_threads(
+                    &src,
+                    compcode,
+                    filter,
+                    clevel,
+                    1,
+                    src.len() + BLOSC2_MAX_OVERHEAD,
+                );
+                for &nthreads in &[2i16, 4, 7] {
+                    let parallel = compress_with_threads(
+                        &src,
+                        compcode,
+                        filter,
+                        clevel,
+                        nthreads,
+                        src.len() + BLOSC2_MAX_OVERHEAD,
+                    );
+                    assert_eq!(
+                        serial, parallel,
+                        "Output differs: compcode={}, filter={}, clevel={}, nthreads={}",
+                        compcode, filter, clevel, nthreads
+                    );
+                }
+
+                let mut decompressed = vec![0u8; src.len()];
+                let dsize = blusc_blosc2_decompress(&serial, &mut decompressed);
+                assert_eq!(dsize as usize, src.len());
+                assert_eq!(src, decompressed);
+            }
+        }
+    }
+}
+
+/// Incompressible input falls back to memcpy identically on both paths.
+#[test]
+fn parallel_compress_incompressible() {
+    let mut state: u64 = 0x9E3779B97F4A7C15;
+    let src: Vec<u8> = (0..500_000)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            state as u8
+        })
+        .collect();
+
+    let serial =
+        compress_with_threads(&src, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 5, 1, src.len() + BLOSC2_MAX_OVERHEAD);
+    let parallel =
+        compress_with_threads(&src, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 5, 4, src.len() + BLOSC2_MAX_OVERHEAD);
+    assert_eq!(serial.len(), src.len() + BLOSC2_MAX_OVERHEAD);
+    assert_eq!(serial, parallel);
+}
+
+/// Destination buffers that are only just large enough give the same result
+/// (including failure) on both paths.
+#[test]
+fn parallel_compress_tight_destination() {
+    let src = make_data(200_000);
+    let full =
+        compress_with_threads(&src, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 5, 1, src.len() + BLOSC2_MAX_OVERHEAD);
+
+    for dest_len in [full.len(), full.len() + 66, full.len() + 67, full.len() + 1000] {
+        let serial = try_compress_with_threads(&src, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 5, 1, dest_len);
+        let parallel = try_compress_with_threads(&src, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 5, 4, dest_len);
+        assert_eq!(serial, parallel, "Result differs with dest_len={}", dest_len);
+    }
+}
+
+fn decompress_with_threads(compressed: &[u8], nbytes: usize, nthreads: i16) -> (i32, Vec<u8>) {
+    let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+    dparams.nthreads = nthreads;
+    let dctx = blusc_blosc2_create_dctx(dparams);
+
+    let mut decompressed = vec![0u8; nbytes];
+    let dsize = blusc_blosc2_decompress_ctx(&dctx, compressed, &mut decompressed);
+    (dsize, decompressed)
+}
+
+/// Decoding with several threads gives the original data for every codec/filter.
+#[test]
+fn parallel_decompress_roundtrip() {
+    let src = make_data(300_000);
+
+    for &compcode in &[BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            let compressed = compress_with_threads(
+                &src,
+                compcode,
+                filter,
+                5,
+                1,
+                src.len() + BLOSC2_MAX_OVERHEAD,
+            );
+            for &nthreads in &[1i16, 2, 4, 7] {
+                let (dsize, decompressed) = decompress_with_threads(&compressed, src.len(), nthreads);
+                assert_eq!(
+                    dsize as usize,
+                    src.len(),
+                    "Size mismatch: compcode={}, filter={}, nthreads={}",
+                    compcode,
+                    filter,
+                    nthreads
+                );
+                assert_eq!(
+                    src, decompressed,
+                    "Data mismatch: compcode={}, filter={}, nthreads={}",
+                    compcode, filter, nthreads
+                );
+            }
+        }
+    }
+}
+
+/// The leftover (shorter) last block is decoded correctly by the parallel path.
+#[test]
+fn parallel_decompress_leftover_block() {
+    let mut src = make_data(250_000);
+    src.truncate(src.len() - 13);
+
+    let compressed =
+        compress_with_threads(&src, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 5, 1, src.len() + BLOSC2_MAX_OVERHEAD);
+    let (dsize, decompressed) = decompress_with_threads(&compressed, src.len(), 4);
+    assert_eq!(dsize as usize, src.len());
+    assert_eq!(src, decompressed);
+}
+
+/// Corrupt input is reported as an error by the parallel path, as it is serially.
+#[test]
+fn parallel_decompress_truncated_input() {
+    let src = make_data(250_000);
+    let compressed =
+        compress_with_threads(&src, BLOSC_BLOSCLZ, BLOSC_SHUFFLE, 5, 1, src.len() + BLOSC2_MAX_OVERHEAD);
+    let truncated = &compressed[..compressed.len() / 2];
+
+    let (serial, _) = decompress_with_threads(truncated, src.len(), 1);
+    let (parallel, _) = decompress_with_threads(truncated, src.len(), 4);
+    assert_eq!(serial, -1);
+    assert_eq!(parallel, -1);
+}
@@ -0,0 +1,97 @@
+/// Tests for zero and run streams (C `blosc_c`'s `get_run` branch): constant streams of
+/// a split block are written as a 4- or 5-byte marker instead of codec output, and
+/// every decode path fills them back in.
+use blusc::api::{
+    blosc1_getitem as blusc_blosc1_getitem, blosc2_decompress as blusc_blosc2_decompress,
+};
+use blusc::reader::ChunkReader;
+use blusc::{
+    Blosc2Cparams, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_EXTENDED_HEADER_LENGTH, BLOSC_SHUFFLE,
+    BLOSC_ZSTD,
+};
+
+mod common;
+
+fn compress(src: &[u8], compcode: u8, filter: u8, nthreads: i16) -> Vec<u8> {
+    let cparams = Blosc2Cparams {
+        nthreads,
+        ..common::cparams(4, compcode, filter)
+    };
+    common::compress(cparams, src)
+}
+
+/// Size prefixes of the streams of block 0, assuming it is split in 4.
+fn stream_sizes(compressed: &[u8]) -> Vec<i32> {
+    let header = BLOSC_EXTENDED_HEADER_LENGTH;
+    let mut offset =
+        u32::from_le_bytes(compressed[header..header + 4].try_into().unwrap()) as usize;
+    let mut sizes = Vec::new();
+    for _ in 0..4 {
+        let size = i32::from_le_bytes(compressed[offset..offset + 4].try_into().unwrap());
+        sizes.push(size);
+        offset += 4 + if size > 0 {
+            size as usize
+        } else {
+            (size < 0) as usize
+        };
+    }
+    sizes
+}
+
+/// u32 values below 256 tagged with 0xab in the top byte: after shuffling, stream 0
+/// holds data, streams 1 and 2 are zeros and stream 3 is a run of 0xab.
+fn tagged_values(n: usize) -> Vec<u8> {
+    (0..n as u32)
+        .flat_map(|i| (((i * 7) % 251) | 0xab00_0000).to_le_bytes())
+        .collect()
+}
+
+#[test]
+fn constant_streams_of_split_blocks() {
+    let src = tagged_values(300_000);
+    for &compcode in &[BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+        let compressed = compress(&src, compcode, BLOSC_SHUFFLE, 1);
+        let sizes = stream_sizes(&compressed);
+        assert!(sizes[0] > 0);
+        assert_eq!(&sizes[1..], &[0, 0, -0xab]);
+
+        let mut dest = vec![0u8; src.len()];
+        assert_eq!(
+            blusc_blosc2_decompress(&compressed, &mut dest) as usize,
+            src.len()
+        );
+        assert!(dest == src);
+        assert_eq!(compress(&src, compcode, BLOSC_SHUFFLE, 4), compressed);
+
+        // Items straddling block 0 and 1
+        let (_, _, blocksize) = blusc::blosc2_cbuffer_sizes(&compressed);
+        let start = blocksize / 4 - 3;
+        let mut items = [0u8; 24];
+        assert_eq!(
+            blusc_blosc1_getitem(&compressed, start as i32, 6, &mut items),
+            24
+        );
+        assert_eq!(&items[..], &src[start * 4..start * 4 + 24]);
+        let mut reader = ChunkReader::new(&compressed[..], 1 << 20).unwrap();
+        assert_eq!(reader.getitem(start, 6, &mut items), Ok(24));
+        assert_eq!(&items[..], &src[start * 4..start * 4 + 24]);
+    }
+}
+
+/// Blocks that are all runs of one value are filled without unshuffling; with
+/// bitshuffle that only holds for runs of all-0 or all-1 bits.
+#[test]
+fn uniform_run_blocks() {
+    for &value in &[0u8, 0x5a, 0xff] {
+        let src = vec![value; 200_003];
+        for &filter in &[BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            let compressed = compress(&src, BLOSC_BLOSCLZ, filter, 1);
+            let mut dest = vec![1u8; src.len()];
+            assert_eq!(
+                blusc_blosc2_decompress(&compressed, &mut dest) as usize,
+                src.len()
+            );
+            assert!(dest == src, "value={} filter={}", value, filter);
+        }
+    }
+}
@@ -0,0 +1,161 @@
+/// Tests for `Schunk`: chunk bookkeeping, the chunk size rules and whole-schunk
+/// decompression, single- and multi-threaded.
+use blusc::api::{
+    blosc2_chunk_zeros as blusc_blosc2_chunk_zeros,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::schunk::Schunk;
+use blusc::{
+    Blosc2Cparams, BLOSC2_ERROR_CHUNK_APPEND, BLOSC2_ERROR_CHUNK_INSERT, BLOSC2_ERROR_CHUNK_UPDATE,
+    BLOSC2_ERROR_INVALID_INDEX, BLOSC2_ERROR_READ_BUFFER, BLOSC2_ERROR_WRITE_BUFFER, BLOSC_BLOSCLZ,
+    BLOSC_SHUFFLE,
+};
+
+const CHUNK_ITEMS: usize = 50_000;
+
+mod common;
+
+fn cparams() -> Blosc2Cparams {
+    common::cparams(4, BLOSC_BLOSCLZ, BLOSC_SHUFFLE)
+}
+
+fn chunk_data(c: u32, nitems: usize) -> Vec<u8> {
+    (0..nitems as u32)
+        .flat_map(|i| (c * 1_000_003 + i * 3).to_le_bytes())
+        .collect()
+}
+
+fn compressed(data: &[u8]) -> Vec<u8> {
+    common::compress(cparams(), data)
+}
+
+fn decompressed(schunk: &Schunk) -> Vec<u8> {
+    let mut dest = vec![0u8; schunk.nbytes()];
+    assert_eq!(schunk.decompress(&mut dest), Ok(schunk.nbytes()));
+    dest
+}
+
+#[test]
+fn append_and_get_chunks() {
+    let mut schunk = Schunk::new(cparams(), BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    assert_eq!(schunk.nchunks(), 0);
+    assert_eq!(schunk.chunksize(), 0);
+
+    let mut expected = Vec::new();
+    for c in 0..8 {
+        let data = chunk_data(c, CHUNK_ITEMS);
+        assert_eq!(schunk.append_buffer(&data), Ok(c as usize + 1));
+        expected.extend_from_slice(&data);
+    }
+    // A short last chunk
+    let tail = chunk_data(8, 1234);
+    assert_eq!(schunk.append_chunk(compressed(&tail)), Ok(9));
+    expected.extend_from_slice(&tail);
+
+    assert_eq!(schunk.chunksize(), CHUNK_ITEMS * 4);
+    assert_eq!(schunk.nbytes(), expected.len());
+    let cbytes: usize = (0..9).map(|i| schunk.get_chunk(i).unwrap().len()).sum();
+    assert_eq!(schunk.cbytes(), cbytes);
+    assert!(cbytes < expected.len());
+
+    let mut dest = vec![0u8; schunk.chunksize()];
+    for i in (0..9).rev() {
+        let n = schunk.decompress_chunk(i, &mut dest).unwrap();
+        let start = i * schunk.chunksize();
+        assert_eq!(&dest[..n], &expected[start..start + n]);
+    }
+    assert!(decompressed(&schunk) == expected);
+
+    // Nothing may follow the short chunk
+    assert_eq!(
+        schunk.append_buffer(&chunk_data(9, CHUNK_ITEMS)),
+        Err(BLOSC2_ERROR_CHUNK_APPEND)
+    );
+    assert_eq!(schunk.get_chunk(9), Err(BLOSC2_ERROR_INVALID_INDEX));
+    assert_eq!(
+        schunk.decompress_chunk(0, &mut dest[..100]),
+        Err(BLOSC2_ERROR_WRITE_BUFFER)
+    );
+    assert_eq!(schunk.decompress(&mut dest), Err(BLOSC2_ERROR_WRITE_BUFFER));
+}
+
+#[test]
+fn insert_update_delete() {
+    let mut schunk = Schunk::new(cparams(), BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    let chunks: Vec<Vec<u8>> = (0..4).map(|c| chunk_data(c, CHUNK_ITEMS)).collect();
+    schunk.append_buffer(&chunks[0]).unwrap();
+    schunk.append_buffer(&chunks[2]).unwrap();
+    assert_eq!(schunk.insert_chunk(1, compressed(&chunks[1])), Ok(3));
+    assert_eq!(schunk.insert_chunk(3, compressed(&chunks[3])), Ok(4));
+    assert!(decompressed(&schunk) == chunks.concat());
+
+    // Only whole chunks can go in the middle
+    let short = compressed(&chunk_data(9, 100));
+    assert_eq!(
+        schunk.insert_chunk(2, short.clone()),
+        Err(BLOSC2_ERROR_CHUNK_INSERT)
+    );
+    assert_eq!(
+        schunk.update_chunk(2, short.clone()),
+        Err(BLOSC2_ERROR_CHUNK_UPDATE)
+    );
+    assert_eq!(
+        schunk.insert_chunk(5, short.clone()),
+        Err(BLOSC2_ERROR_INVALID_INDEX)
+    );
+
+    // A zero chunk made without compressing anything
+    let mut zeros = vec![0u8; 32];
+    blusc_blosc2_chunk_zeros(&cparams(), CHUNK_ITEMS * 4, &mut zeros);
+    let cbytes = schunk.cbytes() - schunk.get_chunk(1).unwrap().len() + 32;
+    assert_eq!(schunk.update_chunk(1, zeros), Ok(4));
+    assert_eq!(schunk.cbytes(), cbytes);
+    // The last chunk may shrink
+    assert_eq!(schunk.update_chunk(3, short), Ok(4));
+
+    let mut expected = chunks[0].clone();
+    expected.extend_from_slice(&vec![0u8; CHUNK_ITEMS * 4]);
+    expected.extend_from_slice(&chunks[2]);
+    expected.extend_from_slice(&chunk_data(9, 100));
+    assert_eq!(schunk.nbytes(), expected.len());
+    assert!(decompressed(&schunk) == expected);
+
+    assert_eq!(schunk.delete_chunk(0), Ok(3));
+    assert_eq!(schunk.delete_chunk(2), Ok(2));
+    assert_eq!(schunk.delete_chunk(2), Err(BLOSC2_ERROR_INVALID_INDEX));
+    assert!(decompressed(&schunk) == expected[CHUNK_ITEMS * 4..CHUNK_ITEMS * 12]);
+    assert_eq!(schunk.chunksize(), CHUNK_ITEMS * 4);
+}
+
+#[test]
+fn invalid_chunks_are_rejected() {
+    let mut schunk = Schunk::new(cparams(), BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    let chunk = compressed(&chunk_data(0, CHUNK_ITEMS));
+    assert_eq!(
+        schunk.append_chunk(chunk[..chunk.len() - 1].to_vec()),
+        Err(BLOSC2_ERROR_READ_BUFFER)
+    );
+    assert_eq!(schunk.nchunks(), 0);
+    assert_eq!(schunk.cbytes(), 0);
+
+    // Trailing bytes past `cbytes` are dropped
+    let mut padded = chunk.clone();
+    padded.extend_from_slice(&[0; 100]);
+    assert_eq!(schunk.append_chunk(padded), Ok(1));
+    assert_eq!(schunk.get_chunk(0), Ok(&chunk[..]));
+}
+
+#[test]
+fn threaded_decompress() {
+    let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+    dparams.nthreads = 4;
+    let mut schunk = Schunk::new(cparams(), dparams);
+    let data: Vec<u8> = (0..13).flat_map(|c| chunk_data(c, CHUNK_ITEMS)).collect();
+    for chunk in data.chunks(CHUNK_ITEMS * 4) {
+        schunk.append_buffer(chunk).unwrap();
+    }
+    assert!(decompressed(&schunk) == data);
+
+    // Reusing the worker buffers
+    assert!(decompressed(&schunk) == data);
+}
@@ -0,0 +1,157 @@
+/// Tests for special chunks (C `blosc2_chunk_zeros` and friends): header-only chunks
+/// that every decode path turns into a fill.
+use blusc::api::{
+    blosc1_getitem as blusc_blosc1_getitem, blosc2_chunk_nans as blusc_blosc2_chunk_nans,
+    blosc2_chunk_repeatval as blusc_blosc2_chunk_repeatval,
+    blosc2_chunk_uninit as blusc_blosc2_chunk_uninit,
+    blosc2_chunk_zeros as blusc_blosc2_chunk_zeros, blosc2_decompress as blusc_blosc2_decompress,
+};
+use blusc::reader::ChunkReader;
+use blusc::stream::ChunkDecoder;
+use blusc::{
+    Blosc2Cparams, BLOSC2_ERROR_DATA, BLOSC2_ERROR_INVALID_PARAM, BLOSC2_SPECIAL_ZERO,
+    BLOSC_BLOSCLZ, BLOSC_EXTENDED_HEADER_LENGTH, BLOSC_NOFILTER,
+};
+
+mod common;
+
+fn cparams(typesize: i32) -> Blosc2Cparams {
+    common::cparams(typesize, BLOSC_BLOSCLZ, BLOSC_NOFILTER)
+}
+
+/// Decodes `chunk` with `blosc2_decompress`, with `ChunkDecoder` and item by item, and
+/// checks each against `expected`.
+fn assert_decodes_to(chunk: &[u8], expected: &[u8], typesize: usize) {
+    let mut dest = vec![0x55u8; expected.len()];
+    assert_eq!(
+        blusc_blosc2_decompress(chunk, &mut dest) as usize,
+        expected.len()
+    );
+    assert!(dest == expected);
+
+    let mut decoder = ChunkDecoder::new();
+    let mut streamed = Vec::new();
+    assert_eq!(
+        decoder.push(chunk, |offset, block| {
+            assert_eq!(offset, streamed.len());
+            streamed.extend_from_slice(block);
+        }),
+        Ok(chunk.len())
+    );
+    assert!(decoder.is_finished());
+    assert!(streamed == expected);
+
+    let mut reader = ChunkReader::new(chunk, 1 << 20).unwrap();
+    let nitems = expected.len() / typesize;
+    let ranges = [(0, 1), (1, 3), (nitems / 2, 7), (nitems - 1, 1)];
+    for &(start, n) in ranges.iter().filter(|(start, n)| start + n <= nitems) {
+        let range = start * typesize..(start + n) * typesize;
+        let mut items = vec![0u8; range.len()];
+        assert_eq!(
+            blusc_blosc1_getitem(chunk, start as i32, n as i32, &mut items) as usize,
+            range.len()
+        );
+        assert_eq!(&items[..], &expected[range.clone()]);
+        assert_eq!(reader.getitem(start, n, &mut items), Ok(range.len()));
+        assert_eq!(&items[..], &expected[range]);
+    }
+    assert_eq!(reader.cached_bytes(), 0);
+}
+
+#[test]
+fn zero_chunks_are_headers() {
+    for &nbytes in &[4usize, 1000, 1 << 20, 10_000_000] {
+        let mut chunk = [0u8; BLOSC_EXTENDED_HEADER_LENGTH];
+        assert_eq!(
+            blusc_blosc2_chunk_zeros(&cparams(4), nbytes, &mut chunk) as usize,
+            BLOSC_EXTENDED_HEADER_LENGTH
+        );
+        assert_eq!(blusc::blosc2_cbuffer_sizes(&chunk).0, nbytes);
+        assert_decodes_to(&chunk, &vec![0u8; nbytes], 4);
+    }
+}
+
+#[test]
+fn nan_chunks() {
+    let mut chunk = [0u8; BLOSC_EXTENDED_HEADER_LENGTH];
+    let nbytes = 100_000 * 4;
+    assert_eq!(blusc_blosc2_chunk_nans(&cparams(4), nbytes, &mut chunk), 32);
+    let expected: Vec<u8> = (0..100_000).flat_map(|_| f32::NAN.to_le_bytes()).collect();
+    assert_decodes_to(&chunk, &expected, 4);
+
+    assert_eq!(blusc_blosc2_chunk_nans(&cparams(8), 8000, &mut chunk), 32);
+    let mut dest = vec![0u8; 8000];
+    assert_eq!(blusc_blosc2_decompress(&chunk, &mut dest), 8000);
+    assert!(dest
+        .chunks(8)
+        .all(|item| f64::from_le_bytes(item.try_into().unwrap()).is_nan()));
+
+    assert_eq!(
+        blusc_blosc2_chunk_nans(&cparams(2), 8000, &mut chunk),
+        BLOSC2_ERROR_INVALID_PARAM
+    );
+}
+
+#[test]
+fn repeatval_chunks() {
+    // An odd typesize, so that items straddle blocks and the fill has to keep the phase
+    let item = [1u8, 2, 3];
+    let nbytes = 3 * 123_457;
+    let mut chunk = [0u8; BLOSC_EXTENDED_HEADER_LENGTH + 3];
+    assert_eq!(
+        blusc_blosc2_chunk_repeatval(&cparams(3), nbytes, &mut chunk, &item),
+        35
+    );
+    let expected: Vec<u8> = item.iter().cycle().take(nbytes).copied().collect();
+    assert_decodes_to(&chunk, &expected, 3);
+
+    // A value of one repeated byte
+    let mut chunk = [0u8; BLOSC_EXTENDED_HEADER_LENGTH + 4];
+    assert_eq!(
+        blusc_blosc2_chunk_repeatval(&cparams(4), 4000, &mut chunk, &[9; 4]),
+        36
+    );
+    assert_decodes_to(&chunk, &[9u8; 4000], 4);
+
+    assert_eq!(
+        blusc_blosc2_chunk_repeatval(&cparams(4), 4000, &mut chunk, &[9; 3]),
+        BLOSC2_ERROR_INVALID_PARAM
+    );
+    assert_eq!(
+        blusc_blosc2_chunk_repeatval(&cparams(4), 4000, &mut chunk[..35], &[9; 4]),
+        BLOSC2_ERROR_DATA
+    );
+}
+
+#[test]
+fn uninit_chunks_leave_dest_alone() {
+    let mut chunk = [0u8; BLOSC_EXTENDED_HEADER_LENGTH];
+    assert_eq!(blusc_blosc2_chunk_uninit(&cparams(8), 8000, &mut chunk), 32);
+    let mut dest = vec![0x55u8; 8000];
+    assert_eq!(blusc_blosc2_decompress(&chunk, &mut dest), 8000);
+    assert!(dest.iter().all(|&b| b == 0x55));
+
+    assert_eq!(
+        blusc_blosc2_chunk_uninit(&cparams(8), 8001, &mut chunk),
+        BLOSC2_ERROR_DATA
+    );
+}
+
+/// The header c-blosc2's `blosc2_chunk_zeros` writes for 4-byte items with default
+/// parameters.
+#[test]
+fn c_zero_chunks() {
+    let nbytes = 4_000_000u32;
+    let mut chunk = [0u8; BLOSC_EXTENDED_HEADER_LENGTH];
+    chunk[..4].copy_from_slice(&[5, 1, 0x05, 4]);
+    chunk[4..8].copy_from_slice(&nbytes.to_le_bytes());
+    chunk[8..12].copy_from_slice(&(1u32 << 17).to_le_bytes());
+    chunk[12..16].copy_from_slice(&32u32.to_le_bytes());
+    chunk[31] = BLOSC2_SPECIAL_ZERO << 4;
+    assert_decodes_to(&chunk, &vec![0u8; nbytes as usize], 4);
+
+    let mut ours = [0u8; BLOSC_EXTENDED_HEADER_LENGTH];
+    blusc_blosc2_chunk_zeros(&cparams(4), nbytes as usize, &mut ours);
+    assert_eq!(ours[..8], chunk[..8]);
+    assert_eq!(ours[12..], chunk[12..]);
+}
@@ -0,0 +1,155 @@
+/// Tests for `cparams.splitmode`: forced and forbidden splits, `BLOSC_AUTO_SPLIT`, and
+/// clevel 0, through `blosc2_compress_ctx`, the parallel path and the stream encoder.
+use blusc::api::BLOSC2_CPARAMS_DEFAULTS as BLUSC_BLOSC2_CPARAMS_DEFAULTS;
+use blusc::stream::ChunkEncoder;
+use blusc::view::ChunkView;
+use blusc::{
+    Blosc2Cparams, BLOSC_ALWAYS_SPLIT, BLOSC_AUTO_SPLIT, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ,
+    BLOSC_DELTA, BLOSC_FORWARD_COMPAT_SPLIT, BLOSC_MEMCPYED, BLOSC_NEVER_SPLIT, BLOSC_NOSHUFFLE,
+    BLOSC_SHUFFLE, BLOSC_ZLIB, BLOSC_ZSTD,
+};
+use std::io::Cursor;
+
+const DONT_SPLIT: u8 = 0x10;
+
+mod common;
+use common::{compress_checked, decompress};
+
+fn cparams(typesize: i32, compcode: u8, clevel: u8, splitmode: u8) -> Blosc2Cparams {
+    Blosc2Cparams {
+        clevel,
+        splitmode: splitmode as i32,
+        ..common::cparams(typesize, compcode, BLOSC_SHUFFLE)
+    }
+}
+
+fn stream(cparams: &Blosc2Cparams, src: &[u8]) -> Vec<u8> {
+    let mut encoder = ChunkEncoder::new(cparams, src.len(), Cursor::new(Vec::new())).unwrap();
+    for piece in src.chunks(50_000) {
+        encoder.push(piece).unwrap();
+    }
+    encoder.finish().unwrap().0.into_inner()
+}
+
+/// Slowly varying u32 values, where one stream per byte compresses best.
+fn ramp() -> Vec<u8> {
+    (0..250_000u32)
+        .flat_map(|i| (i / 3).to_le_bytes())
+        .collect()
+}
+
+/// Text, which byte streams cut apart.
+fn text() -> Vec<u8> {
+    let words = b"the quick brown fox jumps over the lazy dog; ";
+    (0..1_000_000)
+        .map(|i| words[(i * 7 / 5) % words.len()])
+        .collect()
+}
+
+#[test]
+fn forced_splits() {
+    let src = ramp();
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for clevel in [1, 5, 9] {
+            for (splitmode, split) in [(BLOSC_ALWAYS_SPLIT, true), (BLOSC_NEVER_SPLIT, false)] {
+                let chunk = compress_checked(cparams(4, compcode, clevel, splitmode), &src);
+                assert_eq!(chunk[2] & BLOSC_MEMCPYED, 0);
+                assert_eq!(chunk[2] & DONT_SPLIT == 0, split, "{compcode} {clevel}");
+
+                let mut threaded = cparams(4, compcode, clevel, splitmode);
+                threaded.nthreads = 4;
+                assert!(compress_checked(threaded, &src) == chunk);
+                assert!(stream(&cparams(4, compcode, clevel, splitmode), &src) == chunk);
+            }
+        }
+    }
+
+    // Without a byte shuffle too, and with delta
+    for filters in [[0; 6], [0, 0, 0, 0, BLOSC_DELTA, BLOSC_BITSHUFFLE]] {
+        let mut cparams = cparams(4, BLOSC_ZSTD, 5, BLOSC_ALWAYS_SPLIT);
+        cparams.filters = filters;
+        let chunk = compress_checked(cparams, &src);
+        assert_eq!(chunk[2] & DONT_SPLIT, 0);
+    }
+}
+
+#[test]
+fn forward_compat_is_the_default() {
+    let src = ramp();
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZSTD] {
+        for clevel in [3, 7] {
+            let chunk = compress_checked(
+                cparams(4, compcode, clevel, BLOSC_FORWARD_COMPAT_SPLIT),
+                &src,
+            );
+            let mut defaults = cparams(4, compcode, clevel, 0);
+            defaults.splitmode = BLUSC_BLOSC2_CPARAMS_DEFAULTS.splitmode;
+            assert!(compress_checked(defaults, &src) == chunk);
+            // zstd only splits up to clevel 5
+            let split = compcode == BLOSC_BLOSCLZ || clevel <= 5;
+            assert_eq!(chunk[2] & DONT_SPLIT == 0, split);
+        }
+    }
+}
+
+#[test]
+fn auto_split_measures() {
+    let ramp = ramp();
+    let chunk = compress_checked(cparams(4, BLOSC_BLOSCLZ, 5, BLOSC_AUTO_SPLIT), &ramp);
+    assert_eq!(chunk[2] & DONT_SPLIT, 0);
+    let text = text();
+    let chunk = compress_checked(cparams(4, BLOSC_BLOSCLZ, 5, BLOSC_AUTO_SPLIT), &text);
+    assert_eq!(chunk[2] & DONT_SPLIT, DONT_SPLIT);
+    assert!(
+        chunk.len()
+            < compress_checked(cparams(4, BLOSC_BLOSCLZ, 5, BLOSC_ALWAYS_SPLIT), &text).len()
+    );
+
+    // The encoder measures the same block 0
+    for src in [&ramp, &text] {
+        let cparams = cparams(4, BLOSC_ZSTD, 3, BLOSC_AUTO_SPLIT);
+        let streamed = stream(&cparams, src);
+        assert!(decompress(&streamed, src.len()) == *src);
+        assert!(streamed == compress_checked(cparams, src));
+    }
+
+    // A random low byte makes split streams give up, which a chunk cannot afford
+    let noisy: Vec<u8> = (0..125_000)
+        .flat_map(|i| ((i as f64) * 0.01).sin().to_le_bytes())
+        .collect();
+    let chunk = compress_checked(cparams(8, BLOSC_ZSTD, 7, BLOSC_AUTO_SPLIT), &noisy);
+    assert_eq!(chunk[2] & (DONT_SPLIT | BLOSC_MEMCPYED), DONT_SPLIT);
+}
+
+#[test]
+fn clevel_0_is_memcpyed() {
+    let src = ramp();
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for filter in [BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            for splitmode in [BLOSC_FORWARD_COMPAT_SPLIT, BLOSC_NEVER_SPLIT] {
+                let mut cparams = cparams(4, compcode, 0, splitmode);
+                cparams.filters[5] = filter;
+                cparams.nthreads = 2;
+                let chunk = compress_checked(cparams, &src);
+                assert_eq!(chunk.len(), src.len() + 32);
+                assert_ne!(chunk[2] & BLOSC_MEMCPYED, 0);
+
+                // The encoder cannot memcpy, so it stores every stream as is instead
+                let mut cparams = self::cparams(4, compcode, 0, splitmode);
+                cparams.filters[5] = filter;
+                let streamed = stream(&cparams, &src);
+                let view = ChunkView::new(&streamed).unwrap();
+                for i in 0..view.nblocks() {
+                    let neblock = view.block_len(i) / view.block_nstreams(i);
+                    let block = view.block_bytes(i);
+                    assert_eq!(block.len(), view.block_nstreams(i) * (4 + neblock));
+                    for stream in block.chunks(4 + neblock) {
+                        let csize = i32::from_le_bytes(stream[..4].try_into().unwrap());
+                        assert_eq!(csize as usize, neblock);
+                    }
+                }
+                assert!(decompress(&streamed, src.len()) == src);
+            }
+        }
+    }
+}
@@ -0,0 +1,136 @@
+/// Tests for `stream::ChunkDecoder`, the incremental chunk decoder.
+/// However the compressed bytes are split into pieces, the blocks handed out must
+/// concatenate to the full decode.
+use blusc::api::blosc1_compress as blusc_blosc1_compress;
+use blusc::stream::ChunkDecoder;
+use blusc::{
+    BLOSC2_ERROR_DATA, BLOSC2_ERROR_INVALID_HEADER, BLOSC2_MAX_OVERHEAD, BLOSC_BITSHUFFLE,
+    BLOSC_NOSHUFFLE, BLOSC_SHUFFLE,
+};
+
+mod common;
+use common::{compress_u32, make_data};
+
+/// Feeds `compressed` in pieces of the given sizes (cycling) and returns the output.
+fn stream_decode(compressed: &[u8], piece_sizes: &[usize]) -> Result<Vec<u8>, i32> {
+    let mut decoder = ChunkDecoder::new();
+    let mut output = Vec::new();
+    let mut pos = 0;
+    for &size in piece_sizes.iter().cycle() {
+        if pos == compressed.len() {
+            break;
+        }
+        let end = std::cmp::min(pos + size, compressed.len());
+        let consumed = decoder.push(&compressed[pos..end], |offset, block| {
+            assert_eq!(offset, output.len());
+            output.extend_from_slice(block);
+        })?;
+        assert_eq!(consumed, end - pos);
+        pos = end;
+    }
+    assert!(decoder.is_finished());
+    assert_eq!(decoder.nbytes(), Some(output.len()));
+    Ok(output)
+}
+
+#[test]
+fn stream_decode_matches_input() {
+    let src = make_data(300_000, 3);
+    for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+        let compressed = compress_u32(&src, filter);
+        for pieces in [&[1usize][..], &[7, 1, 4096], &[100_000], &[usize::MAX]] {
+            assert_eq!(
+                stream_decode(&compressed, pieces).unwrap(),
+                src,
+                "filter={}, pieces={:?}",
+                filter,
+                pieces
+            );
+        }
+    }
+}
+
+/// Blosc1 chunks (16-byte header) and the shorter last block.
+#[test]
+fn stream_decode_blosc1_leftover() {
+    let mut src = make_data(100_000, 3);
+    src.truncate(src.len() - 13);
+    let mut compressed = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    let csize = blusc_blosc1_compress(5, BLOSC_SHUFFLE as i32, 4, &src, &mut compressed);
+    assert!(csize > 0);
+    compressed.truncate(csize as usize);
+
+    assert_eq!(stream_decode(&compressed, &[333]).unwrap(), src);
+}
+
+/// Memcpyed chunks are handed out block by block straight from the input.
+#[test]
+fn stream_decode_memcpyed() {
+    let mut state: u64 = 0x9E3779B97F4A7C15;
+    let src: Vec<u8> = (0..100_000)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            state as u8
+        })
+        .collect();
+    let compressed = compress_u32(&src, BLOSC_SHUFFLE);
+    assert_eq!(stream_decode(&compressed, &[5_000]).unwrap(), src);
+}
+
+/// Bytes after the end of the chunk are not consumed, so chunks can be streamed back to back.
+#[test]
+fn stream_decode_stops_at_chunk_end() {
+    let src = make_data(50_000, 3);
+    let compressed = compress_u32(&src, BLOSC_SHUFFLE);
+    let mut joined = compressed.clone();
+    joined.extend_from_slice(&compressed);
+
+    let mut decoder = ChunkDecoder::new();
+    let mut output = Vec::new();
+    let consumed = decoder
+        .push(&joined, |_, block| output.extend_from_slice(block))
+        .unwrap();
+    assert_eq!(consumed, compressed.len());
+    assert!(decoder.is_finished());
+    assert_eq!(output, src);
+
+    let mut decoder = ChunkDecoder::new();
+    output.clear();
+    let consumed = decoder
+        .push(&joined[consumed..], |_, block| {
+            output.extend_from_slice(block)
+        })
+        .unwrap();
+    assert_eq!(consumed, compressed.len());
+    assert_eq!(output, src);
+}
+
+#[test]
+fn stream_decode_errors() {
+    let src = make_data(100_000, 3);
+    let compressed = compress_u32(&src, BLOSC_SHUFFLE);
+
+    // bstarts pointing backwards
+    let mut bad = compressed.clone();
+    bad[32..36].copy_from_slice(&0u32.to_le_bytes());
+    assert_eq!(
+        stream_decode(&bad, &[1000]),
+        Err(BLOSC2_ERROR_INVALID_HEADER)
+    );
+
+    // Corrupt stream size in the first block
+    let mut bad = compressed.clone();
+    let bstart = u32::from_le_bytes(bad[32..36].try_into().unwrap()) as usize;
+    bad[bstart..bstart + 4].copy_from_slice(&i32::MAX.to_le_bytes());
+    assert_eq!(stream_decode(&bad, &[1000]), Err(BLOSC2_ERROR_DATA));
+
+    // Truncated input leaves the decoder waiting for more
+    let mut decoder = ChunkDecoder::new();
+    decoder
+        .push(&compressed[..compressed.len() - 1], |_, _| {})
+        .unwrap();
+    assert!(!decoder.is_finished());
+    assert_eq!(decoder.cbytes(), Some(compressed.len()));
+}
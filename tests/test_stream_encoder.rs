@@ -0,0 +1,124 @@
+/// Tests for `stream::ChunkEncoder`, the incremental chunk compressor.
+/// Compressible input must come out byte-identical to `blosc2_compress_ctx` however it is
+/// pushed; incompressible input must still round-trip.
+use blusc::api::{blosc2_decompress as blusc_blosc2_decompress, Blosc2Cparams};
+use blusc::stream::{ChunkDecoder, ChunkEncoder};
+use blusc::{
+    BLOSC2_ERROR_INVALID_PARAM, BLOSC2_MAX_OVERHEAD, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ,
+    BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_ZLIB, BLOSC_ZSTD,
+};
+use std::io::Cursor;
+
+mod common;
+use common::compress;
+
+fn make_data(num_elements: usize) -> Vec<u8> {
+    common::make_data(num_elements, 3)
+}
+
+fn cparams(compcode: u8, filter: u8) -> Blosc2Cparams {
+    common::cparams(4, compcode, filter)
+}
+
+/// Pushes `src` in pieces of `piece` bytes and returns the chunk.
+fn stream_encode(src: &[u8], cparams: &Blosc2Cparams, piece: usize) -> Vec<u8> {
+    let mut encoder = ChunkEncoder::new(cparams, src.len(), Cursor::new(Vec::new())).unwrap();
+    for p in src.chunks(piece) {
+        encoder.push(p).unwrap();
+    }
+    let (sink, cbytes) = encoder.finish().unwrap();
+    let compressed = sink.into_inner();
+    assert_eq!(compressed.len(), cbytes);
+    compressed
+}
+
+#[test]
+fn stream_encode_matches_compress_ctx() {
+    let mut src = make_data(300_000);
+    src.truncate(src.len() - 6);
+    for &compcode in &[BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            let cparams = cparams(compcode, filter);
+            let expected = compress(self::cparams(compcode, filter), &src);
+            for piece in [1_000, 65_536, 1 << 30] {
+                assert_eq!(
+                    stream_encode(&src, &cparams, piece),
+                    expected,
+                    "compcode={}, filter={}, piece={}",
+                    compcode,
+                    filter,
+                    piece
+                );
+            }
+        }
+    }
+}
+
+/// `io::copy` from a reader into the encoder; the chunk starts after existing sink bytes.
+#[test]
+fn stream_encode_from_reader_at_offset() {
+    let src = make_data(100_000);
+    let cparams = cparams(BLOSC_BLOSCLZ, BLOSC_SHUFFLE);
+
+    let mut sink = Cursor::new(Vec::new());
+    std::io::Write::write_all(&mut sink, b"prefix").unwrap();
+    let mut encoder = ChunkEncoder::new(&cparams, src.len(), sink).unwrap();
+    std::io::copy(&mut &src[..], &mut encoder).unwrap();
+    let (sink, cbytes) = encoder.finish().unwrap();
+    assert_eq!(sink.position() as usize, 6 + cbytes);
+
+    let out = sink.into_inner();
+    assert_eq!(&out[..6], b"prefix");
+    assert_eq!(
+        &out[6..],
+        &compress(self::cparams(BLOSC_BLOSCLZ, BLOSC_SHUFFLE), &src)[..]
+    );
+}
+
+/// Incompressible streams are stored as is rather than memcpying the whole chunk.
+#[test]
+fn stream_encode_incompressible_roundtrip() {
+    let mut state: u64 = 0x9E3779B97F4A7C15;
+    let mut src: Vec<u8> = (0..200_000)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            state as u8
+        })
+        .collect();
+    src[..50_000].fill(0);
+
+    for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE] {
+        let compressed = stream_encode(&src, &cparams(BLOSC_BLOSCLZ, filter), 4_096);
+        assert!(compressed.len() <= src.len() + BLOSC2_MAX_OVERHEAD + 4 * 4 * 64);
+
+        let mut decompressed = vec![0u8; src.len()];
+        assert_eq!(
+            blusc_blosc2_decompress(&compressed, &mut decompressed) as usize,
+            src.len()
+        );
+        assert_eq!(decompressed, src);
+
+        let mut decoder = ChunkDecoder::new();
+        let mut output = Vec::new();
+        decoder
+            .push(&compressed, |_, block| output.extend_from_slice(block))
+            .unwrap();
+        assert_eq!(output, src);
+    }
+}
+
+#[test]
+fn stream_encode_empty_and_errors() {
+    let cparams = cparams(BLOSC_BLOSCLZ, BLOSC_SHUFFLE);
+    assert_eq!(
+        stream_encode(&[], &cparams, 1),
+        compress(self::cparams(BLOSC_BLOSCLZ, BLOSC_SHUFFLE), &[])
+    );
+
+    let mut encoder = ChunkEncoder::new(&cparams, 10, Cursor::new(Vec::new())).unwrap();
+    encoder.push(&[0u8; 6]).unwrap();
+    assert_eq!(encoder.push(&[0u8; 6]), Err(BLOSC2_ERROR_INVALID_PARAM));
+    assert_eq!(encoder.finish().err(), Some(BLOSC2_ERROR_INVALID_PARAM));
+}
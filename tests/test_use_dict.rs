@@ -0,0 +1,196 @@
+/// Tests for dictionary compression (`use_dict`): the dictionary is trained per chunk,
+/// stored after `bstarts` and flagged in header byte 31, and every decode path (full,
+/// context, getitem, `ChunkReader`, `ChunkDecoder`) must pick it up.
+use blusc::api::{
+    blosc1_getitem as blusc_blosc1_getitem, blosc2_compress_ctx as blusc_blosc2_compress_ctx,
+    blosc2_create_cctx as blusc_blosc2_create_cctx, blosc2_create_dctx as blusc_blosc2_create_dctx,
+    blosc2_decompress as blusc_blosc2_decompress,
+    blosc2_decompress_ctx as blusc_blosc2_decompress_ctx,
+    BLOSC2_CPARAMS_DEFAULTS as BLUSC_BLOSC2_CPARAMS_DEFAULTS,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::reader::ChunkReader;
+use blusc::stream::ChunkDecoder;
+use blusc::{
+    Blosc2Cparams, BLOSC2_MAX_OVERHEAD, BLOSC2_USEDICT, BLOSC_EXTENDED_HEADER_LENGTH, BLOSC_LZ4,
+    BLOSC_NOSHUFFLE, BLOSC_SHUFFLE, BLOSC_ZSTD,
+};
+
+/// Text-like records: every block shares the same vocabulary, which is what a
+/// dictionary captures.
+fn make_records(n: usize) -> Vec<u8> {
+    let names = ["alpha", "bravo", "charlie", "delta", "echo", "foxtrot"];
+    let mut out = Vec::new();
+    let mut state: u32 = 17;
+    for i in 0..n {
+        state = state.wrapping_mul(1_103_515_245).wrapping_add(12_345);
+        let record = format!(
+            "{{\"id\":{},\"name\":\"{}\",\"x\":{},\"y\":{}}}\n",
+            i,
+            names[(state >> 16) as usize % names.len()],
+            (state >> 8) % 1000,
+            state % 97
+        );
+        out.extend_from_slice(record.as_bytes());
+    }
+    out
+}
+
+mod common;
+
+fn compress(src: &[u8], compcode: u8, filter: u8, use_dict: i32, nthreads: i16) -> Vec<u8> {
+    let cparams = Blosc2Cparams {
+        use_dict,
+        nthreads,
+        ..common::cparams(4, compcode, filter)
+    };
+    common::compress(cparams, src)
+}
+
+/// Offset of the dictionary size, right after `bstarts`.
+fn dict_offset(compressed: &[u8]) -> usize {
+    let (nbytes, _, blocksize) = blusc::blosc2_cbuffer_sizes(compressed);
+    BLOSC_EXTENDED_HEADER_LENGTH + (nbytes + blocksize - 1) / blocksize * 4
+}
+
+#[test]
+fn dict_roundtrip() {
+    let src = make_records(40_000);
+
+    for &filter in &[BLOSC_NOSHUFFLE, BLOSC_SHUFFLE] {
+        let plain = compress(&src, BLOSC_ZSTD, filter, 0, 1);
+        let compressed = compress(&src, BLOSC_ZSTD, filter, 1, 1);
+        assert_eq!(plain[31] & BLOSC2_USEDICT, 0);
+        assert_eq!(compressed[31] & BLOSC2_USEDICT, BLOSC2_USEDICT);
+
+        // The dictionary sits between `bstarts` and the first block
+        let offset = dict_offset(&compressed);
+        let dict_size = i32::from_le_bytes(compressed[offset..offset + 4].try_into().unwrap());
+        assert!(dict_size > 0 && (dict_size as usize) <= src.len() / 20);
+        let bstart0 = u32::from_le_bytes(compressed[32..36].try_into().unwrap()) as usize;
+        assert_eq!(bstart0, offset + 4 + dict_size as usize);
+
+        let mut dest = vec![0u8; src.len()];
+        assert_eq!(
+            blusc_blosc2_decompress(&compressed, &mut dest) as usize,
+            src.len()
+        );
+        assert_eq!(dest, src, "filter={}", filter);
+    }
+}
+
+/// The training is deterministic, so threads do not change the bytes.
+#[test]
+fn dict_parallel_matches_serial() {
+    let src = make_records(40_000);
+    let serial = compress(&src, BLOSC_ZSTD, BLOSC_SHUFFLE, 1, 1);
+    let parallel = compress(&src, BLOSC_ZSTD, BLOSC_SHUFFLE, 1, 4);
+    assert_eq!(serial, parallel);
+
+    let mut dparams = BLUSC_BLOSC2_DPARAMS_DEFAULTS;
+    dparams.nthreads = 4;
+    let dctx = blusc_blosc2_create_dctx(dparams);
+    let mut dest = vec![0u8; src.len()];
+    assert_eq!(
+        blusc_blosc2_decompress_ctx(&dctx, &serial, &mut dest) as usize,
+        src.len()
+    );
+    assert_eq!(dest, src);
+}
+
+/// One decompression context alternates between chunks with different dictionaries and
+/// chunks without one.
+#[test]
+fn dict_reused_dctx() {
+    let a = make_records(40_000);
+    let b = make_records(30_000);
+    let chunks = [
+        (compress(&a, BLOSC_ZSTD, BLOSC_NOSHUFFLE, 1, 1), &a),
+        (compress(&b, BLOSC_ZSTD, BLOSC_NOSHUFFLE, 1, 1), &b),
+        (compress(&a, BLOSC_ZSTD, BLOSC_NOSHUFFLE, 0, 1), &a),
+        (compress(&a, BLOSC_ZSTD, BLOSC_NOSHUFFLE, 1, 1), &a),
+    ];
+
+    let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+    for _ in 0..2 {
+        for (compressed, src) in chunks.iter() {
+            let mut dest = vec![0u8; src.len()];
+            assert_eq!(
+                blusc_blosc2_decompress_ctx(&dctx, compressed, &mut dest) as usize,
+                src.len()
+            );
+            assert_eq!(&dest, *src);
+        }
+    }
+}
+
+#[test]
+fn dict_partial_reads() {
+    let src = make_records(40_000);
+    let compressed = compress(&src, BLOSC_ZSTD, BLOSC_SHUFFLE, 1, 1);
+    assert_eq!(compressed[31] & BLOSC2_USEDICT, BLOSC2_USEDICT);
+    let nitems = src.len() / 4;
+
+    let mut reader = ChunkReader::new(&compressed[..], 1 << 20).unwrap();
+    for &(start, n) in &[(0, 10), (nitems / 3, 5_000), (nitems - 7, 7)] {
+        let expected = &src[start * 4..(start + n) * 4];
+        let mut dest = vec![0u8; n * 4];
+        assert_eq!(
+            blusc_blosc1_getitem(&compressed, start as i32, n as i32, &mut dest) as usize,
+            n * 4
+        );
+        assert_eq!(&dest[..], expected);
+
+        let mut dest = vec![0u8; n * 4];
+        assert_eq!(reader.getitem(start, n, &mut dest), Ok(n * 4));
+        assert_eq!(&dest[..], expected);
+    }
+
+    // Small pieces make the decoder wait for the dictionary size and then its bytes
+    let mut decoder = ChunkDecoder::new();
+    let mut output = Vec::new();
+    for piece in compressed.chunks(7) {
+        decoder
+            .push(piece, |_, block| output.extend_from_slice(block))
+            .unwrap();
+    }
+    assert!(decoder.is_finished());
+    assert_eq!(output, src);
+}
+
+/// Like C, only zstd supports dictionaries; too little data to train one gives a
+/// chunk without a dictionary.
+#[test]
+fn dict_unsupported_and_tiny() {
+    let src = make_records(5_000);
+    let mut cparams = BLUSC_BLOSC2_CPARAMS_DEFAULTS;
+    cparams.compcode = BLOSC_LZ4;
+    cparams.typesize = 4;
+    cparams.use_dict = 1;
+    let cctx = blusc_blosc2_create_cctx(cparams);
+    let mut compressed = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    assert_eq!(blusc_blosc2_compress_ctx(&cctx, &src, &mut compressed), 0);
+
+    let tiny = make_records(20);
+    let compressed = compress(&tiny, BLOSC_ZSTD, BLOSC_NOSHUFFLE, 1, 1);
+    assert_eq!(compressed[31] & BLOSC2_USEDICT, 0);
+    let mut dest = vec![0u8; tiny.len()];
+    assert_eq!(
+        blusc_blosc2_decompress(&compressed, &mut dest) as usize,
+        tiny.len()
+    );
+    assert_eq!(dest, tiny);
+}
+
+#[test]
+fn dict_corrupt_size() {
+    let src = make_records(40_000);
+    let mut compressed = compress(&src, BLOSC_ZSTD, BLOSC_NOSHUFFLE, 1, 1);
+    let offset = dict_offset(&compressed);
+    let mut dest = vec![0u8; src.len()];
+    for bad in [0i32, -5, 1 << 30] {
+        compressed[offset..offset + 4].copy_from_slice(&bad.to_le_bytes());
+        assert_eq!(blusc_blosc2_decompress(&compressed, &mut dest), -1);
+        assert!(ChunkReader::new(&compressed[..], 0).is_err());
+    }
+}
@@ -0,0 +1,177 @@
+/// Tests for `ChunkView`: header fields and block ranges of regular, memcpyed and special
+/// chunks, single-block decoding, and rejected chunks (which every decoder rejects).
+use blusc::api::{
+    blosc1_compress as blusc_blosc1_compress, blosc1_getitem as blusc_blosc1_getitem,
+    blosc2_chunk_repeatval as blusc_blosc2_chunk_repeatval,
+    blosc2_create_dctx as blusc_blosc2_create_dctx, blosc2_decompress as blusc_blosc2_decompress,
+    BLOSC2_DPARAMS_DEFAULTS as BLUSC_BLOSC2_DPARAMS_DEFAULTS,
+};
+use blusc::reader::ChunkReader;
+use blusc::stream::ChunkDecoder;
+use blusc::view::ChunkView;
+use blusc::{
+    Blosc2Cparams, BLOSC2_ERROR_INVALID_HEADER, BLOSC2_ERROR_INVALID_PARAM,
+    BLOSC2_ERROR_READ_BUFFER, BLOSC2_ERROR_WRITE_BUFFER, BLOSC2_MAX_OVERHEAD, BLOSC2_NO_SPECIAL,
+    BLOSC2_SPECIAL_VALUE, BLOSC_BITSHUFFLE, BLOSC_BLOSCLZ, BLOSC_DELTA,
+    BLOSC_EXTENDED_HEADER_LENGTH, BLOSC_SHUFFLE, BLOSC_ZLIB, BLOSC_ZSTD,
+};
+
+mod common;
+use common::compress;
+
+/// Blocks of 16 KB, so that `data()` ends with a short one.
+fn cparams(compcode: u8, filter: u8) -> Blosc2Cparams {
+    Blosc2Cparams {
+        blocksize: 16 << 10,
+        ..common::cparams(4, compcode, filter)
+    }
+}
+
+/// 200 KB of slowly varying u32 values, not a whole number of blocks.
+fn data() -> Vec<u8> {
+    (0..50_000u32).flat_map(|i| (i / 3).to_le_bytes()).collect()
+}
+
+/// Decodes every block of `view` on its own, checking the block ranges on the way.
+fn decode_all(view: &ChunkView) -> Vec<u8> {
+    let mut out = Vec::new();
+    let mut block = vec![0u8; view.blocksize()];
+    for i in 0..view.nblocks() {
+        let n = view.decode_block(i, &mut block).unwrap();
+        assert_eq!(n, view.block_len(i));
+        out.extend_from_slice(&block[..n]);
+        if i + 1 < view.nblocks() {
+            assert_eq!(view.block_range(i).end, view.block_range(i + 1).start);
+        }
+    }
+    out
+}
+
+#[test]
+fn view_matches_chunk() {
+    let src = data();
+    for compcode in [BLOSC_BLOSCLZ, BLOSC_ZLIB, BLOSC_ZSTD] {
+        for filter in [BLOSC_SHUFFLE, BLOSC_BITSHUFFLE] {
+            for delta in [false, true] {
+                let mut cparams = cparams(compcode, filter);
+                if delta {
+                    cparams.filters[4] = BLOSC_DELTA;
+                }
+                let filters = cparams.filters;
+                let chunk = compress(cparams, &src);
+                let view = ChunkView::new(&chunk).unwrap();
+                assert_eq!(
+                    (view.nbytes(), view.cbytes(), view.blocksize()),
+                    blusc::blosc2_cbuffer_sizes(&chunk)
+                );
+                assert_eq!((view.typesize(), view.compcode()), (4, compcode));
+                assert_eq!(view.filters(), filters);
+                assert_eq!(view.special_type(), BLOSC2_NO_SPECIAL);
+                assert!(!view.is_memcpyed() && !view.uses_dict() && !view.is_instrumented());
+                assert_eq!(view.nblocks(), src.len().div_ceil(16 << 10));
+                assert_eq!(view.block_range(view.nblocks() - 1).end, chunk.len());
+                assert!(decode_all(&view) == src);
+
+                // The blocks of a slice, decoded in any order, with a context
+                let dctx = blusc_blosc2_create_dctx(BLUSC_BLOSC2_DPARAMS_DEFAULTS);
+                let blocks = view.blocks_for_items(9000, 10_000).unwrap();
+                assert_eq!(blocks, 2..5);
+                let mut block = vec![0u8; view.blocksize()];
+                for i in blocks.rev() {
+                    let n = view.decode_block_ctx(&dctx, i, &mut block).unwrap();
+                    let start = i * view.blocksize();
+                    assert!(block[..n] == src[start..start + n]);
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn blosc1_memcpyed_and_special_chunks() {
+    let src = data();
+
+    let mut chunk = vec![0u8; src.len() + BLOSC2_MAX_OVERHEAD];
+    let cbytes = blusc_blosc1_compress(5, 1, 4, &src, &mut chunk);
+    let view = ChunkView::new(&chunk[..cbytes as usize]).unwrap();
+    assert_eq!(view.filters()[5], BLOSC_SHUFFLE);
+    assert!(decode_all(&view) == src);
+
+    let mut stored = cparams(BLOSC_ZSTD, BLOSC_SHUFFLE);
+    stored.clevel = 0;
+    let chunk = compress(stored, &src);
+    let view = ChunkView::new(&chunk).unwrap();
+    assert!(view.is_memcpyed());
+    assert_eq!(
+        view.block_range(1),
+        BLOSC_EXTENDED_HEADER_LENGTH + (16 << 10)..BLOSC_EXTENDED_HEADER_LENGTH + (32 << 10)
+    );
+    assert!(decode_all(&view) == src);
+
+    let mut chunk = vec![0u8; BLOSC_EXTENDED_HEADER_LENGTH + 4];
+    let item = 0x01020304u32.to_le_bytes();
+    let cbytes = blusc_blosc2_chunk_repeatval(
+        &cparams(BLOSC_ZSTD, BLOSC_SHUFFLE),
+        src.len(),
+        &mut chunk,
+        &item,
+    );
+    assert!(cbytes > 0);
+    let view = ChunkView::new(&chunk).unwrap();
+    assert_eq!(view.special_type(), BLOSC2_SPECIAL_VALUE);
+    assert!(view.block_bytes(0).is_empty());
+    let expected: Vec<u8> = item.iter().cycle().take(src.len()).copied().collect();
+    assert!(decode_all(&view) == expected);
+}
+
+#[test]
+fn rejected_chunks_and_blocks() {
+    let src = data();
+    let chunk = compress(cparams(BLOSC_BLOSCLZ, BLOSC_SHUFFLE), &src);
+    assert_eq!(
+        ChunkView::new(&chunk[..chunk.len() - 1]).err(),
+        Some(BLOSC2_ERROR_READ_BUFFER)
+    );
+
+    let view = ChunkView::new(&chunk).unwrap();
+    let mut block = vec![0u8; view.blocksize()];
+    assert_eq!(
+        view.decode_block(view.nblocks(), &mut block),
+        Err(BLOSC2_ERROR_INVALID_PARAM)
+    );
+    assert_eq!(
+        view.decode_block(0, &mut block[1..]),
+        Err(BLOSC2_ERROR_WRITE_BUFFER)
+    );
+    // The short last block fits
+    let last = view.nblocks() - 1;
+    assert!(view.decode_block(last, &mut block[1..]).is_ok());
+    assert_eq!(
+        view.blocks_for_items(49_990, 11),
+        Err(BLOSC2_ERROR_INVALID_PARAM)
+    );
+    assert_eq!(view.blocks_for_items(49_990, 0), Ok(0..0));
+
+    // Block offsets out of order or past the end
+    for (block, bstart) in [(1, 10u32), (last, chunk.len() as u32 + 1)] {
+        let mut bad = chunk.clone();
+        let off = BLOSC_EXTENDED_HEADER_LENGTH + block * 4;
+        bad[off..off + 4].copy_from_slice(&bstart.to_le_bytes());
+        assert_eq!(
+            ChunkView::new(&bad).err(),
+            Some(BLOSC2_ERROR_INVALID_HEADER)
+        );
+        // Every decoder parses the same way, and none of them panics
+        let mut out = vec![0u8; src.len()];
+        assert!(blusc_blosc2_decompress(&bad, &mut out) < 0);
+        assert_eq!(blusc_blosc1_getitem(&bad, 0, 10, &mut out), 0);
+        assert_eq!(
+            ChunkReader::new(&bad[..], 1 << 20).err(),
+            Some(BLOSC2_ERROR_INVALID_HEADER)
+        );
+        assert_eq!(
+            ChunkDecoder::new().push(&bad, |_, _| {}),
+            Err(BLOSC2_ERROR_INVALID_HEADER)
+        );
+    }
+}